@@ -0,0 +1,62 @@
+#							-*- Autoconf -*-
+# This file is part of the aMule Project.
+#
+# Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+#
+# Any parts of this program derived from the xMule, lMule or eMule project,
+# or contributed by third-party developers are copyrighted by their
+# respective authors.
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+# 
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+#
+
+AC_DEFUN([MULE_CHECK_MMSG],
+[
+	AC_MSG_CHECKING([for recvmmsg])
+	AC_LINK_IFELSE([
+		AC_LANG_PROGRAM([[
+			#define _GNU_SOURCE
+			#include <sys/types.h>
+			#include <sys/socket.h>
+		]], [[
+			struct mmsghdr msgs[1];
+			recvmmsg(0, msgs, 1, MSG_DONTWAIT, 0);
+		]])
+	], [
+		AH_TEMPLATE([HAVE_RECVMMSG], [Define to 1 if you have the recvmmsg() function.])
+		AC_DEFINE([HAVE_RECVMMSG])
+		AC_MSG_RESULT([yes])
+	], [
+		AC_MSG_RESULT([no])
+	])
+
+	AC_MSG_CHECKING([for sendmmsg])
+	AC_LINK_IFELSE([
+		AC_LANG_PROGRAM([[
+			#define _GNU_SOURCE
+			#include <sys/types.h>
+			#include <sys/socket.h>
+		]], [[
+			struct mmsghdr msgs[1];
+			sendmmsg(0, msgs, 1, MSG_DONTWAIT);
+		]])
+	], [
+		AH_TEMPLATE([HAVE_SENDMMSG], [Define to 1 if you have the sendmmsg() function.])
+		AC_DEFINE([HAVE_SENDMMSG])
+		AC_MSG_RESULT([yes])
+	], [
+		AC_MSG_RESULT([no])
+	])
+])
@@ -857,6 +857,8 @@ bool CUpDownClient::ProcessMuleInfoPacket(const byte* pachPacket, uint32 nSize)
 {
 	uint8 protocol_version;
 
+	SetECDirty();
+
 	const CMemFile data(pachPacket,nSize);
 
 	// The version number part of this packet will soon be useless since
@@ -2435,6 +2437,7 @@ void CUpDownClient::SetUserIDHybrid(uint32 nUserID)
 	theApp->clientlist->UpdateClientID( this, nUserID );
 
 	m_nUserIDHybrid = nUserID;
+	SetECDirty();
 }
 
 
@@ -2447,6 +2450,7 @@ void CUpDownClient::SetIP( uint32 val )
 	m_nConnectIP = val;
 	
 	m_FullUserIP = val;
+	SetECDirty();
 }
 
 
@@ -2455,6 +2459,7 @@ void CUpDownClient::SetUserHash(const CMD4Hash& userhash)
 	theApp->clientlist->UpdateClientHash( this, userhash );
 
 	m_UserHash = userhash;
+	SetECDirty();
 
 	ValidateHash();
 }
@@ -541,7 +541,7 @@ bool CClientTCPSocket::ProcessPacket(const byte* buffer, uint32 size, uint8 opco
 				} else {
 					data.WriteUInt16(0);
 				}
-				CPacket* packet = new CPacket(data, OP_EDONKEYPROT, OP_FILESTATUS);
+				CPacket* packet = new CPacket(data, OP_EDONKEYPROT, OP_FILESTATUS, true);
 				theStats::AddUpOverheadFileRequest(packet->GetPacketSize());
 				AddDebugLogLineN( logLocalClient, wxT("Local Client: OP_FILESTATUS to ") + m_client->GetFullIP() );
 				SendPacket(packet, true);
@@ -1210,7 +1210,7 @@ bool CClientTCPSocket::ProcessExtPacket(const byte* buffer, uint32 size, uint8 o
 
 			}
 			if( data_out.GetLength() > 16 ) {
-				CPacket* reply = new CPacket(data_out, OP_EMULEPROT, OP_MULTIPACKETANSWER);
+				CPacket* reply = new CPacket(data_out, OP_EMULEPROT, OP_MULTIPACKETANSWER, true);
 				theStats::AddUpOverheadFileRequest(reply->GetPacketSize());
 				AddDebugLogLineN( logLocalClient, wxT("Local Client: OP_MULTIPACKETANSWER to ") + m_client->GetFullIP() );
 				SendPacket(reply, true);
@@ -1787,7 +1787,7 @@ bool CClientTCPSocket::ProcessExtPacket(const byte* buffer, uint32 size, uint8 o
 					}
 					
 					data_out.WriteUInt16(sender->GetUploadQueueWaitingPosition());
-					CPacket* response = new CPacket(data_out, OP_EMULEPROT, OP_REASKACK);
+					CPacket* response = new CPacket(data_out, OP_EMULEPROT, OP_REASKACK, true);
 					theStats::AddUpOverheadFileRequest(response->GetPacketSize());
 					AddDebugLogLineN( logLocalClient, wxT("Local Client UDP: OP_REASKACK to ") + m_client->GetFullIP()  );
 					theApp->clientudp->SendPacket(response, destip, destport, sender->ShouldReceiveCryptUDPPackets(), sender->GetUserHash().GetHash(), false, 0);
@@ -97,7 +97,7 @@ void CClientUDPSocket::OnPacketReceived(uint32 ip, uint16 port, byte* buffer, si
 				case OP_KADEMLIAHEADER:
 					theStats::AddDownOverheadKad(length);
 					if (packetLen >= 2) {
-						Kademlia::CKademlia::ProcessPacket(decryptedBuffer, packetLen, wxUINT32_SWAP_ALWAYS(ip), port, (Kademlia::CPrefs::GetUDPVerifyKey(ip) == receiverVerifyKey), Kademlia::CKadUDPKey(senderVerifyKey, theApp->GetPublicIP(false)));
+						Kademlia::CKademlia::ProcessPacket(decryptedBuffer, packetLen, wxUINT32_SWAP_ALWAYS(ip), port, (CEncryptedDatagramSocket::GetUDPVerifyKey(ip) == receiverVerifyKey), Kademlia::CKadUDPKey(senderVerifyKey, theApp->GetPublicIP(false)));
 					} else {
 						throw wxString(wxT("Kad packet too short"));
 					}
@@ -114,7 +114,7 @@ void CClientUDPSocket::OnPacketReceived(uint32 ip, uint16 port, byte* buffer, si
 							AddDebugLogLineN(logClientKadUDP, wxT("Correctly uncompressed Kademlia packet"));
 							unpack[0] = OP_KADEMLIAHEADER;
 							unpack[1] = opcode;
-							Kademlia::CKademlia::ProcessPacket(&(unpack[0]), unpackedsize + 2, wxUINT32_SWAP_ALWAYS(ip), port, (Kademlia::CPrefs::GetUDPVerifyKey(ip) == receiverVerifyKey), Kademlia::CKadUDPKey(senderVerifyKey, theApp->GetPublicIP(false)));
+							Kademlia::CKademlia::ProcessPacket(&(unpack[0]), unpackedsize + 2, wxUINT32_SWAP_ALWAYS(ip), port, (CEncryptedDatagramSocket::GetUDPVerifyKey(ip) == receiverVerifyKey), Kademlia::CKadUDPKey(senderVerifyKey, theApp->GetPublicIP(false)));
 						} else {
 							AddDebugLogLineN(logClientKadUDP, wxT("Failed to uncompress Kademlia packet"));
 						}
@@ -220,7 +220,7 @@ void CClientUDPSocket::ProcessPacket(byte* packet, int16 size, int8 opcode, uint
 					}
 					
 					data_out.WriteUInt16(sender->GetUploadQueueWaitingPosition());
-					CPacket* response = new CPacket(data_out, OP_EMULEPROT, OP_REASKACK);
+					CPacket* response = new CPacket(data_out, OP_EMULEPROT, OP_REASKACK, true);
 					theStats::AddUpOverheadFileRequest(response->GetPacketSize());
 					AddDebugLogLineN( logClientUDP, wxT("Client UDP socket: OP_REASKACK to ") + sender->GetFullIP());
 					SendPacket(response, host, port, sender->ShouldReceiveCryptUDPPackets(), sender->GetUserHash().GetHash(), false, 0);
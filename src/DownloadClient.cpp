@@ -1192,6 +1192,7 @@ float CUpDownClient::CalculateKBpsDown()
 		//			% this % kBpsDown  % kBpsDownCur % dt % bytesReceivedCycle);
 		bytesReceivedCycle = 0;
 		msReceivedPrev = msCur;	
+		SetECDirty();
 	}
 
 	m_cShowDR++;
@@ -1356,6 +1357,9 @@ uint16 CUpDownClient::GetNextRequestedPart() const
 void CUpDownClient::UpdateDisplayedInfo(bool force)
 {
 	uint32 curTick = ::GetTickCount();
+
+	SetECDirty();
+
 	if (force || curTick-m_lastRefreshedDLDisplay > MINWAIT_BEFORE_DLDISPLAY_WINDOWUPDATE) {
 		// Check if we actually need to notify of changes
 		bool update = m_reqfile && m_reqfile->ShowSources();
@@ -1571,6 +1575,8 @@ bool CUpDownClient::IsValidSwapTarget( A4AFList::iterator it, bool ignorenoneede
 void CUpDownClient::SetRequestFile(CPartFile* reqfile)
 {
 	if ( m_reqfile != reqfile ) {
+		SetECDirty();
+
 		// Decrement the source-count of the old request-file
 		if ( m_reqfile ) {
 			m_reqfile->ClientStateChanged( GetDownloadState(), -1 );
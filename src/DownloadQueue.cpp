@@ -84,6 +84,7 @@ CDownloadQueue::CDownloadQueue()
 	: m_mutex( wxMUTEX_RECURSIVE )
 {
 	m_datarate = 0;
+	m_fileListVersion = 1;
 	m_udpserver = 0;
 	m_lastsorttime = 0;
 	m_lastudpsearchtime = 0;
@@ -147,6 +148,7 @@ void CDownloadQueue::LoadMetFiles(const CPath& path)
 			{
 				wxMutexLocker lock(m_mutex);
 				m_filelist.push_back(toadd);
+				m_fileListVersion++;
 			}
 			NotifyObservers(EventType(EventType::INSERTED, toadd));
 			Notify_DownloadCtrlAddFile(toadd);
@@ -366,6 +368,7 @@ void CDownloadQueue::AddDownload(CPartFile* file, bool paused, uint8 category)
 	{
 		wxMutexLocker lock(m_mutex);
 		m_filelist.push_back( file );
+		m_fileListVersion++;
 		DoSortByPriority();
 	}
 
@@ -810,6 +813,7 @@ void CDownloadQueue::RemoveFile(CPartFile* file, bool keepAsCompleted)
 	wxMutexLocker lock( m_mutex );
 
 	EraseValue( m_filelist, file );
+	m_fileListVersion++;
 
 	if (keepAsCompleted) {
 		m_completedDownloads.push_back(file);
@@ -825,6 +829,7 @@ void CDownloadQueue::ClearCompleted(const ListOfUInts32 & ecids)
 			CPartFile * file = *it;
 			if (file->ECID() == ecid) {
 				m_completedDownloads.erase(it);
+				m_fileListVersion++;
 				// get a new EC ID so it is resent and cleared in remote gui
 				file->RenewECID();
 				Notify_DownloadCtrlRemoveFile(file);
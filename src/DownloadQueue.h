@@ -251,6 +251,12 @@ public:
 	 */
 	void	CopyFileList(std::vector<CPartFile*>& out_list, bool includeCompleted = false) const;
 
+	/**
+	 * Returns a counter that changes whenever files are added to or
+	 * removed from the queue or the list of completed downloads.
+	 */
+	uint32	GetFileListVersion() const	{ return m_fileListVersion; }
+
 	/**
 	 * Returns the current number of downloading files.
 	 */
@@ -389,6 +395,9 @@ private:
 	//! List of downloads completed and still on display
 	FileList		m_completedDownloads;
 
+	//! Incremented on every change to m_filelist or m_completedDownloads
+	uint32		m_fileListVersion;
+
 	//! Observer used to keep track of which servers have yet to be asked for sources
 	CQueueObserver<CServer*>	m_queueServers;
 	
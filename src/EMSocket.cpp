@@ -26,6 +26,8 @@
 
 #include "EMSocket.h"		// Interface declarations.
 
+#include <algorithm>
+
 #include <protocol/Protocols.h>
 #include <protocol/ed2k/Constants.h>
 
@@ -35,10 +37,34 @@
 #include "UploadBandwidthThrottler.h"
 #include "Logger.h"
 #include "Preferences.h"
-#include "ScopedPtr.h"
 
 
 const uint32 MAX_PACKET_SIZE = 2000000;
+// Size of the receive buffer, unless a larger frame has to fit
+const uint32 RECV_BUFFER_SIZE = 16384;
+
+namespace {
+
+// Sets a flag for as long as it is in scope, also when left by an exception
+class CFlagSetter
+{
+public:
+	CFlagSetter(bool& flag)
+		: m_flag(flag)
+	{
+		m_flag = true;
+	}
+
+	~CFlagSetter()
+	{
+		m_flag = false;
+	}
+
+private:
+	bool& m_flag;
+};
+
+}
 
 CEMSocket::CEMSocket(const CProxyData *ProxyData)
 	: CEncryptedStreamSocket(wxSOCKET_NOWAIT, ProxyData)
@@ -64,12 +90,10 @@ CEMSocket::CEMSocket(const CProxyData *ProxyData)
 	downloadLimitEnable = false;
 	pendingOnReceive = false;
 
-	// Download partial header
-	pendingHeaderSize = 0;
-
-	// Download partial packet
-	pendingPacket = NULL;
-	pendingPacketSize = 0;
+	// Download buffer
+	recvStart = 0;
+	recvEnd = 0;
+	inOnReceive = false;
 
 	// Upload control
 	sendbuffer = NULL;
@@ -148,13 +172,11 @@ void CEMSocket::ClearQueues()
 	downloadLimitEnable = false;
 	pendingOnReceive = false;
 
-	// Download partial header
-	pendingHeaderSize = 0;
-
-	// Download partial packet
-	delete[] pendingPacket;
-	pendingPacket = NULL;
-	pendingPacketSize = 0;
+	// Download buffer
+	// Not freed here, as this may be called while a packet pointing
+	// into the buffer is being processed.
+	recvStart = 0;
+	recvEnd = 0;
 
 	// Upload control
 	delete[] sendbuffer;
@@ -198,44 +220,96 @@ void CEMSocket::OnReceive(int nErrorCode)
 		byConnected = ES_CONNECTED; // ES_DISCONNECTED, ES_NOTCONNECTED, ES_CONNECTED
 	}
 
-	uint32 ret;
-	do {
+	// PacketReceived may get us called again, through DisableDownloadLimit.
+	// The outer call will read and process the rest.
+	if (inOnReceive) {
+		return;
+	}
+
+	bool readMore = true;
+	while (true) {
+		// Process all complete frames in the buffer
+		while (recvEnd - recvStart >= PACKET_HEADER_SIZE) {
+			byte* header = &recvBuffer[recvStart];
+			uint32 packetSize = CPacket::GetPacketSizeFromHeader(header);
+			if (packetSize > MAX_PACKET_SIZE) {
+				recvStart = recvEnd = 0;
+				OnError(ERR_TOOBIG);
+				return;
+			}
+			if (recvEnd - recvStart - PACKET_HEADER_SIZE < packetSize) {
+				break;
+			}
+			recvStart += PACKET_HEADER_SIZE + packetSize;
+
+			CPacket packet(header, header + PACKET_HEADER_SIZE, true);
+
+			// Bugfix We still need to check for a valid protocol
+			// Remark: the default eMule v0.26b had removed this test......
+			switch (packet.GetProtocol()){
+				case OP_EDONKEYPROT:
+				case OP_PACKEDPROT:
+				case OP_EMULEPROT:
+				case OP_ED2KV2HEADER:
+				case OP_ED2KV2PACKEDPROT:
+					break;
+				default:
+					recvStart = recvEnd = 0;
+					OnError(ERR_WRONGHEADER);
+					return;
+			}
+
+			// Process packet
+			{
+				CFlagSetter receiving(inOnReceive);
+				PacketReceived(&packet);
+			}
+
+			if (byConnected == ES_DISCONNECTED) {
+				return;
+			}
+		}
+
+		if (!readMore) {
+			return;
+		}
+
 		// CPU load improvement
 		if (downloadLimitEnable && downloadLimit == 0){
 			pendingOnReceive = true;
 			return;
 		}
 
-		uint32 readMax;
-		byte *buf;
-		if (pendingHeaderSize < PACKET_HEADER_SIZE) {
-			delete[] pendingPacket;
-			pendingPacket = NULL;
-			buf = pendingHeader + pendingHeaderSize;
-			readMax = PACKET_HEADER_SIZE - pendingHeaderSize;
-		} else if (pendingPacket == NULL) {
-			pendingPacketSize = 0;
-			readMax = CPacket::GetPacketSizeFromHeader(pendingHeader);
-			if (readMax > MAX_PACKET_SIZE) {
-				pendingHeaderSize = 0;
-				OnError(ERR_TOOBIG);
-				return;
+		// Make room for the rest of the current frame, moving it to the
+		// front of the buffer if it doesn't fit behind the processed ones
+		uint32 frameSize = PACKET_HEADER_SIZE;
+		if (recvEnd - recvStart >= PACKET_HEADER_SIZE) {
+			frameSize += CPacket::GetPacketSizeFromHeader(&recvBuffer[recvStart]);
+		}
+		if (recvStart == recvEnd) {
+			recvStart = recvEnd = 0;
+			// Give back what a large frame needed
+			if (recvBuffer.size() > RECV_BUFFER_SIZE) {
+				std::vector<byte>(RECV_BUFFER_SIZE).swap(recvBuffer);
 			}
-			pendingPacket = new byte[readMax + 1];
-			buf = pendingPacket;
-		} else {
-			buf = pendingPacket + pendingPacketSize;
-			readMax = CPacket::GetPacketSizeFromHeader(pendingHeader) - pendingPacketSize;
+		} else if (recvBuffer.size() - recvStart < frameSize) {
+			memmove(&recvBuffer[0], &recvBuffer[recvStart], recvEnd - recvStart);
+			recvEnd -= recvStart;
+			recvStart = 0;
+		}
+		if (recvBuffer.size() < std::max(frameSize, RECV_BUFFER_SIZE)) {
+			recvBuffer.resize(std::max(frameSize, RECV_BUFFER_SIZE));
 		}
 
+		uint32 readMax = recvBuffer.size() - recvEnd;
 		if (downloadLimitEnable && readMax > downloadLimit) {
 			readMax = downloadLimit;
 		}
 
-		ret = 0;
-		if (readMax) {
+		uint32 ret;
+		{
 			wxMutexLocker lock(m_sendLocker);
-			ret = Read(buf, readMax);
+			ret = Read(&recvBuffer[recvEnd], readMax);
 			if (Error() || (ret == 0)) {
 				if (LastError() == wxSOCKET_WOULDBLOCK) {
 					pendingOnReceive = true;
@@ -243,6 +317,7 @@ void CEMSocket::OnReceive(int nErrorCode)
 				return;
 			}
 		}
+		recvEnd += ret;
 
 		// Bandwidth control
 		if (downloadLimitEnable) {
@@ -257,36 +332,9 @@ void CEMSocket::OnReceive(int nErrorCode)
 		// CPU load improvement
 		// Detect if the socket's buffer is empty (or the size did match...)
 		pendingOnReceive = (ret == readMax);
-
-		if (pendingHeaderSize >= PACKET_HEADER_SIZE) {
-			pendingPacketSize += ret;
-			if (pendingPacketSize >= CPacket::GetPacketSizeFromHeader(pendingHeader)) {
-				CScopedPtr<CPacket> packet(new CPacket(pendingHeader, pendingPacket));
-				pendingPacket = NULL;
-				pendingPacketSize = 0;
-				pendingHeaderSize = 0;
-
-				// Bugfix We still need to check for a valid protocol
-				// Remark: the default eMule v0.26b had removed this test......
-				switch (packet->GetProtocol()){
-					case OP_EDONKEYPROT:
-					case OP_PACKEDPROT:
-					case OP_EMULEPROT:
-					case OP_ED2KV2HEADER:
-					case OP_ED2KV2PACKEDPROT:
-						break;
-					default:
-						OnError(ERR_WRONGHEADER);
-						return;
-				}
-
-				// Process packet
-				PacketReceived(packet.get());
-			}
-		} else {
-			pendingHeaderSize += ret;
-		}
-	} while (ret && pendingHeaderSize >= PACKET_HEADER_SIZE);
+		// Don't try another read if this one drained the socket
+		readMore = pendingOnReceive;
+	}
 }
 
 
@@ -30,6 +30,8 @@
 
 #include "ThrottledSocket.h"	// Needed for ThrottledFileSocket
 
+#include <vector>
+
 class CPacket;
 
 #define ERR_WRONGHEADER		0x01
@@ -82,6 +84,8 @@ public:
 	
 protected:
 
+	// The packet points into the receive buffer and is only valid during
+	// the call; copy it if it has to be kept.
 	virtual bool	PacketReceived(CPacket* WXUNUSED(packet)) { return false; };
 	virtual void	OnClose(int nErrorCode);
 	
@@ -100,13 +104,14 @@ private:
 	bool	downloadLimitEnable;
 	bool	pendingOnReceive;
 
-	// Download partial header
-	byte	pendingHeader[PACKET_HEADER_SIZE];
-	uint32	pendingHeaderSize;
-
-	// Download partial packet
-	byte*	pendingPacket;
-	uint32  pendingPacketSize;
+	// Received data not yet handed to PacketReceived, which is
+	// recvBuffer[recvStart, recvEnd). Frames are kept contiguous, so
+	// packets can be passed on as views into the buffer.
+	std::vector<byte>	recvBuffer;
+	uint32	recvStart;
+	uint32	recvEnd;
+	// Set while frames are being processed, see OnReceive
+	bool	inOnReceive;
 
 	// Upload control
 	byte*	sendbuffer;
@@ -99,6 +99,7 @@
 #include "./kademlia/kademlia/Kademlia.h"
 #include "RandomFunctions.h"
 #include "Statistics.h"
+#include "LRUCache.h"
 
 #include <protocol/Protocols.h>
 #include <common/MD5Sum.h>
@@ -106,6 +107,8 @@
 // random generator
 #include "CryptoPP_Inc.h"	// Needed for Crypto functions
 
+#include <wx/thread.h>	// Needed for wxMutex
+
 #define CRYPT_HEADER_WITHOUTPADDING		    8
 #define	MAGICVALUE_UDP						91
 #define MAGICVALUE_UDP_SYNC_CLIENT			0x395F2EC1
@@ -113,6 +116,88 @@
 #define	MAGICVALUE_UDP_SERVERCLIENT			0xA5
 #define	MAGICVALUE_UDP_CLIENTSERVER			0x6B
 
+namespace {
+
+/*
+ * Remembers, for the most recently seen peers, which Kad key derivation
+ * decrypted their last Kad packet, and their UDP verify key. Repeat
+ * packets are then decrypted with a single attempt, and the verify key
+ * (an MD5 of its own) is only computed once.
+ *
+ * The key itself can't be kept, as it includes a random part chosen
+ * by the sender for each packet. Verify keys are also needed when
+ * sending, so they are kept apart from the key types, which only
+ * receiving fills.
+ */
+class CPeerKeyCache
+{
+public:
+	CPeerKeyCache()
+		: m_kadKeyTypes(MAX_ENTRIES),
+		  m_verifyKeys(MAX_ENTRIES)
+	{}
+
+	// Kad derivation that worked last for the peer, or -1 if unknown
+	int	GetKadKeyType(uint32_t ip);
+	void	SetKadKeyType(uint32_t ip, uint8_t keyType);
+	uint32_t GetUDPVerifyKey(uint32_t ip);
+
+private:
+	static const size_t MAX_ENTRIES = 4096;
+
+	struct VerifyKey {
+		// value of thePrefs::GetKadUDPKey() key was made with
+		uint32_t	kadUDPKey;
+		uint32_t	key;
+	};
+
+	CLRUCache<uint32_t, uint8_t>	m_kadKeyTypes;
+	CLRUCache<uint32_t, VerifyKey>	m_verifyKeys;
+	// used by the receiving and the upload thread
+	wxMutex		m_mutex;
+};
+
+
+int CPeerKeyCache::GetKadKeyType(uint32_t ip)
+{
+	wxMutexLocker lock(m_mutex);
+	uint8_t* keyType = m_kadKeyTypes.Find(ip);
+	return keyType ? *keyType : -1;
+}
+
+
+void CPeerKeyCache::SetKadKeyType(uint32_t ip, uint8_t keyType)
+{
+	wxMutexLocker lock(m_mutex);
+	m_kadKeyTypes.Insert(ip, keyType);
+}
+
+
+uint32_t CPeerKeyCache::GetUDPVerifyKey(uint32_t ip)
+{
+	wxMutexLocker lock(m_mutex);
+	VerifyKey* cached = m_verifyKeys.Find(ip);
+	if (cached == NULL || cached->kadUDPKey != thePrefs::GetKadUDPKey()) {
+		VerifyKey verifyKey;
+		verifyKey.kadUDPKey = thePrefs::GetKadUDPKey();
+		verifyKey.key = Kademlia::CPrefs::GetUDPVerifyKey(ip);
+		cached = &m_verifyKeys.Insert(ip, verifyKey);
+	}
+	return cached->key;
+}
+
+
+CPeerKeyCache s_peerKeyCache;
+
+}
+
+
+uint32_t CEncryptedDatagramSocket::GetUDPVerifyKey(uint32_t ip)
+{
+	return s_peerKeyCache.GetUDPVerifyKey(ip);
+}
+
+
 CEncryptedDatagramSocket::CEncryptedDatagramSocket(wxIPaddress &address, wxSocketFlags flags,	const CProxyData *proxyData)
 	: CDatagramSocketProxy(address, flags, proxyData)
 {}
@@ -162,11 +247,21 @@ int CEncryptedDatagramSocket::DecryptReceivedClient(uint8_t *bufIn, int bufLen,
 		currentTry = 1;
 	} else {
 		tries = 3;
+		// if the marker bits say kad, what worked for this peer last
+		// time is a better guess which of the two kad keys to try first
+		if (currentTry != 1) {
+			int lastKeyType = s_peerKeyCache.GetKadKeyType(ip);
+			if (lastKeyType >= 0) {
+				currentTry = lastKeyType;
+			}
+		}
 	}
 	bool kad = false;
+	uint8_t usedTry;
 	do {
 		receivebuffer.FullReset();
 		tries--;
+		usedTry = currentTry;
 		MD5Sum md5;
 
 		if (currentTry == 0) {
@@ -192,7 +287,7 @@ int CEncryptedDatagramSocket::DecryptReceivedClient(uint8_t *bufIn, int bufLen,
 			kad = true;
 			if (Kademlia::CKademlia::GetPrefs()) {
 				uint8_t keyData[6];
-				PokeUInt32(keyData, Kademlia::CPrefs::GetUDPVerifyKey(ip));
+				PokeUInt32(keyData, s_peerKeyCache.GetUDPVerifyKey(ip));
 				memcpy(keyData + 4, bufIn + 1, 2); // random key part sent from remote client
 				md5.Calculate(keyData, sizeof(keyData));
 			}
@@ -209,6 +304,9 @@ int CEncryptedDatagramSocket::DecryptReceivedClient(uint8_t *bufIn, int bufLen,
 
 	if (value == MAGICVALUE_UDP_SYNC_CLIENT) {
 		// yup this is an encrypted packet
+		if (kad) {
+			s_peerKeyCache.SetKadKeyType(ip, usedTry);
+		}
 // 		// debugoutput notices
 // 		// the following cases are "allowed" but shouldn't happen given that there is only our implementation yet
 // 		if (bKad && (pbyBufIn[0] & 0x01) != 0)
@@ -261,7 +359,31 @@ int CEncryptedDatagramSocket::DecryptReceivedClient(uint8_t *bufIn, int bufLen,
 // clientHashOrKadID != NULL					-> clientHashOrKadID
 // clientHashOrKadID == NULL && kad && receiverVerifyKey != 0	-> receiverVerifyKey
 // else								-> ASSERT
+int CEncryptedDatagramSocket::GetClientCryptHeaderLen(bool kad)
+{
+	// padding disabled for UDP currently
+	return CRYPT_HEADER_WITHOUTPADDING + (kad ? 8 : 0);
+}
+
 int CEncryptedDatagramSocket::EncryptSendClient(uint8_t **buf, int bufLen, const uint8_t *clientHashOrKadID, bool kad, uint32_t receiverVerifyKey, uint32_t senderVerifyKey)
+{
+	const int cryptHeaderLen = GetClientCryptHeaderLen(kad);
+	uint8_t *cryptedBuffer = new uint8_t[bufLen + cryptHeaderLen];
+	memcpy(cryptedBuffer + cryptHeaderLen, *buf, bufLen);
+
+	int cryptedLen = EncryptSendClientInPlace(cryptedBuffer + cryptHeaderLen, bufLen, clientHashOrKadID, kad, receiverVerifyKey, senderVerifyKey);
+	if (cryptedLen == bufLen) {
+		// not encrypted
+		delete [] cryptedBuffer;
+		return bufLen;
+	}
+
+	delete [] *buf;
+	*buf = cryptedBuffer;
+	return cryptedLen;
+}
+
+int CEncryptedDatagramSocket::EncryptSendClientInPlace(uint8_t *buf, int bufLen, const uint8_t *clientHashOrKadID, bool kad, uint32_t receiverVerifyKey, uint32_t senderVerifyKey)
 {
 	wxASSERT(theApp->GetPublicIP() != 0 || kad);
 	wxASSERT(thePrefs::IsClientCryptLayerSupported());
@@ -269,9 +391,9 @@ int CEncryptedDatagramSocket::EncryptSendClient(uint8_t **buf, int bufLen, const
 	wxASSERT((receiverVerifyKey == 0 && senderVerifyKey == 0) || kad);
 
 	uint8_t padLen = 0;			// padding disabled for UDP currently
-	const uint32_t cryptHeaderLen = padLen + CRYPT_HEADER_WITHOUTPADDING + (kad ? 8 : 0);
+	const uint32_t cryptHeaderLen = GetClientCryptHeaderLen(kad);
 	uint32_t cryptedLen = bufLen + cryptHeaderLen;
-	uint8_t *cryptedBuffer = new uint8_t[cryptedLen];
+	uint8_t *cryptedBuffer = buf - cryptHeaderLen;
 	bool kadRecvKeyUsed = false;
 
 	uint16_t randomKeyPart = GetRandomUint16();
@@ -365,11 +487,9 @@ int CEncryptedDatagramSocket::EncryptSendClient(uint8_t **buf, int bufLen, const
 		sendbuffer.RC4Crypt((uint8_t*)&senderVerifyKey, cryptedBuffer + CRYPT_HEADER_WITHOUTPADDING + padLen + 4, 4);
 	}
 
-	sendbuffer.RC4Crypt(*buf, cryptedBuffer + cryptHeaderLen, bufLen);
-	delete [] *buf;
-	*buf = cryptedBuffer;
+	sendbuffer.RC4Crypt(buf, buf, bufLen);
 
-	theStats::AddUpOverheadCrypt(cryptedLen - bufLen);
+	// The overhead is accounted by the caller, once the packet was actually sent
 	return cryptedLen;
 }
 
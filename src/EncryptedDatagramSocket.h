@@ -37,7 +37,16 @@ public:
 
 // TODO: Make protected once the UDP socket is again its own class.
 	static int DecryptReceivedClient(uint8_t *bufIn, int bufLen, uint8_t **bufOut, uint32_t ip, uint32_t *receiverVerifyKey, uint32_t *senderVerifyKey);
+	// The client encryption functions don't add to the crypt overhead statistics,
+	// the caller does that for the packets it manages to send.
 	static int EncryptSendClient(uint8_t **buf, int bufLen, const uint8_t *clientHashOrKadID, bool kad, uint32_t receiverVerifyKey, uint32_t senderVerifyKey);
+	// Encrypts buf in place, writing the header into the GetClientCryptHeaderLen(kad) bytes before it.
+	// Returns the length of the encrypted packet, which starts at buf - GetClientCryptHeaderLen(kad).
+	static int EncryptSendClientInPlace(uint8_t *buf, int bufLen, const uint8_t *clientHashOrKadID, bool kad, uint32_t receiverVerifyKey, uint32_t senderVerifyKey);
+	static int GetClientCryptHeaderLen(bool kad);
+
+	// Kademlia::CPrefs::GetUDPVerifyKey, cached for recently seen peers
+	static uint32_t GetUDPVerifyKey(uint32_t ip);
 
 	static int DecryptReceivedServer(uint8_t* pbyBufIn, int nBufLen, uint8_t** ppbyBufOut, uint32_t dwBaseKey, uint32_t dbgIP);
 	static int EncryptSendServer(uint8_t** ppbyBuf, int nBufLen, uint32_t dwBaseKey);
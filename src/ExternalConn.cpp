@@ -53,6 +53,8 @@
 #include "Friend.h"
 #include "FriendList.h"
 #include "RandomFunctions.h"
+#include "GetTickCount.h"	// Needed for GetTickCount
+#include "ThreadScheduler.h"	// Needed for CThreadScheduler
 #include "kademlia/kademlia/Kademlia.h"
 #include "kademlia/kademlia/UDPFirewallTester.h"
 
@@ -135,7 +137,11 @@ public:
 
 class CFileEncoderMap : public std::map<uint32, CKnownFile_Encoder*> {
 	typedef std::set<uint32> IDSet;
+	// file list versions the map was last updated from
+	uint32 m_downloadsVersion;
+	uint32 m_sharesVersion;
 public:
+	CFileEncoderMap() : m_downloadsVersion(0), m_sharesVersion(0) {}
 	~CFileEncoderMap();
 	void UpdateEncoders();
 };
@@ -150,8 +156,17 @@ CFileEncoderMap::~CFileEncoderMap()
 
 // Check if encoder contains files that are no longer used
 // or if we have new files without encoder yet.
+// Nothing to do unless files were added or removed since the last call.
 void CFileEncoderMap::UpdateEncoders()
 {
+	uint32 downloadsVersion = theApp->downloadqueue->GetFileListVersion();
+	uint32 sharesVersion = theApp->sharedfiles->GetFileListVersion();
+	if (downloadsVersion == m_downloadsVersion && sharesVersion == m_sharesVersion) {
+		return;
+	}
+	m_downloadsVersion = downloadsVersion;
+	m_sharesVersion = sharesVersion;
+
 	IDSet curr_files, dead_files;
 	// Downloads
 	std::vector<CPartFile*> downloads;
@@ -197,6 +212,113 @@ void CFileEncoderMap::UpdateEncoders()
 }
 
 
+//-------------------- CECEncodingTask --------------------
+
+// Replies larger than this (uncompressed) are serialized and compressed
+// on a worker thread, instead of blocking the core while doing so.
+#define EC_ASYNC_REPLY_SIZE	16384
+
+class CECServerSocket;
+
+/*
+ * A reply serialized by EncodePacket, on its way to the socket.
+ */
+struct CECEncodedReply {
+	// the socket may be gone by the time the reply is ready,
+	// the id tells it apart from a new socket at the same address
+	CECServerSocket *m_socket;
+	uint32 m_socket_id;
+	// replies are sent in the order of their sequence numbers
+	uint32 m_seq;
+	std::list<CQueuedData *> m_data;
+
+	CECEncodedReply(CECServerSocket *socket, uint32 socket_id, uint32 seq)
+		: m_socket(socket), m_socket_id(socket_id), m_seq(seq)
+	{
+	}
+
+	~CECEncodedReply()
+	{
+		while (!m_data.empty()) {
+			delete m_data.front();
+			m_data.pop_front();
+		}
+	}
+};
+
+
+DECLARE_LOCAL_EVENT_TYPE(MULE_EVT_EC_REPLY_ENCODED, -1)
+DEFINE_LOCAL_EVENT_TYPE(MULE_EVT_EC_REPLY_ENCODED)
+
+/*
+ * Sent by CECEncodingTask when the reply is ready to be sent.
+ */
+class CECReplyEncodedEvent : public wxEvent
+{
+public:
+	CECReplyEncodedEvent(CECEncodedReply *reply)
+		: wxEvent(-1, MULE_EVT_EC_REPLY_ENCODED), m_reply(reply)
+	{
+	}
+
+	virtual wxEvent *Clone() const	{ return new CECReplyEncodedEvent(m_reply); }
+
+	// The handler takes over the reply
+	CECEncodedReply *GetReply() const	{ return m_reply; }
+
+private:
+	CECEncodedReply *m_reply;
+};
+
+typedef void (wxEvtHandler::*MuleECReplyEncodedEventFunction)(CECReplyEncodedEvent&);
+
+#define EVT_MULE_EC_REPLY_ENCODED(func) \
+	DECLARE_EVENT_TABLE_ENTRY(MULE_EVT_EC_REPLY_ENCODED, -1, -1, \
+	(wxObjectEventFunction) (wxEventFunction) \
+	wxStaticCastEvent(MuleECReplyEncodedEventFunction, &func), (wxObject*) NULL),
+
+
+/*
+ * Serializes and compresses a reply on a worker thread. The packet was
+ * built by the core beforehand, so it is an immutable snapshot of the
+ * state it describes, and the task doesn't touch any core object.
+ *
+ * The packet and reply are only taken over once the task runs, so if the
+ * scheduler refuses the task, they are left to the caller.
+ */
+class CECEncodingTask : public CThreadTask
+{
+public:
+	CECEncodingTask(wxEvtHandler *handler, CECEncodedReply *reply, const CECPacket *packet, uint32_t flags, int level)
+		: CThreadTask(wxT("EC reply"), CFormat(wxT("%u:%u")) % reply->m_socket_id % reply->m_seq, ETP_High),
+		  m_handler(handler), m_reply(reply), m_packet(packet), m_flags(flags), m_level(level)
+	{
+	}
+
+protected:
+	virtual void Entry()
+	{
+		CECSocket::EncodePacket(m_packet, m_flags, m_level, m_reply->m_data);
+		delete m_packet;
+		m_packet = NULL;
+	}
+
+	virtual void OnExit()
+	{
+		CECReplyEncodedEvent evt(m_reply);
+		wxPostEvent(m_handler, evt);
+		m_reply = NULL;
+	}
+
+private:
+	wxEvtHandler *m_handler;
+	CECEncodedReply *m_reply;
+	const CECPacket *m_packet;
+	uint32_t m_flags;
+	int m_level;
+};
+
+
 //-------------------- CECServerSocket --------------------
 
 class CECServerSocket : public CECMuleSocket
@@ -211,6 +333,14 @@ public:
 	virtual void WriteDoneAndQueueEmpty();
 
 	void	ResetLog() { m_LoggerAccess.Reset(); }
+
+	uint32	GetId() const { return m_id; }
+
+	// Sends (and deletes) a reply, keeping the order with replies still being encoded
+	void	SendReply(const CECPacket *reply);
+	// Called when a reply was encoded, takes it over
+	void	OnReplyEncoded(CECEncodedReply *reply);
+	bool	RepliesPending() const { return m_encode_seq != m_send_seq; }
 private:
 	ECNotifier *m_ec_notifier;
 
@@ -227,6 +357,14 @@ private:
 	CLoggerAccess m_LoggerAccess;
 	CFileEncoderMap	m_FileEncoder;
 	CObjTagMap		m_obj_tagmap;
+
+	uint32	m_id;
+	static uint32 s_next_id;
+	// sequence numbers of the next reply to encode, and to send
+	uint32	m_encode_seq;
+	uint32	m_send_seq;
+	// replies encoded ahead of earlier ones
+	std::map<uint32, CECEncodedReply *> m_encoded_replies;
 	CECPacket *ProcessRequest2(const CECPacket *request);
 
 	virtual bool IsAuthorized() { return m_conn_state == CONN_ESTABLISHED; }
@@ -237,7 +375,10 @@ CECServerSocket::CECServerSocket(ECNotifier *notifier)
 :
 CECMuleSocket(true),
 m_conn_state(CONN_INIT),
-m_passwd_salt(GetRandomUint64())
+m_passwd_salt(GetRandomUint64()),
+m_id(++s_next_id),
+m_encode_seq(0),
+m_send_seq(0)
 {
 	wxASSERT(theApp->ECServerHandler);
 	theApp->ECServerHandler->AddSocket(this);
@@ -245,10 +386,18 @@ m_passwd_salt(GetRandomUint64())
 }
 
 
+uint32 CECServerSocket::s_next_id = 0;
+
+
 CECServerSocket::~CECServerSocket()
 {
 	wxASSERT(theApp->ECServerHandler);
 	theApp->ECServerHandler->RemoveSocket(this);
+
+	std::map<uint32, CECEncodedReply *>::iterator it = m_encoded_replies.begin();
+	for (; it != m_encoded_replies.end(); ++it) {
+		delete it->second;
+	}
 }
 
 
@@ -270,12 +419,54 @@ const CECPacket *CECServerSocket::OnPacketReceived(const CECPacket *packet, uint
 		// 2) verify password
 		reply = Authenticate(packet);
 	} else {
-		reply = ProcessRequest2(packet);
+		// Replies go through SendReply, as they may have to wait for an earlier one
+		const CECPacket *response = ProcessRequest2(packet);
+		if (response) {
+			SendReply(response);
+		}
 	}
 	return reply;
 }
 
 
+void CECServerSocket::SendReply(const CECPacket *reply)
+{
+	bool large = reply->GetPacketLength() > EC_ASYNC_REPLY_SIZE;
+	if (!large && !RepliesPending()) {
+		SendPacket(reply);
+		delete reply;
+		return;
+	}
+
+	CECEncodedReply *encoded = new CECEncodedReply(this, m_id, m_encode_seq++);
+	reply->DebugPrint(false);
+	if (large && CThreadScheduler::AddTask(new CECEncodingTask(theApp->ECServerHandler, encoded, reply, m_my_flags, m_compression_level))) {
+		return;
+	}
+
+	// Not worth a task, or it couldn't be scheduled, but it must not overtake the pending ones
+	EncodePacket(reply, m_my_flags, m_compression_level, encoded->m_data);
+	delete reply;
+	OnReplyEncoded(encoded);
+}
+
+
+void CECServerSocket::OnReplyEncoded(CECEncodedReply *reply)
+{
+	m_encoded_replies[reply->m_seq] = reply;
+
+	std::map<uint32, CECEncodedReply *>::iterator it;
+	while ((it = m_encoded_replies.find(m_send_seq)) != m_encoded_replies.end()) {
+		CECEncodedReply *next = it->second;
+		m_encoded_replies.erase(it);
+		++m_send_seq;
+		// may come back here through WriteDoneAndQueueEmpty
+		SendEncodedPacket(next->m_data);
+		delete next;
+	}
+}
+
+
 void CECServerSocket::OnLost()
 {
 	AddLogLineN(_("External connection closed."));
@@ -288,7 +479,7 @@ void CECServerSocket::WriteDoneAndQueueEmpty()
 	if ( HaveNotificationSupport() && (m_conn_state == CONN_ESTABLISHED) ) {
 		CECPacket *packet = m_ec_notifier->GetNextPacket(this);
 		if ( packet ) {
-			SendPacket(packet);
+			SendReply(packet);
 		}
 	} else {
 		//printf("[EC] %p: WriteDoneAndQueueEmpty but notification disabled\n", this);
@@ -305,6 +496,7 @@ enum
 
 BEGIN_EVENT_TABLE(ExternalConn, wxEvtHandler)
 	EVT_SOCKET(SERVER_ID, ExternalConn::OnServerEvent)
+	EVT_MULE_EC_REPLY_ENCODED(ExternalConn::OnReplyEncoded)
 END_EVENT_TABLE()
 
 
@@ -408,6 +600,18 @@ void ExternalConn::OnServerEvent(wxSocketEvent& WXUNUSED(event))
 	
 }
 
+
+void ExternalConn::OnReplyEncoded(CECReplyEncodedEvent& event)
+{
+	CECEncodedReply *reply = event.GetReply();
+	if (socket_list.count(reply->m_socket) && reply->m_socket->GetId() == reply->m_socket_id) {
+		reply->m_socket->OnReplyEncoded(reply);
+	} else {
+		// connection was closed in the meantime
+		delete reply;
+	}
+}
+
 //
 // Authentication
 //
@@ -462,14 +666,25 @@ const CECPacket *CECServerSocket::Authenticate(const CECPacket *request)
 				if (request->GetTagByName(EC_TAG_CAN_ZLIB)) {
 					canZLIB = true;
 					m_my_flags |= EC_FLAG_ZLIB;
+					// Clients on a fast link may prefer a cheaper deflate level
+					const CECTag *zlibLevel = request->GetTagByName(EC_TAG_ZLIB_LEVEL);
+					if (zlibLevel) {
+						int level = zlibLevel->GetInt();
+						if (level == Z_NO_COMPRESSION) {
+							m_my_flags &= ~EC_FLAG_ZLIB;
+						} else if (level <= Z_BEST_COMPRESSION) {
+							m_compression_level = level;
+						}
+					}
 				}
 				if (request->GetTagByName(EC_TAG_CAN_UTF8_NUMBERS)) {
 					canUTF8numbers = true;
 					m_my_flags |= EC_FLAG_UTF8_NUMBERS;
 				}
 				m_haveNotificationSupport = request->GetTagByName(EC_TAG_CAN_NOTIFY) != NULL;
-				AddDebugLogLineN(logEC, CFormat(wxT("Client capabilities: ZLIB: %s  UTF8 numbers: %s  Push notification: %s") )
+				AddDebugLogLineN(logEC, CFormat(wxT("Client capabilities: ZLIB: %s (level %d)  UTF8 numbers: %s  Push notification: %s") )
 					% (canZLIB ? wxT("yes") : wxT("no"))
+					% m_compression_level
 					% (canUTF8numbers ? wxT("yes") : wxT("no"))
 					% (m_haveNotificationSupport ? wxT("yes") : wxT("no")));
 			} else {
@@ -655,17 +870,40 @@ static CECPacket *Get_EC_Response_GetSharedFiles(const CECPacket *request, CFile
 	return response;
 }
 
+/*
+ * Incremental updates only serialize objects whose CECID generation moved
+ * past the one the previous update was built from. Unchanged objects are
+ * still listed by ID, because the remote side removes everything missing
+ * from the update. Derived values that change without touching the object
+ * (e.g. queue ranks) are caught by an unconditional pass every minute.
+ */
+#define EC_FULL_UPDATE_INTERVAL	60000	// ms
+
 static CECPacket *Get_EC_Response_GetUpdate(CFileEncoderMap &encoders, CObjTagMap &tagmap)
 {
 	CECPacket *response = new CECPacket(EC_OP_SHARED_FILES);
 
+	// Take the generation first, so changes made while building are sent next time
+	uint64 generation = CECID::GetECGeneration();
+	uint64 since = tagmap.GetGeneration();
+	uint32 curTick = ::GetTickCount();
+	if (curTick - tagmap.GetLastFullUpdate() >= EC_FULL_UPDATE_INTERVAL) {
+		since = 0;
+		tagmap.SetLastFullUpdate(curTick);
+	}
+
 	encoders.UpdateEncoders();
 	for (CFileEncoderMap::iterator it = encoders.begin(); it != encoders.end(); ++it) {
 		const CKnownFile *cur_file = it->second->GetFile();
-		CValueMap &valuemap = tagmap.GetValueMap(cur_file->ECID());
 		// Completed cleared Partfiles are still stored as CPartfile,
 		// but encoded as KnownFile, so we have to check the encoder type
 		// instead of the file type.
+		if (!cur_file->IsECDirty(since) && tagmap.HasValueMap(cur_file->ECID())) {
+			// Unchanged: the encoders keep their state for the next change
+			response->AddTag(CECTag(it->second->IsPartFile_Encoder() ? EC_TAG_PARTFILE : EC_TAG_KNOWNFILE, cur_file->ECID()));
+			continue;
+		}
+		CValueMap &valuemap = tagmap.GetValueMap(cur_file->ECID());
 		if (it->second->IsPartFile_Encoder()) {
 			CEC_PartFile_Tag filetag((const CPartFile*) cur_file, EC_DETAIL_INC_UPDATE, &valuemap);
 			// Add information if partfile is shared
@@ -693,6 +931,10 @@ static CECPacket *Get_EC_Response_GetUpdate(CFileEncoderMap &encoders, CObjTagMa
 			// Set ExternalConnect/TransmitOnlyUploadingClients to 1 for it.
 			continue;
 		}
+		if (!cur_client->IsECDirty(since) && tagmap.HasValueMap(cur_client->ECID())) {
+			clients.AddTag(CECTag(EC_TAG_CLIENT, cur_client->ECID()));
+			continue;
+		}
 		CValueMap &valuemap = tagmap.GetValueMap(cur_client->ECID());
 		clients.AddTag(CEC_UpDownClient_Tag(cur_client, EC_DETAIL_INC_UPDATE, &valuemap));
 	}
@@ -704,6 +946,10 @@ static CECPacket *Get_EC_Response_GetUpdate(CFileEncoderMap &encoders, CObjTagMa
 	uint32 nrServers = serverlist.size();
 	for (uint32 i = 0; i < nrServers; i++) {
 		const CServer* cur_server = serverlist[i];
+		if (!cur_server->IsECDirty(since) && tagmap.HasValueMap(cur_server->ECID())) {
+			servers.AddTag(CECTag(EC_TAG_SERVER, cur_server->ECID()));
+			continue;
+		}
 		CValueMap &valuemap = tagmap.GetValueMap(cur_server->ECID());
 		servers.AddTag(CEC_Server_Tag(cur_server, &valuemap));
 	}
@@ -713,11 +959,17 @@ static CECPacket *Get_EC_Response_GetUpdate(CFileEncoderMap &encoders, CObjTagMa
 	CECEmptyTag friends(EC_TAG_FRIEND);
 	for (CFriendList::const_iterator it = theApp->friendlist->begin(); it != theApp->friendlist->end(); it++) {
 		const CFriend* cur_friend = *it;
+		if (!cur_friend->IsECDirty(since) && tagmap.HasValueMap(cur_friend->ECID())) {
+			friends.AddTag(CECTag(EC_TAG_FRIEND, cur_friend->ECID()));
+			continue;
+		}
 		CValueMap &valuemap = tagmap.GetValueMap(cur_friend->ECID());
 		friends.AddTag(CEC_Friend_Tag(cur_friend, &valuemap));
 	}
 	response->AddTag(friends);
 
+	tagmap.SetGeneration(generation);
+
 	return response;
 }
 
@@ -2249,12 +2501,12 @@ void ECNotifier::NextPacketToSocket()
 	for(std::map<CECServerSocket *, ECUpdateMsgSource **>::iterator i = m_msg_source.begin();
 		i != m_msg_source.end(); i++) {
 		CECServerSocket *sock = i->first;
-		if ( sock->HaveNotificationSupport() && !sock->DataPending() ) {
+		if ( sock->HaveNotificationSupport() && !sock->DataPending() && !sock->RepliesPending() ) {
 			ECUpdateMsgSource **notifier_array = i->second;
 			CECPacket *packet = GetNextPacket(notifier_array);
 			if ( packet ) {
 				printf("[EC] sending update packet; opcode=%x\n",packet->GetOpCode());
-				sock->SendPacket(packet);
+				sock->SendReply(packet);
 			}
 		}
 	}
@@ -64,21 +64,38 @@ class CTagSet : public std::set<T> {
 
 class CObjTagMap {
 		std::map<uint32, CValueMap> m_obj_map;
+		// CECID generation the last update was built from
+		uint64 m_generation;
+		// time of the last update that sent all objects regardless of generation
+		uint32 m_last_full_update;
 	public:
+		CObjTagMap() : m_generation(0), m_last_full_update(0) {}
+
 		CValueMap &GetValueMap(uint32 ECID)
 		{
 			return m_obj_map[ECID];
 		}
 		
+		bool HasValueMap(uint32 ECID) const
+		{
+			return m_obj_map.count(ECID) != 0;
+		}
+
 		size_t size()
 		{
 			return m_obj_map.size();
 		}
+
+		uint64 GetGeneration() const			{ return m_generation; }
+		void SetGeneration(uint64 generation)	{ m_generation = generation; }
+		uint32 GetLastFullUpdate() const		{ return m_last_full_update; }
+		void SetLastFullUpdate(uint32 tick)		{ m_last_full_update = tick; }
 };
 
 
 class CECServerSocket;
 class ECNotifier;
+class CECReplyEncodedEvent;
 
 class ExternalConn : public wxEvtHandler
 {
@@ -101,6 +118,7 @@ public:
 private:
 	// event handlers (these functions should _not_ be virtual)
 	void OnServerEvent(wxSocketEvent& event);
+	void OnReplyEncoded(CECReplyEncodedEvent& event);
 	DECLARE_EVENT_TABLE()
 };
 
@@ -195,6 +195,7 @@ void CCommandTree::PrintHelpFor(const wxString& command) const
 CaMuleExternalConnector::CaMuleExternalConnector()
 	: m_configFile(NULL),
 	  m_port(-1),
+	  m_ZLIBLevel(Z_DEFAULT_COMPRESSION),
 	  m_KeepQuiet(false),
 	  m_Verbose(false),
 	  m_interactive(false),
@@ -389,7 +390,7 @@ void CaMuleExternalConnector::ConnectAndRun(const wxString &ProgName, const wxSt
 		// Create the socket
 		Show(_("\nCreating client...\n"));
 		m_ECClient = new CRemoteConnect(NULL);
-		m_ECClient->SetCapabilities(m_ZLIB, true, false);	// ZLIB, UTF8 numbers, notification
+		m_ECClient->SetCapabilities(m_ZLIB, true, false, m_ZLIBLevel);	// ZLIB, UTF8 numbers, notification, ZLIB level
 
 		// ConnectToCore is blocking since m_ECClient was initialized with NULL
 		if (!m_ECClient->ConnectToCore(m_host, m_port, wxT("foobar"), m_password.Encode(), ProgName, ProgVersion)) {
@@ -544,6 +545,7 @@ void CaMuleExternalConnector::LoadConfigFile()
 		m_port = m_configFile->Read(wxT("/EC/Port"), 4712l);
 		m_configFile->ReadHash(wxT("/EC/Password"), &m_password);
 		m_ZLIB = m_configFile->Read(wxT("/EC/ZLIB"), 1l) != 0;
+		m_ZLIBLevel = m_configFile->Read(wxT("/EC/ZLIBLevel"), (long)Z_DEFAULT_COMPRESSION);
 	}
 }
 
@@ -166,6 +166,7 @@ protected:
 	wxString 	m_host;
 	CMD4Hash	m_password;
 	bool		m_ZLIB;
+	long		m_ZLIBLevel;
 	bool		m_KeepQuiet;
 	bool		m_Verbose;
 	bool		m_interactive;
@@ -106,6 +106,7 @@ void CFriend::UnLinkClient(bool notify)
 		}
 		m_LinkedClient.SetFriend(NULL);
 		m_LinkedClient.Unlink();
+		SetECDirty();
 		if (notify) {
 			Notify_ChatUpdateFriend(this);
 		}
@@ -47,11 +47,11 @@ public:
 	CFriend( const CMD4Hash& userhash, uint32 tm_dwLastSeen, uint32 tm_dwLastUsedIP, uint32 tm_nLastUsedPort, uint32 tm_dwLastChatted, const wxString& tm_strName);
 	CFriend(uint32 ecid) : CECID(ecid)	{ Init(); }
 	
-	void	SetUserHash(const CMD4Hash& userhash) { m_UserHash = userhash;}
+	void	SetUserHash(const CMD4Hash& userhash) { m_UserHash = userhash; SetECDirty(); }
 	bool	HasHash() const			{ return !m_UserHash.IsEmpty(); }
 	const	CMD4Hash& GetUserHash() const { return m_UserHash; }
 	
-	void SetName(const wxString& name) { m_strName = name; }
+	void SetName(const wxString& name) { m_strName = name; SetECDirty(); }
 	
 	void	LinkClient(CClientRef client);
 	const CClientRef& GetLinkedClient() const { return m_LinkedClient; }
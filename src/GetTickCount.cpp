@@ -24,6 +24,10 @@
 // Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
 //
 
+#ifdef HAVE_CONFIG_H
+#	include "config.h"		// Needed for HAVE_CLOCK_GETTIME
+#endif
+
 #include "GetTickCount.h" // Interface
 
 uint32 TheTime = 0;
@@ -69,9 +73,29 @@ uint64 GetTickCount_64()
 	return li.QuadPart * tickFactor;
 }
 
+/**
+ * Returns the highres timer in microseconds.
+ */
+uint64 GetTickCountUSec()
+{
+	static double tickFactor;
+	_LARGE_INTEGER li;
+
+	static bool first = true;
+	if (first) {
+		QueryPerformanceFrequency(&li);
+		tickFactor = 1000000.0 / li.QuadPart;
+		first = false;
+	}
+
+	QueryPerformanceCounter(&li);
+	return li.QuadPart * tickFactor;
+}
+
 #else
 
 #include <sys/time.h>		// Needed for gettimeofday
+#include <time.h>		// Needed for clock_gettime
 
 uint32 GetTickCountFullRes(void) {
 	struct timeval aika;
@@ -81,6 +105,21 @@ uint32 GetTickCountFullRes(void) {
 	return msecs;
 }
 
+uint64 GetTickCountUSec()
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	// Unlike gettimeofday, this does not jump when the system clock is set
+	struct timespec now;
+	if (clock_gettime(CLOCK_MONOTONIC, &now) == 0) {
+		return now.tv_sec * (uint64)1000000 + now.tv_nsec / 1000;
+	}
+#endif
+
+	struct timeval aika;
+	gettimeofday(&aika,NULL);
+	return aika.tv_sec * (uint64)1000000 + aika.tv_usec;
+}
+
 #if wxUSE_GUI && wxUSE_TIMER && !defined(AMULE_DAEMON)
 /**
  * Copyright (c) 2003-2011 Alo Sarv ( madcat_@users.sourceforge.net )
@@ -46,6 +46,11 @@ uint32 GetTickCountFullRes();
 
 uint64 GetTickCount64();
 
+// Microsecond resolution counter for rate control. Only differences
+// between two calls are meaningful.
+
+uint64 GetTickCountUSec();
+
 // Functions used to init the timer on GUI
 
 void StartTickTimer();
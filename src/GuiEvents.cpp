@@ -27,6 +27,7 @@
 #include "PartFile.h"
 #include "DownloadQueue.h"
 #include "ServerList.h"
+#include "Server.h"
 #include "Preferences.h"
 #include "ExternalConn.h"
 #include "SearchFile.h"
@@ -124,6 +125,7 @@ namespace MuleNotify
 	void DownloadCtrlUpdateItem(const void* item)
 	{
 #ifndef CLIENT_GUI
+		((CPartFile *)item)->SetECDirty();
 		theApp->ECServerHandler->m_ec_notifier->DownloadFile_SetDirty((CPartFile *)item);
 #endif
 #ifndef AMULE_DAEMON
@@ -219,8 +221,11 @@ namespace MuleNotify
 #endif
 	}
 	
-	void ServerRefresh(CServer* NOT_ON_DAEMON(server))
+	void ServerRefresh(CServer* server)
 	{
+#ifndef CLIENT_GUI
+		server->SetECDirty();
+#endif
 #ifndef AMULE_DAEMON
 		if (theApp->amuledlg->m_serverwnd && theApp->amuledlg->m_serverwnd->serverlistctrl) {
 			theApp->amuledlg->m_serverwnd->serverlistctrl->RefreshServer(server);
@@ -228,8 +233,11 @@ namespace MuleNotify
 #endif
 	}
 	
-	void ChatUpdateFriend(CFriend * NOT_ON_DAEMON(toupdate))
+	void ChatUpdateFriend(CFriend * toupdate)
 	{
+#ifndef CLIENT_GUI
+		toupdate->SetECDirty();
+#endif
 #ifndef AMULE_DAEMON
 		if (theApp->amuledlg->m_chatwnd) {
 			theApp->amuledlg->m_chatwnd->UpdateFriend(toupdate);
@@ -366,8 +374,11 @@ namespace MuleNotify
 	}
 
 
-	void SharedFilesUpdateItem(CKnownFile* NOT_ON_DAEMON(file))
+	void SharedFilesUpdateItem(CKnownFile* file)
 	{
+#ifndef CLIENT_GUI
+		file->SetECDirty();
+#endif
 #ifndef AMULE_DAEMON
 		if (theApp->amuledlg->m_sharedfileswnd && theApp->amuledlg->m_sharedfileswnd->sharedfilesctrl) {
 			theApp->amuledlg->m_sharedfileswnd->sharedfilesctrl->UpdateItem(file);
@@ -27,6 +27,7 @@
 #include <wx/ffile.h>
 
 #include "IPFilter.h"			// Interface declarations.
+#include "IPFilterTable.h"		// Needed for CIPFilterTable
 #include "IPFilterScanner.h"	// Interface for flexer
 #include "Preferences.h"		// Needed for thePrefs
 #include "amule.h"			// Needed for theApp
@@ -44,6 +45,14 @@
 #include "RangeMap.h"			// Needed for CRangeMap
 #include "ServerConnect.h"		// Needed for ConnectToAnyServer()
 #include "DownloadQueue.h"		// Needed for theApp->downloadqueue
+#include <common/Atomic.h>		// Needed for AtomicLoad, AtomicExchange
+
+
+#ifdef _MSC_VER
+#	define IPFILTER_THREAD_LOCAL __declspec(thread)
+#else
+#	define IPFILTER_THREAD_LOCAL __thread
+#endif
 
 
 ////////////////////////////////////////////////////////////
@@ -59,14 +68,14 @@ DEFINE_EVENT_TYPE(MULE_EVT_IPFILTER_LOADED)
 class CIPFilterEvent : public wxEvent
 {
 public:
-	CIPFilterEvent(CIPFilter::RangeIPs rangeIPs, CIPFilter::RangeLengths rangeLengths, CIPFilter::RangeNames rangeNames) 
-		: wxEvent(-1, MULE_EVT_IPFILTER_LOADED)
+	/**
+	 * The table is owned by whoever handles the event, which is
+	 * CIPFilter::OnIPFilterEvent.
+	 */
+	CIPFilterEvent(CIPFilterTable* table)
+		: wxEvent(-1, MULE_EVT_IPFILTER_LOADED),
+		  m_table(table)
 	{
-		// Physically copy the vectors, this will hopefully resize them back to their needed capacity.
-		m_rangeIPs = rangeIPs;
-		m_rangeLengths = rangeLengths;
-		// This one is usually empty, and should always be swapped, not copied.
-		std::swap(m_rangeNames, rangeNames);
 	}
 	
 	/** @see wxEvent::Clone */
@@ -74,9 +83,7 @@ public:
 		return new CIPFilterEvent(*this);
 	}
 	
-	CIPFilter::RangeIPs m_rangeIPs;
-	CIPFilter::RangeLengths m_rangeLengths;
-	CIPFilter::RangeNames m_rangeNames;
+	CIPFilterTable* m_table;
 };
 
 
@@ -131,72 +138,26 @@ private:
 
 		uint8 accessLevel = thePrefs::GetIPFilterLevel();
 		uint32 size = m_result.size();
-		// Reserve a little more so we don't have to resize the vector later.
-		// (Map ranges can exist that have to be stored in several parts.)
-		// Extra memory will be freed in the end.
-		m_rangeIPs.reserve(size + 1000);
-		m_rangeLengths.reserve(size + 1000);
-		if (m_storeDescriptions) {
-			m_rangeNames.reserve(size + 1000);
-		}
+		CIPFilterTable* table = new CIPFilterTable();
 		for (IPMap::iterator it = m_result.begin(); it != m_result.end(); ++it) {
 			if (it->AccessLevel < accessLevel) {
-				// Calculate range "length"
-				// (which is included-end - start and thus length - 1)
-				// Encoding:
-				// 0      - 0x7fff	same
-				// 0x8000 - 0xffff	0xfff	- 0x07ffffff
-				// that means: remove msb, shift left by 12 bit, add 0xfff
-				// so it can cover 8 consecutive class A nets
-				// larger ranges (or theoretical ranges with uneven ends) have to be split
-				uint32 startIP = it.keyStart();
-				uint32 realLength = it.keyEnd() - it.keyStart() + 1;
-#ifdef __DEBUG__
-				std::string * descp = 0;
-#endif
-				while (realLength) {
-					m_rangeIPs.push_back(startIP);
-					uint32 curLength = realLength;
-					uint16 pushLength;
-					if (realLength <= 0x8000) {
-						pushLength = realLength - 1;
-					} else {
-						if (curLength >= 0x08000000) {
-							// range to big, limit
-							curLength = 0x08000000;
-						} else {
-							// cut off LSBs
-							curLength &= 0x07FFF000;
-						}
-						pushLength = ((curLength - 1) >> 12) | 0x8000;
-					}
-					m_rangeLengths.push_back(pushLength);
+				// The ranges of the map are sorted and never overlap,
+				// so they can be added to the table as they are.
 #ifdef __DEBUG__
-					if (m_storeDescriptions) {
-						// std::string has no ref counting, so swap it
-						// (it's used so we need half the space than wxString with wide chars)
-						if (descp) {
-							// we split the range so we have to duplicate it
-							m_rangeNames.push_back(*descp);
-						} else {
-							// push back empty string and swap
-							m_rangeNames.push_back(std::string());
-							descp = & * m_rangeNames.rbegin();
-							std::swap(*descp, it->Description);
-						}
-					}
-#endif
-					realLength -= curLength;
-					startIP += curLength;
+				if (m_storeDescriptions) {
+					table->AddRange(it.keyStart(), it.keyEnd(), &it->Description);
+					continue;
 				}
+#endif
+				table->AddRange(it.keyStart(), it.keyEnd());
 			}
 		}
-		// Numbers are probably different:
-		// - ranges from map that are not blocked because of their level are not added to the table
-		// - some ranges from the map have to be split for the table
-		AddDebugLogLineN(logIPFilter, CFormat(wxT("Ranges in map: %d  blocked ranges in table: %d")) % size % m_rangeIPs.size());
+		table->Finish();
+		// Numbers are probably different, because ranges from map that are
+		// not blocked because of their level are not added to the table
+		AddDebugLogLineN(logIPFilter, CFormat(wxT("Ranges in map: %d  blocked ranges in table: %d")) % size % table->GetRangeCount());
 
-		CIPFilterEvent evt(m_rangeIPs, m_rangeLengths, m_rangeNames);
+		CIPFilterEvent evt(table);
 		wxPostEvent(m_owner, evt);
 	}
 
@@ -225,11 +186,6 @@ private:
 	
 	bool m_storeDescriptions;
 
-	// the generated filter
-	CIPFilter::RangeIPs m_rangeIPs;
-	CIPFilter::RangeLengths m_rangeLengths;
-	CIPFilter::RangeNames m_rangeNames;
-
 	wxEvtHandler*		m_owner;
 	// temporary map for filter generation
 	IPMap				m_result;
@@ -346,6 +302,63 @@ BEGIN_EVENT_TABLE(CIPFilter, wxEvtHandler)
 END_EVENT_TABLE()
 
 
+/**
+ * Gives lock-free access to the current table of a CIPFilter.
+ *
+ * Every reader registers itself in the reader count of the current epoch
+ * before fetching the table, and stays registered for as long as it uses
+ * it. CIPFilter::SetTable waits for both counts to drain before deleting
+ * a replaced table, so the table stays valid for the reader's lifetime.
+ * Readers must therefore be short-lived and must not block.
+ */
+class CIPFilterReader
+{
+public:
+	CIPFilterReader(CIPFilter& filter)
+		: m_filter(filter)
+	{
+		m_epoch = AtomicLoad(&m_filter.m_epoch) & 1;
+		AtomicIncrement(&m_filter.m_readers[m_epoch]);
+		m_table = AtomicLoad(&m_filter.m_table);
+	}
+
+	~CIPFilterReader()
+	{
+		AtomicDecrement(&m_filter.m_readers[m_epoch]);
+	}
+
+	const CIPFilterTable* operator->() const { return m_table; }
+
+private:
+	CIPFilter&		m_filter;
+	long			m_epoch;
+	const CIPFilterTable*	m_table;
+};
+
+
+/**
+ * Per-thread cache of recent lookups that found the IP not to be filtered,
+ * which is the answer for nearly all of them. A hit avoids touching the
+ * reader counts shared with the other threads. Entries are only valid for
+ * the table generation they were made with.
+ */
+struct CachedLookup
+{
+	uint32	ip;
+	long	generation;
+};
+
+static const uint32 LOOKUP_CACHE_SIZE = 64;	// Must be a power of two
+static IPFILTER_THREAD_LOCAL CachedLookup s_lookupCache[LOOKUP_CACHE_SIZE];
+
+
+static inline CachedLookup& GetCachedLookup(uint32 ip)
+{
+	// Multiplicative hash, so that neighbouring IPs don't share a slot.
+	return s_lookupCache[(ip * 2654435761u) >> 26 & (LOOKUP_CACHE_SIZE - 1)];
+}
+
+
 
 /**
  * This function creates a text-file containing the specified text, 
@@ -367,10 +380,16 @@ static bool CreateDummyFile(const wxString& filename, const wxString& text)
 
 
 CIPFilter::CIPFilter() :
+	m_table(new CIPFilterTable()),
+	m_generation(1),
+	m_epoch(0),
 	m_ready(false),
 	m_startKADWhenReady(false),
 	m_connectToAnyServerWhenReady(false)
 {
+	m_table->Finish();
+	m_readers[0] = m_readers[1] = 0;
+
 	// Setup dummy files for the curious user.
 	const wxString normalDat = theApp->ConfigDir + wxT("ipfilter.dat");
 	const wxString normalMsg = wxString()
@@ -401,6 +420,12 @@ CIPFilter::CIPFilter() :
 }
 
 
+CIPFilter::~CIPFilter()
+{
+	delete m_table;
+}
+
+
 void CIPFilter::Reload()
 {
 	// We keep the current filter till the new one has been loaded.
@@ -410,9 +435,9 @@ void CIPFilter::Reload()
 
 uint32 CIPFilter::BanCount() const
 {
-	wxMutexLocker lock(m_mutex);
+	CIPFilterReader reader(const_cast<CIPFilter&>(*this));
 
-	return m_rangeIPs.size();
+	return reader->GetRangeCount();
 }
 
 
@@ -432,44 +457,38 @@ bool CIPFilter::IsFiltered(uint32 IPTest, bool isServer)
 		}
 		return true;
 	}
-	wxMutexLocker lock(m_mutex);
 	// The IP needs to be in host order
 	uint32 ip = wxUINT32_SWAP_ALWAYS(IPTest);
-	int imin = 0;
-	int imax = m_rangeIPs.size() - 1;
-	int i;
-	bool found = false;
-	while (imin <= imax) {
-		i = (imin + imax) / 2;
-		uint32 curIP = m_rangeIPs[i];
-		if (curIP <= ip) {
-			uint32 curLength = m_rangeLengths[i];
-			if (curLength >= 0x8000) {
-				curLength = ((curLength & 0x7fff) << 12) + 0xfff;
-			}
-			if (curIP + curLength >= ip) {
-				found = true;
-				break;
-			}
-		}
-		if (curIP > ip) {
-			imax = i - 1;
-		} else {
-			imin = i + 1;
-		}
+
+	// Read the generation before the table, so that a result is never
+	// cached under a newer generation than the table it came from.
+	long generation = AtomicLoad(&m_generation);
+	CachedLookup& cached = GetCachedLookup(ip);
+	if (cached.ip == ip && cached.generation == generation) {
+		return false;
 	}
-	if (found) {
-		AddDebugLogLineN(logIPFilter, CFormat(wxT("Filtered IP %s%s")) % Uint32toStringIP(IPTest)
-			% (i < (int)m_rangeNames.size() ? (wxT(" (") + wxString(char2unicode(m_rangeNames[i].c_str())) + wxT(")")) 
-											: wxString(wxEmptyString)));
-		if (isServer) {
-			theStats::AddFilteredServer();
-		} else {
-			theStats::AddFilteredClient();
+
+	std::string name;
+	{
+		CIPFilterReader reader(*this);
+		int index = reader->Find(ip);
+		if (index < 0) {
+			cached.ip = ip;
+			cached.generation = generation;
+			return false;
 		}
-		return true;
+		name = reader->GetName(index);
 	}
-	return false;
+
+	AddDebugLogLineN(logIPFilter, CFormat(wxT("Filtered IP %s%s")) % Uint32toStringIP(IPTest)
+		% (!name.empty() ? (wxT(" (") + wxString(char2unicode(name.c_str())) + wxT(")"))
+						: wxString(wxEmptyString)));
+	if (isServer) {
+		theStats::AddFilteredServer();
+	} else {
+		theStats::AddFilteredClient();
+	}
+	return true;
 }
 
 
@@ -520,13 +539,9 @@ void CIPFilter::DownloadFinished(uint32 result)
 
 void CIPFilter::OnIPFilterEvent(CIPFilterEvent& evt)
 {
-	{
-		wxMutexLocker lock(m_mutex);
-		std::swap(m_rangeIPs, evt.m_rangeIPs);
-		std::swap(m_rangeLengths, evt.m_rangeLengths);
-		std::swap(m_rangeNames, evt.m_rangeNames);
-		m_ready = true;
-	}
+	SetTable(evt.m_table);
+	m_ready = true;
+
 	if (theApp->IsOnShutDown()) {
 		return;
 	}
@@ -561,4 +576,25 @@ void CIPFilter::OnIPFilterEvent(CIPFilterEvent& evt)
 	}
 }
 
+
+void CIPFilter::SetTable(CIPFilterTable* table)
+{
+	CIPFilterTable* oldTable = AtomicExchange(&m_table, table);
+	AtomicIncrement(&m_generation);
+
+	// Any reader still using the old table registered itself before the
+	// exchange, in either of the two counts. Flip the epoch so that new
+	// readers go to the other count, wait for the old one to drain, and
+	// do the same once more for the other count. Readers only hold the
+	// table for a single lookup, so this takes next to no time.
+	for (int i = 0; i < 2; ++i) {
+		long epoch = (AtomicIncrement(&m_epoch) - 1) & 1;
+		while (AtomicLoad(&m_readers[epoch])) {
+			wxThread::Yield();
+		}
+	}
+
+	delete oldTable;
+}
+
 // File_checked_for_headers
@@ -31,6 +31,7 @@
 #include "Types.h"	// Needed for uint8, uint16 and uint32
 
 class CIPFilterEvent;
+class CIPFilterTable;
 
 /**
  * This class represents a list of IPs that should not be accepted
@@ -41,7 +42,9 @@ class CIPFilterEvent;
  * format and the AntiP2P format, read from either text files or text
  * files compressed with the zip compression format.
  *
- * This class is thread-safe.
+ * This class is thread-safe. Lookups take no lock: the ranges are kept
+ * in an immutable CIPFilterTable, which is replaced as a whole when the
+ * filter is reloaded.
  */
 class CIPFilter : public wxEvtHandler
 {
@@ -51,6 +54,11 @@ public:
 	 */
 	CIPFilter();
 
+	/**
+	 * Destructor.
+	 */
+	~CIPFilter();
+
 	/**
 	 * Checks if a IP is filtered with the current list and AccessLevel.
 	 *
@@ -106,18 +114,22 @@ private:
 	//! The URL from which the IP filter was downloaded
 	wxString m_URL;
 	
-	// The IP ranges
-	typedef std::vector<uint32> RangeIPs;
-	RangeIPs m_rangeIPs;
-	typedef std::vector<uint16> RangeLengths;
-	RangeLengths m_rangeLengths;
-	// Name for each range. This usually stays empty for memory reasons,
-	// except if IP-Filter debugging is active.
-	typedef std::vector<std::string> RangeNames;
-	RangeNames m_rangeNames;
+	/**
+	 * Replaces the current table with a new one.
+	 *
+	 * Returns once no other thread can be using the old table anymore,
+	 * which is then deleted. Must only be called from the main thread.
+	 */
+	void	SetTable(CIPFilterTable* table);
 
-	//! Mutex used to ensure thread-safety of this class
-	mutable wxMutex	m_mutex;
+	//! The current table of blocked ranges.
+	CIPFilterTable* volatile m_table;
+	//! Incremented every time the table is replaced.
+	volatile long m_generation;
+	//! Selects which of the two reader counts new lookups register in.
+	volatile long m_epoch;
+	//! Number of lookups in progress, per epoch.
+	volatile long m_readers[2];
 
 	// false if loading (on startup only)
 	bool m_ready;
@@ -129,6 +141,7 @@ private:
 
 	friend class CIPFilterEvent;
 	friend class CIPFilterTask;
+	friend class CIPFilterReader;
 
 	DECLARE_EVENT_TABLE()
 };
@@ -0,0 +1,119 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+// Copyright (c) 2002-2011 Merkur ( devs@emule-project.net / http://www.emule-project.net )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#include "IPFilterTable.h"	// Interface declarations
+
+#include <algorithm>		// Needed for std::upper_bound
+
+
+CIPFilterTable::CIPFilterTable()
+{
+}
+
+
+void CIPFilterTable::AddRange(uint32 start, uint32 end, std::string* name)
+{
+	wxASSERT(start <= end);
+	wxASSERT(m_ranges.empty() || m_ranges.back().end < start);
+
+	Range range = { start, end };
+	m_ranges.push_back(range);
+
+	if (name) {
+		// Only pay for the descriptions when there are any.
+		m_names.resize(m_ranges.size());
+		std::swap(m_names.back(), *name);
+	}
+}
+
+
+void CIPFilterTable::Finish()
+{
+	// Release the extra capacity, the table lives until the next reload.
+	std::vector<Range>(m_ranges).swap(m_ranges);
+	if (!m_names.empty()) {
+		m_names.resize(m_ranges.size());
+	}
+
+	const uint32 buckets = 1 << INDEX_BITS;
+	m_index.resize(buckets + 1);
+
+	uint32 pos = 0;
+	for (uint32 bucket = 0; bucket < buckets; ++bucket) {
+		while (pos < m_ranges.size() && (m_ranges[pos].start >> (32 - INDEX_BITS)) < bucket) {
+			++pos;
+		}
+		m_index[bucket] = pos;
+	}
+	m_index[buckets] = m_ranges.size();
+}
+
+
+namespace {
+	struct RangeStartLess {
+		template<typename T>
+		bool operator()(uint32 ip, const T& range) const {
+			return ip < range.start;
+		}
+	};
+}
+
+
+int CIPFilterTable::Find(uint32 ip) const
+{
+	if (m_ranges.empty()) {
+		return -1;
+	}
+
+	const uint32 bucket = ip >> (32 - INDEX_BITS);
+	const Range* first = &m_ranges[0] + m_index[bucket];
+	const Range* last = &m_ranges[0] + m_index[bucket + 1];
+
+	// Find the last range starting at or before the IP. If none of the ranges
+	// of this /16 does, that is the last range of an earlier one, which may
+	// still span into this network.
+	const Range* pos = std::upper_bound(first, last, ip, RangeStartLess());
+	if (pos == &m_ranges[0]) {
+		return -1;
+	}
+
+	--pos;
+	if (ip <= pos->end) {
+		return pos - &m_ranges[0];
+	}
+
+	return -1;
+}
+
+
+std::string CIPFilterTable::GetName(int index) const
+{
+	if (index >= 0 && (uint32)index < m_names.size()) {
+		return m_names[index];
+	}
+
+	return std::string();
+}
+// File_checked_for_headers
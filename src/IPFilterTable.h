@@ -0,0 +1,107 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+// Copyright (c) 2002-2011 Merkur ( devs@emule-project.net / http://www.emule-project.net )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#ifndef IPFILTERTABLE_H
+#define IPFILTERTABLE_H
+
+#include "Types.h"	// Needed for uint32
+
+#include <string>
+#include <vector>
+
+
+/**
+ * Immutable lookup table for the blocked IP ranges.
+ *
+ * The ranges are kept as plain start/end pairs sorted by start, and an
+ * index over the upper 16 bits of the address narrows every lookup to
+ * the few ranges starting in the same /16 network. A lookup is thus one
+ * index read plus a short binary search, regardless of the size of the
+ * blocklist.
+ *
+ * The table is built once by CIPFilterTask and never modified after
+ * Finish() has been called, so any number of threads may call Find()
+ * without locking. CIPFilter takes care of replacing it on reload.
+ */
+class CIPFilterTable
+{
+public:
+	CIPFilterTable();
+
+	/**
+	 * Appends a blocked range.
+	 *
+	 * @param start The first blocked IP, in host order.
+	 * @param end The last blocked IP (inclusive), in host order.
+	 * @param name If not NULL, the description of the range. Its contents
+	 *             are moved into the table, leaving the string empty.
+	 *
+	 * Ranges must be added in ascending order and must not overlap.
+	 */
+	void	AddRange(uint32 start, uint32 end, std::string* name = NULL);
+
+	/**
+	 * Builds the index, must be called once all ranges have been added.
+	 */
+	void	Finish();
+
+	/**
+	 * Looks up the range containing an IP.
+	 *
+	 * @param ip The IP to look up, in host order.
+	 * @return The index of the range, or -1 if the IP is not blocked.
+	 */
+	int	Find(uint32 ip) const;
+
+	/**
+	 * Returns the number of ranges in the table.
+	 */
+	uint32	GetRangeCount() const	{ return m_ranges.size(); }
+
+	/**
+	 * Returns the description of a range, which is empty unless
+	 * descriptions were passed to AddRange.
+	 */
+	std::string GetName(int index) const;
+
+private:
+	//! Number of address bits covered by the index.
+	static const unsigned INDEX_BITS = 16;
+
+	struct Range {
+		uint32	start;
+		uint32	end;
+	};
+
+	//! The ranges, sorted by start.
+	std::vector<Range> m_ranges;
+	//! For every /16 network, the index of the first range starting in it or later.
+	std::vector<uint32> m_index;
+	//! Descriptions of the ranges, usually empty.
+	std::vector<std::string> m_names;
+};
+
+#endif
+// File_checked_for_headers
@@ -56,11 +56,14 @@
 #include "FileArea.h"		// Needed for CFileArea
 #include "FileAutoClose.h"	// Needed for CFileAutoClose
 #include "Server.h"			// Needed for CServer
+#include "SHAKernels.h"		// Needed for SHAKernels::HashBuffers
 
 #include "CryptoPP_Inc.h"       // Needed for MD4
 
 #include <common/Format.h>
 
+#include <algorithm>		// Needed for std::min
+
 CFileStatistic::CFileStatistic() : 
 	requested(0), 
 	transferred(0),
@@ -427,6 +430,7 @@ void CKnownFile::SetFileSize(uint64 nFileSize)
 void CKnownFile::AddUploadingClient(CUpDownClient* client)
 {
 	m_ClientUploadList.insert(CCLIENTREF(client, wxT("CKnownFile::AddUploadingClient m_ClientUploadList")));
+	SetECDirty();
 	
 	SourceItemType type = UNAVAILABLE_SOURCE;
 	switch (client->GetUploadState()) {
@@ -448,6 +452,7 @@ void CKnownFile::AddUploadingClient(CUpDownClient* client)
 void CKnownFile::RemoveUploadingClient(CUpDownClient* client)
 {
 	if (m_ClientUploadList.erase(CCLIENTREF(client, wxEmptyString))) {
+		SetECDirty();
 		Notify_SharedCtrlRemoveClient(client->ECID(), this);
 		UpdateAutoUpPriority();
 	}
@@ -491,6 +496,7 @@ CKnownFile::~CKnownFile()
 void CKnownFile::SetFilePath(const CPath& filePath)
 {
 	m_filePath = filePath;
+	SetECDirty();
 }
 
 
@@ -816,83 +822,71 @@ void CKnownFile::CreateHashFromInput(const byte* input, uint32 Length, CMD4Hash*
 	wxASSERT_MSG(Output || pShaHashOut, wxT("Nothing to do in CreateHashFromInput"));
 	wxCHECK_RET(input, wxT("No input to hash from in CreateHashFromInput"));
 	wxASSERT(Length <= PARTSIZE); // We never hash more than one PARTSIZE
-	
-	CMemFile data(input, Length);
 
-	uint32 Required = Length;
-	byte   X[64*128];
-	
-	uint32	posCurrentEMBlock = 0;
-	uint32	nIACHPos = 0;
-	CScopedPtr<CAICHHashAlgo> pHashAlg(CAICHHashSet::GetNewHashAlgo());
+	#ifdef __WEAK_CRYPTO__
+		CryptoPP::Weak::MD4 md4_hasher;
+	#else
+		CryptoPP::MD4 md4_hasher;
+	#endif
 
-	// This is all AICH.
-	while (Required >= 64) {
-		uint32 len = Required / 64; 
-		if (len > sizeof(X)/(64 * sizeof(X[0]))) {
-			len = sizeof(X)/(64 * sizeof(X[0])); 
-		}
-		
-		data.Read(&X, len * 64);
-
-		// SHA hash needs 180KB blocks
-		if (pShaHashOut) {
-			if (nIACHPos + len*64 >= EMBLOCKSIZE) {
-				uint32 nToComplete = EMBLOCKSIZE - nIACHPos;
-				pHashAlg->Add(X, nToComplete);
-				wxASSERT( nIACHPos + nToComplete == EMBLOCKSIZE );
-				pShaHashOut->SetBlockHash(EMBLOCKSIZE, posCurrentEMBlock, pHashAlg.get());
-				posCurrentEMBlock += EMBLOCKSIZE;
-				pHashAlg->Reset();
-				pHashAlg->Add(X+nToComplete,(len*64) - nToComplete);
-				nIACHPos = (len*64) - nToComplete;
-			}
-			else{
-				pHashAlg->Add(X, len*64);
-				nIACHPos += len*64;
+	if (pShaHashOut == NULL) {
+		md4_hasher.CalculateDigest(Output->GetHash(), input, Length);
+		return;
+	}
+
+	// MD4 and the AICH leaves are computed in a single pass over the input,
+	// feeding each range to MD4 right after SHA-1 is done with it, while it
+	// is still in the cache. With a multi-buffer SHA-1 kernel the 180KB
+	// blocks are hashed several at once.
+	const uint32 lanes = SHAKernels::GetParallelLanes();
+	const uint32 fullBlocks = Length / EMBLOCKSIZE;
+	uint32 posCurrentEMBlock = 0;
+
+	if (lanes > 1) {
+		std::vector<const byte*> blocks(lanes);
+		std::vector<byte> digests(lanes * CAICHHash::GetHashSize());
+
+		for (uint32 first = 0; first < fullBlocks; first += lanes) {
+			const uint32 count = std::min(lanes, fullBlocks - first);
+			for (uint32 i = 0; i < count; ++i) {
+				blocks[i] = input + (first + i) * EMBLOCKSIZE;
 			}
-		}
 
-		Required -= len*64;
-	}
-	// bytes to read
-	Required = Length % 64;
-	if (Required != 0){
-		data.Read(&X,Required);
-
-		if (pShaHashOut != NULL){
-			if (nIACHPos + Required >= EMBLOCKSIZE){
-				uint32 nToComplete = EMBLOCKSIZE - nIACHPos;
-				pHashAlg->Add(X, nToComplete);
-				wxASSERT( nIACHPos + nToComplete == EMBLOCKSIZE );
-				pShaHashOut->SetBlockHash(EMBLOCKSIZE, posCurrentEMBlock, pHashAlg.get());
+			SHAKernels::HashBuffers(&blocks[0], EMBLOCKSIZE, &digests[0], count);
+
+			for (uint32 i = 0; i < count; ++i) {
+				pShaHashOut->SetBlockHash(EMBLOCKSIZE, posCurrentEMBlock, CAICHHash(&digests[i * CAICHHash::GetHashSize()]));
 				posCurrentEMBlock += EMBLOCKSIZE;
-				pHashAlg->Reset();
-				pHashAlg->Add(X+nToComplete, Required - nToComplete);
-				nIACHPos = Required - nToComplete;
 			}
-			else{
-				pHashAlg->Add(X, Required);
-				nIACHPos += Required;
+
+			if (Output != NULL) {
+				md4_hasher.Update(blocks[0], count * EMBLOCKSIZE);
 			}
 		}
 	}
-	if (pShaHashOut != NULL){
-		if(nIACHPos > 0){
-			pShaHashOut->SetBlockHash(nIACHPos, posCurrentEMBlock, pHashAlg.get());
-			posCurrentEMBlock += nIACHPos;
+
+	CScopedPtr<CAICHHashAlgo> pHashAlg(CAICHHashSet::GetNewHashAlgo());
+
+	// Remaining blocks, including the last (short) one.
+	while (posCurrentEMBlock < Length) {
+		const uint32 nBlockSize = std::min(EMBLOCKSIZE, Length - posCurrentEMBlock);
+
+		pHashAlg->Reset();
+		pHashAlg->Add(input + posCurrentEMBlock, nBlockSize);
+		pShaHashOut->SetBlockHash(nBlockSize, posCurrentEMBlock, pHashAlg.get());
+
+		if (Output != NULL) {
+			md4_hasher.Update(input + posCurrentEMBlock, nBlockSize);
 		}
-		wxASSERT( posCurrentEMBlock == Length );
-		wxCHECK2( pShaHashOut->ReCalculateHash(pHashAlg.get(), false), );
+
+		posCurrentEMBlock += nBlockSize;
 	}
 
-	if (Output != NULL){
-		#ifdef __WEAK_CRYPTO__
-			CryptoPP::Weak::MD4 md4_hasher;
-		#else
-			CryptoPP::MD4 md4_hasher;
-		#endif
-		 md4_hasher.CalculateDigest(Output->GetHash(), input, Length);
+	wxASSERT( posCurrentEMBlock == Length );
+	wxCHECK2( pShaHashOut->ReCalculateHash(pHashAlg.get(), false), );
+
+	if (Output != NULL) {
+		md4_hasher.Final(Output->GetHash());
 	}
 }
 
@@ -1071,7 +1065,7 @@ CPacket* CKnownFile::CreateSrcInfoPacket(const CUpDownClient* forClient, uint8 b
 	data.Seek(bIsSX2Packet ? 17 : 16, wxFromStart);
 	data.WriteUInt16(nCount);
 
-	CPacket* result = new CPacket(data, OP_EMULEPROT, bIsSX2Packet ? OP_ANSWERSOURCES2 : OP_ANSWERSOURCES);
+	CPacket* result = new CPacket(data, OP_EMULEPROT, bIsSX2Packet ? OP_ANSWERSOURCES2 : OP_ANSWERSOURCES, true);
 	
 	if ( result->GetPacketSize() > 354 ) {
 		result->PackPacket();
@@ -1265,6 +1259,7 @@ void CKnownFile::SetFileCommentRating(const wxString& strNewComment, int8 iNewRa
      
 		m_strComment = strNewComment;
  		m_iRating = iNewRating; 
+		SetECDirty();
  
 		SourceSet::iterator it = m_ClientUploadList.begin();
 		for ( ; it != m_ClientUploadList.end(); it++ ) {
@@ -1276,6 +1271,7 @@ void CKnownFile::SetFileCommentRating(const wxString& strNewComment, int8 iNewRa
 
 void CKnownFile::SetUpPriority(uint8 iNewUpPriority, bool m_bsave){
 	m_iUpPriority = iNewUpPriority;
+	SetECDirty();
 	if( IsPartFile() && m_bsave ) {
 		((CPartFile*)this)->SavePartFile();
 	}
@@ -1489,6 +1485,7 @@ void GuessAndRemoveExt(CPath& name)
 void CKnownFile::SetFileName(const CPath& filename)
 { 
 	CAbstractFile::SetFileName(filename);
+	SetECDirty();
 	wordlist.clear();
 	// Don't publish extension. That'd kill the node indexing e.g. "avi".
 	CPath tmpName = GetFileName();
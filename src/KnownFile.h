@@ -168,6 +168,7 @@ class CFile;
 class CKnownFile : public CAbstractFile, public CECID
 {
 friend class CHashingTask;
+friend class CPartHashingTask;
 public:
 	CKnownFile();
 	CKnownFile(uint32 ecid);
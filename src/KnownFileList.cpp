@@ -30,12 +30,16 @@
 
 #include <memory>		// Do_not_auto_remove (lionel's Mac, 10.3)
 #include "PartFile.h"		// Needed for CPartFile
+#include "FileArea.h"		// Needed for CFileArea
+#include "FileAutoClose.h"	// Needed for CFileAutoClose
 #include "amule.h"
 #include "Logger.h"
 #include "MemFile.h"
 #include "ScopedPtr.h"
 #include "SearchList.h"		// Needed for UpdateSearchFileByHash
+#include "Tag.h"			// Needed for CTag
 #include <common/Format.h>
+#include <tags/FileTags.h>
 #ifdef ENABLE_TORRENT
 #include "Torrent.h"
 #endif
@@ -62,6 +66,9 @@ CKnownFileList::CKnownFileList()
 	m_filename = wxT("known.met");
 	m_knownSizeMap = NULL;
 	m_duplicateSizeMap = NULL;
+	m_recordSizeMap = NULL;
+	m_metFile = NULL;
+	m_metArea = NULL;
 	Init();
 }
 
@@ -74,8 +81,6 @@ CKnownFileList::~CKnownFileList()
 
 bool CKnownFileList::Init()
 {
-	CFile file;
-	
 	CPath fullpath = CPath(theApp->ConfigDir + m_filename);
 	if (!fullpath.FileExists()) {
 		// This is perfectly normal. The file was probably either
@@ -83,32 +88,50 @@ bool CKnownFileList::Init()
 		return false;
 	}
 
-	if (!file.Open(fullpath)) {
+	wxMutexLocker sLock(list_mut);
+
+	if (!MapMetFile(fullpath)) {
 		AddLogLineC(CFormat(_("WARNING: %s cannot be opened.")) % m_filename);
 		return false;
 	}
-	
+
 	try {
+		CMemFile file(m_metArea->GetBuffer(), m_metFile->GetLength());
 		uint8 version = file.ReadUInt8();
 		if ((version != MET_HEADER) && (version != MET_HEADER_WITH_LARGEFILES)) {
 			AddLogLineC(_("WARNING: Known file list corrupted, contains invalid header."));
+			CloseMetFile();
 			return false;
 		}
 		
-		wxMutexLocker sLock(list_mut);
 		uint32 RecordsNumber = file.ReadUInt32();
 		AddDebugLogLineN(logKnownFiles, CFormat(wxT("Reading %i known files from file format 0x%2.2x."))
 			% RecordsNumber % version);
+		// Only index the records here, they are loaded when looked up
 		for (uint32 i = 0; i < RecordsNumber; i++) {
-			CScopedPtr<CKnownFile> record;
-			if (record->LoadFromFile(&file)) {
-				AddDebugLogLineN(logKnownFiles,
-					CFormat(wxT("Known file read: %s")) % record->GetFileName());
-				Append(record.release());
+			CMD4Hash hash;
+			KnownFileRecord record;
+			if (!ScanRecord(file, hash, record)) {
+				continue;
+			}
+			if (m_records.find(hash) == m_records.end()
+				&& m_knownFileMap.find(hash) == m_knownFileMap.end()) {
+				m_records[hash] = record;
 			} else {
-				AddLogLineC(_("Failed to load entry in known file list, file may be corrupt"));
+				// Duplicated hash: load both, so Append() can sort them out
+				LoadRecord(hash);
+				CScopedPtr<CKnownFile> duplicate;
+				CMemFile data(m_metArea->GetBuffer() + record.offset, record.length);
+				if (duplicate->LoadFromFile(&data)) {
+					AddDebugLogLineN(logKnownFiles,
+						CFormat(wxT("Known file read: %s")) % duplicate->GetFileName());
+					Append(duplicate.release());
+				} else {
+					AddLogLineC(_("Failed to load entry in known file list, file may be corrupt"));
+				}
 			}
 		}
+		m_metArea->CheckError();
 		AddDebugLogLineN(logKnownFiles, wxT("Finished reading known files"));
 	
 		return true;
@@ -122,14 +145,124 @@ bool CKnownFileList::Init()
 }
 
 
+bool CKnownFileList::ScanRecord(const CMemFile& data, CMD4Hash& hash, KnownFileRecord& record) const
+{
+	// Same layout as read by CKnownFile::LoadFromFile
+	record.offset = data.GetPosition();
+	record.date = data.ReadUInt32();
+	hash = data.ReadHash();
+	uint16 parts = data.ReadUInt16();
+	if (parts * MD4HASH_LENGTH > data.GetLength() - data.GetPosition()) {
+		throw CInvalidPacket(wxT("Hashset ends past end of file"));
+	}
+	data.Seek(parts * MD4HASH_LENGTH, wxFromCurrent);
+
+	record.size = 0;
+	uint32 tagcount = data.ReadUInt32();
+	for (uint32 j = 0; j != tagcount; ++j) {
+		uint8 name;
+		uint64 value;
+		if (CTag::ReadIntOrSkip(data, name, value) && name == FT_FILESIZE) {
+			record.size = value;
+		}
+	}
+	record.length = data.GetPosition() - record.offset;
+
+	if (record.size == 0) {
+		AddDebugLogLineN(logGeneral,
+			CFormat(wxT("%s is 0-size, not added")) % hash.Encode());
+		return false;
+	}
+	return true;
+}
+
+
+CKnownFile* CKnownFileList::LoadRecord(KnownFileRecordMap::iterator it)
+{
+	KnownFileRecord record = it->second;
+	m_records.erase(it);
+
+	CScopedPtr<CKnownFile> file;
+	try {
+		CMemFile data(m_metArea->GetBuffer() + record.offset, record.length);
+		bool loaded = file->LoadFromFile(&data);
+		m_metArea->CheckError();
+		if (!loaded) {
+			AddLogLineC(_("Failed to load entry in known file list, file may be corrupt"));
+			return NULL;
+		}
+	} catch (const CInvalidPacket& e) {
+		AddLogLineC(_("Invalid entry in known file list, file may be corrupt: ") + e.what());
+		return NULL;
+	} catch (const CSafeIOException& e) {
+		AddLogLineC(CFormat(_("IO error while reading %s file: %s")) % m_filename % e.what());
+		return NULL;
+	}
+	AddDebugLogLineN(logKnownFiles, CFormat(wxT("Known file read: %s")) % file->GetFileName());
+
+	CKnownFile *result = file.release();
+	m_knownFileMap[result->GetFileHash()] = result;
+	if (m_knownSizeMap) {
+		m_knownSizeMap->insert(std::pair<uint32, CKnownFile*>((uint32) result->GetFileSize(), result));
+	}
+	return result;
+}
+
+
+CKnownFile* CKnownFileList::LoadRecord(const CMD4Hash& hash)
+{
+	KnownFileRecordMap::iterator it = m_records.find(hash);
+	return it == m_records.end() ? NULL : LoadRecord(it);
+}
+
+
+bool CKnownFileList::MapMetFile(const CPath& path)
+{
+	CScopedPtr<CFileAutoClose> file;
+	CScopedPtr<CFileArea> area;
+	if (!file->Open(path)) {
+		return false;
+	}
+	try {
+		area->ReadAt(*file, 0, file->GetLength());
+	} catch (const CSafeIOException& e) {
+		AddLogLineC(CFormat(_("IO error while reading %s file: %s")) % m_filename % e.what());
+		return false;
+	}
+	// Not needed anymore unless mapped, and keeping it open would
+	// prevent replacing the file on some systems.
+	file->Release(true);
+
+	CloseMetFile();
+	m_metFile = file.release();
+	m_metArea = area.release();
+	return true;
+}
+
+
+void CKnownFileList::CloseMetFile()
+{
+	// The area references the file, so it goes first
+	delete m_metArea;
+	m_metArea = NULL;
+	delete m_metFile;
+	m_metFile = NULL;
+}
+
+
 void CKnownFileList::Save()
 {
-	CFile file(theApp->ConfigDir + m_filename, CFile::write);
+	// Records not loaded are copied from the current file,
+	// so the new one is written next to it.
+	CPath fullpath = CPath(theApp->ConfigDir + m_filename);
+	CPath newpath = CPath(theApp->ConfigDir + m_filename + wxT(".new"));
+	CFile file(newpath, CFile::write);
 	if (!file.IsOpened()) {
 		return;
 	}
 
 	wxMutexLocker sLock(list_mut);
+	KnownFileRecordMap records;
 
 	try {
 		// Kry - This is the version, but we don't know it till
@@ -138,7 +271,7 @@ void CKnownFileList::Save()
 		bool bContainsAnyLargeFiles = false;
 		file.WriteUInt8(0);
 		
-		file.WriteUInt32(m_knownFileMap.size() + m_duplicateFileList.size());
+		file.WriteUInt32(m_knownFileMap.size() + m_duplicateFileList.size() + m_records.size());
 
 		// Duplicates handling. Duplicates needs to be saved first,
 		// since it is the last entry that gets used.
@@ -164,11 +297,44 @@ void CKnownFileList::Save()
 			}
 #endif
 		}
+
+		// Records that were never looked up didn't change either
+		KnownFileRecordMap::const_iterator itRec = m_records.begin();
+		for (; itRec != m_records.end(); ++itRec) {
+			KnownFileRecord record = itRec->second;
+			file.Write(m_metArea->GetBuffer() + record.offset, record.length);
+			record.offset = file.GetPosition() - record.length;
+			records[itRec->first] = record;
+			if (record.size > OLD_MAX_FILE_SIZE) {
+				bContainsAnyLargeFiles = true;
+			}
+		}
+		if (m_metArea) {
+			m_metArea->CheckError();
+		}
 		
 		file.Seek(0);
 		file.WriteUInt8(bContainsAnyLargeFiles ? MET_HEADER_WITH_LARGEFILES : MET_HEADER);
+		file.Close();
 	} catch (const CIOFailureException& e) {
 		AddLogLineC(CFormat(_("Error while saving %s file: %s")) % m_filename % e.what());
+		if (file.IsOpened()) {
+			file.Close();
+		}
+		CPath::RemoveFile(newpath);
+		return;
+	}
+
+	if (!CPath::RenameFile(newpath, fullpath, true)) {
+		AddLogLineC(CFormat(_("Error while saving %s file: %s")) % m_filename % _("cannot replace the file"));
+		return;
+	}
+	// Point the records into the new file. Until then the old
+	// mapping is still valid, even though the file was replaced.
+	if (m_records.empty()) {
+		CloseMetFile();
+	} else if (MapMetFile(fullpath)) {
+		m_records.swap(records);
 	}
 }
 
@@ -179,7 +345,9 @@ void CKnownFileList::Clear()
 
 	DeleteContents(m_knownFileMap);
 	DeleteContents(m_duplicateFileList);
+	m_records.clear();
 	ReleaseIndex();
+	CloseMetFile();
 }
 
 
@@ -199,6 +367,19 @@ CKnownFile* CKnownFileList::FindKnownFile(
 				return cur_file;
 			}
 		}
+		// Load records of the same size and date to compare the name
+		std::pair<KnownRecordSizeMap::const_iterator, KnownRecordSizeMap::const_iterator> r;
+		r = m_recordSizeMap->equal_range((uint32) in_size);
+		for (KnownRecordSizeMap::const_iterator it = r.first; it != r.second; it++) {
+			KnownFileRecordMap::iterator rec = m_records.find(it->second);
+			if (rec != m_records.end()
+				&& rec->second.date == (uint32) in_date && rec->second.size == in_size) {
+				CKnownFile *cur_file = LoadRecord(rec);
+				if (cur_file && KnownFileMatches(cur_file, filename, in_date, in_size)) {
+					return cur_file;
+				}
+			}
+		}
 	} else {
 		for (CKnownFileMap::const_iterator it = m_knownFileMap.begin();
 			 it != m_knownFileMap.end(); ++it) {
@@ -207,6 +388,16 @@ CKnownFile* CKnownFileList::FindKnownFile(
 				return cur_file;
 			}
 		}
+		KnownFileRecordMap::iterator it = m_records.begin();
+		while (it != m_records.end()) {
+			KnownFileRecordMap::iterator rec = it++;
+			if (rec->second.date == (uint32) in_date && rec->second.size == in_size) {
+				CKnownFile *cur_file = LoadRecord(rec);
+				if (cur_file && KnownFileMatches(cur_file, filename, in_date, in_size)) {
+					return cur_file;
+				}
+			}
+		}
 	}
 
 	return IsOnDuplicates(filename, in_date, in_size);
@@ -248,7 +439,7 @@ CKnownFile* CKnownFileList::FindKnownFileByID(const CMD4Hash& hash)
 		if (m_knownFileMap.find(hash) != m_knownFileMap.end()) {
 			return m_knownFileMap[hash];
 		} else {
-			return NULL;	
+			return LoadRecord(hash);
 		}
 	}
 	return NULL;	
@@ -274,6 +465,8 @@ bool CKnownFileList::Append(CKnownFile *Record, bool afterHashing)
 {
 	if (Record->GetFileSize() > 0) {
 		const CMD4Hash& tkey = Record->GetFileHash();
+		// A record of known.met with the same hash must be compared
+		LoadRecord(tkey);
 		CKnownFileMap::iterator it = m_knownFileMap.find(tkey);
 		if (it == m_knownFileMap.end()) {
 			m_knownFileMap[tkey] = Record;			
@@ -334,6 +527,10 @@ void CKnownFileList::PrepareIndex()
 	for (KnownFileList::const_iterator it = m_duplicateFileList.begin(); it != m_duplicateFileList.end(); it++) {
 		m_duplicateSizeMap->insert(std::pair<uint32, CKnownFile*>((uint32) (*it)->GetFileSize(), *it));
 	}
+	m_recordSizeMap = new KnownRecordSizeMap;
+	for (KnownFileRecordMap::const_iterator it = m_records.begin(); it != m_records.end(); it++) {
+		m_recordSizeMap->insert(std::pair<uint32, CMD4Hash>((uint32) it->second.size, it->first));
+	}
 }
 
 
@@ -341,8 +538,10 @@ void CKnownFileList::ReleaseIndex()
 {
 	delete m_knownSizeMap;
 	delete m_duplicateSizeMap;
+	delete m_recordSizeMap;
 	m_knownSizeMap = NULL;
 	m_duplicateSizeMap = NULL;
+	m_recordSizeMap = NULL;
 }
 
 // File_checked_for_headers
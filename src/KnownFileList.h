@@ -30,7 +30,10 @@
 #include "SharedFileList.h" // CKnownFileMap
 
 
+class CFileArea;
+class CFileAutoClose;
 class CKnownFile;
+class CMemFile;
 class CPath;
 
 class CKnownFileList
@@ -59,6 +62,26 @@ private:
 
 	bool	Append(CKnownFile*, bool afterHashing = false);
 
+	/**
+	 * A record of known.met which hasn't been loaded yet.
+	 *
+	 * Only the fields needed to find it are read on startup, the
+	 * CKnownFile is created from the mapped file when it is looked up.
+	 */
+	struct KnownFileRecord {
+		uint64	offset;
+		uint32	length;
+		uint32	date;
+		uint64	size;
+	};
+	typedef std::map<CMD4Hash, KnownFileRecord> KnownFileRecordMap;
+
+	bool	ScanRecord(const CMemFile& data, CMD4Hash& hash, KnownFileRecord& record) const;
+	CKnownFile*	LoadRecord(KnownFileRecordMap::iterator it);
+	CKnownFile*	LoadRecord(const CMD4Hash& hash);
+	bool	MapMetFile(const CPath& path);
+	void	CloseMetFile();
+
 	CKnownFile *IsOnDuplicates(
 		const CPath& filename,
 		uint32 in_date,
@@ -79,6 +102,13 @@ private:
 	typedef std::multimap<uint32, CKnownFile*> KnownFileSizeMap;
 	KnownFileSizeMap * m_knownSizeMap;
 	KnownFileSizeMap * m_duplicateSizeMap;
+	// Records not loaded yet, and their index by size
+	KnownFileRecordMap	m_records;
+	typedef std::multimap<uint32, CMD4Hash> KnownRecordSizeMap;
+	KnownRecordSizeMap * m_recordSizeMap;
+	// The mapped known.met the records point into
+	CFileAutoClose * m_metFile;
+	CFileArea * m_metArea;
 };
 
 #endif // KNOWNFILELIST_H
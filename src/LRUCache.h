@@ -0,0 +1,112 @@
+//							-*- C++ -*-
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#ifndef LRUCACHE_H
+#define LRUCACHE_H
+
+#include <list>
+#include <map>
+
+/**
+ * CLRUCache is a map holding at most a fixed number of entries.
+ *
+ * When full, inserting a new key drops the least recently used entry,
+ * where both Find and Insert count as a use. The class does no locking.
+ */
+template <typename KEY, typename VALUE>
+class CLRUCache
+{
+public:
+	/** Creates a cache holding at most maxEntries (> 0) entries. */
+	CLRUCache(size_t maxEntries)
+		: m_maxEntries(maxEntries)
+	{}
+
+	/**
+	 * Returns the value stored for key, or NULL if there is none.
+	 *
+	 * The entry becomes the most recently used one.
+	 */
+	VALUE* Find(const KEY& key)
+	{
+		typename EntryMap::iterator it = m_entries.find(key);
+		if (it == m_entries.end()) {
+			return NULL;
+		}
+
+		m_lru.splice(m_lru.begin(), m_lru, it->second.lru);
+		return &it->second.value;
+	}
+
+	/**
+	 * Stores value for key, replacing any previous value.
+	 *
+	 * The entry becomes the most recently used one, and the least
+	 * recently used entry is dropped if the cache was full.
+	 */
+	VALUE& Insert(const KEY& key, const VALUE& value)
+	{
+		VALUE* stored = Find(key);
+		if (stored) {
+			return *stored = value;
+		}
+
+		if (m_entries.size() >= m_maxEntries) {
+			m_entries.erase(m_lru.back());
+			m_lru.pop_back();
+		}
+
+		m_lru.push_front(key);
+		Entry& entry = m_entries[key];
+		entry.value = value;
+		entry.lru = m_lru.begin();
+		return entry.value;
+	}
+
+	/** Returns the number of entries. */
+	size_t GetCount() const		{ return m_entries.size(); }
+
+	/** Removes all entries. */
+	void Clear()
+	{
+		m_entries.clear();
+		m_lru.clear();
+	}
+
+private:
+	typedef std::list<KEY> KeyList;
+	struct Entry {
+		VALUE	value;
+		typename KeyList::iterator lru;
+	};
+	typedef std::map<KEY, Entry> EntryMap;
+
+	size_t		m_maxEntries;
+	EntryMap	m_entries;
+	//! Most recently used first
+	KeyList		m_lru;
+};
+
+#endif
+// File_checked_for_headers
@@ -25,6 +25,8 @@
 
 #include "MemFile.h"	// Interface declarations
 
+#include <algorithm>	// Needed for std::max
+
 
 CMemFile::CMemFile(unsigned int growthRate)
 {
@@ -66,8 +68,8 @@ CMemFile::CMemFile(const byte* buffer, size_t bufferSize)
 
 CMemFile::~CMemFile()
 {
-	if (m_delete) {
-		free(m_buffer);
+	if (m_delete && m_buffer) {
+		delete [] (m_buffer - HeaderRoom);
 	}
 }
 
@@ -100,7 +102,7 @@ uint64 CMemFile::GetLength() const
 }
 
 
-void CMemFile::enlargeBuffer(size_t size)
+void CMemFile::enlargeBuffer(size_t size, bool exact)
 {
 	MULE_VALIDATE_PARAMS(size >= m_BufferSize, wxT("CMemFile: Attempted to shrink buffer."));
 	MULE_VALIDATE_STATE(m_delete, wxT("CMemFile: Attempted to grow an attached buffer."));
@@ -108,17 +110,49 @@ void CMemFile::enlargeBuffer(size_t size)
 	
 	size_t newsize = m_BufferSize;
 	
-	if (m_growthRate) {
-		newsize = ((size + m_growthRate - 1) / m_growthRate) * m_growthRate;
+	if (m_growthRate && !exact) {
+		// Grow at least by doubling, to keep the number of copies logarithmic.
+		newsize = std::max<size_t>(size, m_BufferSize * 2);
+		newsize = ((newsize + m_growthRate - 1) / m_growthRate) * m_growthRate;
 	} else {
-		// No growth-rate specified. Change to exactly the size specified.
+		// No growth-rate specified, or an exact size was asked for.
 		newsize = size;
 	}
 
-	m_buffer = (byte*)realloc(m_buffer, newsize);
+	// Allocated with new[], so that DetachBuffer can hand it over to CPacket.
+	byte* newbuffer = new byte[newsize + HeaderRoom] + HeaderRoom;
+	if (m_buffer) {
+		memcpy(newbuffer, m_buffer, m_BufferSize);
+		delete [] (m_buffer - HeaderRoom);
+	}
+
+	m_buffer = newbuffer;
 	m_BufferSize = newsize;
+}
+
+
+void CMemFile::Reserve(size_t size)
+{
+	if (size > m_BufferSize) {
+		enlargeBuffer(size, true);
+	}
+}
+
+
+byte* CMemFile::DetachBuffer()
+{
+	if (!m_delete || m_readonly) {
+		return NULL;
+	}
+
+	byte* result = m_buffer ? m_buffer - HeaderRoom : new byte[HeaderRoom];
+
+	m_buffer		= NULL;
+	m_BufferSize	= 0;
+	m_fileSize		= 0;
+	m_position		= 0;
 
-	MULE_VALIDATE_STATE(m_buffer, wxT("CMemFile: Failed to (re)allocate buffer"));
+	return result;
 }
 
 
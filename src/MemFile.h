@@ -65,6 +65,9 @@ public:
 	 *
 	 * If the growth-rate is set to zero, the memfile will allocate
 	 * exactly the needed amount of memory and no more when resizing.
+	 * Otherwise the buffer grows at least geometrically, so that
+	 * writing a large file piecewise doesn't degrade into a long
+	 * series of copies.
 	 */
 	CMemFile(unsigned int growthRate = 1024);
 
@@ -131,6 +134,32 @@ public:
 	 */
 	virtual void ResetData();
 
+	/**
+	 * Makes sure that at least 'size' bytes fit in the buffer.
+	 *
+	 * @param size The total size the file is expected to reach.
+	 *
+	 * Writers that know the exact size of what they are about to
+	 * write should call this first, so the buffer is allocated once.
+	 * The length of the file is not changed.
+	 */
+	void Reserve(size_t size);
+
+	/**
+	 * Hands the buffer over to the caller and empties the file.
+	 *
+	 * @return The allocation, or NULL if the buffer isn't owned by the memfile.
+	 *
+	 * The returned block starts with HeaderRoom spare bytes, followed
+	 * by the GetLength() bytes of file contents, and must be freed
+	 * with delete[]. This lets CPacket adopt the buffer and write its
+	 * header in front of the data without copying the payload.
+	 */
+	byte* DetachBuffer();
+
+	//! Spare bytes allocated in front of owned buffers, see DetachBuffer.
+	static const size_t HeaderRoom = 6;
+
 	// Sometimes it's useful to get the buffer and do stuff with it.
 	byte* GetRawBuffer() const { return m_buffer; }
 	
@@ -151,8 +180,8 @@ private:
 	CMemFile& operator=(const CMemFile&);
 	//@}
 
-	/** Enlarges the buffer to at least 'size' length. */
-	void enlargeBuffer(size_t size);
+	/** Enlarges the buffer to at least 'size' length, or exactly 'size' if 'exact' is set. */
+	void enlargeBuffer(size_t size, bool exact = false);
 	
 	//! The growth-rate for the buffer.
 	unsigned int m_growthRate;
@@ -162,7 +191,7 @@ private:
 	size_t	m_BufferSize;
 	//! The size of the virtual file, may be less than the buffer-size.
 	size_t	m_fileSize;
-	//! If true, the buffer will be freed upon termination.
+	//! If true, the buffer (HeaderRoom bytes before m_buffer) will be freed upon termination.
 	bool	m_delete;
 	//! read-only mark.
 	bool	m_readonly;
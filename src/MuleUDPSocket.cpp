@@ -22,9 +22,19 @@
 // Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
 //
 
+#ifdef HAVE_CONFIG_H
+#	include "config.h"
+#endif
+
 #include <wx/wx.h>
 #include <algorithm>
 
+#if defined(HAVE_RECVMMSG) || defined(HAVE_SENDMMSG)
+#	include <sys/types.h>
+#	include <sys/socket.h>
+#	include <netinet/in.h>
+#endif
+
 #include "MuleUDPSocket.h"              // Interface declarations
 
 #include <protocol/ed2k/Constants.h>
@@ -38,8 +48,10 @@
 #include "UploadBandwidthThrottler.h"
 #include "EncryptedDatagramSocket.h"
 #include "OtherFunctions.h"
+#include "ArchSpecific.h"				// Needed for ENDIAN_*
 #include "kademlia/kademlia/Prefs.h"
 #include "ClientList.h"
+#include "Statistics.h"					// Needed for theStats
 
 
 CMuleUDPSocket::CMuleUDPSocket(const wxString& name, int id, const amuleIPV4Address& address, const CProxyData* ProxyData)
@@ -49,7 +61,10 @@ m_name(name),
 m_id(id),
 m_addr(address),
 m_proxy(ProxyData),
-m_socket(NULL)
+m_socket(NULL),
+m_queue(64),
+m_queueHead(0),
+m_queueSize(0)
 {
 }
 
@@ -60,6 +75,36 @@ CMuleUDPSocket::~CMuleUDPSocket()
 
 	wxMutexLocker lock(m_mutex);
 	DestroySocket();
+
+	while (m_queueSize) {
+		QueuePop();
+	}
+}
+
+
+void CMuleUDPSocket::QueuePush(const UDPPack& item)
+{
+	if (m_queueSize == m_queue.size()) {
+		// Full, unwrap into a buffer twice the size
+		std::vector<UDPPack> queue(m_queue.size() * 2);
+		for (size_t i = 0; i < m_queueSize; ++i) {
+			queue[i] = QueueAt(i);
+		}
+		m_queue.swap(queue);
+		m_queueHead = 0;
+	}
+
+	m_queue[(m_queueHead + m_queueSize) % m_queue.size()] = item;
+	m_queueSize++;
+}
+
+
+void CMuleUDPSocket::QueuePop()
+{
+	delete m_queue[m_queueHead].packet;
+	m_queue[m_queueHead].packet = NULL;
+	m_queueHead = (m_queueHead + 1) % m_queue.size();
+	m_queueSize--;
 }
 
 
@@ -120,7 +165,7 @@ void CMuleUDPSocket::OnSend(int errorCode)
 	{
 		wxMutexLocker lock(m_mutex);
 		m_busy = false;
-		if (m_queue.empty()) {
+		if (!m_queueSize) {
 			return;
 		}
 	}
@@ -130,6 +175,8 @@ void CMuleUDPSocket::OnSend(int errorCode)
 
 
 const unsigned UDP_BUFFER_SIZE = 16384;
+//! Number of datagrams read at once by ReceiveBatch.
+const unsigned UDP_RECV_BATCH = 16;
 
 
 void CMuleUDPSocket::OnReceive(int errorCode)
@@ -142,6 +189,8 @@ void CMuleUDPSocket::OnReceive(int errorCode)
 	unsigned length = 0;
 	bool error = false;
 	int lastError = 0;
+	UDPDatagram batch[UDP_RECV_BATCH];
+	size_t count = 0;
 	
 	{
 		wxMutexLocker lock(m_mutex);
@@ -153,36 +202,113 @@ void CMuleUDPSocket::OnReceive(int errorCode)
 			return;
 		}
 
-		
+		count = ReceiveBatch(batch);
+
+		// The last read always goes through wx, as that re-enables
+		// the input notification for the socket.
 		length = m_socket->RecvFrom(addr, buffer, UDP_BUFFER_SIZE).LastCount();
 		error = m_socket->Error();
 		lastError = m_socket->LastError();
 	}
+
+	for (size_t i = 0; i < count; ++i) {
+		if (AcceptPacket(batch[i].ip, batch[i].port, batch[i].length)) {
+			OnPacketReceived(batch[i].ip, batch[i].port, batch[i].buffer, batch[i].length);
+		}
+	}
 	
 	const uint32 ip = StringIPtoUint32(addr.IPAddress());
 	const uint16 port = addr.Service();
 	if (error) {
-		OnReceiveError(lastError, ip, port);
-	} else if (length < 2) {
+		// Nothing left to read is expected after a batch
+		if (!count || lastError != wxSOCKET_WOULDBLOCK) {
+			OnReceiveError(lastError, ip, port);
+		}
+	} else if (AcceptPacket(ip, port, length)) {
+		OnPacketReceived(ip, port, (byte*)buffer, length);
+	}
+}
+
+
+bool CMuleUDPSocket::AcceptPacket(uint32 ip, uint16 port, size_t length)
+{
+	if (length < 2) {
 		// 2 bytes (protocol and opcode) is the smallets possible packet.
 		AddDebugLogLineN(logMuleUDP, m_name + wxT(": Invalid Packet received"));
 	} else if (!ip) {
 		// wxFAIL;
-		AddLogLineNS(wxT("Unknown ip receiving a UDP packet! Ignoring: '") + addr.IPAddress() + wxT("'"));
+		AddLogLineNS(wxT("Unknown ip receiving a UDP packet! Ignoring"));
 	} else if (!port) {
 		// wxFAIL;
 		AddLogLineNS(wxT("Unknown port receiving a UDP packet! Ignoring"));
 	} else if (theApp->clientlist->IsBannedClient(ip)) {
-		AddDebugLogLineN(logMuleUDP, m_name + wxT(": Dropped packet from banned IP ") + addr.IPAddress());
+		AddDebugLogLineN(logMuleUDP, m_name + wxT(": Dropped packet from banned IP ") + Uint32toStringIP(ip));
 	} else {
 		AddDebugLogLineN(logMuleUDP, (m_name + wxT(": Packet received ("))
-			<< addr.IPAddress() << wxT(":") << port << wxT("): ")
+			<< Uint32_16toStringIP_Port(ip, port) << wxT("): ")
 			<< length << wxT("b"));
-		OnPacketReceived(ip, port, (byte*)buffer, length);
+		return true;
 	}
+
+	return false;
 }
 
 
+#ifdef HAVE_RECVMMSG
+size_t CMuleUDPSocket::ReceiveBatch(UDPDatagram* packets)
+{
+	// The proxy socket strips the relay header in RecvFrom
+	if (m_proxy && m_proxy->m_proxyEnable) {
+		return 0;
+	}
+
+	if (m_recvBuffers.empty()) {
+		m_recvBuffers.resize(UDP_RECV_BATCH * UDP_BUFFER_SIZE);
+	}
+
+	struct mmsghdr msgs[UDP_RECV_BATCH];
+	struct iovec iovecs[UDP_RECV_BATCH];
+	struct sockaddr_in addrs[UDP_RECV_BATCH];
+	memset(msgs, 0, sizeof(msgs));
+	for (unsigned i = 0; i < UDP_RECV_BATCH; ++i) {
+		iovecs[i].iov_base = &m_recvBuffers[i * UDP_BUFFER_SIZE];
+		iovecs[i].iov_len = UDP_BUFFER_SIZE;
+		msgs[i].msg_hdr.msg_iov = &iovecs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &addrs[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+	}
+
+	int received = recvmmsg(m_socket->GetSocket(), msgs, UDP_RECV_BATCH, MSG_DONTWAIT, NULL);
+	if (received <= 0) {
+		// Errors are reported by the regular read that follows
+		return 0;
+	}
+
+	size_t count = 0;
+	for (int i = 0; i < received; ++i) {
+		if ((msgs[i].msg_hdr.msg_flags & MSG_TRUNC) || addrs[i].sin_family != AF_INET) {
+			AddDebugLogLineN(logMuleUDP, m_name + wxT(": Invalid Packet received"));
+			continue;
+		}
+		// Same byte order as StringIPtoUint32
+		packets[count].ip = ENDIAN_SWAP_32(addrs[i].sin_addr.s_addr);
+		packets[count].port = ENDIAN_NTOHS(addrs[i].sin_port);
+		packets[count].buffer = &m_recvBuffers[i * UDP_BUFFER_SIZE];
+		packets[count].length = msgs[i].msg_len;
+		++count;
+	}
+
+	return count;
+}
+#else
+size_t CMuleUDPSocket::ReceiveBatch(UDPDatagram*)
+{
+	return 0;
+}
+#endif
+
+
 void CMuleUDPSocket::OnReceiveError(int DEBUG_ONLY(errorCode), uint32 WXUNUSED(ip), uint16 WXUNUSED(port))
 {
 	AddDebugLogLineN(logMuleUDP, (m_name + wxT(": Error while reading: ")) << errorCode);
@@ -243,7 +369,7 @@ void CMuleUDPSocket::SendPacket(CPacket* packet, uint32 IP, uint16 port, bool bE
 
 	{
 		wxMutexLocker lock(m_mutex);		
-		m_queue.push_back(newpending);
+		QueuePush(newpending);
 	}
 
 	theApp->uploadBandwidthThrottler->QueueForSendingControlPacket(this);
@@ -262,23 +388,32 @@ SocketSentBytes CMuleUDPSocket::SendControlData(uint32 maxNumberOfBytesToSend, u
 {
 	wxMutexLocker lock(m_mutex);
 	uint32 sentBytes = 0;
-	while (!m_queue.empty() && !m_busy && (sentBytes < maxNumberOfBytesToSend)) {
-		UDPPack item = m_queue.front();
+	while (m_queueSize && !m_busy && (sentBytes < maxNumberOfBytesToSend)) {
+		uint32 batchBytes = SendBatch(maxNumberOfBytesToSend - sentBytes);
+		if (batchBytes) {
+			sentBytes += batchBytes;
+			continue;
+		}
+
+		UDPPack& item = QueueAt(0);
 		CPacket* packet = item.packet;
 		if (GetTickCount() - item.time < UDPMAXQUEUETIME) {
 			uint32_t len = packet->GetPacketSize() + 2;
 			uint8_t *sendbuffer = new uint8_t [len];
 			memcpy(sendbuffer, packet->GetUDPHeader(), 2);
 			memcpy(sendbuffer + 2, packet->GetDataBuffer(), packet->GetPacketSize());
+			uint32_t plainLen = len;
 
 			if (item.bEncrypt && (theApp->GetPublicIP() > 0 || item.bKad)) {
-				len = CEncryptedDatagramSocket::EncryptSendClient(&sendbuffer, len, item.pachTargetClientHashORKadID, item.bKad, item.nReceiverVerifyKey, (item.bKad ? Kademlia::CPrefs::GetUDPVerifyKey(item.IP) : 0));
+				len = CEncryptedDatagramSocket::EncryptSendClient(&sendbuffer, len, item.pachTargetClientHashORKadID, item.bKad, item.nReceiverVerifyKey, (item.bKad ? CEncryptedDatagramSocket::GetUDPVerifyKey(item.IP) : 0));
 			}
 
 			if (SendTo(sendbuffer, len, item.IP, item.port)) {
+				if (len != plainLen) {
+					theStats::AddUpOverheadCrypt(len - plainLen);
+				}
 				sentBytes += len;
-				m_queue.pop_front();
-				delete packet;
+				QueuePop();
 				delete [] sendbuffer;
 			} else {
 				// TODO: Needs better error handling, see SentTo
@@ -286,11 +421,10 @@ SocketSentBytes CMuleUDPSocket::SendControlData(uint32 maxNumberOfBytesToSend, u
 				break;
 			}
 		} else {
-			m_queue.pop_front();
-			delete packet;
+			QueuePop();
 		}
 	}
-	if (!m_busy && !m_queue.empty()) {
+	if (!m_busy && m_queueSize) {
 		theApp->uploadBandwidthThrottler->QueueForSendingControlPacket(this);
 	}
 	SocketSentBytes returnVal = { true, 0, sentBytes };
@@ -299,6 +433,119 @@ SocketSentBytes CMuleUDPSocket::SendControlData(uint32 maxNumberOfBytesToSend, u
 }
 
 
+#ifdef HAVE_SENDMMSG
+//! Number of datagrams sent at once by SendBatch.
+const unsigned UDP_SEND_BATCH = 16;
+//! Size of each staging buffer, larger packets are sent one by one.
+const unsigned UDP_SEND_SLOT_SIZE = 8192;
+//! Room left for the crypt header in front of each staged packet.
+const unsigned UDP_SEND_HEADROOM = 16;
+
+
+uint32 CMuleUDPSocket::SendBatch(uint32 maxNumberOfBytes)
+{
+	// The proxy socket adds the relay header in SendTo
+	if (m_proxy && m_proxy->m_proxyEnable) {
+		return 0;
+	}
+	if (!(m_socket && m_socket->Ok())) {
+		return 0;
+	}
+
+	if (m_sendBuffers.empty()) {
+		m_sendBuffers.resize(UDP_SEND_BATCH * UDP_SEND_SLOT_SIZE);
+	}
+
+	struct mmsghdr msgs[UDP_SEND_BATCH];
+	struct iovec iovecs[UDP_SEND_BATCH];
+	struct sockaddr_in addrs[UDP_SEND_BATCH];
+	// Bytes added by the encryption to each packet
+	uint32 cryptOverhead[UDP_SEND_BATCH];
+	memset(msgs, 0, sizeof(msgs));
+	memset(addrs, 0, sizeof(addrs));
+
+	// Stage the packets at the front of the queue. Expired packets end the
+	// batch, they are dropped by the regular path.
+	uint32 now = GetTickCount();
+	uint32 stagedBytes = 0;
+	unsigned count = 0;
+	while (count < UDP_SEND_BATCH && count < m_queueSize && stagedBytes < maxNumberOfBytes) {
+		UDPPack& item = QueueAt(count);
+		CPacket* packet = item.packet;
+		uint32_t len = packet->GetPacketSize() + 2;
+		if (now - item.time >= UDPMAXQUEUETIME || len + UDP_SEND_HEADROOM > UDP_SEND_SLOT_SIZE) {
+			break;
+		}
+
+		uint8_t *data = &m_sendBuffers[count * UDP_SEND_SLOT_SIZE + UDP_SEND_HEADROOM];
+		memcpy(data, packet->GetUDPHeader(), 2);
+		memcpy(data + 2, packet->GetDataBuffer(), packet->GetPacketSize());
+
+		cryptOverhead[count] = 0;
+		if (item.bEncrypt && (theApp->GetPublicIP() > 0 || item.bKad)) {
+			int cryptedLen = CEncryptedDatagramSocket::EncryptSendClientInPlace(data, len, item.pachTargetClientHashORKadID, item.bKad, item.nReceiverVerifyKey, (item.bKad ? CEncryptedDatagramSocket::GetUDPVerifyKey(item.IP) : 0));
+			if (cryptedLen != (int)len) {
+				cryptOverhead[count] = cryptedLen - len;
+				data -= cryptOverhead[count];
+				len = cryptedLen;
+			}
+		}
+
+		addrs[count].sin_family = AF_INET;
+		addrs[count].sin_addr.s_addr = ENDIAN_SWAP_32(item.IP);
+		addrs[count].sin_port = ENDIAN_HTONS(item.port);
+		iovecs[count].iov_base = data;
+		iovecs[count].iov_len = len;
+		msgs[count].msg_hdr.msg_iov = &iovecs[count];
+		msgs[count].msg_hdr.msg_iovlen = 1;
+		msgs[count].msg_hdr.msg_name = &addrs[count];
+		msgs[count].msg_hdr.msg_namelen = sizeof(addrs[count]);
+
+		stagedBytes += len;
+		count++;
+	}
+
+	// A single packet gains nothing over the regular path
+	if (count < 2) {
+		return 0;
+	}
+
+	// We better clear this flag here, see SendTo
+	m_busy = false;
+	int sent = sendmmsg(m_socket->GetSocket(), msgs, count, MSG_DONTWAIT);
+	if (sent <= 0) {
+		// Let the regular path deal with the error (and re-enable the
+		// output notification on would-block).
+		return 0;
+	}
+
+	// Packets the kernel didn't take are staged and encrypted again next time,
+	// so only the ones sent count as overhead.
+	uint32 sentBytes = 0;
+	uint32 sentOverhead = 0;
+	for (int i = 0; i < sent; ++i) {
+		AddDebugLogLineN(logMuleUDP, (m_name + wxT(": Packet sent ("))
+			<< Uint32_16toStringIP_Port(QueueAt(0).IP, QueueAt(0).port) << wxT("): ")
+			<< msgs[i].msg_len << wxT("b"));
+		sentBytes += iovecs[i].iov_len;
+		sentOverhead += cryptOverhead[i];
+		QueuePop();
+	}
+	if (sentOverhead) {
+		theStats::AddUpOverheadCrypt(sentOverhead);
+	}
+	theStats::AddUDPSendCallsSaved(sent - 1);
+
+	return sentBytes;
+}
+#else
+uint32 CMuleUDPSocket::SendBatch(uint32)
+{
+	return 0;
+}
+#endif
+
+
 bool CMuleUDPSocket::SendTo(uint8_t *buffer, uint32_t length, uint32_t ip, uint16_t port)
 {
 	// Just pretend that we sent the packet in order to avoid infinite loops.
@@ -119,6 +119,19 @@ public:
 	bool	Ok();
 
 protected:
+	//! A datagram read by ReceiveBatch.
+	struct UDPDatagram
+	{
+		//! Source IP address.
+		uint32	ip;
+		//! Source port.
+		uint16	port;
+		//! The data that has been received.
+		byte*	buffer;
+		//! The length of the data buffer.
+		size_t	length;
+	};
+
 	/**
 	 * This function is called when a packet has been received.
 	 *
@@ -143,6 +156,18 @@ private:
 	 */
 	bool	SendTo(uint8_t *buffer, uint32_t length, uint32_t ip, uint16_t port);
 
+	/**
+	 * Sends the first packets of the queue with a single system call.
+	 *
+	 * @param maxNumberOfBytes The number of bytes that may be sent.
+	 * @return The number of bytes sent.
+	 *
+	 * Packets are copied and encrypted in place in m_sendBuffers, and sent
+	 * ones are removed from the queue. Returns zero without touching the
+	 * queue where batched sends are not supported, or when a proxy is used.
+	 */
+	uint32	SendBatch(uint32 maxNumberOfBytes);
+
 
 	/**
 	 * Creates a new socket.
@@ -157,6 +182,25 @@ private:
 	 */
 	void	DestroySocket();
 
+	/**
+	 * Checks a received datagram before it is passed on.
+	 *
+	 * @return True if the datagram may be processed.
+	 */
+	bool	AcceptPacket(uint32 ip, uint16 port, size_t length);
+
+	/**
+	 * Reads the queued datagrams with a single system call.
+	 *
+	 * @param packets Filled with the datagrams, which point into m_recvBuffers.
+	 * @return The number of datagrams read.
+	 *
+	 * Must be called with m_mutex held. Returns zero where batched reads
+	 * are not supported, or when a proxy is used, so that the regular
+	 * read path is taken.
+	 */
+	size_t	ReceiveBatch(UDPDatagram* packets);
+
 	
 	//! Specifies if the last write attempt would cause the socket to block.
 	bool					m_busy;
@@ -194,8 +238,30 @@ private:
 		uint8 pachTargetClientHashORKadID[16];		
 	} ;
 	
-	//! The queue of packets waiting to be sent.
-	std::list<UDPPack> m_queue;
+	/**
+	 * The queue of packets waiting to be sent.
+	 *
+	 * This is a ring buffer, m_queueSize packets starting at m_queueHead.
+	 * It only grows, so that bursts don't allocate once it is large enough.
+	 */
+	std::vector<UDPPack> m_queue;
+	//! Position of the first queued packet.
+	size_t	m_queueHead;
+	//! Number of queued packets.
+	size_t	m_queueSize;
+
+	//! Appends a packet to the queue.
+	void	QueuePush(const UDPPack& item);
+	//! Returns the n'th queued packet.
+	UDPPack& QueueAt(size_t n)	{ return m_queue[(m_queueHead + n) % m_queue.size()]; }
+	//! Removes the first queued packet, deleting its CPacket.
+	void	QueuePop();
+
+	//! Staging buffers used by SendBatch, allocated on first use.
+	std::vector<uint8_t> m_sendBuffers;
+
+	//! Buffers reused by ReceiveBatch, allocated on first use.
+	std::vector<byte> m_recvBuffers;
 };
 
 #endif // CLIENTUDPSOCKET_H
@@ -44,6 +44,7 @@ CPacket::CPacket(CPacket &p)
 	m_bLastSplitted = p.m_bLastSplitted;
 	m_bPacked 	= p.m_bPacked;
 	m_bFromPF 	= p.m_bFromPF;
+	m_bView 	= false;
 	memcpy(head, p.head, sizeof head);
 	tempbuffer	= NULL;
 	if (p.completebuffer) {
@@ -70,6 +71,7 @@ CPacket::CPacket(uint8 protocol)
 	m_bLastSplitted = false;
 	m_bPacked 	= false;
 	m_bFromPF 	= false;
+	m_bView 	= false;
 	memset(head, 0, sizeof head);
 	tempbuffer	= NULL;
 	completebuffer 	= NULL;
@@ -77,7 +79,9 @@ CPacket::CPacket(uint8 protocol)
 }
 
 // only used for receiving packets
-CPacket::CPacket(byte* rawHeader, byte *buf)
+// A view borrows buf from the receive buffer of the socket, and is only
+// valid while the packet is being processed; copy it to keep it longer.
+CPacket::CPacket(byte* rawHeader, byte *buf, bool bView)
 {
 	memset(head, 0, sizeof head);
 	Header_Struct* header = (Header_Struct*)rawHeader;
@@ -88,6 +92,7 @@ CPacket::CPacket(byte* rawHeader, byte *buf)
 	m_bLastSplitted = false;
 	m_bPacked 	= false;
 	m_bFromPF 	= false;
+	m_bView 	= bView;
 	tempbuffer	= NULL;
 	completebuffer 	= NULL;
 	pBuffer 	= buf;
@@ -102,6 +107,7 @@ CPacket::CPacket(const CMemFile& datafile, uint8 protocol, uint8 ucOpcode)
 	m_bLastSplitted = false;
 	m_bPacked 	= false;
 	m_bFromPF 	= false;
+	m_bView 	= false;
 	memset(head, 0, sizeof head);
 	tempbuffer = NULL;
 	completebuffer = new byte[size + sizeof(Header_Struct)/*Why this 4?*/];
@@ -114,6 +120,34 @@ CPacket::CPacket(const CMemFile& datafile, uint8 protocol, uint8 ucOpcode)
 	datafile.Seek(position, wxFromStart);
 }
 
+CPacket::CPacket(CMemFile& datafile, uint8 protocol, uint8 ucOpcode, bool bDetach)
+{
+	wxCOMPILE_TIME_ASSERT(CMemFile::HeaderRoom == sizeof(Header_Struct), MemFileHeaderRoomMismatch);
+
+	size		= datafile.GetLength();
+	opcode		= ucOpcode;
+	prot		= protocol;
+	m_bSplitted 	= false;
+	m_bLastSplitted = false;
+	m_bPacked 	= false;
+	m_bFromPF 	= false;
+	m_bView 	= false;
+	memset(head, 0, sizeof head);
+	tempbuffer = NULL;
+	// The memfile keeps room for the header in front of its data,
+	// so the payload doesn't need to be copied.
+	completebuffer = bDetach ? datafile.DetachBuffer() : NULL;
+	if (completebuffer) {
+		pBuffer = completebuffer + sizeof(Header_Struct);
+	} else {
+		// Attached buffer, fall back to copying
+		completebuffer = new byte[size + sizeof(Header_Struct)];
+		pBuffer = completebuffer + sizeof(Header_Struct);
+		datafile.Seek(0, wxFromStart);
+		datafile.Read(pBuffer, size);
+	}
+}
+
 CPacket::CPacket(int8 in_opcode, uint32 in_size, uint8 protocol, bool bFromPF)
 {
 	size		= in_size;
@@ -123,6 +157,7 @@ CPacket::CPacket(int8 in_opcode, uint32 in_size, uint8 protocol, bool bFromPF)
 	m_bLastSplitted = false;
 	m_bPacked 	= false;
 	m_bFromPF	= bFromPF;
+	m_bView		= false;
 	memset(head, 0, sizeof head);
 	tempbuffer	= NULL;
 	if (in_size) {
@@ -145,6 +180,7 @@ CPacket::CPacket(byte* pPacketPart, uint32 nSize, bool bLast, bool bFromPF)
 	m_bLastSplitted	= bLast;
 	m_bPacked	= false;
 	m_bFromPF	= bFromPF;
+	m_bView		= false;
 	memset(head, 0, sizeof head);
 	tempbuffer	= NULL;
 	completebuffer	= pPacketPart;
@@ -156,7 +192,7 @@ CPacket::~CPacket()
 	// Never deletes pBuffer when completebuffer is not NULL
 	if (completebuffer) {
 		delete [] completebuffer;
-	} else if (pBuffer) {
+	} else if (pBuffer && !m_bView) {
 	// On the other hand, if completebuffer is NULL and pBuffer is not NULL 
 		delete [] pBuffer;
 	}
@@ -296,8 +332,11 @@ bool CPacket::UnPackPacket(uint32 uMaxDecompressedSize) {
 		wxASSERT( pBuffer != NULL );
 
 		size = unpackedsize;
-		delete[] pBuffer;
+		if (!m_bView) {
+			delete[] pBuffer;
+		}
 		pBuffer = unpack;
+		m_bView = false;
 		prot = OP_EMULEPROT;
 		return true;
 	}
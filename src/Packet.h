@@ -41,8 +41,9 @@ class CPacket {
 public:
 	CPacket(CPacket &p);
 	CPacket(uint8 protocol);
-	CPacket(byte* header, byte *buf); // only used for receiving packets
+	CPacket(byte* header, byte *buf, bool bView = false); // only used for receiving packets, a view doesn't own buf
 	CPacket(const CMemFile& datafile, uint8 protocol, uint8 ucOpcode);
+	CPacket(CMemFile& datafile, uint8 protocol, uint8 ucOpcode, bool bDetach); // takes over the buffer, empties datafile
 	CPacket(int8 in_opcode, uint32 in_size, uint8 protocol, bool bFromPF = true);
 	CPacket(byte* pPacketPart, uint32 nSize, bool bLast, bool bFromPF = true); // only used for splitted packets!
 
@@ -82,6 +83,7 @@ private:
 	bool		m_bLastSplitted;
 	bool		m_bPacked;
 	bool		m_bFromPF;
+	bool		m_bView;
 	byte		head[6];
 	byte*		tempbuffer;
 	byte*		completebuffer;
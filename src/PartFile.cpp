@@ -257,6 +257,13 @@ CPartFile::~CPartFile()
 	// if it's not opened, it was completed or deleted
 	if (m_hpartfile.IsOpened()) { 
 		FlushBuffer();
+		// Results of pending verifications will not arrive anymore
+		std::set<uint16> pendingParts;
+		pendingParts.swap(m_partsHashing);
+		m_partsRehash.clear();
+		for (std::set<uint16>::iterator it = pendingParts.begin(); it != pendingParts.end(); ++it) {
+			PartHashVerified(*it, HashSinglePart(*it), false);
+		}
 		m_hpartfile.Close();
 		// Update met file (with current directory entry)
 		SavePartFile();			
@@ -879,8 +886,15 @@ bool CPartFile::SavePartFile(bool Initial)
 		}
 		
 		// gaps
+		// Parts still being verified are saved as missing, so they
+		// are not trusted if we go down before the result arrives.
+		CGapList gaplist(m_gaplist);
+		for (std::set<uint16>::const_iterator it = m_partsHashing.begin(); it != m_partsHashing.end(); ++it) {
+			gaplist.AddGap(*it);
+		}
+
 		unsigned i_pos = 0;
-		for (CGapList::const_iterator it = m_gaplist.begin(); it != m_gaplist.end(); ++it) {
+		for (CGapList::const_iterator it = gaplist.begin(); it != gaplist.end(); ++it) {
 			wxString tagName = CFormat(wxT(" %u")) % i_pos;
 			
 			// gap start = first missing byte but gap ends = first non-missing byte
@@ -1338,6 +1352,8 @@ void CPartFile::UpdateCompletedInfos()
 void CPartFile::WritePartStatus(CMemFile* file)
 {
 	uint16 parts = GetED2KPartCount();
+	// Size the buffer once, rather than growing it while writing
+	file->Reserve(file->GetPosition() + 2 + (parts + 7) / 8);
 	file->WriteUInt16(parts);
 	uint16 done = 0;
 	while (done != parts){
@@ -1509,6 +1525,11 @@ uint32 CPartFile::Process(uint32 reducedownload/*in percent*/,uint8 m_icounter)
 		if (((old_trans==0) && (transferingsrc>0)) || ((old_trans>0) && (transferingsrc==0))) {
 			SetStatus(status);
 		}
+
+		// Speed and transferred size change while sources are transferring
+		if (old_trans || transferingsrc) {
+			SetECDirty();
+		}
 	
 		// Kad source search		
 		if( GetMaxSourcePerFileUDP() > GetSourceCount()){
@@ -2313,23 +2334,32 @@ bool CPartFile::HashSinglePart(uint16 partnumber)
 			return false;
 		}
 
-		if (GetPartCount() > 1) {
-			if (hashresult != GetPartHash(partnumber)) {
-				AddDebugLogLineN(logPartFile, CFormat( wxT("%s: Expected hash of part %d: %s")) % GetFileName() % partnumber % GetPartHash(partnumber).Encode() );
-				AddDebugLogLineN(logPartFile, CFormat( wxT("%s: Actual   hash of part %d: %s")) % GetFileName() % partnumber % hashresult.Encode() );
-				return false;
-			} else {
-				return true;
-			}
+		return VerifyPartHash(partnumber, hashresult);
+	}
+}
+
+
+bool CPartFile::VerifyPartHash(uint16 partnumber, const CMD4Hash& hashresult)
+{
+	if (GetPartCount() > 1) {
+		if (GetHashCount() <= partnumber) {
+			// The hashset was lost in the mean time, see HashSinglePart
+			m_hashsetneeded = true;
+			return true;
+		} else if (hashresult != GetPartHash(partnumber)) {
+			AddDebugLogLineN(logPartFile, CFormat( wxT("%s: Expected hash of part %d: %s")) % GetFileName() % partnumber % GetPartHash(partnumber).Encode() );
+			AddDebugLogLineN(logPartFile, CFormat( wxT("%s: Actual   hash of part %d: %s")) % GetFileName() % partnumber % hashresult.Encode() );
+			return false;
 		} else {
-			if (hashresult != m_abyFileHash) {
-				return false;
-			} else {
-				return true;
-			}
+			return true;
+		}
+	} else {
+		if (hashresult != m_abyFileHash) {
+			return false;
+		} else {
+			return true;
 		}
 	}
-
 }
 
 bool CPartFile::IsCorruptedPart(uint16 partnumber)
@@ -2343,6 +2373,8 @@ void CPartFile::SetDownPriority(uint8 np, bool bSave, bool bRefresh )
 {
 	if ( m_iDownPriority != np ) {
 		m_iDownPriority = np;
+		// Auto priority changes don't refresh the display, but EC must see them
+		SetECDirty();
 		if ( bRefresh )
 			UpdateDisplayedInfo(true);
 		if ( bSave )
@@ -2661,7 +2693,7 @@ CPacket *CPartFile::CreateSrcInfoPacket(const CUpDownClient* forClient, uint8 by
 	data.Seek(bIsSX2Packet ? 17 : 16, wxFromStart);
 	data.WriteUInt16(nCount);
 
-	CPacket* result = new CPacket(data, OP_EMULEPROT, bIsSX2Packet ? OP_ANSWERSOURCES2 : OP_ANSWERSOURCES);
+	CPacket* result = new CPacket(data, OP_EMULEPROT, bIsSX2Packet ? OP_ANSWERSOURCES2 : OP_ANSWERSOURCES, true);
 
 	// 16+2+501*(4+2+4+2+16) = 14046 bytes max.
 	if (result->GetPacketSize() > 354) {
@@ -3031,94 +3063,158 @@ void CPartFile::FlushBuffer(bool fromAICHRecoveryDataAvailable)
 			continue;
 		}
 
-		uint32 partRange = GetPartSize(partNumber) - 1;
-	
-		// Is this 9MB part complete
-		if (IsComplete(partNumber)) {
-			// Is part corrupt
-			if (!HashSinglePart(partNumber)) {
-				AddLogLineC(CFormat(
-					_("Downloaded part %i is corrupt in file: %s") ) % partNumber % GetFileName() );
-				AddGap(partNumber);
-				// add part to corrupted list, if not already there
-				if (!IsCorruptedPart(partNumber)) {
-					m_corrupted_list.push_back(partNumber);
-				}
-				// request AICH recovery data
-				// Don't if called from the AICHRecovery. It's already there and would lead to an infinite recursion.
-				if (!fromAICHRecoveryDataAvailable) { 
-					RequestAICHRecovery(partNumber);					
-				}
-				// Reduce transferred amount by corrupt amount
-				m_iLostDueToCorruption += (partRange + 1);
+		if (m_partsHashing.count(partNumber)) {
+			// The result of the pending verification will be stale
+			m_partsRehash.insert(partNumber);
+		} else if (IsComplete(partNumber)		// 9MB part complete
+				|| (IsCorruptedPart(partNumber) &&	// corrupted part:
+					(thePrefs::IsICHEnabled()	// old ICH:  rehash whenever we have new data hoping it will be good now
+					|| fromAICHRecoveryDataAvailable))) {// new AICH: one rehash right before performing it (maybe it's already good)
+			if (fromAICHRecoveryDataAvailable || !theApp->IsRunning()) {
+				// AICH recovery needs the result right away, and
+				// hashing events are no longer handled on shutdown.
+				PartHashVerified(partNumber, HashSinglePart(partNumber), fromAICHRecoveryDataAvailable);
 			} else {
-				if (!m_hashsetneeded) {
-					AddDebugLogLineN(logPartFile, CFormat(
-						wxT("Finished part %u of '%s'")) % partNumber % GetFileName());
-				}
-				
-				// tell the blackbox about the verified data
-				m_CorruptionBlackBox->VerifiedData(true, partNumber, 0, partRange);
-
-				// if this part was successfully completed (although ICH is active), remove from corrupted list
-				EraseFirstValue(m_corrupted_list, partNumber);
-				
-				if (status == PS_EMPTY) {
-					if (theApp->IsRunning()) { // may be called during shutdown!
-						if (GetHashCount() == GetED2KPartHashCount() && !m_hashsetneeded) {
-							// Successfully completed part, make it available for sharing
-							SetStatus(PS_READY);
-							theApp->sharedfiles->SafeAddKFile(this);
-						}
-					}
-				}
+				QueuePartHashing(partNumber);
 			}
-		} else if ( IsCorruptedPart(partNumber) &&		// corrupted part:
-					(thePrefs::IsICHEnabled()			// old ICH:  rehash whenever we have new data hoping it will be good now
-					|| fromAICHRecoveryDataAvailable)) {// new AICH: one rehash right before performing it (maybe it's already good)
-			// Try to recover with minimal loss
-			if (HashSinglePart(partNumber)) {
-				++m_iTotalPacketsSavedDueToICH;
-				
-				uint64 uMissingInPart = m_gaplist.GetGapSize(partNumber);					
-				FillGap(partNumber);
-				RemoveBlockFromList(PARTSIZE*partNumber,(PARTSIZE*partNumber + partRange));
+		}
+	}
 
-				// tell the blackbox about the verified data
-				m_CorruptionBlackBox->VerifiedData(true, partNumber, 0, partRange);
+	// Update met file
+	SavePartFile();
 
-				// remove from corrupted list
-				EraseFirstValue(m_corrupted_list, partNumber);
-				
-				AddLogLineC(CFormat( _("ICH: Recovered corrupted part %i for %s -> Saved bytes: %s") )
-					% partNumber
-					% GetFileName()
-					% CastItoXBytes(uMissingInPart));
-				
-				if (GetHashCount() == GetED2KPartHashCount() && !m_hashsetneeded) {
-					if (status == PS_EMPTY) {
-						// Successfully recovered part, make it available for sharing							
-						SetStatus(PS_READY);
-						if (theApp->IsRunning()) // may be called during shutdown!
-							theApp->sharedfiles->SafeAddKFile(this);
-					}
-				}
-			}
+	if (theApp->IsRunning()) { // may be called during shutdown!
+		// Is this file finished ? (and are all parts verified)
+		if (m_gaplist.IsComplete() && m_partsHashing.empty()) {
+			CompleteFile(false);
 		}
 	}
+}
+
+
+void CPartFile::QueuePartHashing(uint16 partNumber)
+{
+	if ((GetHashCount() <= partNumber) && (GetPartCount() > 1)) {
+		// Nothing to verify against, HashSinglePart will request the hashset.
+		PartHashVerified(partNumber, HashSinglePart(partNumber), false);
+	} else if (CThreadScheduler::AddTask(new CPartHashingTask(this, partNumber))) {
+		m_partsHashing.insert(partNumber);
+	} else {
+		// Scheduler has been terminated, verify it here.
+		PartHashVerified(partNumber, HashSinglePart(partNumber), false);
+	}
+}
+
+
+void CPartFile::PartHashFinished(uint16 partNumber, const CMD4Hash& hashresult, bool errorOccured)
+{
+	if (!m_partsHashing.erase(partNumber)) {
+		// Not a verification that we are waiting for.
+		return;
+	}
+
+	if (m_partsRehash.erase(partNumber)) {
+		// New data was written to the part while it was being hashed.
+		QueuePartHashing(partNumber);
+		return;
+	}
+
+	bool hashOk = false;
+	if (errorOccured) {
+		SetStatus(PS_ERROR);
+	} else {
+		hashOk = VerifyPartHash(partNumber, hashresult);
+	}
+
+	PartHashVerified(partNumber, hashOk, false);
 
 	// Update met file
 	SavePartFile();
 
-	if (theApp->IsRunning()) { // may be called during shutdown!
-		// Is this file finished ?
-		if (m_gaplist.IsComplete()) {
+	if (theApp->IsRunning()) {
+		// Is this file finished ? (and are all parts verified)
+		if (m_gaplist.IsComplete() && m_partsHashing.empty()) {
 			CompleteFile(false);
 		}
 	}
 }
 
 
+void CPartFile::PartHashVerified(uint16 partNumber, bool hashOk, bool fromAICHRecoveryDataAvailable)
+{
+	uint32 partRange = GetPartSize(partNumber) - 1;
+
+	// Is this 9MB part complete
+	if (IsComplete(partNumber)) {
+		// Is part corrupt
+		if (!hashOk) {
+			AddLogLineC(CFormat(
+				_("Downloaded part %i is corrupt in file: %s") ) % partNumber % GetFileName() );
+			AddGap(partNumber);
+			// add part to corrupted list, if not already there
+			if (!IsCorruptedPart(partNumber)) {
+				m_corrupted_list.push_back(partNumber);
+			}
+			// request AICH recovery data
+			// Don't if called from the AICHRecovery. It's already there and would lead to an infinite recursion.
+			if (!fromAICHRecoveryDataAvailable) { 
+				RequestAICHRecovery(partNumber);					
+			}
+			// Reduce transferred amount by corrupt amount
+			m_iLostDueToCorruption += (partRange + 1);
+		} else {
+			if (!m_hashsetneeded) {
+				AddDebugLogLineN(logPartFile, CFormat(
+					wxT("Finished part %u of '%s'")) % partNumber % GetFileName());
+			}
+			
+			// tell the blackbox about the verified data
+			m_CorruptionBlackBox->VerifiedData(true, partNumber, 0, partRange);
+
+			// if this part was successfully completed (although ICH is active), remove from corrupted list
+			EraseFirstValue(m_corrupted_list, partNumber);
+			
+			if (status == PS_EMPTY) {
+				if (theApp->IsRunning()) { // may be called during shutdown!
+					if (GetHashCount() == GetED2KPartHashCount() && !m_hashsetneeded) {
+						// Successfully completed part, make it available for sharing
+						SetStatus(PS_READY);
+						theApp->sharedfiles->SafeAddKFile(this);
+					}
+				}
+			}
+		}
+	} else if (IsCorruptedPart(partNumber) && hashOk) {
+		// Try to recover with minimal loss
+		++m_iTotalPacketsSavedDueToICH;
+		
+		uint64 uMissingInPart = m_gaplist.GetGapSize(partNumber);					
+		FillGap(partNumber);
+		RemoveBlockFromList(PARTSIZE*partNumber,(PARTSIZE*partNumber + partRange));
+
+		// tell the blackbox about the verified data
+		m_CorruptionBlackBox->VerifiedData(true, partNumber, 0, partRange);
+
+		// remove from corrupted list
+		EraseFirstValue(m_corrupted_list, partNumber);
+		
+		AddLogLineC(CFormat( _("ICH: Recovered corrupted part %i for %s -> Saved bytes: %s") )
+			% partNumber
+			% GetFileName()
+			% CastItoXBytes(uMissingInPart));
+		
+		if (GetHashCount() == GetED2KPartHashCount() && !m_hashsetneeded) {
+			if (status == PS_EMPTY) {
+				// Successfully recovered part, make it available for sharing							
+				SetStatus(PS_READY);
+				if (theApp->IsRunning()) // may be called during shutdown!
+					theApp->sharedfiles->SafeAddKFile(this);
+			}
+		}
+	}
+}
+
+
 // read data for upload, return false on error
 bool CPartFile::ReadData(CFileArea & area, uint64 offset, uint32 toread)
 {
@@ -3181,6 +3277,7 @@ void CPartFile::SetCategory(uint8 cat)
 	wxASSERT( cat < theApp->glob_prefs->GetCatCount() );
 	
 	m_category = cat; 
+	SetECDirty();
 	SavePartFile(); 
 }
 
@@ -3348,6 +3445,10 @@ void CPartFile::AICHRecoveryDataAvailable(uint16 nPart)
 	}
 
 	FlushBuffer(true);
+	if (m_partsHashing.count(nPart)) {
+		// A pending ICH verification would be outdated by the recovery
+		m_partsRehash.insert(nPart);
+	}
 	uint32 length = GetPartSize(nPart);
 	// if the part was already ok, it would now be complete
 	if (IsComplete(nPart)) {
@@ -3427,8 +3528,8 @@ void CPartFile::AICHRecoveryDataAvailable(uint16 nPart)
 			}
 
 			if (theApp->IsRunning()) {
-				// Is this file finished?
-				if (m_gaplist.IsComplete()) {
+				// Is this file finished? (and are all parts verified)
+				if (m_gaplist.IsComplete() && m_partsHashing.empty()) {
 					CompleteFile(false);
 				}
 			}
@@ -3616,6 +3717,8 @@ void CPartFile::UpdateDisplayedInfo(bool force)
 {
 	uint32 curTick = ::GetTickCount();
 
+	SetECDirty();
+
 	// Wait 1.5s between each redraw
 	if (force || curTick-m_lastRefreshedDLDisplay > MINWAIT_BEFORE_DLDISPLAY_WINDOWUPDATE) {
 		Notify_DownloadCtrlUpdateItem(this);
@@ -34,6 +34,8 @@
 #include "DeadSourceList.h"	// Needed for CDeadSourceList
 #include "GapList.h"
 
+#include <set>
+
 class CSearchFile;
 class CMemFile;
 class CFileDataIO;
@@ -112,6 +114,7 @@ public:
 	uint8	LoadPartFile(const CPath& in_directory, const CPath& filename, bool from_backup = false, bool getsizeonly = false);
 	bool	SavePartFile(bool Initial = false);
 	void	PartFileHashFinished(CKnownFile* result);
+	void	PartHashFinished(uint16 partnumber, const CMD4Hash& hashresult, bool errorOccured);
 	bool	HashSinglePart(uint16 partnumber); // true = ok , false = corrupted
 	
 	bool    CheckShowItemInGivenCat(int inCategory);
@@ -292,6 +295,15 @@ private:
 	CDeadSourceList	m_deadSources;
 
 	class CCorruptionBlackBox* m_CorruptionBlackBox;
+
+	//! Parts currently being verified by a CPartHashingTask.
+	std::set<uint16> m_partsHashing;
+	//! Parts that received new data while being verified, and must be hashed again.
+	std::set<uint16> m_partsRehash;
+
+	void	QueuePartHashing(uint16 partnumber);
+	void	PartHashVerified(uint16 partnumber, bool hashOk, bool fromAICHRecoveryDataAvailable);
+	bool	VerifyPartHash(uint16 partnumber, const CMD4Hash& hashresult);
 #endif
 
 	uint16	m_notCurrentSources;
@@ -312,6 +312,39 @@ PlatformSpecific::EFSType PlatformSpecific::GetFilesystemType(const CPath& path)
 }
 
 
+#include <wx/filefn.h>		// Needed for wxStat
+#include <common/Format.h>	// Needed for CFormat
+
+wxString PlatformSpecific::GetStorageDevice(const CPath& path)
+{
+	typedef std::map<wxString, wxString>	DeviceMap;
+	// Caching previous results, since this is called for every new task.
+	static DeviceMap	s_devcache;
+	// Lock used to ensure the integrity of the cache.
+	static wxMutex		s_lock;
+
+	wxCHECK_MSG(path.IsOk(), wxEmptyString, wxT("Invalid path in GetStorageDevice()"));
+
+	// Files are looked up by their directory, to keep the cache small.
+	CPath dir = path.DirExists() ? path : path.GetPath();
+
+	wxMutexLocker locker(s_lock);
+
+	DeviceMap::iterator it = s_devcache.find(dir.GetRaw());
+	if (it != s_devcache.end()) {
+		return it->second;
+	}
+
+	wxString device;
+	wxStructStat buf;
+	if (wxStat(dir.GetRaw(), &buf) == 0) {
+		device = CFormat(wxT("%u")) % (uint64)buf.st_dev;
+	}
+
+	return s_devcache[dir.GetRaw()] = device;
+}
+
+
 // Power event vetoing
 
 static bool m_preventingSleepMode = false;
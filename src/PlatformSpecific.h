@@ -133,6 +133,18 @@ inline bool CanFSHandleLargeFiles(const CPath& path)
 	}
 }
 
+/**
+ * Identifies the storage device holding the given path.
+ *
+ * @param path The path (file or directory) for which the device should be found.
+ * @return A string identifying the device, or an empty string if unknown.
+ *
+ * Two paths on the same device return the same string, which can be used
+ * to avoid running several disk-heavy operations on one device at a time.
+ */
+wxString GetStorageDevice(const CPath& path);
+
+
 /**
  * Disable / enable computer's energy saving "standby" mode.
  *
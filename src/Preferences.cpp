@@ -228,6 +228,8 @@ wxString 	CPreferences::s_KadURL;
 bool	 	CPreferences::s_GeoIPEnabled;
 wxString 	CPreferences::s_GeoIPUpdateUrl;
 bool		CPreferences::s_preventSleepWhileDownloading;
+uint16		CPreferences::s_maxTaskThreads;
+bool		CPreferences::s_uploadTokenBucket;
 wxString 	CPreferences::s_StatsServerName;
 wxString 	CPreferences::s_StatsServerURL;
 
@@ -1254,6 +1256,9 @@ void CPreferences::BuildItemList( const wxString& appdir )
 
 	s_MiscList.push_back( new Cfg_Bool( wxT("/ExternalConnect/TransmitOnlyUploadingClients"),	s_TransmitOnlyUploadingClients, false ) );
 
+	s_MiscList.push_back(    MkCfg_Int( wxT("/eMule/MaxTaskThreads"),		s_maxTaskThreads, 0 ) );
+	s_MiscList.push_back( new Cfg_Bool( wxT("/eMule/UploadTokenBucket"),		s_uploadTokenBucket, false ) );
+
 #ifndef AMULE_DAEMON
 	// Colors have been moved from global prefs to CStatisticsDlg
 	for ( int i = 0; i < cntStatColors; i++ ) {
@@ -580,6 +580,12 @@ public:
 	// Sleep
 	static bool		GetPreventSleepWhileDownloading() { return s_preventSleepWhileDownloading; }
 	static void		SetPreventSleepWhileDownloading(bool status) { s_preventSleepWhileDownloading = status; }
+
+	// Background tasks
+	static uint16		GetMaxTaskThreads()		{ return s_maxTaskThreads; }
+
+	// Upload throttling
+	static bool		UseUploadTokenBucket()		{ return s_uploadTokenBucket; }
 protected:
 	static	int32 GetRecommendedMaxConnections();
 
@@ -814,6 +820,12 @@ protected:
 	// Sleep vetoing
 	static bool s_preventSleepWhileDownloading;
 
+	// Max number of threads for background tasks (0 = one per CPU)
+	static uint16 s_maxTaskThreads;
+
+	// Pace uploads with a token bucket and microsecond timers
+	static bool s_uploadTokenBucket;
+
 	// Stats server
 	static wxString s_StatsServerName;
 	static wxString s_StatsServerURL;
@@ -27,6 +27,8 @@
 #include "ScopedPtr.h"
 #include <ec/cpp/ECTag.h>		// Needed for CECTag
 
+#include <algorithm>		// Needed for std::min
+
 /*
  * RLE encoder implementation. This is RLE implementation for very specific
  * purpose: encode DIFFERENCE between subsequent states of status bar.
@@ -36,6 +38,50 @@
  * We can't use implementation with "control char" since this encoder
  * will process binary data - not ascii (or unicode) strings
  */
+
+//
+// Word-at-a-time helpers for the diff and RLE steps. Words are moved
+// with memcpy, so the buffers don't need to be aligned.
+//
+namespace {
+
+// dst ^= src, for len bytes
+void XorBuffer(uint8 *dst, const uint8 *src, int len)
+{
+	int i = 0;
+	for (; i + 8 <= len; i += 8) {
+		uint64 a, b;
+		memcpy(&a, dst + i, 8);
+		memcpy(&b, src + i, 8);
+		a ^= b;
+		memcpy(dst + i, &a, 8);
+	}
+	for (; i < len; i++) {
+		dst[i] ^= src[i];
+	}
+}
+
+// Length of the run of bytes equal to p[0], at most maxlen
+int RunLength(const uint8 *p, int maxlen)
+{
+	const uint64 pattern = 0x0101010101010101ULL * p[0];
+	int n = 1;
+	while (n + 8 <= maxlen) {
+		uint64 word;
+		memcpy(&word, p + n, 8);
+		if (word != pattern) {
+			break;
+		}
+		n += 8;
+	}
+	while (n < maxlen && p[n] == p[0]) {
+		n++;
+	}
+	return n;
+}
+
+}
+
 void RLE_Data::setup(int len, bool use_diff, uint8 * content)
 {
 	m_len = len;
@@ -72,7 +118,7 @@ RLE_Data::~RLE_Data()
 
 void RLE_Data::ResetEncoder()
 {
-	delete m_buff;
+	delete [] m_buff;
 	m_len = 0;
 	m_buff = 0;
 }
@@ -144,9 +190,7 @@ const uint8 *RLE_Data::Decode(const uint8 *buff, int len)
 	// Recreate data from diff
 	//
 	if ( m_use_diff ) {
-		for (int k = 0; k < m_len; k++) {
-			m_buff[k] ^= decBuf[k];
-		}
+		XorBuffer(m_buff, decBuf, m_len);
 	} else {
 		memcpy(m_buff, decBuf, m_len);
 	}
@@ -166,12 +210,13 @@ const uint8 * RLE_Data::Encode(const uint8 *data, int inlen, int &outlen, bool &
 	// calculate difference from prev
 	//
 	if ( m_use_diff ) {
-		for (int i = 0; i < m_len; i++) {
-			m_buff[i] ^= data[i];
-			if (m_buff[i]) {
-				changed = true;
-			}
+		if (!changed && memcmp(m_buff, data, m_len) == 0) {
+			// Nothing changed, the diff would be all zero
+			outlen = 0;
+			return NULL;
 		}
+		XorBuffer(m_buff, data, m_len);
+		changed = true;
 	} else {
 		memcpy(m_buff, data, m_len);
 		changed = true;
@@ -185,15 +230,13 @@ const uint8 * RLE_Data::Encode(const uint8 *data, int inlen, int &outlen, bool &
 	int i = 0, j = 0;
 	while ( i != m_len ) {
 		uint8 curr_val = m_buff[i];
-		int seq_start = i;
-		while ( (i != m_len) && (curr_val == m_buff[i]) && ((i - seq_start) < 0xff)) {
-			i++;
-		}
-		if (i - seq_start > 1) {
+		int seq_len = RunLength(m_buff + i, std::min(m_len - i, 0xff));
+		i += seq_len;
+		if (seq_len > 1) {
 			// if there's 2 or more equal vals - put it twice in stream
 			enc_buff[j++] = curr_val;
 			enc_buff[j++] = curr_val;
-			enc_buff[j++] = i - seq_start;
+			enc_buff[j++] = seq_len;
 		} else {
 			// single value - put it as is
 			enc_buff[j++] = curr_val;
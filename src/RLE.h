@@ -72,6 +72,7 @@ private:
 	//          so the differential data (before encoding) is not all zero
 	//
 	// return:	new buffer with encoded data, must be deleted after use!
+	//			NULL if nothing changed in differential mode.
 	//
 	const uint8 *Encode(const uint8 *data, int inlen, int &outlen, bool &changed);
 
@@ -63,6 +63,7 @@
 */
 
 #include "SHA.h"
+#include "SHAKernels.h"	// Needed for SHAKernels::Compress
 
 
 CSHA::CSHA()
@@ -93,61 +94,12 @@ CSHA::CSHA()
 
 #define SHA1_MASK   (SHA1_BLOCK_SIZE - 1)
 
-/* reverse byte order in 32-bit words   */
-
-#define ch(x,y,z)       (((x) & (y)) ^ (~(x) & (z)))
-#define parity(x,y,z)   ((x) ^ (y) ^ (z))
-#define maj(x,y,z)      (((x) & (y)) ^ ((x) & (z)) ^ ((y) & (z)))
-
-/* A normal version as set out in the FIPS. This version uses   */
-/* partial loop unrolling and is optimised for the Pentium 4    */
-
-#define rnd(f,k) t = a; a = rotl32(a,5) + f(b,c,d) + e + k + w[i]; e = d; d = c; c = rotl32(b, 30); b = t
+/* The compression function itself lives in SHAKernels.cpp, which  */
+/* picks the fastest implementation supported by the CPU.           */
 
 void CSHA::Compile()
 {
-	uint32    w[80], i, a, b, c, d, e, t;
-
-    /* note that words are compiled from the buffer into 32-bit */
-    /* words in big-endian order so an order reversal is needed */
-    /* here on little endian machines                           */
-    for(i = 0; i < SHA1_BLOCK_SIZE / 4; ++i)
-        w[i] = swap_b32(m_nBuffer[i]);
-
-    for(i = SHA1_BLOCK_SIZE / 4; i < 80; ++i)
-        w[i] = rotl32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
-
-    a = m_nHash[0];
-    b = m_nHash[1];
-    c = m_nHash[2];
-    d = m_nHash[3];
-    e = m_nHash[4];
-
-    for(i = 0; i < 20; ++i)
-    {
-        rnd(ch, 0x5a827999);    
-    }
-
-    for(i = 20; i < 40; ++i)
-    {
-        rnd(parity, 0x6ed9eba1);
-    }
-
-    for(i = 40; i < 60; ++i)
-    {
-        rnd(maj, 0x8f1bbcdc);
-    }
-
-    for(i = 60; i < 80; ++i)
-    {
-        rnd(parity, 0xca62c1d6);
-    }
-
-    m_nHash[0] += a; 
-    m_nHash[1] += b; 
-    m_nHash[2] += c; 
-    m_nHash[3] += d; 
-    m_nHash[4] += e;
+	SHAKernels::Compress(m_nHash, (const byte*)m_nBuffer, 1);
 }
 
 void CSHA::Reset()
@@ -184,13 +136,20 @@ void CSHA::Add(const void* pData, uint32 nLength)
     if((m_nCount[0] += nLength) < nLength)
         ++(m_nCount[1]);
 
-    while(nLength >= space)     /* tranfer whole blocks while possible  */
+    if(pos && nLength >= space) /* complete a partially filled block    */
     {
         memcpy(((unsigned char*)m_nBuffer) + pos, sp, space);
-        sp += space; nLength -= space; space = SHA1_BLOCK_SIZE; pos = 0; 
+        sp += space; nLength -= space; pos = 0;
         Compile();
     }
 
+    if(nLength >= SHA1_BLOCK_SIZE) /* hash whole blocks in place        */
+    {
+        uint32 blocks = nLength / SHA1_BLOCK_SIZE;
+        SHAKernels::Compress(m_nHash, sp, blocks);
+        sp += blocks * SHA1_BLOCK_SIZE; nLength -= blocks * SHA1_BLOCK_SIZE;
+    }
+
     memcpy(((unsigned char*)m_nBuffer) + pos, sp, nLength);
 }
 
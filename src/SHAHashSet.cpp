@@ -46,6 +46,9 @@
 #define	MINPERCENTAGE_TOTRUST		92  // how many percentage of clients have to send the same hash to make it trustworthy
 
 CAICHRequestedDataList CAICHHashSet::m_liRequestedData;
+wxMutex CAICHHashSet::m_mutKnown2File;
+CAICHHashSet::Known2Index CAICHHashSet::m_known2Index;
+bool CAICHHashSet::m_known2Indexed = false;
 
 /////////////////////////////////////////////////////////////////////////////////////////
 ///CAICHHash
@@ -246,6 +249,14 @@ bool CAICHHashTree::VerifyHashTree(CAICHHashAlgo* hashalg, bool bDeleteBadTrees)
 
 
 void CAICHHashTree::SetBlockHash(uint64 nSize, uint64 nStartPos, CAICHHashAlgo* pHashAlg)
+{
+	CAICHHash hash;
+	pHashAlg->Finish(hash);
+	SetBlockHash(nSize, nStartPos, hash);
+}
+
+
+void CAICHHashTree::SetBlockHash(uint64 nSize, uint64 nStartPos, const CAICHHash& hash)
 {
 	wxASSERT ( nSize <= EMBLOCKSIZE );
 	CAICHHashTree* pToInsert = FindHash(nStartPos, nSize);
@@ -262,7 +273,7 @@ void CAICHHashTree::SetBlockHash(uint64 nSize, uint64 nStartPos, CAICHHashAlgo*
 		return;
 	}
 
-	pHashAlg->Finish(pToInsert->m_Hash);
+	pToInsert->m_Hash = hash;
 	pToInsert->m_bHashValid = true;
 }
 
@@ -633,6 +644,8 @@ bool CAICHHashSet::SaveHashSet()
 	}
 
 
+	wxMutexLocker lockKnown2Met(m_mutKnown2File);
+
 	try {
 		const wxString fullpath = theApp->ConfigDir + KNOWN2_MET_FILENAME;
 		const bool exists = wxFile::Exists(fullpath);
@@ -659,6 +672,12 @@ bool CAICHHashSet::SaveHashSet()
 		}
 
 		// first we check if the hashset we want to write is already stored
+		if (m_known2Indexed) {
+			if (m_known2Index.find(m_pHashTree.m_Hash) != m_known2Index.end()) {
+				return true;
+			}
+			file.Seek(nExistingSize);
+		}
 		CAICHHash CurrentHash;
 		while (file.GetPosition() < nExistingSize) {
 			CurrentHash.Read(&file);
@@ -676,6 +695,7 @@ bool CAICHHashSet::SaveHashSet()
 		}
 
 		// write hashset
+		uint64 nHashSetPos = file.GetPosition();
 		m_pHashTree.m_Hash.Write(&file);
 		uint32 nHashCount = (PARTSIZE/EMBLOCKSIZE + ((PARTSIZE % EMBLOCKSIZE != 0)? 1 : 0)) * (m_pHashTree.m_nDataSize/PARTSIZE);
 		if (m_pHashTree.m_nDataSize % PARTSIZE != 0) {
@@ -694,6 +714,7 @@ bool CAICHHashSet::SaveHashSet()
 			AddDebugLogLineC(logSHAHashSet, wxT("Failed to save HashSet: Calculated and real size of hashset differ!"));
 			return false;
 		}
+		m_known2Index[m_pHashTree.m_Hash] = nHashSetPos;
 		AddDebugLogLineN(logSHAHashSet, CFormat(wxT("Successfully saved eMuleAC Hashset, %u Hashs + 1 Masterhash written")) % nHashCount);
 	} catch (const CSafeIOException& e) {
 		AddDebugLogLineC(logSHAHashSet, wxT("IO error while saving AICH HashSet: ") + e.what());
@@ -715,6 +736,8 @@ bool CAICHHashSet::LoadHashSet()
 		wxFAIL;
 		return false;
 	}
+	wxMutexLocker lockKnown2Met(m_mutKnown2File);
+
 	wxString fullpath = theApp->ConfigDir + KNOWN2_MET_FILENAME;
 	CFile file(fullpath, CFile::read);
 	if (!file.IsOpened()) {
@@ -732,6 +755,16 @@ bool CAICHHashSet::LoadHashSet()
 			return false;
 		}		
 		
+		if (m_known2Indexed) {
+			Known2Index::const_iterator it = m_known2Index.find(m_pHashTree.m_Hash);
+			if (it == m_known2Index.end()) {
+				AddDebugLogLineC(logSHAHashSet, wxT("Failed to load HashSet: HashSet not found!"));
+				return false;
+			}
+			// The scan below finds it right away
+			file.Seek(it->second);
+		}
+
 		CAICHHash CurrentHash;
 		uint64 nExistingSize = file.GetLength();
 		uint32 nHashCount;
@@ -73,7 +73,9 @@ Version 2 of AICH also supports 32bit identifiers to support large files, check
 #define __SHAHAHSET_H__
 
 #include <deque>
+#include <map>
 #include <set>
+#include <wx/thread.h>	// Needed for wxMutex
 
 #include "Types.h"
 #include "ClientRef.h"
@@ -122,6 +124,10 @@ public:
 		return memcmp(k1.m_abyBuffer, k2.m_abyBuffer, HASHSIZE) == 0;
 	}
 	friend bool operator!=(const CAICHHash& k1,const CAICHHash& k2)	{ return !(k1 == k2); }
+	friend bool operator<(const CAICHHash& k1,const CAICHHash& k2)
+	{
+		return memcmp(k1.m_abyBuffer, k2.m_abyBuffer, HASHSIZE) < 0;
+	}
 	void Read(CFileDataIO* file);
 	void Write(CFileDataIO* file) const;
 	void Read(byte* data)			{ memcpy(m_abyBuffer, data, HASHSIZE); }
@@ -168,6 +174,7 @@ public:
 	bool GetHashValid() const		{ return m_bHashValid; }
 	
 	void SetBlockHash(uint64 nSize, uint64 nStartPos, CAICHHashAlgo* pHashAlg);
+	void SetBlockHash(uint64 nSize, uint64 nStartPos, const CAICHHash& hash);
 	bool ReCalculateHash(CAICHHashAlgo* hashalg, bool bDontReplace );
 	bool VerifyHashTree(CAICHHashAlgo* hashalg, bool bDeleteBadTrees);
 	CAICHHashTree* FindHash(uint64 nStartPos, uint64 nSize)
@@ -240,6 +247,13 @@ private:
 	
 public:
 	static CAICHRequestedDataList m_liRequestedData;
+	//! Serializes access to the known2_64.met file, which is used by several threads.
+	static wxMutex m_mutKnown2File;
+	//! Offsets of the hashsets in known2_64.met by master hash, guarded by m_mutKnown2File.
+	typedef std::map<CAICHHash, uint64> Known2Index;
+	static Known2Index m_known2Index;
+	//! Set once the AICH sync thread has indexed the whole file.
+	static bool m_known2Indexed;
 	CAICHHashTree m_pHashTree;
 	
 	CAICHHashSet(CKnownFile* pOwner);
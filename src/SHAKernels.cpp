@@ -0,0 +1,478 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#include "SHAKernels.h"		// Interface declarations
+
+#include <string.h>		// Needed for memcpy and memset
+
+
+// The x86 kernels rely on GCC style vector extensions and per-function
+// target attributes, so that the rest of the program can still be built
+// for the baseline CPU. Other compilers and CPUs only get the generic code.
+#if (defined(__i386__) || defined(__x86_64__)) && \
+	(defined(__clang__) || (defined(__GNUC__) && (__GNUC__ * 100 + __GNUC_MINOR__) >= 409))
+	#define SHA_X86_KERNELS
+	#include <cpuid.h>
+	#include <immintrin.h>
+#endif
+
+
+namespace SHAKernels {
+
+static const uint32 s_initialState[5] = {
+	0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+};
+
+#define SHA_K1	0x5a827999
+#define SHA_K2	0x6ed9eba1
+#define SHA_K3	0x8f1bbcdc
+#define SHA_K4	0xca62c1d6
+
+
+static inline uint32 LoadBE32(const byte* p)
+{
+	return (uint32(p[0]) << 24) | (uint32(p[1]) << 16) | (uint32(p[2]) << 8) | uint32(p[3]);
+}
+
+
+static inline void StoreBE32(byte* p, uint32 x)
+{
+	p[0] = (byte)(x >> 24);
+	p[1] = (byte)(x >> 16);
+	p[2] = (byte)(x >> 8);
+	p[3] = (byte)x;
+}
+
+
+/**
+ * Builds the padding blocks for the last (length % 64) bytes of a message.
+ *
+ * @param tail Buffer of at least 128 bytes that receives the final block(s).
+ * @param data The message.
+ * @param length The total length of the message.
+ * @return The number of blocks written to 'tail', either 1 or 2.
+ */
+static size_t PrepareTail(byte* tail, const byte* data, uint32 length)
+{
+	const uint32 rest = length % 64;
+	const size_t blocks = (rest < 56) ? 1 : 2;
+
+	memcpy(tail, data + (length - rest), rest);
+	tail[rest] = 0x80;
+	memset(tail + rest + 1, 0, blocks * 64 - rest - 1);
+
+	const uint64 bits = (uint64)length << 3;
+	StoreBE32(tail + blocks * 64 - 8, (uint32)(bits >> 32));
+	StoreBE32(tail + blocks * 64 - 4, (uint32)bits);
+
+	return blocks;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Generic kernel
+
+#define rotl32(x,n)	(((x) << (n)) | ((x) >> (32 - (n))))
+
+static void CompressGeneric(uint32 state[5], const byte* data, size_t blocks)
+{
+	for (; blocks; --blocks, data += 64) {
+		uint32 w[80];
+		for (unsigned i = 0; i < 16; ++i) {
+			w[i] = LoadBE32(data + 4 * i);
+		}
+		for (unsigned i = 16; i < 80; ++i) {
+			w[i] = rotl32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+		}
+
+		uint32 a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+
+#define GENERIC_ROUND(f, k) { \
+		const uint32 t = rotl32(a, 5) + (f) + e + (k) + w[i]; \
+		e = d; d = c; c = rotl32(b, 30); b = a; a = t; }
+
+		unsigned i = 0;
+		for (; i < 20; ++i) GENERIC_ROUND(d ^ (b & (c ^ d)), SHA_K1);
+		for (; i < 40; ++i) GENERIC_ROUND(b ^ c ^ d, SHA_K2);
+		for (; i < 60; ++i) GENERIC_ROUND((b & c) | (d & (b | c)), SHA_K3);
+		for (; i < 80; ++i) GENERIC_ROUND(b ^ c ^ d, SHA_K4);
+
+#undef GENERIC_ROUND
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+	}
+}
+
+
+#ifdef SHA_X86_KERNELS
+
+////////////////////////////////////////////////////////////////////////////////
+// SHA extensions kernel
+
+// One group of four rounds. Even groups consume E0 and save the state in
+// E1, odd groups the other way round. The message schedule for the group
+// 4 ahead is computed in the same step.
+#define SHANI_GROUP(g, Ein, Eout) \
+	Ein = ((g) == 0) ? _mm_add_epi32(Ein, MSG[0]) : _mm_sha1nexte_epu32(Ein, MSG[(g) % 4]); \
+	Eout = ABCD; \
+	if ((g) >= 3 && (g) <= 18) { \
+		MSG[((g) + 1) % 4] = _mm_sha1msg2_epu32(MSG[((g) + 1) % 4], MSG[(g) % 4]); \
+	} \
+	ABCD = _mm_sha1rnds4_epu32(ABCD, Ein, (g) / 5); \
+	if ((g) >= 1 && (g) <= 16) { \
+		MSG[((g) + 3) % 4] = _mm_sha1msg1_epu32(MSG[((g) + 3) % 4], MSG[(g) % 4]); \
+	} \
+	if ((g) >= 2 && (g) <= 17) { \
+		MSG[((g) + 2) % 4] = _mm_xor_si128(MSG[((g) + 2) % 4], MSG[(g) % 4]); \
+	}
+
+__attribute__((target("sha,sse4.1")))
+static void CompressSHANI(uint32 state[5], const byte* data, size_t blocks)
+{
+	const __m128i MASK = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+
+	__m128i ABCD = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)state), 0x1B);
+	__m128i E0 = _mm_set_epi32(state[4], 0, 0, 0);
+	__m128i E1;
+
+	for (; blocks; --blocks, data += 64) {
+		const __m128i ABCD_SAVE = ABCD;
+		const __m128i E0_SAVE = E0;
+
+		__m128i MSG[4];
+		for (unsigned i = 0; i < 4; ++i) {
+			MSG[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data + 16 * i)), MASK);
+		}
+
+		SHANI_GROUP( 0, E0, E1); SHANI_GROUP( 1, E1, E0);
+		SHANI_GROUP( 2, E0, E1); SHANI_GROUP( 3, E1, E0);
+		SHANI_GROUP( 4, E0, E1); SHANI_GROUP( 5, E1, E0);
+		SHANI_GROUP( 6, E0, E1); SHANI_GROUP( 7, E1, E0);
+		SHANI_GROUP( 8, E0, E1); SHANI_GROUP( 9, E1, E0);
+		SHANI_GROUP(10, E0, E1); SHANI_GROUP(11, E1, E0);
+		SHANI_GROUP(12, E0, E1); SHANI_GROUP(13, E1, E0);
+		SHANI_GROUP(14, E0, E1); SHANI_GROUP(15, E1, E0);
+		SHANI_GROUP(16, E0, E1); SHANI_GROUP(17, E1, E0);
+		SHANI_GROUP(18, E0, E1); SHANI_GROUP(19, E1, E0);
+
+		E0 = _mm_sha1nexte_epu32(E0, E0_SAVE);
+		ABCD = _mm_add_epi32(ABCD, ABCD_SAVE);
+	}
+
+	_mm_storeu_si128((__m128i*)state, _mm_shuffle_epi32(ABCD, 0x1B));
+	state[4] = _mm_extract_epi32(E0, 3);
+}
+
+#undef SHANI_GROUP
+
+
+////////////////////////////////////////////////////////////////////////////////
+// Multi-buffer kernels
+//
+// Every lane of a vector holds the same state word of a different buffer,
+// so the rounds are exactly those of the generic kernel. The helpers are
+// macros rather than functions, since passing the wider vector types by
+// value outside of AVX enabled code changes the ABI.
+
+typedef uint32 v4u32 __attribute__((vector_size(16)));
+typedef uint32 v8u32 __attribute__((vector_size(32)));
+
+template<typename V, unsigned N>
+static inline __attribute__((always_inline))
+void CompressLanes(V st[5], const byte* const* data, size_t offset)
+{
+	V w[16];
+	for (unsigned i = 0; i < 16; ++i) {
+		for (unsigned l = 0; l < N; ++l) {
+			w[i][l] = LoadBE32(data[l] + offset + 4 * i);
+		}
+	}
+
+	V a = st[0], b = st[1], c = st[2], d = st[3], e = st[4];
+	V k, wt;
+
+#define LANES_ROUND(f) { \
+		if (i < 16) { \
+			wt = w[i]; \
+		} else { \
+			wt = w[(i - 3) & 15] ^ w[(i - 8) & 15] ^ w[(i - 14) & 15] ^ w[i & 15]; \
+			wt = rotl32(wt, 1); \
+			w[i & 15] = wt; \
+		} \
+		const V t = rotl32(a, 5) + (f) + e + k + wt; \
+		e = d; d = c; c = rotl32(b, 30); b = a; a = t; }
+
+	unsigned i = 0;
+	for (unsigned l = 0; l < N; ++l) k[l] = SHA_K1;
+	for (; i < 20; ++i) LANES_ROUND(d ^ (b & (c ^ d)));
+	for (unsigned l = 0; l < N; ++l) k[l] = SHA_K2;
+	for (; i < 40; ++i) LANES_ROUND(b ^ c ^ d);
+	for (unsigned l = 0; l < N; ++l) k[l] = SHA_K3;
+	for (; i < 60; ++i) LANES_ROUND((b & c) | (d & (b | c)));
+	for (unsigned l = 0; l < N; ++l) k[l] = SHA_K4;
+	for (; i < 80; ++i) LANES_ROUND(b ^ c ^ d);
+
+#undef LANES_ROUND
+
+	st[0] += a;
+	st[1] += b;
+	st[2] += c;
+	st[3] += d;
+	st[4] += e;
+}
+
+
+template<typename V, unsigned N>
+static inline __attribute__((always_inline))
+void HashLanes(const byte* const* data, uint32 length, byte* digests)
+{
+	V st[5];
+	for (unsigned i = 0; i < 5; ++i) {
+		for (unsigned l = 0; l < N; ++l) {
+			st[i][l] = s_initialState[i];
+		}
+	}
+
+	const size_t fullBlocks = length / 64;
+	for (size_t b = 0; b < fullBlocks; ++b) {
+		CompressLanes<V, N>(st, data, b * 64);
+	}
+
+	// All buffers have the same length, so they need the same number of
+	// padding blocks, and those can be run through the lanes as well.
+	byte tail[N][128];
+	const byte* tails[N];
+	size_t tailBlocks = 0;
+	for (unsigned l = 0; l < N; ++l) {
+		tailBlocks = PrepareTail(tail[l], data[l], length);
+		tails[l] = tail[l];
+	}
+	for (size_t b = 0; b < tailBlocks; ++b) {
+		CompressLanes<V, N>(st, tails, b * 64);
+	}
+
+	for (unsigned l = 0; l < N; ++l) {
+		for (unsigned i = 0; i < 5; ++i) {
+			StoreBE32(digests + 20 * l + 4 * i, st[i][l]);
+		}
+	}
+}
+
+
+__attribute__((target("sse2")))
+static void HashBuffersSSE2(const byte* const* data, uint32 length, byte* digests)
+{
+	HashLanes<v4u32, 4>(data, length, digests);
+}
+
+
+__attribute__((target("avx2")))
+static void HashBuffersAVX2(const byte* const* data, uint32 length, byte* digests)
+{
+	HashLanes<v8u32, 8>(data, length, digests);
+}
+
+
+static unsigned DetectKernels()
+{
+	unsigned supported = 1 << KernelGeneric;
+	unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		return supported;
+	}
+
+	if (edx & (1 << 26)) {
+		supported |= 1 << KernelSSE2;
+	}
+
+	const bool sse41 = (ecx & (1 << 19)) != 0;
+	// AVX needs the OS to save the upper halves of the registers.
+	bool avxState = false;
+	if ((ecx & (1 << 27)) && (ecx & (1 << 28))) {
+		unsigned xcr0, xcr0High;
+		__asm__ volatile (".byte 0x0f, 0x01, 0xd0" : "=a" (xcr0), "=d" (xcr0High) : "c" (0));
+		avxState = (xcr0 & 6) == 6;
+	}
+
+	if (__get_cpuid_max(0, NULL) >= 7) {
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		if (avxState && (ebx & (1 << 5))) {
+			supported |= 1 << KernelAVX2;
+		}
+		if (sse41 && (ebx & (1 << 29))) {
+			supported |= 1 << KernelSHANI;
+		}
+	}
+
+	return supported;
+}
+
+#else
+
+static unsigned DetectKernels()
+{
+	return 1 << KernelGeneric;
+}
+
+#endif // SHA_X86_KERNELS
+
+
+static const unsigned s_supported = DetectKernels();
+static EKernel s_kernel = GetBestKernel();
+
+
+wxString GetName(EKernel kernel)
+{
+	switch (kernel) {
+		case KernelGeneric:	return wxT("generic");
+		case KernelSSE2:	return wxT("SSE2 x4");
+		case KernelAVX2:	return wxT("AVX2 x8");
+		case KernelSHANI:	return wxT("SHA-NI");
+		default:		return wxT("unknown");
+	}
+}
+
+
+bool IsSupported(EKernel kernel)
+{
+	return kernel < KernelCount && (s_supported & (1 << kernel));
+}
+
+
+unsigned GetLanes(EKernel kernel)
+{
+	switch (kernel) {
+		case KernelSSE2:	return 4;
+		case KernelAVX2:	return 8;
+		default:		return 1;
+	}
+}
+
+
+EKernel GetBestKernel()
+{
+	// The SHA extensions beat eight lanes of AVX2 on every CPU having both,
+	// and they also speed up the single stream users of CSHA.
+	static const EKernel preference[] = { KernelSHANI, KernelAVX2, KernelSSE2 };
+
+	for (unsigned i = 0; i < sizeof(preference) / sizeof(preference[0]); ++i) {
+		if (IsSupported(preference[i])) {
+			return preference[i];
+		}
+	}
+
+	return KernelGeneric;
+}
+
+
+EKernel GetKernel()
+{
+	return s_kernel;
+}
+
+
+bool SetKernel(EKernel kernel)
+{
+	if (!IsSupported(kernel)) {
+		return false;
+	}
+
+	s_kernel = kernel;
+	return true;
+}
+
+
+unsigned GetParallelLanes()
+{
+	return GetLanes(s_kernel);
+}
+
+
+void Compress(uint32 state[5], const byte* data, size_t blocks)
+{
+#ifdef SHA_X86_KERNELS
+	if (s_supported & (1 << KernelSHANI)) {
+		CompressSHANI(state, data, blocks);
+		return;
+	}
+#endif
+	CompressGeneric(state, data, blocks);
+}
+
+
+static void HashSingle(EKernel kernel, const byte* data, uint32 length, byte* digest)
+{
+	uint32 state[5];
+	memcpy(state, s_initialState, sizeof(state));
+
+	byte tail[128];
+	const size_t tailBlocks = PrepareTail(tail, data, length);
+
+#ifdef SHA_X86_KERNELS
+	if (kernel == KernelSHANI) {
+		CompressSHANI(state, data, length / 64);
+		CompressSHANI(state, tail, tailBlocks);
+	} else
+#endif
+	{
+		CompressGeneric(state, data, length / 64);
+		CompressGeneric(state, tail, tailBlocks);
+	}
+
+	for (unsigned i = 0; i < 5; ++i) {
+		StoreBE32(digest + 4 * i, state[i]);
+	}
+}
+
+
+void HashBuffers(const byte* const* data, uint32 length, byte* digests, unsigned count)
+{
+	const EKernel kernel = s_kernel;
+	unsigned i = 0;
+
+#ifdef SHA_X86_KERNELS
+	if (kernel == KernelAVX2) {
+		for (; i + 8 <= count; i += 8) {
+			HashBuffersAVX2(data + i, length, digests + 20 * i);
+		}
+	}
+	if (kernel == KernelAVX2 || kernel == KernelSSE2) {
+		for (; i + 4 <= count; i += 4) {
+			HashBuffersSSE2(data + i, length, digests + 20 * i);
+		}
+	}
+#endif
+
+	for (; i < count; ++i) {
+		HashSingle(kernel, data[i], length, digests + 20 * i);
+	}
+}
+
+} // namespace SHAKernels
+// File_checked_for_headers
@@ -0,0 +1,112 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#ifndef SHAKERNELS_H
+#define SHAKERNELS_H
+
+#include "Types.h"
+
+
+/**
+ * SHA-1 compression kernels, selected at runtime.
+ *
+ * The single stream kernels (generic C and the x86 SHA extensions) are
+ * used by CSHA. The multi-buffer kernels hash several independent
+ * buffers of equal length at once, one buffer per SIMD lane, which is
+ * what AICH needs when hashing the 180KB blocks of a part.
+ *
+ * All kernels produce identical results; the fastest one supported by
+ * the CPU is picked on first use.
+ */
+namespace SHAKernels {
+
+enum EKernel {
+	//! Portable C implementation, one buffer at a time.
+	KernelGeneric = 0,
+	//! Four buffers at a time using SSE2.
+	KernelSSE2,
+	//! Eight buffers at a time using AVX2.
+	KernelAVX2,
+	//! One buffer at a time using the x86 SHA extensions.
+	KernelSHANI,
+	//! Not a kernel, must be last.
+	KernelCount
+};
+
+//! Returns a human readable name for the kernel.
+wxString GetName(EKernel kernel);
+
+//! Returns true if the kernel is compiled in and supported by the CPU.
+bool IsSupported(EKernel kernel);
+
+//! Returns the number of buffers the kernel hashes in parallel.
+unsigned GetLanes(EKernel kernel);
+
+//! Returns the fastest kernel supported by this machine.
+EKernel GetBestKernel();
+
+//! Returns the kernel currently in use.
+EKernel GetKernel();
+
+/**
+ * Overrides the kernel in use, mainly for testing.
+ *
+ * @return False if the kernel is not supported, in which case nothing changes.
+ */
+bool SetKernel(EKernel kernel);
+
+/**
+ * Returns the number of buffers HashBuffers can process in one go.
+ *
+ * This is 1 when the current kernel has no multi-buffer support, in which
+ * case callers are better off streaming the data through CSHA.
+ */
+unsigned GetParallelLanes();
+
+/**
+ * Runs the SHA-1 compression function on a number of 64 byte blocks.
+ *
+ * This always uses the best single stream kernel, regardless of the
+ * kernel selected with SetKernel.
+ *
+ * @param state The five state words, updated in place.
+ * @param data The blocks to compress, need not be aligned.
+ * @param blocks The number of blocks.
+ */
+void Compress(uint32 state[5], const byte* data, size_t blocks);
+
+/**
+ * Computes the complete SHA-1 digests of a number of buffers of equal length.
+ *
+ * @param data Pointers to 'count' buffers, each of 'length' bytes.
+ * @param length The length of every buffer.
+ * @param digests Receives 'count' digests of 20 bytes each.
+ * @param count The number of buffers, any number is accepted.
+ */
+void HashBuffers(const byte* const* data, uint32 length, byte* digests, unsigned count);
+
+} // namespace SHAKernels
+
+#endif // SHAKERNELS_H
+// File_checked_for_headers
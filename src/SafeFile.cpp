@@ -231,11 +231,16 @@ wxString CFileDataIO::ReadOnlyString(bool bOptUTF8, uint16 raw_len) const
 {
 	// We only need to set the the NULL terminator, since we know that
 	// reads will either succeed or throw an exception, in which case
-	// we wont be returning anything
-	std::vector<char> val_array(raw_len + 1);
-	val_array[raw_len] = 0;
-		
-	char* val = &(val_array[0]);
+	// we wont be returning anything.
+	// Most strings (tag names, file names) fit on the stack.
+	char val_buffer[256];
+	std::vector<char> val_array;
+	char* val = val_buffer;
+	if (raw_len >= sizeof(val_buffer)) {
+		val_array.resize(raw_len + 1);
+		val = &(val_array[0]);
+	}
+	val[raw_len] = 0;
 
 	Read(val, raw_len);
 	wxString str;
@@ -394,103 +399,20 @@ void CFileDataIO::WriteStringCore(const char *s, EUtf8Str eEncode, uint8 SizeLen
 }
 
 
-CTag *CFileDataIO::ReadTag(bool bOptACP) const
+CTag *CFileDataIO::ReadTag(bool bOptACP, CTagArena* arena) const
 {
-	CTag *retVal = NULL;
-	wxString name;
-	byte type = 0;
-	try {
-		type = ReadUInt8();
-		name = ReadString(false);
-
-		switch (type)
-		{
-			// NOTE: This tag data type is accepted and stored only to give us the possibility to upgrade 
-			// the net in some months.
-			//
-			// And still.. it doesnt't work this way without breaking backward compatibility. To properly
-			// do this without messing up the network the following would have to be done:
-			//	 -	those tag types have to be ignored by any client, otherwise those tags would also be sent (and 
-			//		that's really the problem)
-			//
-			//	 -	ignoring means, each client has to read and right throw away those tags, so those tags get
-			//		get never stored in any tag list which might be sent by that client to some other client.
-			//
-			//	 -	all calling functions have to be changed to deal with the 'nr. of tags' attribute (which was 
-			//		already parsed) correctly.. just ignoring those tags here is not enough, any taglists have to 
-			//		be built with the knowledge that the 'nr. of tags' attribute may get decreased during the tag 
-			//		reading..
-			// 
-			// If those new tags would just be stored and sent to remote clients, any malicious or just bugged
-			// client could let send a lot of nodes "corrupted" packets...
-			//
-			case TAGTYPE_HASH16:
-			{
-				retVal = new CTagHash(name, ReadHash());
-				break;
-			}
-
-			case TAGTYPE_STRING:
-				retVal = new CTagString(name, ReadString(bOptACP));
-				break;
-
-			case TAGTYPE_UINT64:
-				retVal = new CTagInt64(name, ReadUInt64());
-				break;
-
-			case TAGTYPE_UINT32:
-				retVal = new CTagInt32(name, ReadUInt32());
-				break;
-
-			case TAGTYPE_UINT16:
-				retVal = new CTagInt16(name, ReadUInt16());
-				break;
-
-			case TAGTYPE_UINT8:
-				retVal = new CTagInt8(name, ReadUInt8());
-				break;
-
-			case TAGTYPE_FLOAT32:
-				retVal = new CTagFloat(name, ReadFloat());
-				break;
-
-			// NOTE: This tag data type is accepted and stored only to give us the possibility to upgrade 
-			// the net in some months.
-			//
-			// And still.. it doesnt't work this way without breaking backward compatibility
-			case TAGTYPE_BSOB:
-			{
-				uint8 size = 0;
-				CScopedArray<unsigned char> value(ReadBsob(&size));
-				
-				retVal = new CTagBsob(name, value.get(), size);
-				break;
-			}
-
-			default:
-				throw wxString(CFormat(wxT("Invalid Kad tag type; type=0x%02x name=%s\n")) % type % name);
-		}
-	} catch(const CMuleException& e) {
-		AddLogLineN(e.what());
-		delete retVal;
-		throw;
-	} catch(const wxString& e) {
-		AddLogLineN(e);
-		throw;
-	}
-	
-	return retVal;
+	return CTag::ReadKadTag(*this, bOptACP, arena);
 }
 
 
-void CFileDataIO::ReadTagPtrList(TagPtrList* taglist, bool bOptACP) const
+void CFileDataIO::ReadTagPtrList(TagPtrList* taglist, bool bOptACP, CTagArena* arena) const
 {
 	MULE_VALIDATE_PARAMS(taglist, wxT("NULL pointer argument in ReadTagPtrList"));
 
 	uint32 count = ReadUInt8();
 	for (uint32 i = 0; i < count; i++)
 	{
-		CTag* tag = ReadTag(bOptACP);
+		CTag* tag = ReadTag(bOptACP, arena);
 		taglist->push_back(tag);
 	}
 }
@@ -199,8 +199,9 @@ public:
 
 /* Warning: Special Kad functions, needs documentation */
 
-	CTag*		ReadTag(bool bOptACP = false) const;
-	void		ReadTagPtrList(TagPtrList* taglist, bool bOptACP = false) const;
+	// Tags read into an arena belong to it, see CTagArena
+	CTag*		ReadTag(bool bOptACP = false, CTagArena* arena = NULL) const;
+	void		ReadTagPtrList(TagPtrList* taglist, bool bOptACP = false, CTagArena* arena = NULL) const;
 
 	void		WriteTag(const CTag& tag);
 	void		WriteTagPtrList(const TagPtrList& tagList);
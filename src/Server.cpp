@@ -268,11 +268,13 @@ bool CServer::AddTagFromFile(CFileDataIO* servermet)
 void CServer::SetListName(const wxString& newname)
 {
 	listname = newname;
+	SetECDirty();
 }
 
 void CServer::SetDescription(const wxString& newname)
 {
 	description = newname;
+	SetECDirty();
 }
 
 void CServer::SetID(uint32 newip)
@@ -280,6 +282,7 @@ void CServer::SetID(uint32 newip)
 	wxASSERT(newip);
 	ip = newip;
 	ipfull = Uint32toStringIP(ip);
+	SetECDirty();
 }
 
 void CServer::SetDynIP(const wxString& newdynip)
@@ -70,7 +70,7 @@ public:
 	uint16  GetPort() const			{return realport ? realport : port;}
 	// the connection port
 	uint16  GetConnPort() const		{return port;}
-	void    SetPort(uint32 val)		{realport = val;}
+	void    SetPort(uint32 val)		{realport = val; SetECDirty();}
 	bool	AddTagFromFile(CFileDataIO* servermet);
 	void	SetListName(const wxString& newname);
 	void	SetDescription(const wxString& newdescription);
@@ -81,11 +81,11 @@ public:
 	uint32	GetPing() const			{return ping;} 
 	uint32	GetPreferences() const		{return preferences;} 
 	uint32	GetMaxUsers() const		{return maxusers;}
-	void	SetMaxUsers(uint32 in_maxusers) {maxusers = in_maxusers;}
-	void	SetUserCount(uint32 in_users)	{users = in_users;}
-	void	SetFileCount(uint32 in_files)	{files = in_files;}
-	void	ResetFailedCount()		{failedcount = 0;} 
-	void	AddFailedCount()		{failedcount++;} 
+	void	SetMaxUsers(uint32 in_maxusers) {maxusers = in_maxusers; SetECDirty();}
+	void	SetUserCount(uint32 in_users)	{users = in_users; SetECDirty();}
+	void	SetFileCount(uint32 in_files)	{files = in_files; SetECDirty();}
+	void	ResetFailedCount()		{failedcount = 0; SetECDirty();} 
+	void	AddFailedCount()		{failedcount++; SetECDirty();} 
 	uint32	GetFailedCount() const		{return failedcount;} 
 	void	SetID(uint32 newip);
 	const wxString &GetDynIP() const	{return dynip;}
@@ -101,9 +101,9 @@ public:
 	uint32	GetLastPinged() const		{return lastpinged;}
 	void	SetLastPinged(uint32 in_lastpinged) {lastpinged = in_lastpinged;}
 	
-	void	SetPing(uint32 in_ping)		{ping = in_ping;}
-	void	SetPreference(uint32 in_preferences) {preferences = in_preferences;}
-	void	SetIsStaticMember(bool in)	{staticservermember=in;}
+	void	SetPing(uint32 in_ping)		{ping = in_ping; SetECDirty();}
+	void	SetPreference(uint32 in_preferences) {preferences = in_preferences; SetECDirty();}
+	void	SetIsStaticMember(bool in)	{staticservermember=in; SetECDirty();}
 	bool	IsStaticMember() const		{return staticservermember;}
 	uint32	GetChallenge() const		{return challenge;}
 	void	SetChallenge(uint32 in_challenge) {challenge = in_challenge;}
@@ -112,7 +112,7 @@ public:
 	uint32	GetHardFiles() const		{return hardfiles;}
 	void	SetHardFiles(uint32 in_hardfiles) {hardfiles = in_hardfiles;}
 	const	wxString &GetVersion() const	{return m_strVersion;}
-	void	SetVersion(const wxString &pszVersion)	{m_strVersion = pszVersion;}
+	void	SetVersion(const wxString &pszVersion)	{m_strVersion = pszVersion; SetECDirty();}
 	void	SetTCPFlags(uint32 uFlags)	{m_uTCPFlags = uFlags;}
 	uint32	GetTCPFlags() const		{return m_uTCPFlags;}
 	void	SetUDPFlags(uint32 uFlags)	{m_uUDPFlags = uFlags;}
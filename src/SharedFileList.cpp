@@ -291,6 +291,7 @@ void CPublishKeywordList::PurgeUnreferencedKeywords()
 CSharedFileList::CSharedFileList(CKnownFileList* in_filelist){
 	filelist = in_filelist;
 	reloading = false;
+	m_fileListVersion = 1;
 	m_lastPublishED2K = 0;
 	m_lastPublishED2KFlag = true;
 	/* Kad Stuff */
@@ -325,6 +326,7 @@ void CSharedFileList::FindSharedFiles()
 	{
 		wxMutexLocker lock(list_mut);
 		m_Files_map.clear();
+		m_fileListVersion++;
 	}
 
 	// All part files are automatically shared.
@@ -495,6 +497,7 @@ bool CSharedFileList::AddFile(CKnownFile* pFile)
 
 	CKnownFileMap::value_type entry(pFile->GetFileHash(), pFile);
 	if (m_Files_map.insert(entry).second) {
+		m_fileListVersion++;
 		/* Keywords to publish on Kad */
 		m_keywords->AddKeywords(pFile);
 		theStats::AddSharedFile(pFile->GetFileSize());
@@ -525,6 +528,7 @@ void CSharedFileList::RemoveFile(CKnownFile* toremove){
 	Notify_SharedFilesRemoveFile(toremove);
 	wxMutexLocker lock(list_mut);
 	if (m_Files_map.erase(toremove->GetFileHash()) > 0) {
+		m_fileListVersion++;
 		theStats::RemoveSharedFile(toremove->GetFileSize());
 	}
 	/* This file keywords must not be published to kad anymore */
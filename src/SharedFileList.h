@@ -61,6 +61,8 @@ public:
 	size_t	GetCount()	{ wxMutexLocker lock(list_mut); return m_Files_map.size(); }
 	size_t  GetFileCount()	{ wxMutexLocker lock(list_mut); return m_Files_map.size(); }
 	void	CopyFileList(std::vector<CKnownFile*>& out_list) const;
+	// changes whenever files are added or removed
+	uint32	GetFileListVersion() const	{ return m_fileListVersion; }
 	void	UpdateItem(CKnownFile* toupdate);
 	unsigned	AddFilesFromDirectory(const CPath& directory);
 	void    GetSharedFilesByDirectory(const wxString& directory, CKnownFilePtrList& list);
@@ -114,6 +116,8 @@ private:
 
 	CKnownFileMap		m_Files_map;
 	mutable wxMutex		list_mut;
+	//! Incremented on every change to m_Files_map
+	uint32				m_fileListVersion;
 
 	StringPathMap m_PublicSharedDirNames;  //! used for mapping strings to shared directories
 
@@ -43,6 +43,9 @@
 	#include "ServerList.h"		// Needed for CServerList (tree)
 	#include <cmath>		// Needed for std::floor
 	#include "updownclient.h"	// Needed for CUpDownClient
+	#ifdef ENABLE_TORRENT
+		#include "Torrent.h"		// Needed for CTorrent (tree)
+	#endif
 #else
 	#include "GetTickCount.h"	// Needed for GetTickCount64()
 	#include "Preferences.h"
@@ -165,6 +168,7 @@ CStatTreeItemPackets*		CStatistics::s_sourceXchgUpOverhead;
 CStatTreeItemPackets*		CStatistics::s_serverUpOverhead;
 CStatTreeItemPackets*		CStatistics::s_kadUpOverhead;
 CStatTreeItemCounter*		CStatistics::s_cryptUpOverhead;
+CStatTreeItemCounter*		CStatistics::s_udpSendCallsSaved;
 CStatTreeItemNativeCounter*	CStatistics::s_activeUploads;
 CStatTreeItemNativeCounter*	CStatistics::s_waitingUploads;
 CStatTreeItemCounter*		CStatistics::s_totalSuccUploads;
@@ -217,6 +221,14 @@ CStatTreeItemSimple*		CStatistics::s_serverOccupation;
 CStatTreeItemCounter*		CStatistics::s_numberOfShared;
 CStatTreeItemCounter*		CStatistics::s_sizeOfShare;
 
+#ifdef ENABLE_TORRENT
+// Torrent alerts
+CStatTreeItemSimple*		CStatistics::s_processedAlerts;
+CStatTreeItemSimple*		CStatistics::s_maxAlertBacklog;
+CStatTreeItemSimple*		CStatistics::s_avgAlertLatency;
+CStatTreeItemSimple*		CStatistics::s_maxAlertLatency;
+#endif
+
 // Kad
 uint64_t			CStatistics::s_kadNodesTotal;
 uint16_t			CStatistics::s_kadNodesCur;
@@ -742,6 +754,7 @@ void CStatistics::InitStatsTree()
 	s_totalUpOverhead->AddPacketCounter(s_kadUpOverhead);
 	s_cryptUpOverhead = (CStatTreeItemCounter*)tmpRoot2->AddChild(new CStatTreeItemCounter(wxTRANSLATE("Crypt overhead (UDP): %s")));
 	s_cryptUpOverhead->SetDisplayMode(dmBytes);
+	s_udpSendCallsSaved = (CStatTreeItemCounter*)tmpRoot2->AddChild(new CStatTreeItemCounter(wxTRANSLATE("UDP send calls saved by batching: %s")));
 	s_activeUploads = (CStatTreeItemNativeCounter*)tmpRoot2->AddChild(new CStatTreeItemNativeCounter(wxTRANSLATE("Active Uploads: %s")));
 	s_waitingUploads = (CStatTreeItemNativeCounter*)tmpRoot2->AddChild(new CStatTreeItemNativeCounter(wxTRANSLATE("Waiting Uploads: %s")));
 	s_totalSuccUploads = (CStatTreeItemCounter*)tmpRoot2->AddChild(new CStatTreeItemCounter(wxTRANSLATE("Total successful upload sessions: %s")));
@@ -812,6 +825,14 @@ void CStatistics::InitStatsTree()
 	s_sizeOfShare = (CStatTreeItemCounter*)tmpRoot1->AddChild(new CStatTreeItemCounter(wxTRANSLATE("Total size of Shared Files: %s")));
 	s_sizeOfShare->SetDisplayMode(dmBytes);
 	tmpRoot1->AddChild(new CStatTreeItemAverage(wxTRANSLATE("Average file size: %s"), s_sizeOfShare, s_numberOfShared, dmBytes));
+
+#ifdef ENABLE_TORRENT
+	tmpRoot1 = s_statTree->AddChild(new CStatTreeItemBase(wxTRANSLATE("Torrent")));
+	s_processedAlerts = (CStatTreeItemSimple*)tmpRoot1->AddChild(new CStatTreeItemSimple(wxTRANSLATE("Processed alerts: %llu")));
+	s_maxAlertBacklog = (CStatTreeItemSimple*)tmpRoot1->AddChild(new CStatTreeItemSimple(wxTRANSLATE("Largest alert backlog: %llu")));
+	s_avgAlertLatency = (CStatTreeItemSimple*)tmpRoot1->AddChild(new CStatTreeItemSimple(wxTRANSLATE("Average alert latency: %llu ms")));
+	s_maxAlertLatency = (CStatTreeItemSimple*)tmpRoot1->AddChild(new CStatTreeItemSimple(wxTRANSLATE("Longest alert latency: %llu ms")));
+#endif
 }
 
 
@@ -842,6 +863,16 @@ void CStatistics::UpdateStatsTree()
 	s_totalUsers->SetValue((uint64)servtuser);
 	s_totalFiles->SetValue((uint64)servtfile);
 	s_serverOccupation->SetValue(servocc);
+
+#ifdef ENABLE_TORRENT
+	const CTorrentStrategy* strategy = CTorrent::GetInstance().GetStrategy();
+	if (strategy) {
+		s_processedAlerts->SetValue(strategy->GetProcessedAlerts());
+		s_maxAlertBacklog->SetValue((uint64)strategy->GetMaxAlertBacklog());
+		s_avgAlertLatency->SetValue((uint64)strategy->GetAverageAlertLatency());
+		s_maxAlertLatency->SetValue((uint64)strategy->GetMaxAlertLatency());
+	}
+#endif
 }
 
 
@@ -248,6 +248,7 @@ class CStatistics {
 	static	void	AddUpOverheadServer(uint32 size)	{ (*s_serverUpOverhead) += size; (*s_upOverheadRate) += size; }
 	static	void	AddUpOverheadKad(uint32 size)		{ (*s_kadUpOverhead) += size; (*s_upOverheadRate) += size; }
 	static	void	AddUpOverheadCrypt(uint32_t size)	{ (*s_cryptUpOverhead) += size; }
+	static	void	AddUDPSendCallsSaved(uint32 count)	{ (*s_udpSendCallsSaved) += count; }
 	static	void	AddUpOverheadOther(uint32 size)		{ (*s_totalUpOverhead) += size; (*s_upOverheadRate) += size; }
 	static	double	GetUpOverheadRate()			{ return s_upOverheadRate->GetRate(); }
 	static	void	AddSuccessfulUpload()			{ ++(*s_totalSuccUploads); }
@@ -414,6 +415,7 @@ class CStatistics {
 	static	CStatTreeItemPackets*		s_serverUpOverhead;
 	static	CStatTreeItemPackets*		s_kadUpOverhead;
 	static	CStatTreeItemCounter*		s_cryptUpOverhead;
+	static	CStatTreeItemCounter*		s_udpSendCallsSaved;
 	static	CStatTreeItemNativeCounter*	s_activeUploads;
 	static	CStatTreeItemNativeCounter*	s_waitingUploads;
 	static	CStatTreeItemCounter*		s_totalSuccUploads;
@@ -466,6 +468,14 @@ class CStatistics {
 	static	CStatTreeItemCounter*		s_numberOfShared;
 	static	CStatTreeItemCounter*		s_sizeOfShare;
 
+#ifdef ENABLE_TORRENT
+	// Torrent alerts
+	static	CStatTreeItemSimple*		s_processedAlerts;
+	static	CStatTreeItemSimple*		s_maxAlertBacklog;
+	static	CStatTreeItemSimple*		s_avgAlertLatency;
+	static	CStatTreeItemSimple*		s_maxAlertLatency;
+#endif
+
 	// Kad nodes
 	static	uint64_t	s_kadNodesTotal;
 	static	uint16_t	s_kadNodesCur;
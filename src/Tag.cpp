@@ -30,11 +30,64 @@
 
 #include "SafeFile.h"		// Needed for CFileDataIO
 #include "MD4Hash.h"			// Needed for CMD4Hash
+#include "ScopedPtr.h"			// Needed for CScopedArray
+#include "Logger.h"			// Needed for AddLogLineN
+
+#include <wx/thread.h>			// Needed for wxMutex
+
+#include <new>
+#include <set>
 
 #ifdef __SUNPRO_CC
 #define __FUNCTION__ __FILE__+__LINE__
 #endif
 
+namespace {
+	// Names of single-byte named Kad tags
+	struct CKadTagNames {
+		wxString names[256];
+
+		CKadTagNames()
+		{
+			for (unsigned i = 0; i < 256; ++i) {
+				names[i] = wxString((wxChar)i, 1);
+			}
+		}
+	} s_kadTagNames;
+
+	const wxString s_emptyTagName;
+
+	// Longer tag names, shared by all tags using them. The names come from
+	// the network, so only a bounded number of short ones is kept, tags
+	// with other names own a copy.
+	class CTagNamePool {
+	public:
+		const wxString* Find(const wxString& name)
+		{
+			if (name.Length() > MAX_NAME_LENGTH) {
+				return NULL;
+			}
+
+			wxMutexLocker lock(m_mutex);
+			std::set<wxString>::const_iterator it = m_names.find(name);
+			if (it != m_names.end()) {
+				return &*it;
+			} else if (m_names.size() < MAX_NAMES) {
+				return &*m_names.insert(name).first;
+			}
+			return NULL;
+		}
+
+	private:
+		static const size_t MAX_NAMES = 1024;
+		static const size_t MAX_NAME_LENGTH = 32;
+
+		wxMutex m_mutex;
+		std::set<wxString> m_names;
+	} s_tagNamePool;
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 // CTag
 
@@ -42,7 +95,8 @@ CTag::CTag(const wxString& Name)
 {
 	m_uType = 0;
 	m_uName = 0;
-	m_Name = Name;
+	m_flags = 0;
+	SetName(Name);
 	m_uVal = 0;
 	m_nSize = 0;
 }
@@ -51,6 +105,8 @@ CTag::CTag(uint8 uName)
 {
 	m_uType = 0;
 	m_uName = uName;
+	m_flags = 0;
+	m_pName = &s_emptyTagName;
 	m_uVal = 0;
 	m_nSize = 0;
 }
@@ -59,7 +115,34 @@ CTag::CTag(const CTag& rTag)
 {
 	m_uType = rTag.m_uType;
 	m_uName = rTag.m_uName;
-	m_Name = rTag.m_Name;
+	m_flags = 0;
+	if (rTag.m_flags & TAGF_OWNNAME) {
+		SetName(*rTag.m_pName);
+	} else {
+		m_pName = rTag.m_pName;
+	}
+	CopyValue(rTag);
+}
+
+
+void CTag::SetName(const wxString& name)
+{
+	if (name.IsEmpty()) {
+		m_pName = &s_emptyTagName;
+	} else if (name.Length() == 1 && (unsigned)name[0] < 256) {
+		m_pName = &s_kadTagNames.names[(unsigned)name[0]];
+	} else {
+		m_pName = s_tagNamePool.Find(name);
+		if (!m_pName) {
+			m_pName = new wxString(name);
+			m_flags |= TAGF_OWNNAME;
+		}
+	}
+}
+
+
+void CTag::CopyValue(const CTag& rTag)
+{
 	m_nSize = 0;
 	if (rTag.IsStr()) {
 		m_pstrVal = new wxString(rTag.GetStr());
@@ -84,11 +167,32 @@ CTag::CTag(const CTag& rTag)
 }
 
 
+void CTag::FreeValue()
+{
+	if (m_flags & TAGF_ARENA) {
+		// Only the destructors run, the memory belongs to the arena
+		if (IsStr()) {
+			m_pstrVal->~wxString();
+		} else if (IsHash()) {
+			m_hashVal->~CMD4Hash();
+		}
+		m_flags &= ~TAGF_ARENA;
+	} else if (IsStr()) {
+		delete m_pstrVal;
+	} else if (IsHash()) {
+		delete m_hashVal;
+	} else if (IsBlob() || IsBsob()) {
+		delete[] m_pData;
+	}
+}
+
+
 CTag::CTag(const CFileDataIO& data, bool bOptUTF8)
 {
 	// Zero variables to allow for safe deletion
-	m_uType = m_uName = m_nSize = m_uVal = 0;
+	m_uType = m_uName = m_flags = m_nSize = m_uVal = 0;
 	m_pData = NULL;	
+	m_pName = &s_emptyTagName;
 	
 	try {
 		m_uType = data.ReadUInt8();
@@ -101,7 +205,7 @@ CTag::CTag(const CFileDataIO& data, bool bOptUTF8)
 				m_uName = data.ReadUInt8();
 			} else {
 				m_uName = 0;
-				m_Name = data.ReadOnlyString(utf8strNone,length);
+				SetName(data.ReadOnlyString(utf8strNone,length));
 			}
 		}
 	
@@ -185,6 +289,9 @@ CTag::CTag(const CFileDataIO& data, bool bOptUTF8)
 		if (m_uType == TAGTYPE_BLOB) {
 			delete[] m_pData;
 		}
+		if (m_flags & TAGF_OWNNAME) {
+			delete m_pName;
+		}
 
 		throw;
 	}
@@ -193,51 +300,34 @@ CTag::CTag(const CFileDataIO& data, bool bOptUTF8)
 
 CTag::~CTag()
 {
-	if (IsStr()) {
-		delete m_pstrVal;
-	} else if (IsHash()) {
-		delete m_hashVal;
-	} else if (IsBlob() || IsBsob()) {
-		delete[] m_pData;
-	} 
+	FreeValue();
+	if (m_flags & TAGF_OWNNAME) {
+		delete m_pName;
+	}
 }
 
 
 CTag &CTag::operator=(const CTag &rhs)
 {
 	if (&rhs != this) {
-		m_uType = rhs.m_uType;
-		m_uName = rhs.m_uName;
-		m_Name = rhs.m_Name;
-		m_nSize = 0;
-		if (rhs.IsStr()) {
-			wxString *p = new wxString(rhs.GetStr());
-			delete m_pstrVal;
-			m_pstrVal = p;
-		} else if (rhs.IsInt()) {
-			m_uVal = rhs.GetInt();
-		} else if (rhs.IsFloat()) {
-			m_fVal = rhs.GetFloat();
-		} else if (rhs.IsHash()) {
-			CMD4Hash *p = new CMD4Hash(rhs.GetHash());
-			delete m_hashVal;
-			m_hashVal = p;
-		} else if (rhs.IsBlob()) {
-			m_nSize = rhs.GetBlobSize();
-			unsigned char *p = new unsigned char[rhs.GetBlobSize()];
-			delete [] m_pData;
-			m_pData = p;
-			memcpy(m_pData, rhs.GetBlob(), rhs.GetBlobSize());
-		} else if (rhs.IsBsob()) {
-			m_nSize = rhs.GetBsobSize();
-			unsigned char *p = new unsigned char[rhs.GetBsobSize()];
-			delete [] m_pData;
-			m_pData = p;
-			memcpy(m_pData, rhs.GetBsob(), rhs.GetBsobSize());
-		} else {
-			wxFAIL;
-			m_uVal = 0;
+		// Copy first, rhs may use the value or name freed below
+		CTag tmp(rhs);
+
+		FreeValue();
+		if (m_flags & TAGF_OWNNAME) {
+			delete m_pName;
 		}
+
+		m_uType = tmp.m_uType;
+		m_uName = tmp.m_uName;
+		m_flags = tmp.m_flags;
+		m_pName = tmp.m_pName;
+		m_nSize = tmp.m_nSize;
+		m_uVal = tmp.m_uVal;
+
+		// The value and name now belong to this tag
+		tmp.m_uType = 0;
+		tmp.m_flags = 0;
 	}
 	return *this;
 }
@@ -311,6 +401,275 @@ const byte* CTag::GetBsob() const
 	return m_pData;
 }
 
+
+namespace {
+	// Skips tag data, unless it ends past the end of the data
+	void SkipTagData(const CFileDataIO& data, uint64 len)
+	{
+		if (len > data.GetLength() - data.GetPosition()) {
+			throw CInvalidPacket(wxT("Malformed tag"));
+		}
+		data.Seek(len, wxFromCurrent);
+	}
+}
+
+
+bool CTag::ReadIntOrSkip(const CFileDataIO& data, uint8& uName, uint64& uVal)
+{
+	// Same layout as read by CTag(data, bOptUTF8)
+	uint8 uType = data.ReadUInt8();
+	if (uType & 0x80) {
+		uType &= 0x7F;
+		uName = data.ReadUInt8();
+	} else {
+		uint16 length = data.ReadUInt16();
+		if (length == 1) {
+			uName = data.ReadUInt8();
+		} else {
+			uName = 0;
+			SkipTagData(data, length);
+		}
+	}
+
+	switch (uType) {
+		case TAGTYPE_UINT64:
+			uVal = data.ReadUInt64();
+			return true;
+
+		case TAGTYPE_UINT32:
+			uVal = data.ReadUInt32();
+			return true;
+
+		case TAGTYPE_UINT16:
+			uVal = data.ReadUInt16();
+			return true;
+
+		case TAGTYPE_UINT8:
+			uVal = data.ReadUInt8();
+			return true;
+
+		case TAGTYPE_STRING:
+			SkipTagData(data, data.ReadUInt16());
+			break;
+
+		case TAGTYPE_FLOAT32:
+			SkipTagData(data, 4);
+			break;
+
+		case TAGTYPE_HASH16:
+			SkipTagData(data, 16);
+			break;
+
+		case TAGTYPE_BOOL:
+			SkipTagData(data, 1);
+			break;
+
+		case TAGTYPE_BOOLARRAY:
+			SkipTagData(data, (data.ReadUInt16() / 8) + 1);
+			break;
+
+		case TAGTYPE_BLOB:
+			SkipTagData(data, data.ReadUInt32());
+			break;
+
+		default:
+			if (uType >= TAGTYPE_STR1 && uType <= TAGTYPE_STR16) {
+				SkipTagData(data, uType - TAGTYPE_STR1 + 1);
+			} else {
+				throw CInvalidPacket(CFormat(wxT("Unknown tag type encounted %x, cannot proceed!")) % uType);
+			}
+	}
+	return false;
+}
+
+
+CTag* CTag::ReadKadTag(const CFileDataIO& data, bool bOptACP, CTagArena* arena)
+{
+	CTag* tag = NULL;
+	try {
+		byte type = data.ReadUInt8();
+		// Kad tag names are almost always a single byte, those are shared
+		uint16 nameLen = data.ReadUInt16();
+		if (nameLen == 1) {
+			tag = arena ? new (arena->Alloc(sizeof(CTag))) CTag((uint8)0) : new CTag((uint8)0);
+			tag->m_pName = &s_kadTagNames.names[data.ReadUInt8()];
+		} else {
+			wxString name = data.ReadOnlyString(false, nameLen);
+			tag = arena ? new (arena->Alloc(sizeof(CTag))) CTag(name) : new CTag(name);
+		}
+		if (arena) {
+			tag->m_flags |= TAGF_ARENA;
+		}
+
+		// The type is only set once the value is allocated, so the tag can be destroyed on failure.
+		switch (type)
+		{
+			// NOTE: This tag data type is accepted and stored only to give us the possibility to upgrade 
+			// the net in some months.
+			//
+			// And still.. it doesnt't work this way without breaking backward compatibility. To properly
+			// do this without messing up the network the following would have to be done:
+			//	 -	those tag types have to be ignored by any client, otherwise those tags would also be sent (and 
+			//		that's really the problem)
+			//
+			//	 -	ignoring means, each client has to read and right throw away those tags, so those tags get
+			//		get never stored in any tag list which might be sent by that client to some other client.
+			//
+			//	 -	all calling functions have to be changed to deal with the 'nr. of tags' attribute (which was 
+			//		already parsed) correctly.. just ignoring those tags here is not enough, any taglists have to 
+			//		be built with the knowledge that the 'nr. of tags' attribute may get decreased during the tag 
+			//		reading..
+			// 
+			// If those new tags would just be stored and sent to remote clients, any malicious or just bugged
+			// client could let send a lot of nodes "corrupted" packets...
+			//
+			case TAGTYPE_HASH16: {
+				CMD4Hash hash = data.ReadHash();
+				tag->m_hashVal = arena ? new (arena->Alloc(sizeof(CMD4Hash))) CMD4Hash(hash) : new CMD4Hash(hash);
+				break;
+			}
+
+			case TAGTYPE_STRING: {
+				wxString value = data.ReadString(bOptACP);
+				tag->m_pstrVal = arena ? new (arena->Alloc(sizeof(wxString))) wxString : new wxString;
+				tag->m_pstrVal->swap(value);
+				break;
+			}
+
+			case TAGTYPE_UINT64:
+				tag->m_uVal = data.ReadUInt64();
+				break;
+
+			case TAGTYPE_UINT32:
+				tag->m_uVal = data.ReadUInt32();
+				break;
+
+			case TAGTYPE_UINT16:
+				tag->m_uVal = data.ReadUInt16();
+				break;
+
+			case TAGTYPE_UINT8:
+				tag->m_uVal = data.ReadUInt8();
+				break;
+
+			case TAGTYPE_FLOAT32:
+				tag->m_fVal = data.ReadFloat();
+				break;
+
+			// NOTE: This tag data type is accepted and stored only to give us the possibility to upgrade 
+			// the net in some months.
+			//
+			// And still.. it doesnt't work this way without breaking backward compatibility
+			case TAGTYPE_BSOB: {
+				uint8 size = 0;
+				CScopedArray<unsigned char> value(data.ReadBsob(&size));
+				
+				if (arena) {
+					tag->m_pData = (unsigned char*)arena->Alloc(size);
+					memcpy(tag->m_pData, value.get(), size);
+				} else {
+					tag->m_pData = value.release();
+				}
+				tag->m_nSize = size;
+				break;
+			}
+
+			default:
+				throw wxString(CFormat(wxT("Invalid Kad tag type; type=0x%02x name=%s\n")) % type % tag->GetName());
+		}
+		tag->m_uType = type;
+	} catch(const CMuleException& e) {
+		AddLogLineN(e.what());
+		DestroyKadTag(tag, arena);
+		throw;
+	} catch(const wxString& e) {
+		AddLogLineN(e);
+		DestroyKadTag(tag, arena);
+		throw;
+	}
+
+	if (arena) {
+		arena->m_tags.push_back(tag);
+	}
+
+	return tag;
+}
+
+
+void CTag::DestroyKadTag(CTag* tag, CTagArena* arena)
+{
+	if (arena) {
+		if (tag) {
+			tag->~CTag();
+		}
+	} else {
+		delete tag;
+	}
+}
+
+
+///////////////////////////////////////////////////////////////////////////////
+// CTagArena
+
+CTagArena::CTagArena()
+	: m_block(0),
+	  m_used(0)
+{
+}
+
+
+CTagArena::~CTagArena()
+{
+	Clear();
+	for (size_t i = 0; i < m_blocks.size(); ++i) {
+		delete[] m_blocks[i];
+	}
+}
+
+
+void CTagArena::Clear()
+{
+	for (size_t i = 0; i < m_tags.size(); ++i) {
+		m_tags[i]->~CTag();
+	}
+	m_tags.clear();
+
+	for (size_t i = 0; i < m_large.size(); ++i) {
+		delete[] m_large[i];
+	}
+	m_large.clear();
+
+	m_block = 0;
+	m_used = 0;
+}
+
+
+void* CTagArena::Alloc(size_t size)
+{
+	// Keep every allocation aligned for uint64 and pointers
+	const size_t align = sizeof(uint64) > sizeof(void*) ? sizeof(uint64) : sizeof(void*);
+	size = (size + align - 1) & ~(align - 1);
+
+	if (size > BLOCK_SIZE / 4) {
+		byte* large = new byte[size];
+		m_large.push_back(large);
+		return large;
+	}
+
+	if (m_block < m_blocks.size() && m_used + size > BLOCK_SIZE) {
+		++m_block;
+		m_used = 0;
+	}
+	if (m_block == m_blocks.size()) {
+		m_blocks.push_back(new byte[BLOCK_SIZE]);
+	}
+
+	void* ptr = m_blocks[m_block] + m_used;
+	m_used += size;
+	return ptr;
+}
+
+
 bool CTag::WriteNewEd2kTag(CFileDataIO* data, EUtf8Str eStrEncode) const
 {
 
@@ -339,9 +698,9 @@ bool CTag::WriteNewEd2kTag(CFileDataIO* data, EUtf8Str eStrEncode) const
 	}
 
 	// Write tag name
-	if (!m_Name.IsEmpty()) {
+	if (!m_pName->IsEmpty()) {
 		data->WriteUInt8(uType);
-		data->WriteString(m_Name,utf8strNone);
+		data->WriteString(*m_pName,utf8strNone);
 	} else {
 		wxASSERT( m_uName != 0 );
 		data->WriteUInt8(uType | 0x80);
@@ -414,13 +773,13 @@ bool CTag::WriteTagToFile(CFileDataIO* file, EUtf8Str WXUNUSED(eStrEncode), bool
 wxString CTag::GetFullInfo() const
 {
 	wxString strTag;
-	if (!m_Name.IsEmpty()) {
+	if (!m_pName->IsEmpty()) {
 		// Special case: Kad tags, and some ED2k tags ...
-		if (m_Name.Length() == 1) {
-			strTag = CFormat(wxT("0x%02X")) % (unsigned)m_Name[0];
+		if (m_pName->Length() == 1) {
+			strTag = CFormat(wxT("0x%02X")) % (unsigned)(*m_pName)[0];
 		} else {
 			strTag = wxT('\"');
-			strTag += m_Name;
+			strTag += *m_pName;
 			strTag += wxT('\"');
 		}
 	} else {
@@ -33,8 +33,11 @@
 
 #include "OtherFunctions.h"
 
+#include <vector>
+
 class CMD4Hash;
 class CFileDataIO;
+class CTagArena;
 
 ///////////////////////////////////////////////////////////////////////////////
 // CTag
@@ -49,7 +52,7 @@ public:
 
 	uint8 GetType() const		{ return m_uType; }
 	uint8 GetNameID() const		{ return m_uName; }
-	const wxString& GetName() const	{ return m_Name; }
+	const wxString& GetName() const	{ return *m_pName; }
 	
 	bool IsStr() const		{ return m_uType == TAGTYPE_STRING; }
 	bool IsInt() const		{ return 
@@ -86,6 +89,29 @@ public:
 	
 	wxString GetFullInfo() const;
 
+	/**
+	 * Reads a tag like CTag(data, bOptUTF8), without creating it.
+	 *
+	 * @param data The data to read the tag from.
+	 * @param uName Receives the name ID, or 0 for string names.
+	 * @param uVal Receives the value of integer tags.
+	 * @return True if the tag was an integer, other values are skipped.
+	 *
+	 * Nothing is allocated, so this is the way to go through long
+	 * taglists when only a few integers are needed.
+	 */
+	static bool ReadIntOrSkip(const CFileDataIO& data, uint8& uName, uint64& uVal);
+
+	/**
+	 * Reads a tag in the Kad format, see CFileDataIO::ReadTag.
+	 *
+	 * @param data The data to read the tag from.
+	 * @param bOptACP Whether non-UTF8 strings may be converted from the local code page.
+	 * @param arena If not NULL, the tag and its value are allocated there.
+	 * @return The new tag, which must be deleted unless it is in an arena.
+	 */
+	static CTag* ReadKadTag(const CFileDataIO& data, bool bOptACP, CTagArena* arena = NULL);
+
 protected:
 	CTag(const wxString& Name);
 	CTag(uint8 uName);
@@ -102,9 +128,71 @@ protected:
 	uint32		m_nSize;
 	
 private:
+	enum {
+		//! m_pName is owned instead of interned
+		TAGF_OWNNAME	= 0x01,
+		//! The value was allocated from a CTagArena
+		TAGF_ARENA	= 0x02
+	};
+
+	void	SetName(const wxString& name);
+	void	CopyValue(const CTag& rTag);
+	void	FreeValue();
+	static void DestroyKadTag(CTag* tag, CTagArena* arena);
+
 	uint8		m_uName;
-	wxString	m_Name;
-	
+	uint8		m_flags;
+	//! Shared with all tags of the same name, see SetName
+	const wxString*	m_pName;
+};
+
+
+/**
+ * Storage for the tags of a single packet.
+ *
+ * Tags read into an arena (see CFileDataIO::ReadTagPtrList) are placed in
+ * a few blocks together with their values, instead of taking several heap
+ * allocations each. They are all destroyed by Clear() or when the arena
+ * goes away, so they must not be deleted individually, and CloneTag() has
+ * to be used to keep one of them. The blocks are kept on Clear(), so an
+ * arena reused for every packet quickly stops allocating at all.
+ *
+ * Only the characters of string values are still allocated by wxString.
+ */
+class CTagArena
+{
+public:
+	CTagArena();
+	~CTagArena();
+
+	/**
+	 * Destroys all tags in the arena.
+	 */
+	void	Clear();
+
+private:
+	friend class CTag;
+
+	//! Returns uninitialized memory, suitably aligned for any tag value.
+	void*	Alloc(size_t size);
+
+	//! Size of the blocks, larger allocations get a block of their own.
+	static const size_t BLOCK_SIZE = 8192;
+
+	//! Blocks of BLOCK_SIZE bytes, reused after Clear().
+	std::vector<byte*> m_blocks;
+	//! Oversized allocations, freed by Clear().
+	std::vector<byte*> m_large;
+	//! Index of the block allocations are taken from.
+	size_t		m_block;
+	//! Bytes used in that block.
+	size_t		m_used;
+	//! Tags to destroy on Clear().
+	std::vector<CTag*> m_tags;
+
+	// Not copyable
+	CTagArena(const CTagArena&);
+	CTagArena& operator=(const CTagArena&);
 };
 
 typedef std::list<CTag*> TagPtrList;
@@ -26,10 +26,11 @@
 #include "Logger.h"				// Needed for Add(Debug)LogLine{C,N}
 #include <common/Format.h>		// Needed for CFormat
 #include "ScopedPtr.h"			// Needed for CScopedPtr
+#include "PlatformSpecific.h"	// Needed for GetStorageDevice
 
-#include <algorithm>			// Needed for std::sort		// Do_not_auto_remove (mingw-gcc-3.4.5)
+#include <algorithm>			// Needed for std::find		// Do_not_auto_remove (mingw-gcc-3.4.5)
 
-//! Global lock the scheduler and its thread.
+//! Global lock the scheduler and its threads.
 static wxMutex s_lock;
 //! Pointer to the global scheduler instance (automatically instantiated).
 static CThreadScheduler* s_scheduler = NULL;
@@ -37,6 +38,8 @@ static CThreadScheduler* s_scheduler = NULL;
 static bool	s_running = false;
 //! Specifies if the gobal scheduler has been terminated.
 static bool s_terminated = false;
+//! The max number of worker threads, as passed to Start (0 for automatic).
+static unsigned s_maxThreads = 0;
 
 /**
  * This class is used in a custom implementation of wxThreadHelper.
@@ -58,7 +61,7 @@ public:
 
 	//! For simplicity's sake, all code is placed in CThreadScheduler::Entry
 	void* Entry() {
-		return m_owner->Entry();
+		return m_owner->Entry(this);
 	}
 
 private:
@@ -67,17 +70,32 @@ private:
 };
 
 
-void CThreadScheduler::Start()
+/** Returns the number of worker threads to use for the given setting. */
+static unsigned GetMaxThreads(unsigned maxThreads)
+{
+	if (maxThreads == 0) {
+		int cpus = wxThread::GetCPUCount();
+
+		maxThreads = (cpus > 0) ? cpus : 1;
+	}
+
+	return maxThreads;
+}
+
+
+void CThreadScheduler::Start(unsigned maxThreads)
 {
 	wxMutexLocker lock(s_lock);
 
 	s_running = true;
 	s_terminated = false;
+	s_maxThreads = maxThreads;
 
-	// Ensures that a thread is started if tasks are already waiting.
+	// Ensures that threads are started if tasks are already waiting.
 	if (s_scheduler) {
 		AddDebugLogLineN(logThreads, wxT("Starting scheduler"));
-		s_scheduler->CreateSchedulerThread();
+		s_scheduler->m_maxThreads = GetMaxThreads(s_maxThreads);
+		s_scheduler->CreateSchedulerThreads();
 	}
 }
 
@@ -136,158 +154,220 @@ wxString GetErrMsg(wxThreadError err)
 }
 
 
-void CThreadScheduler::CreateSchedulerThread()
+void CThreadScheduler::CreateSchedulerThreads()
 {
-	if ((m_thread && m_thread->IsAlive()) || m_tasks.empty()) {
+	if (!s_running || m_terminating) {
 		return;
 	}
 
-	// A thread can only be run once, so the old one must be safely disposed of
-	if (m_thread) {
-		AddDebugLogLineN(logThreads, wxT("CreateSchedulerThread: Disposing of old thread."));
-		m_thread->Stop();
-		delete m_thread;
+	// Threads can only be run once, so the old ones must be safely disposed of
+	for (CThreadList::iterator it = m_threads.begin(); it != m_threads.end();) {
+		if ((*it)->IsAlive()) {
+			++it;
+		} else {
+			AddDebugLogLineN(logThreads, wxT("CreateSchedulerThreads: Disposing of old thread."));
+			(*it)->Stop();
+			delete *it;
+			it = m_threads.erase(it);
+		}
 	}
-	
-	m_thread = new CTaskThread(this);
 
-	wxThreadError err = m_thread->Create();
-	if (err == wxTHREAD_NO_ERROR) {
-		// Try to avoid reducing the latency of the main thread
-		m_thread->SetPriority(WXTHREAD_MIN_PRIORITY);
-		
-		err = m_thread->Run();
+	// Idle threads will pick up one task each, before exiting.
+	size_t wanted = std::min<size_t>(m_maxThreads, m_runningTasks.size() + GetRunnableTaskCount());
+	while (m_activeThreads < wanted) {
+		CMuleThread* thread = new CTaskThread(this);
+
+		wxThreadError err = thread->Create();
 		if (err == wxTHREAD_NO_ERROR) {
-			AddDebugLogLineN(logThreads, wxT("Scheduler thread started"));
-			return;
+			// Try to avoid reducing the latency of the main thread
+			thread->SetPriority(WXTHREAD_MIN_PRIORITY);
+			
+			err = thread->Run();
+			if (err == wxTHREAD_NO_ERROR) {
+				AddDebugLogLineN(logThreads, wxT("Scheduler thread started"));
+				m_threads.push_back(thread);
+				++m_activeThreads;
+				continue;
+			} else {
+				AddDebugLogLineC(logThreads, wxT("Error while starting scheduler thread: ") + GetErrMsg(err));
+			}
 		} else {
-			AddDebugLogLineC(logThreads, wxT("Error while starting scheduler thread: ") + GetErrMsg(err));
+			AddDebugLogLineC(logThreads, wxT("Error while creating scheduler thread: ") + GetErrMsg(err));
 		}
-	} else {
-		AddDebugLogLineC(logThreads, wxT("Error while creating scheduler thread: ") + GetErrMsg(err));
+		
+		// Creation or running failed.
+		thread->Stop();
+		delete thread;
+		break;
 	}
-	
-	// Creation or running failed.
-	m_thread->Stop();
-	delete m_thread;
-	m_thread = NULL;
 }
 
 
-/** This is the sorter functor for the task-queue. */
-struct CTaskSorter 
+CThreadScheduler::CThreadScheduler()
+	: m_activeThreads(0),
+	  m_maxThreads(GetMaxThreads(s_maxThreads)),
+	  m_terminating(false)
 {
-	bool operator()(const CThreadScheduler::CEntryPair& a, const CThreadScheduler::CEntryPair& b) {
-		if (a.first->GetPriority() != b.first->GetPriority()) {
-			return a.first->GetPriority() > b.first->GetPriority();
-		}
-
-		// Compare tasks numbers.
-		return a.second < b.second;
-	}
-};
 
+}
 
 
-CThreadScheduler::CThreadScheduler()
-	: m_tasksDirty(false),
-	  m_thread(NULL),
-	  m_currentTask(NULL)
+CThreadScheduler::~CThreadScheduler()
 {
+	CThreadList threads;
+
+	{
+		wxMutexLocker lock(s_lock);
 
+		// Prevent running threads from starting new threads,
+		// and make the running tasks stop as soon as possible.
+		m_terminating = true;
+		std::set<CThreadTask*>::iterator it = m_runningTasks.begin();
+		for (; it != m_runningTasks.end(); ++it) {
+			(*it)->m_abort = true;
+		}
+
+		threads.swap(m_threads);
+	}
+
+	for (CThreadList::iterator it = threads.begin(); it != threads.end(); ++it) {
+		(*it)->Stop();
+		delete *it;
+	}
 }
 
 
-CThreadScheduler::~CThreadScheduler()
+size_t CThreadScheduler::GetTaskCount() const
 {
-	if (m_thread) {
-		m_thread->Stop();
-		delete m_thread;
+	size_t count = 0;
+	for (unsigned i = 0; i < ETP_Count; ++i) {
+		count += m_tasks[i].size();
 	}
+
+	return count;
 }
 
 
-size_t CThreadScheduler::GetTaskCount() const
+size_t CThreadScheduler::GetRunnableTaskCount() const
 {
-	wxMutexLocker lock(s_lock);
+	size_t count = 0;
+	// Disk-heavy tasks on the same device only count once.
+	std::set<wxString> devices(m_busyDevices);
+	for (unsigned i = 0; i < ETP_Count; ++i) {
+		CTaskQueue::const_iterator it = m_tasks[i].begin();
+		for (; it != m_tasks[i].end(); ++it) {
+			const wxString& device = (*it)->GetDevice();
+			if (device.IsEmpty() || devices.insert(device).second) {
+				++count;
+			}
+		}
+	}
 
-	return m_tasks.size();
+	return count;
 }
 
 
 bool CThreadScheduler::DoAddTask(CThreadTask* task, bool overwrite)
 {
-	// GetTick is too lowres, so we just use a counter to ensure that
-	// the sorted order will match the order in which the tasks were added.
-	static unsigned taskAge = 0;
-	
+	wxCHECK_MSG(task->GetPriority() < ETP_Count, false, wxT("Invalid task priority"));
+
 	// Get the map for this task type, implicitly creating it as needed.
 	CDescMap& map = m_taskDescs[task->GetType()];
 	
 	CDescMap::value_type entry(task->GetDesc(), task);
 	if (map.insert(entry).second) {
 		AddDebugLogLineN(logThreads, wxT("Task scheduled: ") + task->GetType() + wxT(" - ") + task->GetDesc());
-		m_tasks.push_back(CEntryPair(task, taskAge++));
-		m_tasksDirty = true;
+		m_tasks[task->GetPriority()].push_back(task);
 	} else if (overwrite) {
 		AddDebugLogLineN(logThreads, wxT("Task overwritten: ") + task->GetType() + wxT(" - ") + task->GetDesc());
 
 		CThreadTask* existingTask = map[task->GetDesc()];
-		if (m_currentTask == existingTask) {
+		if (m_runningTasks.count(existingTask)) {
 			// The duplicate is already being executed, abort it.
-			m_currentTask->m_abort = true;
+			existingTask->m_abort = true;
 		} else {
 			// Task not yet started, simply remove and delete.
-			wxCHECK2(map.erase(existingTask->GetDesc()), /* Do nothing. */);
+			RemoveQueuedTask(existingTask);
 			delete existingTask;
 		}
 			
-		m_tasks.push_back(CEntryPair(task, taskAge++));
+		m_tasks[task->GetPriority()].push_back(task);
 		map[task->GetDesc()] = task;
-		m_tasksDirty = true;
 	} else {
 		AddDebugLogLineN(logThreads, wxT("Duplicate task, discarding: ") + task->GetType() + wxT(" - ") + task->GetDesc());
 		delete task;
 		return false;
 	}
 
-	if (s_running) {
-		CreateSchedulerThread();
-	}
+	CreateSchedulerThreads();
 
 	return true;
 }
 
 
-void* CThreadScheduler::Entry()
+void CThreadScheduler::RemoveQueuedTask(CThreadTask* task)
+{
+	CTaskQueue& queue = m_tasks[task->GetPriority()];
+	CTaskQueue::iterator it = std::find(queue.begin(), queue.end(), task);
+
+	wxCHECK_RET(it != queue.end(), wxT("Task not found in queue"));
+	queue.erase(it);
+}
+
+
+CThreadTask* CThreadScheduler::PopNextTask()
+{
+	// Highest priority first, and within a priority the oldest task,
+	// skipping tasks that would compete for a busy device.
+	for (int i = ETP_Count - 1; i >= 0; --i) {
+		CTaskQueue& queue = m_tasks[i];
+		for (CTaskQueue::iterator it = queue.begin(); it != queue.end(); ++it) {
+			CThreadTask* task = *it;
+			const wxString& device = task->GetDevice();
+
+			if (device.IsEmpty() || m_busyDevices.insert(device).second) {
+				queue.erase(it);
+				m_runningTasks.insert(task);
+
+				return task;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+
+void* CThreadScheduler::Entry(CMuleThread* thread)
 {
 	AddDebugLogLineN(logThreads, wxT("Entering scheduling loop"));
 	
-	while (!m_thread->TestDestroy()) {
+	while (true) {
 		CScopedPtr<CThreadTask> task(NULL);
 
 		{
 			wxMutexLocker lock(s_lock);	
 			
-			// Resort tasks by priority/age if list has been modified.
-			if (m_tasksDirty) {
-				AddDebugLogLineN(logThreads, wxT("Resorting tasks"));
-				std::sort(m_tasks.begin(), m_tasks.end(), CTaskSorter());
-				m_tasksDirty = false;
-			} else if (m_tasks.empty()) {
-				AddDebugLogLineN(logThreads, wxT("No more tasks, stopping"));
+			// Select the next task
+			if (!m_terminating && !thread->TestDestroy()) {
+				task.reset(PopNextTask());
+			}
+
+			// The thread must be marked as stopped while the lock is held,
+			// otherwise new tasks could be left without a thread to run them.
+			if (!task.get()) {
+				AddDebugLogLineN(logThreads, wxT("No more runnable tasks, stopping"));
+				--m_activeThreads;
 				break;
 			}
-			
-			// Select the next task
-			task.reset(m_tasks.front().first);
-			m_tasks.pop_front();
-			m_currentTask = task.get();
+
+			// Let other threads pick up any remaining tasks.
+			CreateSchedulerThreads();
 		}
 
 		AddDebugLogLineN(logThreads, wxT("Current task: ") + task->GetType() + wxT(" - ") + task->GetDesc());
 		// Execute the task
-		task->m_owner = m_thread;
+		task->m_owner = thread;
 		task->Entry();
 		task->OnExit();
 	
@@ -305,7 +385,7 @@ void* CThreadScheduler::Entry()
 					CFormat(wxT("Completed task '%s%s', %u tasks remaining.")) 
 						% task->GetType()
 						% (task->GetDesc().IsEmpty() ? wxString() : (wxT(" - ") + task->GetDesc()))
-						% m_tasks.size() );
+						% GetTaskCount() );
 				
 				CDescMap& map = m_taskDescs[task->GetType()];
 				if (!map.erase(task->GetDesc())) {
@@ -316,7 +396,10 @@ void* CThreadScheduler::Entry()
 				}
 			}
 
-			m_currentTask = NULL;
+			m_runningTasks.erase(task.get());
+			if (!task->GetDevice().IsEmpty()) {
+				m_busyDevices.erase(task->GetDevice());
+			}
 		}
 
 		if (isLastTask) {
@@ -386,4 +469,20 @@ ETaskPriority CThreadTask::GetPriority() const
 }
 
 
+const wxString& CThreadTask::GetDevice() const
+{
+	return m_device;
+}
+
+
+void CThreadTask::SetDiskUsage(const CPath& path)
+{
+	m_device = PlatformSpecific::GetStorageDevice(path);
+	if (m_device.IsEmpty()) {
+		// Unknown device, assume that all such tasks share one.
+		m_device = wxT("?");
+	}
+}
+
+
 // File_checked_for_headers
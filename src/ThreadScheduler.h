@@ -29,12 +29,15 @@
 
 #include <deque>
 #include <map>
+#include <set>
+#include <vector>
 
 #include "Types.h"
 #include "MuleThread.h"
 
 
 class CThreadTask;
+class CPath;
 
 
 //! The priority values of tasks.
@@ -44,19 +47,27 @@ enum ETaskPriority
 	ETP_Normal,
 	ETP_High,
 	//! For tasks such as finding shared files and ipfilter.dat loading only.
-	ETP_Critical
+	ETP_Critical,
+	//! Number of priorities, not a valid priority.
+	ETP_Count
 };
 
 
 /**
  * This class mananges scheduling of background tasks.
  *
- * Currently it is assumed that all tasks are IO intensive,
- * so that only a single task is allowed to proceed at any
- * one time. All threads are run in lowest priority mode.
- * 
- * Tasks are sorted by priority (see ETaskPriority) and age.
- *  
+ * Tasks are executed by a pool of worker threads, which
+ * are created as needed and exit once there is no more
+ * work to be done. All threads are run in lowest priority
+ * mode.
+ *
+ * Tasks are kept in one queue per priority (see ETaskPriority),
+ * and are selected by priority and then by age. Tasks which
+ * are disk-heavy (see CThreadTask::SetDiskUsage) are never run
+ * at the same time as another disk-heavy task on the same
+ * storage device, in which case the next task that does not
+ * conflict is selected instead.
+ *
  * Note that the scheduler starts in suspended mode, in
  * which tasks are queued but not executed. Call Start()
  * to begin execution of the tasks.
@@ -64,8 +75,12 @@ enum ETaskPriority
 class CThreadScheduler
 {
 public:
-	/** Starts execution of queued tasks. */
-	static void Start();
+	/**
+	 * Starts execution of queued tasks.
+	 *
+	 * @param maxThreads The max number of worker threads, 0 for one per CPU.
+	 */
+	static void Start(unsigned maxThreads = 0);
 	
 	/**
 	 * Terminates task execution and frees the scheduler object.
@@ -97,39 +112,52 @@ private:
 	CThreadScheduler();
 	~CThreadScheduler();
 
-	/** Returns the number of tasks on the queue. */
+	/** Returns the number of tasks on the queues. */
 	size_t GetTaskCount() const;
 	
+	/** Returns the number of queued tasks that could be started right now. */
+	size_t GetRunnableTaskCount() const;
+
 	/** Tries to add the given task to the queue, returning true on success. */
 	bool DoAddTask(CThreadTask* task, bool overwrite);
 	
-	/** Creates the actual scheduler thread if none exist. */
-	void CreateSchedulerThread();
+	/** Removes a queued (not running) task from its queue. */
+	void RemoveQueuedTask(CThreadTask* task);
+
+	/** Returns the next task that may be started, removing it from the queue, or NULL. */
+	CThreadTask* PopNextTask();
+
+	/** Creates worker threads as long as there are tasks that could be run. */
+	void CreateSchedulerThreads();
 
-	/** Entry function called via internal thread-object. */
-	void* Entry();
+	/** Entry function called via internal thread-objects. */
+	void* Entry(CMuleThread* thread);
 		
-	//! Contains a task and its age.
-	typedef std::pair<CThreadTask*, uint32> CEntryPair;
-	
-	//! List of currently scheduled tasks. 
-	std::deque<CEntryPair> m_tasks;
+	typedef std::deque<CThreadTask*> CTaskQueue;
+	//! Currently scheduled tasks, one queue per priority, oldest first.
+	CTaskQueue m_tasks[ETP_Count];
 
-	//! Specifies if tasks should be resorted by priority.
-	bool	m_tasksDirty;
-	
 	typedef std::map<wxString, CThreadTask*> CDescMap;
 	typedef std::map<wxString, CDescMap> CTypeMap;
 	//! Map of current task by type -> desc. Used to avoid duplicate tasks.
 	CTypeMap m_taskDescs;
 
-	//! The actual worker thread.
-	CMuleThread* m_thread;
-	//! The currently running task, if any.
-	CThreadTask* m_currentTask;
+	typedef std::vector<CMuleThread*> CThreadList;
+	//! The worker threads, including threads that have finished but not yet been freed.
+	CThreadList m_threads;
+	//! The number of worker threads still executing the scheduling loop.
+	unsigned m_activeThreads;
+	//! The max number of worker threads.
+	unsigned m_maxThreads;
+	//! Specifies if the scheduler is being destroyed, in which case no more threads are created.
+	bool	m_terminating;
+
+	//! The currently running tasks.
+	std::set<CThreadTask*> m_runningTasks;
+	//! Storage devices currently used by a running disk-heavy task.
+	std::set<wxString> m_busyDevices;
 	
 	friend class CTaskThread;
-	friend struct CTaskSorter;
 };
 
 
@@ -145,6 +173,9 @@ private:
  * all tasks of a given type and in duplicate detection
  * with the description. The description should be unique
  * for the given task, such that duplicates can be discovered.
+ *
+ * Since several tasks may be executed at the same time,
+ * tasks must not share unprotected state with each other.
  */
 class CThreadTask
 {
@@ -168,6 +199,9 @@ public:
 	/** Returns the priority of the task. Used when selecting the next task. */
 	ETaskPriority GetPriority() const;
 	
+	/** Returns the storage device used by a disk-heavy task, empty otherwise. */
+	const wxString& GetDevice() const;
+
 protected:
 	//! @see wxThread::Entry
 	virtual void Entry() = 0;
@@ -180,11 +214,21 @@ protected:
 
 	/** @see wxThread::TestDestroy */
 	bool TestDestroy() const;
+
+	/**
+	 * Marks the task as disk-heavy, working on the device holding 'path'.
+	 *
+	 * Should be called from the constructor. Disk-heavy tasks on the
+	 * same device are executed one at a time, as to avoid seeking back
+	 * and forth between files.
+	 */
+	void SetDiskUsage(const CPath& path);
 	
 private:
 	wxString m_type;
 	wxString m_desc;
 	ETaskPriority m_priority;
+	wxString m_device;
 
 	//! The owner (scheduler), used when calling TestDestroy.
 	CMuleThread* m_owner;
@@ -38,6 +38,9 @@
 #include "PlatformSpecific.h"		// Needed for CanFSHandleSpecialChars
 #ifdef ENABLE_TORRENT
 #include "Torrent.h"
+#include "TorrentCreator.h"
+#include "FileArea.h"			// Needed for CFileArea
+#include "OtherFunctions.h"		// Needed for CPathToBoost
 #endif
 
 #ifdef HAVE_CONFIG_H
@@ -69,6 +72,15 @@ CHashingTask::CHashingTask(const CPath& path, const CPath& filename, const CPart
 	if (part && !part->GetGapList().empty()) {
 		m_toHash = EH_MD4;
 	}
+
+#ifdef ENABLE_TORRENT
+	m_torrentCreator = NULL;
+	if (part == NULL) {
+		m_creatorName = thePrefs::GetUserNick();
+	}
+#endif
+
+	SetDiskUsage(m_path);
 }
 
 
@@ -80,6 +92,11 @@ CHashingTask::CHashingTask(const CKnownFile* toAICHHash)
 	  m_toHash(EH_AICH),
 	  m_owner(toAICHHash)
 {
+#ifdef ENABLE_TORRENT
+	m_torrentCreator = NULL;
+#endif
+
+	SetDiskUsage(m_path);
 }
 
 
@@ -146,6 +163,18 @@ void CHashingTask::Entry()
 		wxCHECK_RET(0, (CFormat(wxT("No hashes requested for file, skipping: %s"))
 			% m_filename).GetString());
 	}
+
+#ifdef ENABLE_TORRENT
+	// New shared files get their torrent metadata built from the same reads.
+	CScopedPtr<torrent::CTorrentCreator> torrentCreator(NULL);
+	if (m_owner == NULL) {
+		torrentCreator.reset(new torrent::CTorrentCreator(CPathToBoost(fullPath), std::string(m_creatorName)));
+		if (!torrentCreator->IsOk()) {
+			torrentCreator.reset();
+		}
+	}
+	m_torrentCreator = torrentCreator.get();
+#endif
 	
 
 	// This loops creates the part-hashes, loop-de-loop.
@@ -200,13 +229,45 @@ void CHashingTask::Entry()
 		
 		wxPostEvent(wxTheApp, evt);
 	} else if (!TestDestroy()) {
+#ifdef ENABLE_TORRENT
+		CMD4Hash fileId = knownfile->GetFileHash();
+#endif
 		CHashingEvent evt(MULE_EVT_HASHING, knownfile.release(), m_owner);
 		
 		wxPostEvent(wxTheApp, evt);
+
+#ifdef ENABLE_TORRENT
+		// Posted after the hashing event, so the file is known when the metadata is registered.
+		if (m_torrentCreator) {
+			SaveTorrentMetadata(fileId);
+		}
+#endif
 	}
 }
 
 
+#ifdef ENABLE_TORRENT
+void CHashingTask::SaveTorrentMetadata(const CMD4Hash& fileId)
+{
+	if (!m_torrentCreator->IsComplete()) {
+		AddDebugLogLineC(logHasher, CFormat(wxT("Torrent metadata incomplete after hashing, skipping: %s")) % m_filename);
+		return;
+	}
+
+	// An empty filename tells the main thread that saving failed.
+	CPath torrentFile;
+	try {
+		torrentFile = BoostToCPath(m_torrentCreator->Save(fileId));
+	} catch (const boost::filesystem::filesystem_error& e) {
+		AddDebugLogLineC(logHasher, CFormat(wxT("Failed to save torrent metadata of %s: %s")) % m_filename % wxString(e.what(), wxConvUTF8));
+	}
+
+	CTorrentCreatedEvent evt(fileId, torrentFile);
+	wxPostEvent(wxTheApp, evt);
+}
+#endif
+
+
 bool CHashingTask::CreateNextPartHash(CFileAutoClose& file, uint16 part, CKnownFile* owner, EHashes toHash)
 {
 	wxCHECK_MSG(!file.Eof(), false, wxT("Unexpected EOF in CreateNextPartHash"));
@@ -224,6 +285,16 @@ bool CHashingTask::CreateNextPartHash(CFileAutoClose& file, uint16 part, CKnownF
 		aichHash = owner->GetAICHHashset()->m_pHashTree.FindHash(offset, partLength);
 	}
 
+#ifdef ENABLE_TORRENT
+	if (m_torrentCreator) {
+		// The mapped part is fed to the torrent metadata too, so the file is read only once.
+		CFileArea area;
+		area.ReadAt(file, offset, partLength);
+		owner->CreateHashFromInput(area.GetBuffer(), partLength, md4Hash, aichHash);
+		m_torrentCreator->Update(area.GetBuffer(), partLength);
+		area.CheckError();
+	} else
+#endif
 	owner->CreateHashFromFile(file, offset, partLength, md4Hash, aichHash);
 	
 	if (toHash & EH_MD4) {
@@ -256,6 +327,58 @@ void CHashingTask::OnLastTask()
 }
 
 
+////////////////////////////////////////////////////////////
+// CPartHashingTask
+
+CPartHashingTask::CPartHashingTask(const CPartFile* part, uint16 partNumber)
+	// GetPrintable is used to improve the readability of the log.
+	: CThreadTask(wxT("Verifying"), CFormat(wxT("%s (part %u)")) % part->GetFullName().RemoveExt().GetPrintable() % partNumber, ETP_High),
+	  m_path(part->GetFullName().RemoveExt()),
+	  m_offset(PARTSIZE * partNumber),
+	  m_length(part->GetPartSize(partNumber)),
+	  m_part(partNumber),
+	  m_owner(part),
+	  m_error(false)
+{
+	wxASSERT(m_path.IsOk());
+	wxASSERT(m_length);
+}
+
+
+void CPartHashingTask::Entry()
+{
+	CFileAutoClose file;
+
+	if (!file.Open(m_path, CFile::read)) {
+		AddDebugLogLineC(logPartFile,
+			CFormat(wxT("Failed to open partfile for verification of part %u: %s")) % m_part % m_path);
+		m_error = true;
+		return;
+	}
+
+	try {
+		CKnownFile::CreateHashFromFile(file, m_offset, m_length, &m_hash, NULL);
+	} catch (const CIOFailureException& e) {
+		AddLogLineC(CFormat( _("EOF while hashing downloaded part %u with length %u (max %u) of partfile '%s': %s"))
+			% m_part % m_length % (m_offset + m_length) % m_path.GetFullName() % e.what());
+		m_error = true;
+	} catch (const CEOFException& e) {
+		AddLogLineC(CFormat( _("EOF while hashing downloaded part %u with length %u (max %u) of partfile '%s': %s"))
+			% m_part % m_length % (m_offset + m_length) % m_path.GetFullName() % e.what());
+		m_error = true;
+	}
+}
+
+
+void CPartHashingTask::OnExit()
+{
+	// Notify the partfile that the verification has finished for this part.
+	CPartHashingEvent evt(m_owner, m_part, m_hash, m_error);
+
+	wxPostEvent(wxTheApp, evt);
+}
+
+
 ////////////////////////////////////////////////////////////
 // CAICHSyncTask
 
@@ -265,22 +388,25 @@ CAICHSyncTask::CAICHSyncTask()
 }
 
 
-void CAICHSyncTask::Entry()
+bool CAICHSyncTask::LoadMasterHashes(std::list<CAICHHash>& hashlist)
 {
 	ConvertToKnown2ToKnown264();
 	
 	AddDebugLogLineN( logAICHThread, wxT("Syncronization thread started.") );
 	
-	// We collect all masterhashs which we find in the known2.met and store them in a list
-	std::list<CAICHHash> hashlist;
 	const CPath fullpath = CPath(theApp->ConfigDir + KNOWN2_MET_FILENAME);
 	
 	CFile file;
 	if (!file.Open(fullpath, (fullpath.FileExists() ? CFile::read_write : CFile::write))) {
 		AddDebugLogLineC( logAICHThread, wxT("Error, failed to open 'known2_64.met' file!") );
-		return;
+		return false;
 	}
 
+	// The index is rebuilt along with the list, so that loading and
+	// saving hashsets don't need to scan the file anymore.
+	CAICHHashSet::m_known2Indexed = false;
+	CAICHHashSet::m_known2Index.clear();
+
 	uint32 nLastVerifiedPos = 0;
 	try {
 		if (file.Eof()) {
@@ -293,12 +419,15 @@ void CAICHSyncTask::Entry()
 			uint64 nExistingSize = file.GetLength();
 			while (file.GetPosition() < nExistingSize) {
 				// Read the next hash
+				uint64 nHashSetPos = file.GetPosition();
 				hashlist.push_back(CAICHHash(&file));
 
 				uint32 nHashCount = file.ReadUInt32();
 				if (file.GetPosition() + nHashCount * CAICHHash::GetHashSize() > nExistingSize){
 					throw CEOFException(wxT("Hashlist ends past end of file."));
 				}
+				// The first copy is the one a scan would find
+				CAICHHashSet::m_known2Index.insert(std::make_pair(hashlist.back(), nHashSetPos));
 
 				// skip the rest of this hashset
 				nLastVerifiedPos = file.Seek(nHashCount * HASHSIZE, wxFromCurrent);
@@ -309,8 +438,28 @@ void CAICHSyncTask::Entry()
 		file.SetLength(nLastVerifiedPos);
 	} catch (const CIOFailureException& e) {
 		AddDebugLogLineC(logAICHThread, wxT("IO failure while reading hashlist (Aborting): ") + e.what());
+		CAICHHashSet::m_known2Index.clear();
 		
-		return;		
+		return false;
+	}
+
+	CAICHHashSet::m_known2Indexed = true;
+	return true;
+}
+
+
+void CAICHSyncTask::Entry()
+{
+	// We collect all masterhashs which we find in the known2.met and store them in a list
+	std::list<CAICHHash> hashlist;
+
+	{
+		// Hashing tasks may be saving hashsets at the same time.
+		wxMutexLocker lockKnown2Met(CAICHHashSet::m_mutKnown2File);
+
+		if (!LoadMasterHashes(hashlist)) {
+			return;
+		}
 	}
 	
 	AddDebugLogLineN( logAICHThread, wxT("Masterhashes of known files have been loaded.") );
@@ -385,21 +534,78 @@ bool CAICHSyncTask::ConvertToKnown2ToKnown264()
 
 
 
+#ifdef ENABLE_TORRENT
 ////////////////////////////////////////////////////////////
-// CCompletionTask
+// CTorrentCreationTask
 
-#ifdef ENABLE_TORRENT
-CCompletionTask::CCompletionTask(const CPartFile* file)
+CTorrentCreationTask::CTorrentCreationTask(const CMD4Hash& fileId, const CPath& path, const CPath& filename)
 	// GetPrintable is used to improve the readability of the log.
-	: CThreadTask(wxT("Completing"), file->GetFullName().GetPrintable(), ETP_High),
-	  m_filename(file->GetFileName()),
-	  m_metPath(file->GetFullName()),
-	  m_category(file->GetCategory()),
-	  m_owner(file),
-	  m_error(false),
-	  m_fileId(file->GetFileHash())
+	: CThreadTask(wxT("Torrent creation"), path.JoinPaths(filename).GetPrintable(), ETP_Low),
+	  m_fileId(fileId),
+	  m_path(path),
+	  m_filename(filename),
+	  m_creatorName(thePrefs::GetUserNick()),
+	  m_saved(false)
 {
-#else
+	SetDiskUsage(m_path);
+}
+
+
+void CTorrentCreationTask::Entry()
+{
+	CPath fullPath = m_path.JoinPaths(m_filename);
+	torrent::CTorrentCreator creator(CPathToBoost(fullPath), std::string(m_creatorName));
+	if (!creator.IsOk()) {
+		AddDebugLogLineC(logHasher, CFormat(wxT("No content to create torrent metadata for, skipping: %s")) % fullPath);
+		return;
+	}
+
+	CFileAutoClose file;
+	if (!file.Open(fullPath, CFile::read)) {
+		AddDebugLogLineC(logHasher, CFormat(wxT("Warning, failed to open file, skipping: %s")) % fullPath);
+		return;
+	}
+
+	try {
+		// Read in PARTSIZE chunks, the same way CHashingTask maps the file.
+		const uint64 length = file.GetLength();
+		for (uint64 offset = 0; offset < length && !TestDestroy(); offset += PARTSIZE) {
+			const uint32 count = std::min<uint64>(PARTSIZE, length - offset);
+			CFileArea area;
+			area.ReadAt(file, offset, count);
+			creator.Update(area.GetBuffer(), count);
+			area.CheckError();
+		}
+	} catch (const CSafeIOException& e) {
+		AddDebugLogLineC(logHasher, wxT("IO exception while creating torrent metadata: ") + e.what());
+		return;
+	}
+
+	if (!TestDestroy() && creator.IsComplete()) {
+		m_saved = true;
+		try {
+			m_torrentFile = BoostToCPath(creator.Save(m_fileId));
+		} catch (const boost::filesystem::filesystem_error& e) {
+			AddDebugLogLineC(logHasher, CFormat(wxT("Failed to save torrent metadata of %s: %s")) % fullPath % wxString(e.what(), wxConvUTF8));
+		}
+	}
+}
+
+
+void CTorrentCreationTask::OnExit()
+{
+	// A failed save is reported as well, with an empty filename.
+	if (m_saved) {
+		CTorrentCreatedEvent evt(m_fileId, m_torrentFile);
+		wxPostEvent(wxTheApp, evt);
+	}
+}
+#endif
+
+
+////////////////////////////////////////////////////////////
+// CCompletionTask
+
 CCompletionTask::CCompletionTask(const CPartFile* file)
 	// GetPrintable is used to improve the readability of the log.
 	: CThreadTask(wxT("Completing"), file->GetFullName().GetPrintable(), ETP_High),
@@ -409,10 +615,12 @@ CCompletionTask::CCompletionTask(const CPartFile* file)
 	  m_owner(file),
 	  m_error(false)
 {
-#endif
 	wxASSERT(m_filename.IsOk());
 	wxASSERT(m_metPath.IsOk());
 	wxASSERT(m_owner);
+
+	// The destination is not known yet, but moving within a device is cheap.
+	SetDiskUsage(m_metPath);
 }
 	
 
@@ -470,13 +678,6 @@ void CCompletionTask::Entry()
 		}
 	}
 
-#ifdef ENABLE_TORRENT
-	// Create a torrent if this was not created earlier.
-	if(!torrent::CTorrent::GetInstance().HasBTMetadata(m_fileId)){
-		torrent::CTorrent::GetInstance().GiveUp(m_fileId);
-		torrent::CTorrent::GetInstance().CreateMetadataForFile(m_fileId, dstName, targetPath);
-	}
-#endif
 	// Removes the various other data-files	
 	const wxChar* otherMetExt[] = { wxT(""), PARTMET_BAK_EXT, wxT(".seeds"), NULL };
 	for (size_t i = 0; otherMetExt[i]; ++i) {
@@ -534,6 +735,8 @@ CAllocateFileTask::CAllocateFileTask(CPartFile *file, bool pause)
 	  m_file(file), m_pause(pause), m_result(ENOSYS)
 {
 	wxASSERT(file != NULL);
+
+	SetDiskUsage(file->GetFullName());
 }
 
 void CAllocateFileTask::Entry()
@@ -657,6 +860,28 @@ CKnownFile* CHashingEvent::GetResult() const
 
 
 
+////////////////////////////////////////////////////////////
+// CPartHashingEvent
+
+DEFINE_LOCAL_EVENT_TYPE(MULE_EVT_PART_HASHING)
+
+
+CPartHashingEvent::CPartHashingEvent(const CPartFile* owner, uint16 part, const CMD4Hash& hash, bool errorOccured)
+	: wxEvent(-1, MULE_EVT_PART_HASHING),
+	  m_owner(owner),
+	  m_part(part),
+	  m_hash(hash),
+	  m_error(errorOccured)
+{
+}
+
+
+wxEvent* CPartHashingEvent::Clone() const
+{
+	return new CPartHashingEvent(m_owner, m_part, m_hash, m_error);
+}
+
+
 ////////////////////////////////////////////////////////////
 // CCompletionEvent
 
@@ -696,6 +921,28 @@ const CPath& CCompletionEvent::GetFullPath() const
 }
 
 
+#ifdef ENABLE_TORRENT
+////////////////////////////////////////////////////////////
+// CTorrentCreatedEvent
+
+DEFINE_LOCAL_EVENT_TYPE(MULE_EVT_TORRENT_CREATED)
+
+
+CTorrentCreatedEvent::CTorrentCreatedEvent(const CMD4Hash& fileId, const CPath& torrentFile)
+	: wxEvent(-1, MULE_EVT_TORRENT_CREATED),
+	  m_fileId(fileId),
+	  m_torrentFile(torrentFile)
+{
+}
+
+
+wxEvent* CTorrentCreatedEvent::Clone() const
+{
+	return new CTorrentCreatedEvent(m_fileId, m_torrentFile);
+}
+#endif
+
+
 ////////////////////////////////////////////////////////////
 // CAllocFinishedEvent
 
@@ -29,13 +29,19 @@
 
 #include "ThreadScheduler.h"
 #include <common/Path.h>
-#ifdef ENABLE_TORRENT
 #include "MD4Hash.h"
-#endif
+
+#include <list>
 
 class CKnownFile;
 class CPartFile;
+class CAICHHash;
 class CFileAutoClose;
+#ifdef ENABLE_TORRENT
+namespace torrent {
+	class CTorrentCreator;
+}
+#endif
 
 
 /**
@@ -104,6 +110,15 @@ protected:
 	 */
 	bool CreateNextPartHash(CFileAutoClose& file, uint16 part, CKnownFile* owner, EHashes toHash);
 
+#ifdef ENABLE_TORRENT
+	/**
+	 * Saves the torrent metadata built while hashing and notifies the core.
+	 *
+	 * @param fileId The MD4 hash of the hashed file.
+	 */
+	void SaveTorrentMetadata(const CMD4Hash& fileId);
+#endif
+
 
 	//! The path to the file to be hashed (shared or part), without filename.
 	CPath m_path;
@@ -113,6 +128,58 @@ protected:
 	EHashes m_toHash;
 	//! If a partfile or an AICH hashing, this pointer stores it for callbacks.
 	const CKnownFile* m_owner;
+#ifdef ENABLE_TORRENT
+	//! Creator written in the torrent metadata, read in the constructor for thread-safety.
+	wxString m_creatorName;
+	//! Builds the torrent metadata of new shared files while hashing them, NULL otherwise.
+	torrent::CTorrentCreator* m_torrentCreator;
+#endif
+};
+
+
+/**
+ * This task verifies a single part of a partfile.
+ *
+ * Completed parts are queued by CPartFile::FlushBuffer, so that
+ * the MD4 hashing of the part does not stall the core thread.
+ * Only the hash is computed here; comparing it against the
+ * expected part-hash is left to the partfile, which receives
+ * the result via a CPartHashingEvent.
+ *
+ * @see CPartHashingEvent
+ */
+class CPartHashingTask : public CThreadTask
+{
+public:
+	/**
+	 * Schedules a part of a partfile for verification.
+	 *
+	 * @param part The partfile owning the part, used to identify the owner in the event-handler.
+	 * @param partNumber The number of the part to hash.
+	 */
+	CPartHashingTask(const CPartFile* part, uint16 partNumber);
+
+protected:
+	/** See CThreadTask::Entry */
+	virtual void Entry();
+
+	/** See CThreadTask::OnExit */
+	virtual void OnExit();
+
+	//! The full path to the .part file.
+	CPath		m_path;
+	//! Offset of the part in the file.
+	uint64		m_offset;
+	//! Length of the part.
+	uint32		m_length;
+	//! The number of the part being hashed.
+	uint16		m_part;
+	//! Owner of the part, used when sending the result.
+	const CPartFile*	m_owner;
+	//! The resulting MD4 hash.
+	CMD4Hash	m_hash;
+	//! Specifies if the part could not be read.
+	bool		m_error;
 };
 
 
@@ -132,9 +199,58 @@ protected:
 
 	/** Converts old known2.met files to known2_64.met files. */
 	bool ConvertToKnown2ToKnown264();
+
+	/** Reads the masterhashes found in known2_64.met, returning false on failure. */
+	bool LoadMasterHashes(std::list<CAICHHash>& hashlist);
 };
 
 
+#ifdef ENABLE_TORRENT
+/**
+ * This task creates the torrent metadata of a shared file.
+ *
+ * It is used for files that are already known, new shared files get their
+ * torrent metadata built by the CHashingTask while they are read for MD4 and
+ * AICH. The info-file is saved by the task, while registering it in the
+ * torrent session is left to the core, which receives a CTorrentCreatedEvent.
+ *
+ * @see CTorrentCreatedEvent
+ */
+class CTorrentCreationTask : public CThreadTask
+{
+public:
+	/**
+	 * Schedules the creation of the torrent metadata of a file.
+	 *
+	 * @param fileId The MD4 hash of the file.
+	 * @param path The full path, without filename.
+	 * @param filename The actual filename.
+	 */
+	CTorrentCreationTask(const CMD4Hash& fileId, const CPath& path, const CPath& filename);
+
+protected:
+	/** See CThreadTask::Entry */
+	virtual void Entry();
+
+	/** See CThreadTask::OnExit */
+	virtual void OnExit();
+
+	//! The MD4 hash of the file.
+	CMD4Hash	m_fileId;
+	//! The path to the file, without filename.
+	CPath		m_path;
+	//! The filename of the file.
+	CPath		m_filename;
+	//! Creator written in the torrent metadata.
+	wxString	m_creatorName;
+	//! Specifies if saving the info-file was attempted.
+	bool		m_saved;
+	//! Filename of the saved info-file, empty on failure.
+	CPath		m_torrentFile;
+};
+#endif
+
+
 /**
  * This task performs the final tasks on a complete download.
  *
@@ -169,9 +285,6 @@ protected:
 	bool		m_error;
 	//! The resulting full path. File may be be renamed.
 	CPath		m_newName;
-#ifdef ENABLE_TORRENT
-	CMD4Hash    m_fileId;
-#endif
 };
 
 
@@ -233,6 +346,74 @@ private:
 };
 
 
+/**
+ * This event is used to signal the completion of a part verification.
+ *
+ * @see CPartHashingTask
+ */
+class CPartHashingEvent : public wxEvent
+{
+public:
+	/** Constructor, see getter funtion for description of parameters. */
+	CPartHashingEvent(const CPartFile* owner, uint16 part, const CMD4Hash& hash, bool errorOccured);
+
+	/** @see wxEvent::Clone */
+	virtual wxEvent* Clone() const;
+
+	/** Returns the owner of the part that was hashed. */
+	const CPartFile* GetOwner() const	{ return m_owner; }
+
+	/** Returns the number of the part that was hashed. */
+	uint16 GetPart() const			{ return m_part; }
+
+	/** Returns the MD4 hash of the part (invalid on failure). */
+	const CMD4Hash& GetHash() const		{ return m_hash; }
+
+	/** Returns true if the part could not be read. */
+	bool ErrorOccured() const		{ return m_error; }
+
+private:
+	//! The owner of the hashed part.
+	const CPartFile* m_owner;
+	//! The number of the hashed part.
+	uint16 m_part;
+	//! The resulting hash.
+	CMD4Hash m_hash;
+	//! Specifies if hashing failed.
+	bool m_error;
+};
+
+
+#ifdef ENABLE_TORRENT
+/**
+ * This event is sent when the torrent metadata of a shared file was saved.
+ *
+ * @see CTorrentCreationTask
+ */
+class CTorrentCreatedEvent : public wxEvent
+{
+public:
+	/** Constructor, see getter funtion for description of parameters. */
+	CTorrentCreatedEvent(const CMD4Hash& fileId, const CPath& torrentFile);
+
+	/** @see wxEvent::Clone */
+	virtual wxEvent* Clone() const;
+
+	/** Returns the MD4 hash of the file the metadata was created for. */
+	const CMD4Hash& GetFileId() const	{ return m_fileId; }
+
+	/** Returns the filename of the info-file, in the torrent metadata directory, or an empty path if saving failed. */
+	const CPath& GetTorrentFile() const	{ return m_torrentFile; }
+
+private:
+	//! The MD4 hash of the file.
+	CMD4Hash m_fileId;
+	//! The filename of the saved info-file.
+	CPath m_torrentFile;
+};
+#endif
+
+
 /**
  * This event is sent when a part-file has been completed.
  */
@@ -306,12 +487,20 @@ class CAllocFinishedEvent : public wxEvent
 
 DECLARE_LOCAL_EVENT_TYPE(MULE_EVT_HASHING, -1)
 DECLARE_LOCAL_EVENT_TYPE(MULE_EVT_AICH_HASHING, -1)
+DECLARE_LOCAL_EVENT_TYPE(MULE_EVT_PART_HASHING, -1)
 DECLARE_LOCAL_EVENT_TYPE(MULE_EVT_FILE_COMPLETED, -1)
+#ifdef ENABLE_TORRENT
+DECLARE_LOCAL_EVENT_TYPE(MULE_EVT_TORRENT_CREATED, -1)
+#endif
 
 	
 typedef void (wxEvtHandler::*MuleHashingEventFunction)(CHashingEvent&);
+typedef void (wxEvtHandler::*MulePartHashingEventFunction)(CPartHashingEvent&);
 typedef void (wxEvtHandler::*MuleCompletionEventFunction)(CCompletionEvent&);
 typedef void (wxEvtHandler::*MuleAllocFinishedEventFunction)(CAllocFinishedEvent&);
+#ifdef ENABLE_TORRENT
+typedef void (wxEvtHandler::*MuleTorrentCreatedEventFunction)(CTorrentCreatedEvent&);
+#endif
 
 //! Event-handler for completed hashings of new shared files and partfiles.
 #define EVT_MULE_HASHING(func) \
@@ -325,6 +514,12 @@ typedef void (wxEvtHandler::*MuleAllocFinishedEventFunction)(CAllocFinishedEvent
 	(wxObjectEventFunction) (wxEventFunction) \
 	wxStaticCastEvent(MuleHashingEventFunction, &func), (wxObject*) NULL),
 
+//! Event-handler for completed verifications of single parts of part-files.
+#define EVT_MULE_PART_HASHING(func) \
+	DECLARE_EVENT_TABLE_ENTRY(MULE_EVT_PART_HASHING, -1, -1, \
+	(wxObjectEventFunction) (wxEventFunction) \
+	wxStaticCastEvent(MulePartHashingEventFunction, &func), (wxObject*) NULL),
+
 //! Event-handler for completion of part-files.
 #define EVT_MULE_FILE_COMPLETED(func) \
 	DECLARE_EVENT_TABLE_ENTRY(MULE_EVT_FILE_COMPLETED, -1, -1, \
@@ -337,6 +532,14 @@ typedef void (wxEvtHandler::*MuleAllocFinishedEventFunction)(CAllocFinishedEvent
 	(wxObjectEventFunction) (wxEventFunction) \
 	wxStaticCastEvent(MuleAllocFinishedEventFunction, &func), (wxObject*) NULL),
 
+#ifdef ENABLE_TORRENT
+//! Event-handler for saved torrent metadata of shared files.
+#define EVT_MULE_TORRENT_CREATED(func) \
+	DECLARE_EVENT_TABLE_ENTRY(MULE_EVT_TORRENT_CREATED, -1, -1, \
+	(wxObjectEventFunction) (wxEventFunction) \
+	wxStaticCastEvent(MuleTorrentCreatedEventFunction, &func), (wxObject*) NULL),
+#endif
+
 
 #endif // TASKS_H
 // File_checked_for_headers
@@ -45,10 +45,19 @@ public:
 
 class ThrottledFileSocket : public ThrottledControlSocket
 {
+	friend class UploadBandwidthThrottler;
 public:
+    ThrottledFileSocket() : m_uploadSlot(NO_UPLOAD_SLOT) {}
+
     virtual SocketSentBytes SendFileAndControlData(uint32 maxNumberOfBytesToSend, uint32 minFragSize) = 0;
     virtual uint32 GetLastCalledSend() = 0;
     virtual uint32	GetNeededBytes() = 0;
+
+private:
+	enum { NO_UPLOAD_SLOT = 0xFFFFFFFF };
+
+	//! Position in the upload slot list of the throttler, maintained by it.
+	uint32	m_uploadSlot;
 };
 
 #endif
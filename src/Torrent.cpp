@@ -12,21 +12,48 @@
 #include <boost/filesystem/fstream.hpp>
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string.hpp>
-#include <boost/lambda/lambda.hpp>
 #include <cstdlib>
 #include <libtorrent/escape_string.hpp>
 #include <iostream>
 #include <iterator>
+#include <deque>
 #include "Preferences.h"
 #include "OtherFunctions.h"
 #include <libtorrent/magnet_uri.hpp>
+#include "ThreadTasks.h"
+#include <libtorrent/lazy_entry.hpp>
+#include <libtorrent/bencode.hpp>
+#include <libtorrent/alert_types.hpp>
+#include "GetTickCount.h"
+#include <common/Macros.h>
 
 
 namespace torrent {
 typedef boost::asio::ip::basic_endpoint<boost::asio::ip::tcp> endpoint; // Listener for bt incomming connections
 
+static const uint32 RESUME_DATA_SAVE_INTERVAL = MIN2MS(5); // How often the resume data of changed torrents is saved.
+static const int RESUME_DATA_SHUTDOWN_TIMEOUT = 10; // Seconds to wait for each resume data alert when closing the session.
+
+/**
+ * Reads a whole file into a buffer.
+ *
+ * @return false if the file couldn't be read or is empty.
+ */
+static bool ReadWholeFile(const boost::filesystem::path & path, std::vector<char> & buffer){
+	boost::filesystem::ifstream file(path, std::ios_base::in | std::ios_base::binary);
+	if (!file) return false;
+	file.seekg(0, std::ios_base::end);
+	std::streamoff size = file.tellg();
+	if (size <= 0) return false;
+	file.seekg(0, std::ios_base::beg);
+	buffer.resize(size);
+	file.read(&buffer[0], size);
+	return file.good();
+}
+
 CTorrent::CTorrent() {
 	m_strategy = NULL;
+	m_lastTimeResumeDataSaved = 0;
 }
 
 CTorrent& CTorrent::GetInstance(){
@@ -44,22 +71,29 @@ void CTorrent::StartTorrentSession() {
 	boost::filesystem::path osDir = CPathToBoost(thePrefs::GetOSDir());
 	// Load previous session metadata, lt-data.dat has the content of session state, stats, etc, but no torrent metadata.
 	boost::filesystem::path fullpathState = boost::filesystem::system_complete( osDir / "lt-state.dat");
-	if (boost::filesystem::exists(fullpathState)){
-		//TODO: implement the use of session resume and torrents fast resume, session is already been saved ok.
-		//boost::filesystem::ifstream stateStream(fullpathState);
-		//m_ts->load_state(libtorrent::bdecode(std::istream_iterator<char>(stateStream), std::istream_iterator<char>()));
-		//AddLogLineN(_("Loaded torrent previous session state"));
+	std::vector<char> state;
+	if (boost::filesystem::exists(fullpathState) && ReadWholeFile(fullpathState, state)){
+		libtorrent::lazy_entry stateEntry;
+		libtorrent::error_code ec;
+		if (libtorrent::lazy_bdecode(&state[0], &state[0] + state.size(), stateEntry, ec) == 0){
+			m_ts->load_state(stateEntry);
+			AddLogLineNS(_("Loaded torrent previous session state"));
+		} else {
+			AddLogLineCS(_("Corrupted torrent session state, starting with a clean one: ") + ec.message());
+		}
 	}
 	// Load previous known metadata relations.
 	m_tmm.Load(osDir);
 	AddLogLineNS(_("Loaded mule-torrent relation dictionaries"));
 	// Load torrent metadata from known info-files registered in the loaded metadata relations
 	for (CTorrentMuleMapping::const_iterator it = m_tmm.begin(); it != m_tmm.end(); ++it){
-		if ( (*it)->get<2>() != NULL ){
-			LoadMetadataFile(*(*it)->get<2>());
+		if ( it->HasTorrentPath() ){
+			boost::filesystem::path torrentPath = it->GetTorrentPath();
+			LoadMetadataFile(torrentPath);
 		}
 	}
 	AddLogLineNS(_("Loaded known torrent files"));
+	m_lastTimeResumeDataSaved = ::GetTickCount();
 	SetStrategy(thePrefs::GetTorrentStrategy());
 }
 
@@ -74,6 +108,26 @@ std::string CTorrent::GetBTIHAsString(const CMD4Hash fileId){
 void CTorrent::EndTorrentSession() {
 	// Pause all downloads to save non-corrupted state.
 	m_ts->pause();
+	// Save the fast-resume data of every torrent, so the next session doesn't need to recheck them.
+	int pendingResumeData = RequestResumeData(true);
+	while (pendingResumeData > 0){
+		if (m_ts->wait_for_alert(libtorrent::seconds(RESUME_DATA_SHUTDOWN_TIMEOUT)) == NULL){
+			AddLogLineCS(_("Timed out while saving torrent fast-resume data, some torrents will be checked again on next start"));
+			break;
+		}
+		std::deque<libtorrent::alert*> alerts;
+		m_ts->pop_alerts(&alerts);
+		for (std::deque<libtorrent::alert*>::iterator it = alerts.begin(); it != alerts.end(); ++it){
+			std::auto_ptr<libtorrent::alert> a(*it);
+			if (libtorrent::save_resume_data_alert* sra = libtorrent::alert_cast<libtorrent::save_resume_data_alert>(a.get())){
+				if (sra->resume_data) SaveResumeData(sra->handle, *sra->resume_data);
+				--pendingResumeData;
+			} else if (libtorrent::alert_cast<libtorrent::save_resume_data_failed_alert>(a.get())){
+				AddDebugLogLineN(logTorrent, wxT("Failed saving torrent fast-resume data: ") + a->message());
+				--pendingResumeData;
+			}
+		}
+	}
 	libtorrent::entry session_state;
 	// Save Torrent session state in lt-state.dat.
 	m_ts->save_state(session_state);
@@ -86,15 +140,12 @@ void CTorrent::EndTorrentSession() {
 	savingState.close();
 	// Save transfered torrent metadata that was not previously saved.
 	for (CTorrentMuleMapping::const_iterator MTBTit = m_tmm.begin(); MTBTit != m_tmm.end(); ++MTBTit){
-		if((*MTBTit)->get<1>() && !(*MTBTit)->get<2>()){
-			libtorrent::torrent_handle th;
-			if ((*MTBTit)->get<1>() != NULL){
-				th = m_ts->find_torrent(*(*MTBTit)->get<1>());
-				if(th.has_metadata()) {
-					libtorrent::create_torrent ct(th.get_torrent_info());
-					boost::filesystem::path filename(th.name());
-					m_tmm.UpdateMetadata(*(*MTBTit)->get<1>(), boost::filesystem::path(SaveTorrent(ct, filename)));
-				}
+		if(MTBTit->HasBTIH() && !MTBTit->HasTorrentPath()){
+			libtorrent::torrent_handle th = m_ts->find_torrent(MTBTit->GetBTIH());
+			if(th.has_metadata()) {
+				libtorrent::create_torrent ct(th.get_torrent_info());
+				boost::filesystem::path filename(th.name());
+				m_tmm.UpdateMetadata(MTBTit->GetBTIH(), boost::filesystem::path(SaveTorrent(ct, filename)));
 			}
 		}
 	}
@@ -110,7 +161,7 @@ bool CTorrent::HasBTMetadata(const CMD4Hash fileId) const{
 	return (m_tmm.HasTorrentPath(fileId));
 }
 
-libtorrent::torrent_handle& CTorrent::LoadMetadataFile(boost::filesystem::path& filename){
+libtorrent::torrent_handle CTorrent::LoadMetadataFile(boost::filesystem::path& filename){
 	libtorrent::torrent_handle th;
 	try {
 		boost::filesystem::path tempDir = CPathToBoost(thePrefs::GetTempDir());
@@ -141,6 +192,12 @@ libtorrent::torrent_handle& CTorrent::LoadMetadataFile(boost::filesystem::path&
 				p.save_path = tempDir.native();
 			}
 			p.ti = new libtorrent::torrent_info((torrentDir / filename).native());
+			// Fast-resume data saved in previous session avoids rechecking all the pieces from disk.
+			std::vector<char> resumeData;
+			if (ReadWholeFile(GetResumeDataPath(p.ti->info_hash()), resumeData)){
+				p.resume_data = &resumeData;
+				AddDebugLogLineN(logTorrent, wxT("Using fast-resume data for: ") + filename.native());
+			}
 			try {
 				th = m_ts->add_torrent(p);
 				if (m_tmm.IsSharing(filename)){
@@ -202,38 +259,27 @@ bool CTorrent::AddDownloadFromMagnet(std::string magnet){
 }
 
 void CTorrent::CreateMetadataForFile(const CMD4Hash fileId, const CPath& filename, const CPath& storeDir){
-	CreateMetadataForFile(fileId, CPathToBoost(filename), CPathToBoost(storeDir));
+	AddLogLineNS(_("Creating BitTorrent metadata for:") + storeDir.JoinPaths(filename).GetPrintable());
+	CThreadScheduler::AddTask(new CTorrentCreationTask(fileId, storeDir, filename));
 }
 
 void CTorrent::CreateMetadataForFile(const CMD4Hash fileId, boost::filesystem::path filename, boost::filesystem::path storeDir){
-	AddLogLineNS(_("Creating BitTorrent metadata for:") + (storeDir/filename).native());
-	boost::filesystem::path fullpath = storeDir / filename;
-	// Prepare basic flags and info
-	int flags = 0;
-	int pad_file_limit = -1;
-	int piece_size = 0;
-	std::string creator_str = std::string(thePrefs::GetUserNick());
-	libtorrent::file_storage fs;
-	libtorrent::add_files(fs, fullpath.native(), boost::lambda::constant(true), flags);
-	if (fs.num_files() == 0) { // Check there is content defined
-		AddLogLineCS(_("Creation of Torrent metadata required, but no files provided for: ") + (storeDir /  filename).native());
-	}
-	libtorrent::create_torrent t(fs, piece_size, pad_file_limit, flags);
+	CreateMetadataForFile(fileId, BoostToCPath(filename), BoostToCPath(storeDir));
+}
+
+void CTorrent::RegisterMetadataFile(const CMD4Hash fileId, boost::filesystem::path filenameTorrent){
+	if (m_tmm.HasTorrentPath(fileId)) return; // Created twice, the first one is already in session.
 	try {
-		// Compute all the pieces hashes.
-		AddDebugLogLineN(logTorrent, wxT("Creating .torrent for:") + fullpath.branch_path().native());
-		libtorrent::set_piece_hashes(t, fullpath.branch_path().native());
+		libtorrent::torrent_info ti((CPathToBoost(thePrefs::GetTorrentDir()) / filenameTorrent).native());
+		// Update metadata relation dictionaries before loading, so it is loaded as a shared file.
+		m_tmm.UpdateMetadata(fileId, ti.info_hash(), filenameTorrent);
+		m_tmm.SetSharing(fileId);
 	} catch (libtorrent::libtorrent_exception &le) {
-		AddLogLineCS(_("Found problems while hashing Torrent metadata: ") + le.what());
+		AddLogLineCS(_("Fail to load a torrent metadata file: ") + filenameTorrent.native());
+		return;
 	}
-	t.set_creator(creator_str.c_str());
-	// Save torrent metadata to file.
-	boost::filesystem::path filenameTorrent = SaveTorrent(t, filename);
 	// Load file created to current session.
-	libtorrent::torrent_handle th = LoadMetadataFile(filenameTorrent);
-	// Update metadata relation dictionaries.
-	m_tmm.UpdateMetadata(fileId, th.info_hash(), filenameTorrent);
-	m_tmm.SetSharing(fileId);
+	LoadMetadataFile(filenameTorrent);
 }
 
 boost::filesystem::path CTorrent::SaveTorrent(libtorrent::create_torrent & t, boost::filesystem::path & filenameBoosted){
@@ -252,6 +298,52 @@ boost::filesystem::path CTorrent::SaveTorrent(libtorrent::create_torrent & t, bo
 	return filenameTorrent;
 }
 
+int CTorrent::RequestResumeData(bool all){
+	int requested = 0;
+	std::vector<libtorrent::torrent_handle> handles = m_ts->get_torrents();
+	for (std::vector<libtorrent::torrent_handle>::iterator it = handles.begin(); it != handles.end(); ++it){
+		if (!it->is_valid() || !it->has_metadata()) continue; // Nothing to resume without metadata.
+		if (!all && !it->need_save_resume_data()) continue;
+		it->save_resume_data();
+		++requested;
+	}
+	return requested;
+}
+
+boost::filesystem::path CTorrent::GetResumeDataPath(const libtorrent::sha1_hash & infoHash) const{
+	return CPathToBoost(thePrefs::GetOSDir()) / "torrent-resume" / (libtorrent::to_hex(infoHash.to_string()) + ".fastresume");
+}
+
+void CTorrent::SaveResumeData(const libtorrent::torrent_handle & th, const libtorrent::entry & resumeData){
+	if (!th.is_valid()) return;
+	boost::filesystem::path fullpath = GetResumeDataPath(th.info_hash());
+	try {
+		if (!boost::filesystem::exists(fullpath.parent_path())){
+			boost::filesystem::create_directory(fullpath.parent_path());
+		}
+		std::vector<char> data;
+		libtorrent::bencode(back_inserter(data), resumeData);
+		// Written aside and renamed, so a crash while saving never leaves a truncated file.
+		boost::filesystem::path temppath(fullpath.native() + ".tmp");
+		boost::filesystem::ofstream saving(temppath, std::ofstream::binary);
+		saving.write(&data[0], data.size());
+		saving.close();
+		if (saving.fail()){
+			AddLogLineCS(_("Failed writing torrent fast-resume data: ") + temppath.native());
+			boost::filesystem::remove(temppath);
+		} else {
+			boost::filesystem::rename(temppath, fullpath);
+		}
+	} catch (boost::filesystem::filesystem_error &fe){
+		AddLogLineCS(_("Failed saving torrent fast-resume data: ") + std::string(fe.what()));
+	}
+}
+
+void CTorrent::RemoveResumeData(const libtorrent::sha1_hash & infoHash){
+	boost::system::error_code ec;
+	boost::filesystem::remove(GetResumeDataPath(infoHash), ec);
+}
+
 void CTorrent::LoadUnregisteredTorrents(){
 	boost::filesystem::path torrentDir = CPathToBoost(thePrefs::GetTorrentDir());
 	if (boost::filesystem::exists(torrentDir)){
@@ -293,6 +385,7 @@ void CTorrent::GiveUp(CMD4Hash file_id){
 		if(m_tmm.HasBTIH(file_id)){
 			libtorrent::torrent_handle th = m_ts->find_torrent(m_tmm.GetBTIH(file_id));
 			if (th.is_valid()) m_ts->remove_torrent(th, libtorrent::session::delete_files);
+			RemoveResumeData(m_tmm.GetBTIH(file_id));
 		}
 		if(m_tmm.HasTorrentPath(file_id)){
 			boost::filesystem::path p = CPathToBoost(thePrefs::GetTorrentDir()) / m_tmm.GetTorrentPath(file_id);
@@ -318,6 +411,14 @@ bool CTorrent::IsMainlineConnected(){
 }
 
 void CTorrent::Process(){
+	// Alerts are drained even while the shares are checked, so they don't pile up in the session.
+	m_strategy->ProcessAlerts();
+	uint32 tick = ::GetTickCount();
+	if (tick - m_lastTimeResumeDataSaved >= RESUME_DATA_SAVE_INTERVAL){
+		// The data is saved when the alerts arrive, see CTorrentStrategy::ProcessAlerts.
+		RequestResumeData(false);
+		m_lastTimeResumeDataSaved = tick;
+	}
 	if (sharedTorrentsWaitingCheck.size() == 0){
 		m_strategy->Process();
 	} else {
@@ -334,6 +435,7 @@ void CTorrent::CheckLoadedSharedTorrents(){
 				sharedTorrentsWaitingCheck.erase(it);
 			} else if( it->status().state == libtorrent::torrent_status::downloading || it->status().state == libtorrent::torrent_status::downloading_metadata){
 				m_tmm.SetRemoved(it->info_hash());
+				RemoveResumeData(it->info_hash());
 				m_ts->remove_torrent(*it, libtorrent::session::delete_files); // Removing if some file was downloaded while bootstrapping.
 				sharedTorrentsWaitingCheck.erase(it);
 			}
@@ -70,6 +70,9 @@ public:
 	/**
 	 * Creates torrent Metadata for a file.
 	 *
+	 * The pieces are hashed by a CTorrentCreationTask, once the info-file is saved it is registered
+	 * with RegisterMetadataFile.
+	 *
 	 * @param fileId The MD4 aMule identifier of the file.
 	 * @param filename The name of the file.
 	 * @param storeDir Path where the file is stored
@@ -85,6 +88,14 @@ public:
 	 */
 	void CreateMetadataForFile(const CMD4Hash fileId, boost::filesystem::path filename, boost::filesystem::path storeDir);
 
+	/**
+	 * Registers the info-file created for a shared file and starts seeding it.
+	 *
+	 * @param fileId The MD4 aMule identifier of the file.
+	 * @param filenameTorrent The filename of the info-file, in the torrent metadata directory.
+	 */
+	void RegisterMetadataFile(const CMD4Hash fileId, boost::filesystem::path filenameTorrent);
+
 	/**
 	 * Checks if BT Metadata is known for a file identified with a MD4 aMule identifier.
 	 *
@@ -163,6 +174,13 @@ public:
 	 */
 	bool IsMainlineConnected();
 
+	/**
+	 * The strategy currently selected for data transfer.
+	 *
+	 * @return the strategy, or NULL if the session was not started yet.
+	 */
+	const CTorrentStrategy* GetStrategy() const { return m_strategy; }
+
 	/**
 	 * Checks the ThePrefs::TorrentDir for info-files that are known yet.
 	 *
@@ -180,6 +198,14 @@ public:
 	*/
 	boost::filesystem::path SaveTorrent(libtorrent::create_torrent & t, boost::filesystem::path & filename);
 
+	/**
+	* Saves the fast-resume data of a torrent, so it can be started without a recheck in the next session.
+	*
+	* @param th The torrent the data belongs to.
+	* @param resumeData The resume data received in a save_resume_data_alert.
+	*/
+	void SaveResumeData(const libtorrent::torrent_handle & th, const libtorrent::entry & resumeData);
+
 	/**
 	 * If downloading in bt this file, just give up.
 	 *
@@ -226,12 +252,37 @@ private :
 	* @param filename The filename where the torrent metadata is persisted.
 	* @return A torrent handle to the loaded torrent.
 	*/
-	libtorrent::torrent_handle& LoadMetadataFile(boost::filesystem::path& filename);
+	libtorrent::torrent_handle LoadMetadataFile(boost::filesystem::path& filename);
+
+	/**
+	* Asks libtorrent to generate the fast-resume data of the torrents in session.
+	*
+	* The data arrives asynchronously as save_resume_data_alert alerts.
+	*
+	* @param all If false only the torrents that changed since their last save are requested.
+	* @return The number of requests made.
+	*/
+	int RequestResumeData(bool all);
+
+	/**
+	* Path of the file keeping the fast-resume data of a torrent.
+	*
+	* @param infoHash The SHA1 content identifier of the torrent.
+	*/
+	boost::filesystem::path GetResumeDataPath(const libtorrent::sha1_hash & infoHash) const;
+
+	/**
+	* Removes the fast-resume data of a torrent that is no longer in session.
+	*
+	* @param infoHash The SHA1 content identifier of the torrent.
+	*/
+	void RemoveResumeData(const libtorrent::sha1_hash & infoHash);
 
 	CTorrentStrategy* m_strategy; //! Selected strategy for data transfer.
 	libtorrent::session * m_ts; //! Active torrent session instance.
 	CTorrentMuleMapping m_tmm; //! Active MetadataRelations.
 	std::vector<libtorrent::torrent_handle> sharedTorrentsWaitingCheck;
+	uint32 m_lastTimeResumeDataSaved; //! last time the fast-resume data of the changed torrents was requested.
 };
 
 }
@@ -0,0 +1,104 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#include "TorrentCreator.h"
+#include "Torrent.h"
+#include "SHAKernels.h"
+#include <boost/lambda/lambda.hpp>
+#include <algorithm>
+#include <wx/debug.h>
+
+
+namespace torrent {
+
+CTorrentCreator::CTorrentCreator(const boost::filesystem::path& fullpath, const std::string& creator)
+	: m_filename(fullpath.filename()),
+	  m_offset(0),
+	  m_piece(0),
+	  m_pieceFilled(0)
+{
+	libtorrent::add_files(m_storage, fullpath.native(), boost::lambda::constant(true), 0);
+	if (m_storage.num_files() != 0 && m_storage.total_size() != 0) {
+		m_torrent.reset(new libtorrent::create_torrent(m_storage, 0, -1, 0));
+		m_torrent->set_creator(creator.c_str());
+		unsigned lanes = std::max(1u, SHAKernels::GetParallelLanes());
+		m_pieces.resize(lanes);
+		m_digests.resize(lanes * CAICHHash::GetHashSize());
+	}
+}
+
+void CTorrentCreator::Update(const byte* data, size_t length){
+	wxCHECK_RET(IsOk(), wxT("Hashing content for a torrent without files"));
+	m_offset += length;
+	const uint32 pieceLength = m_torrent->piece_length();
+	while (length > 0 && m_piece < m_torrent->num_pieces()) {
+		// Whole pieces are hashed straight from the buffer, several at once if the kernel can.
+		size_t count = std::min<size_t>(m_pieces.size(), length / pieceLength);
+		count = std::min<size_t>(count, m_torrent->num_pieces() - m_piece);
+		if (m_pieceFilled == 0 && count > 0) {
+			for (size_t i = 0; i < count; ++i) {
+				m_pieces[i] = data + i * pieceLength;
+			}
+			SHAKernels::HashBuffers(&m_pieces[0], pieceLength, &m_digests[0], count);
+			for (size_t i = 0; i < count; ++i) {
+				SetNextPieceHash(&m_digests[i * CAICHHash::GetHashSize()]);
+			}
+			data += count * pieceLength;
+			length -= count * pieceLength;
+			continue;
+		}
+		// Pieces split between buffers, and the last shorter one, are hashed as they come.
+		const uint32 pieceSize = m_torrent->piece_size(m_piece);
+		const uint32 toAdd = std::min<size_t>(pieceSize - m_pieceFilled, length);
+		m_pieceHasher.Add(data, toAdd);
+		m_pieceFilled += toAdd;
+		data += toAdd;
+		length -= toAdd;
+		if (m_pieceFilled == pieceSize) {
+			CAICHHash hash;
+			m_pieceHasher.Finish(hash);
+			m_pieceHasher.Reset();
+			m_pieceFilled = 0;
+			SetNextPieceHash(hash.GetRawHash());
+		}
+	}
+}
+
+void CTorrentCreator::SetNextPieceHash(const byte* digest){
+	libtorrent::sha1_hash hash;
+	hash.assign((const char*)digest);
+	m_torrent->set_hash(m_piece++, hash);
+}
+
+bool CTorrentCreator::IsComplete() const{
+	return IsOk() && m_piece == m_torrent->num_pieces() && m_offset == (uint64)m_storage.total_size();
+}
+
+boost::filesystem::path CTorrentCreator::Save(const CMD4Hash& fileId){
+	wxCHECK_MSG(IsComplete(), boost::filesystem::path(), wxT("Saving a torrent before all pieces were hashed"));
+	boost::filesystem::path filename(m_filename.native() + "." + fileId.EncodeSTL());
+	return CTorrent::GetInstance().SaveTorrent(*m_torrent, filename);
+}
+
+}
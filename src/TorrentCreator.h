@@ -0,0 +1,111 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#ifndef TORRENTCREATOR_H_
+#define TORRENTCREATOR_H_
+#include <libtorrent/create_torrent.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <string>
+#include <vector>
+#include "Types.h"
+#include "SHA.h"
+#include "MD4Hash.h"
+
+namespace torrent {
+
+/**
+ * Builds the torrent metadata of a single shared file from its content.
+ *
+ * The content is fed in order with Update, usually from buffers that were already read for
+ * the MD4 and AICH hashes, so the file is not read a second time as libtorrent::set_piece_hashes does.
+ * It doesn't touch the torrent session, so it can be used from any thread; registering the
+ * saved info-file is left to CTorrent::RegisterMetadataFile in the main thread.
+ */
+class CTorrentCreator {
+public:
+	/**
+	 * Prepares the metadata, the piece size is chosen by libtorrent from the size of the file.
+	 *
+	 * @param fullpath The complete filename of the content.
+	 * @param creator The creator to be written in the metadata.
+	 */
+	CTorrentCreator(const boost::filesystem::path& fullpath, const std::string& creator);
+
+	/**
+	 * Check if the file could be added to the metadata.
+	 *
+	 * @return false if the file doesn't exist or is empty, nothing can be created then.
+	 */
+	bool IsOk() const { return m_torrent.get() != NULL; }
+
+	/**
+	 * Hashes the next bytes of the content.
+	 *
+	 * Whole pieces contained in the buffer are hashed several at once when the SHA-1 kernels support it,
+	 * pieces split between buffers are hashed as they come.
+	 *
+	 * @param data The next bytes of the content.
+	 * @param length Count of bytes in data.
+	 */
+	void Update(const byte* data, size_t length);
+
+	/**
+	 * Check if all the pieces were hashed.
+	 */
+	bool IsComplete() const;
+
+	/**
+	 * Saves the metadata into the torrent metadata directory.
+	 *
+	 * The MD4 hash is part of the info-file name, so shared files with the same
+	 * name, hashed at the same time, don't overwrite each other's metadata.
+	 *
+	 * @warning Only valid when IsComplete.
+	 * @param fileId The MD4 hash of the content.
+	 * @return filename of the saved info-file torrent metadata.
+	 * @throws boost::filesystem::filesystem_error if the directory can't be created.
+	 */
+	boost::filesystem::path Save(const CMD4Hash& fileId);
+
+private:
+	/**
+	 * Sets the hash of the next piece.
+	 */
+	void SetNextPieceHash(const byte* digest);
+
+	boost::filesystem::path m_filename; //! Filename of the content, without path.
+	uint64 m_offset; //! Bytes of content hashed so far.
+	libtorrent::file_storage m_storage; //! Files in the metadata, just the one.
+	boost::scoped_ptr<libtorrent::create_torrent> m_torrent; //! Metadata being built, NULL if there is no content.
+	int m_piece; //! Next piece to be hashed.
+	uint32 m_pieceFilled; //! Bytes of the next piece already added to m_pieceHasher.
+	CSHA m_pieceHasher; //! Hashes the pieces split between buffers.
+	std::vector<const byte*> m_pieces; //! Scratch space for the multi-buffer hashing.
+	std::vector<byte> m_digests; //! Scratch space for the multi-buffer hashing.
+};
+
+}
+
+#endif /* TORRENTCREATOR_H_ */
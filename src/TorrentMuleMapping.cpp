@@ -11,285 +11,393 @@
 #include <boost/lexical_cast.hpp>
 #include <boost/algorithm/string.hpp>
 #include "OtherFunctions.h"
+#include "FileAutoClose.h"
+#include "FileArea.h"
+#include "SafeFile.h"
 
 namespace torrent {
 
-MetadataRelation* CTorrentMuleMapping::UpdateMetadata(CMD4Hash* muleId, libtorrent::sha1_hash* BTId, boost::filesystem::path* torrentPath){
+/**
+ * Binary layout of MBTD.dat.
+ *
+ * A header, followed by a fixed size record per relation and a pool with the info-file names
+ * the records point into. All the fields are in the byte order of the machine that wrote it, so the
+ * file can be mapped and read in place.
+ */
+static const char MBTD_MAGIC[4] = { 'M', 'B', 'T', 'D' };
+static const uint32 MBTD_VERSION = 1;
+static const uint32 MBTD_BYTE_ORDER = 0x01020304;
+
+struct MBTDHeader {
+	char magic[4];
+	uint32 byteOrder;
+	uint32 version;
+	uint32 count; //! Number of records.
+	uint32 poolLength; //! Bytes of info-file names after the records.
+};
+
+struct MBTDRecord {
+	byte muleId[16];
+	byte BTId[20];
+	uint32 pathOffset; //! Offset of the info-file name in the pool.
+	uint32 pathLength;
+	uint8 known; //! MetadataRelation::m_known flags.
+	uint8 state;
+	uint8 reserved[2];
+};
+
+RelationHandle CTorrentMuleMapping::UpdateMetadata(const CMD4Hash* muleId, const libtorrent::sha1_hash* BTId, const boost::filesystem::path* torrentPath){
 	MuleIdToMetadataRelation::iterator muleIt;
 	BTIdToMetadataRelation::iterator BTIt;
 	InfoFileToMetadataRelation::iterator fileIt;
-	MetadataRelation* data = NULL;
-	// Check what needs an insert, since missed data will be set as NULL and only NULL data should be updated.
-	bool insertMule = (muleId != NULL);
-	bool insertBT = (BTId != NULL);
-	bool insertFile = (torrentPath != NULL);
+	// Unless some of the identifiers is already known, this is a new relation.
+	RelationHandle handle = m_relations.size();
 	if (muleId != NULL && (m_MuleIHDictionary.end() != (muleIt = m_MuleIHDictionary.find(*muleId)))){
-		data = muleIt->second;
-		insertMule = false;
+		handle = muleIt->second;
 	}
 	if (BTId !=NULL && (m_BTIHDictionary.end() != (BTIt = m_BTIHDictionary.find(*BTId)))){
-		data = BTIt->second;
-		insertBT = false;
+		handle = BTIt->second;
 	}
 	if (torrentPath != NULL && (m_BTFileDictionary.end() != (fileIt = m_BTFileDictionary.find(*torrentPath)))){
-		data = fileIt->second;
-		insertFile =  false;
+		handle = fileIt->second;
 	}
 	// If no old metada was found for update, create a new relation.
-	if (data == NULL){
-		data = new MetadataRelation(NULL, NULL, NULL, downloading);
+	if (handle == m_relations.size()){
+		m_relations.push_back(MetadataRelation());
 	}
-	// Create objects for the needed tuple components.
-	if (data->get<0>() == NULL){
-		if(muleId == NULL) data->get<0>() = NULL;
-		else data->get<0>() = new CMD4Hash(*muleId);
+	// Only the unknown data is set and indexed, the relation can't be modified, only incremented.
+	MetadataRelation& data = m_relations[handle];
+	if (muleId != NULL && !data.HasMuleIH()){
+		data.m_muleId = *muleId;
+		data.m_known |= MetadataRelation::KnownMuleIH;
+		m_MuleIHDictionary.insert(MuleIdToMetadataRelation::value_type(*muleId, handle));
 	}
-	if (data->get<1>() == NULL) {
-		if(BTId == NULL) data->get<1>() = NULL;
-		else data->get<1>() = new libtorrent::sha1_hash(BTId->to_string());
+	if (BTId != NULL && !data.HasBTIH()){
+		data.m_BTId = *BTId;
+		data.m_known |= MetadataRelation::KnownBTIH;
+		m_BTIHDictionary.insert(BTIdToMetadataRelation::value_type(*BTId, handle));
 	}
-	if (data->get<2>() == NULL) {
-		if(torrentPath == NULL) data->get<2>() = NULL;
-		else data->get<2>() = new boost::filesystem::path(*torrentPath);
+	if (torrentPath != NULL && !data.HasTorrentPath()){
+		data.m_torrentPath = *torrentPath;
+		data.m_known |= MetadataRelation::KnownTorrentPath;
+		m_BTFileDictionary.insert(InfoFileToMetadataRelation::value_type(*torrentPath, handle));
 	}
-	// Index the metadata relation
-	if (insertMule) m_MuleIHDictionary.insert(MuleIdToMetadataRelation::value_type(*muleId, data));
-	if (insertBT) m_BTIHDictionary.insert(BTIdToMetadataRelation::value_type(*BTId, data));
-	if (insertFile) m_BTFileDictionary.insert(InfoFileToMetadataRelation::value_type(*torrentPath, data));
-	// If metadata is new add it to the iterableMetadataVector for iteration.
-	if (insertMule || insertBT || insertFile) m_IterableMetadataRelations.push_back(data);
 	// Return the new/updated metadata
-	return data;
+	return handle;
 }
 
-MetadataRelation* CTorrentMuleMapping::UpdateMetadata(CMD4Hash muleId, libtorrent::sha1_hash BTId, boost::filesystem::path torrentPath){
-	CMD4Hash * mule_p = &muleId;
-	libtorrent::sha1_hash * BTId_p = &BTId;
-	boost::filesystem::path * torrentPath_p = &torrentPath;
-	return UpdateMetadata(mule_p, BTId_p, torrentPath_p);
+RelationHandle CTorrentMuleMapping::UpdateMetadata(CMD4Hash muleId, libtorrent::sha1_hash BTId, boost::filesystem::path torrentPath){
+	return UpdateMetadata(&muleId, &BTId, &torrentPath);
 }
 
-MetadataRelation* CTorrentMuleMapping::UpdateMetadata(CMD4Hash muleId, libtorrent::sha1_hash BTId){
-	CMD4Hash * mule_p = &muleId;
-	libtorrent::sha1_hash * BTId_p = &BTId;
-	boost::filesystem::path * torrentPath_p = NULL;
-	return UpdateMetadata(mule_p, BTId_p, torrentPath_p);
+RelationHandle CTorrentMuleMapping::UpdateMetadata(CMD4Hash muleId, libtorrent::sha1_hash BTId){
+	return UpdateMetadata(&muleId, &BTId, NULL);
 }
 
-MetadataRelation* CTorrentMuleMapping::UpdateMetadata(libtorrent::sha1_hash BTId, boost::filesystem::path torrentPath){
-	CMD4Hash * mule_p = NULL;
-	libtorrent::sha1_hash * BTId_p = &BTId;
-	boost::filesystem::path * torrentPath_p = &torrentPath;
-	return UpdateMetadata(mule_p, BTId_p, torrentPath_p);
+RelationHandle CTorrentMuleMapping::UpdateMetadata(libtorrent::sha1_hash BTId, boost::filesystem::path torrentPath){
+	return UpdateMetadata(NULL, &BTId, &torrentPath);
 }
 
 void CTorrentMuleMapping::Erase(CMD4Hash muleId){
-	MuleIdToMetadataRelation::iterator muleIt;
-	BTIdToMetadataRelation::iterator BTIt;
-	InfoFileToMetadataRelation::iterator fileIt;
-	MetadataRelation* data = NULL;
-	std::vector<MetadataRelation*>::iterator vit;
-	
-	if (m_MuleIHDictionary.end() != (muleIt = m_MuleIHDictionary.find(muleId))){
-		data = muleIt->second;
-		if (data->get<1>() !=NULL && (m_BTIHDictionary.end() != (BTIt = m_BTIHDictionary.find(*data->get<1>())))){
-			m_BTIHDictionary.erase(BTIt);
-		}
-		if (data->get<2>() != NULL && (m_BTFileDictionary.end() != (fileIt = m_BTFileDictionary.find(*data->get<2>())))){
-			m_BTFileDictionary.erase(fileIt);
-		}
-		m_MuleIHDictionary.erase(muleIt);
-		
-		for(vit=m_IterableMetadataRelations.begin(); vit!=m_IterableMetadataRelations.end(); ++vit){
-			*vit = data;
-			m_IterableMetadataRelations.erase(vit);
-			delete data;
-		}
+	MuleIdToMetadataRelation::iterator muleIt = m_MuleIHDictionary.find(muleId);
+	if (m_MuleIHDictionary.end() == muleIt) return;
+	RelationHandle handle = muleIt->second;
+	const MetadataRelation& data = m_relations[handle];
+	if (data.HasBTIH()) m_BTIHDictionary.erase(data.GetBTIH());
+	if (data.HasTorrentPath()) m_BTFileDictionary.erase(data.GetTorrentPath());
+	m_MuleIHDictionary.erase(muleIt);
+	// The last relation takes the place of the erased one, so the store stays contiguous.
+	RelationHandle last = m_relations.size() - 1;
+	if (handle != last){
+		std::swap(m_relations[handle], m_relations[last]);
+		Reindex(handle);
 	}
+	m_relations.pop_back();
+}
+
+void CTorrentMuleMapping::Reindex(RelationHandle handle){
+	const MetadataRelation& data = m_relations[handle];
+	if (data.HasMuleIH()) m_MuleIHDictionary[data.GetMuleIH()] = handle;
+	if (data.HasBTIH()) m_BTIHDictionary[data.GetBTIH()] = handle;
+	if (data.HasTorrentPath()) m_BTFileDictionary[data.GetTorrentPath()] = handle;
 }
 
 void CTorrentMuleMapping::SetDownloading(CMD4Hash muleId){
-	(m_MuleIHDictionary.at(muleId))->get<3>() = downloading;
+	At(muleId).m_state = downloading;
 }
 
 void CTorrentMuleMapping::SetDownloading(libtorrent::sha1_hash torrentId){
-	(m_BTIHDictionary.at(torrentId))->get<3>() = downloading;
+	At(torrentId).m_state = downloading;
 }
 
 void CTorrentMuleMapping::SetSharing(CMD4Hash muleId){
-	(m_MuleIHDictionary.at(muleId))->get<3>() = sharing;
+	At(muleId).m_state = sharing;
 }
 
 void CTorrentMuleMapping::SetSharing(libtorrent::sha1_hash torrentId){
-	(m_BTIHDictionary.at(torrentId))->get<3>() = sharing;
+	At(torrentId).m_state = sharing;
 }
 
 void CTorrentMuleMapping::SetRemoved(CMD4Hash muleId){
-	(m_MuleIHDictionary.at(muleId))->get<3>() = removed;
+	At(muleId).m_state = removed;
 }
 
 void CTorrentMuleMapping::SetRemoved(libtorrent::sha1_hash torrentId){
-	(m_BTIHDictionary.at(torrentId))->get<3>() = removed;
+	At(torrentId).m_state = removed;
 }
 
 bool CTorrentMuleMapping::IsDownloading(CMD4Hash muleId){
-	if (HasMuleIH(muleId)) return downloading == (m_MuleIHDictionary.at(muleId))->get<3>();
-	else return false;
+	MuleIdToMetadataRelation::const_iterator it = m_MuleIHDictionary.find(muleId);
+	return m_MuleIHDictionary.end() != it && downloading == m_relations[it->second].GetState();
 }
 
 bool CTorrentMuleMapping::IsDownloading(libtorrent::sha1_hash torrentId){
-	if(HasBTIH(torrentId)) return downloading == (m_BTIHDictionary.at(torrentId))->get<3>();
-	else return false;
+	BTIdToMetadataRelation::const_iterator it = m_BTIHDictionary.find(torrentId);
+	return m_BTIHDictionary.end() != it && downloading == m_relations[it->second].GetState();
 }
 
 bool CTorrentMuleMapping::IsDownloading(boost::filesystem::path& torrentPath){
-	if (HasTorrentPath(torrentPath)) return downloading == (m_BTFileDictionary.at(torrentPath))->get<3>();
-	else return false;
+	InfoFileToMetadataRelation::const_iterator it = m_BTFileDictionary.find(torrentPath);
+	return m_BTFileDictionary.end() != it && downloading == m_relations[it->second].GetState();
 }
 
 bool CTorrentMuleMapping::IsSharing(CMD4Hash muleId){
-	if (HasMuleIH(muleId)) return sharing == (m_MuleIHDictionary.at(muleId))->get<3>();
-	else return false;
+	MuleIdToMetadataRelation::const_iterator it = m_MuleIHDictionary.find(muleId);
+	return m_MuleIHDictionary.end() != it && sharing == m_relations[it->second].GetState();
 }
 
 bool CTorrentMuleMapping::IsSharing(libtorrent::sha1_hash torrentId){
-	if (HasBTIH(torrentId)) return sharing == (m_BTIHDictionary.at(torrentId))->get<3>();
-	else return false;
+	BTIdToMetadataRelation::const_iterator it = m_BTIHDictionary.find(torrentId);
+	return m_BTIHDictionary.end() != it && sharing == m_relations[it->second].GetState();
 }
 
 bool CTorrentMuleMapping::IsSharing(boost::filesystem::path& torrentPath){
-	if (HasTorrentPath(torrentPath)) return sharing == (m_BTFileDictionary.at(torrentPath))->get<3>();
-	else return false;
+	InfoFileToMetadataRelation::const_iterator it = m_BTFileDictionary.find(torrentPath);
+	return m_BTFileDictionary.end() != it && sharing == m_relations[it->second].GetState();
 }
 
 bool CTorrentMuleMapping::WasRemoved(boost::filesystem::path& torrentPath){
-	if (HasTorrentPath(torrentPath)) return removed== (m_BTFileDictionary.at(torrentPath))->get<3>();
-	else return false;
+	InfoFileToMetadataRelation::const_iterator it = m_BTFileDictionary.find(torrentPath);
+	return m_BTFileDictionary.end() != it && removed == m_relations[it->second].GetState();
 }
 
 const boost::filesystem::path& CTorrentMuleMapping::GetTorrentPath(CMD4Hash muleId) const {
-	return *(m_MuleIHDictionary.at(muleId)->get<2>());
+	return At(muleId).GetTorrentPath();
 }
 
 const boost::filesystem::path& CTorrentMuleMapping::GetTorrentPath(libtorrent::sha1_hash btId) const {
-	return *(m_BTIHDictionary.at(btId)->get<2>());
+	return At(btId).GetTorrentPath();
 }
 
 const libtorrent::sha1_hash& CTorrentMuleMapping::GetBTIH(CMD4Hash muleId) const {
-	return *(m_MuleIHDictionary.at(muleId)->get<1>());
+	return At(muleId).GetBTIH();
 }
 
 const libtorrent::sha1_hash& CTorrentMuleMapping::GetBTIH(boost::filesystem::path torrentPath) const {
-	return *(m_BTFileDictionary.at(torrentPath)->get<1>());
+	return At(torrentPath).GetBTIH();
 }
 
 const CMD4Hash& CTorrentMuleMapping::GetMuleIH(libtorrent::sha1_hash btId) const {
-	return *(m_BTIHDictionary.at(btId)->get<0>());
+	return At(btId).GetMuleIH();
 }
 
 const CMD4Hash& CTorrentMuleMapping::GetMuleIH(boost::filesystem::path torrentPath) const {
-	return *(m_BTFileDictionary.at(torrentPath)->get<0>());
+	return At(torrentPath).GetMuleIH();
 }
 
 CTorrentMuleMapping::const_iterator CTorrentMuleMapping::begin() const{
-	return m_IterableMetadataRelations.begin();
+	return m_relations.begin();
 }
 
 CTorrentMuleMapping::const_iterator CTorrentMuleMapping::end() const{
-	return m_IterableMetadataRelations.end();
+	return m_relations.end();
 }
 
 void CTorrentMuleMapping::Load(boost::filesystem::path workingDir){
-	int counter=0;
-	int lineCounter=0;
+	boost::filesystem::path filename = workingDir / "MBTD.dat";
 	// Check if MBTD.dat is accessible
-	if (!boost::filesystem::exists(workingDir / "MBTD.dat")){
+	if (!boost::filesystem::exists(filename)){
 		AddLogLineCS(_("Metadata dictionaries for BT doesn't exist."));
-	} else {
-		std::string input; // MBTD.dat reading buffer
-		std::vector<std::string> parsedLine; // parsed line of MBTD.dat
-		CMD4Hash muleId;
+		return;
+	}
+	int counter = 0;
+	bool isBinary = false;
+	try {
+		CFileAutoClose file(BoostToCPath(filename));
+		uint64 length = file.GetLength();
+		if (length >= sizeof(MBTDHeader)){
+			CFileArea area;
+			area.ReadAt(file, 0, length);
+			isBinary = (memcmp(area.GetBuffer(), MBTD_MAGIC, sizeof(MBTD_MAGIC)) == 0);
+			if (isBinary){
+				counter = LoadBinary(area.GetBuffer(), length);
+			}
+			area.CheckError();
+		}
+	} catch (const CSafeIOException& e){
+		AddLogLineCS(_("Failed reading MBTD.dat: ") + e.what());
+		return;
+	}
+	if (!isBinary){
+		// Written by an older version, it will be converted on next Save.
+		counter = LoadText(filename);
+	}
+	AddLogLineNS(_("MBTD.dat - Loaded definitions: ") + (boost::lexical_cast<std::string>(counter)));
+}
+
+int CTorrentMuleMapping::LoadBinary(const byte* data, size_t length){
+	MBTDHeader header;
+	memcpy(&header, data, sizeof(header));
+	size_t available = length - sizeof(header);
+	if (header.byteOrder != MBTD_BYTE_ORDER || header.version != MBTD_VERSION
+		|| available / sizeof(MBTDRecord) < header.count
+		|| available - header.count * sizeof(MBTDRecord) < header.poolLength){
+		AddLogLineCS(_("Corrupted or unsupported MBTD.dat file, torrent metadata relations were not loaded."));
+		return 0;
+	}
+	const byte* records = data + sizeof(header);
+	const char* pool = (const char*)(records + header.count * sizeof(MBTDRecord));
+	// Size everything once, instead of growing while inserting.
+	m_relations.reserve(m_relations.size() + header.count);
+	m_MuleIHDictionary.rehash(m_MuleIHDictionary.size() + header.count);
+	m_BTIHDictionary.rehash(m_BTIHDictionary.size() + header.count);
+	m_BTFileDictionary.rehash(m_BTFileDictionary.size() + header.count);
+	int counter = 0;
+	for (uint32 i = 0; i < header.count; ++i){
+		MBTDRecord record;
+		memcpy(&record, records + i * sizeof(MBTDRecord), sizeof(record));
+		if (!(record.known & (MetadataRelation::KnownMuleIH | MetadataRelation::KnownBTIH | MetadataRelation::KnownTorrentPath))
+			|| record.pathOffset > header.poolLength || record.pathLength > header.poolLength - record.pathOffset){
+			AddDebugLogLineC(logTorrent, wxT("Skipping corrupted record in MBTD.dat: ") + boost::lexical_cast<std::string>(i));
+			continue;
+		}
+		CMD4Hash muleId(record.muleId);
 		libtorrent::sha1_hash BTId;
-		boost::filesystem::path torrentPath;
-		state downloadingState;
-		MetadataRelation* data;
-		boost::filesystem::ifstream MBTD( workingDir / "MBTD.dat");
-		while(MBTD.good()){
-			lineCounter++;
-			// Obtain a config line
-			std::getline(MBTD, input);
-			// If line is empty, skip it.
-			if (input.length() == 0) continue;
-			// If line is commented, skip it.
-			if (input.at(0) == '#') continue;
-			// Clean up previous parsing.
-			parsedLine.clear();
-			data = NULL;
-			try {
-				boost::split(parsedLine, input, boost::is_any_of(":"));
-			} catch (int e){
-				AddDebugLogLineC(logTorrent, wxT("Exception catched in split, review the MBTD.dat file"));
-				AddLogLineCS(_("Corrupted MBTD.dat file in line: ") + boost::lexical_cast<std::string>(lineCounter));
-				continue;
+		BTId.assign((const char*)record.BTId);
+		boost::filesystem::path torrentPath(std::string(pool + record.pathOffset, record.pathLength));
+		RelationHandle handle = UpdateMetadata(
+			(record.known & MetadataRelation::KnownMuleIH) ? &muleId : NULL,
+			(record.known & MetadataRelation::KnownBTIH) ? &BTId : NULL,
+			(record.known & MetadataRelation::KnownTorrentPath) ? &torrentPath : NULL);
+		m_relations[handle].m_state = (state) record.state;
+		counter++;
+	}
+	return counter;
+}
+
+int CTorrentMuleMapping::LoadText(const boost::filesystem::path& filename){
+	int counter=0;
+	int lineCounter=0;
+	std::string input; // MBTD.dat reading buffer
+	std::vector<std::string> parsedLine; // parsed line of MBTD.dat
+	CMD4Hash muleId;
+	libtorrent::sha1_hash BTId;
+	boost::filesystem::path torrentPath;
+	state downloadingState;
+	RelationHandle data;
+	boost::filesystem::ifstream MBTD(filename);
+	while(MBTD.good()){
+		lineCounter++;
+		// Obtain a config line
+		std::getline(MBTD, input);
+		// If line is empty, skip it.
+		if (input.length() == 0) continue;
+		// If line is commented, skip it.
+		if (input.at(0) == '#') continue;
+		// Clean up previous parsing.
+		parsedLine.clear();
+		data = m_relations.size();
+		try {
+			boost::split(parsedLine, input, boost::is_any_of(":"));
+		} catch (int e){
+			AddDebugLogLineC(logTorrent, wxT("Exception catched in split, review the MBTD.dat file"));
+			AddLogLineCS(_("Corrupted MBTD.dat file in line: ") + boost::lexical_cast<std::string>(lineCounter));
+			continue;
+		}
+		// Check the parsed data has enough info, last (state) field is mandatory.
+		if(parsedLine.size() == 4 && parsedLine[3].length() != 0){
+			if (parsedLine[0].length()) muleId.Decode(parsedLine[0]);
+			if (parsedLine[1].length()) BTId.assign(libtorrent::base32decode(parsedLine[1]));
+			if (parsedLine[2].length()) torrentPath = boost::filesystem::path(parsedLine[2]);
+			downloadingState = (state) boost::lexical_cast<int>(parsedLine[3]);
+			// Choose what update method to use based in the loaded data.
+			if (parsedLine[0].length() && parsedLine[1].length() && parsedLine[2].length()){
+				// Whole relation is known
+				data = UpdateMetadata(muleId, BTId, torrentPath);
+			}
+			else if (!parsedLine[0].length() && parsedLine[1].length() && parsedLine[2].length()){
+				// There is no info about mule MD4 identifier yet, only torrent downloading.
+				data = UpdateMetadata(BTId, torrentPath);
 			}
-			// Check the parsed data has enough info, last (state) field is mandatory.
-			if(parsedLine.size() == 4 && parsedLine[3].length() != 0){
-				if (parsedLine[0].length()) muleId.Decode(parsedLine[0]);
-				if (parsedLine[1].length()) BTId.assign(libtorrent::base32decode(parsedLine[1]));
-				if (parsedLine[2].length()) torrentPath = boost::filesystem::path(parsedLine[2]);
-				downloadingState = (state) boost::lexical_cast<int>(parsedLine[3]);
-				// Choose what update method to use based in the loaded data.
-				if (parsedLine[0].length() && parsedLine[1].length() && parsedLine[2].length()){
-					// Whole relation is known
-					data = UpdateMetadata(muleId, BTId, torrentPath);
-				}
-				else if (!parsedLine[0].length() && parsedLine[1].length() && parsedLine[2].length()){
-					// There is no info about mule MD4 identifier yet, only torrent downloading.
-					data = UpdateMetadata(BTId, torrentPath);
-				}
-				else if (parsedLine[0].length() && parsedLine[1].length() && !parsedLine[2].length()){
-					// Metadata for torrent is not known, but SHA1 identifier was already transfered.
-					data = UpdateMetadata(muleId, BTId);
-				}
-				if (data !=  NULL){
-					counter++; // Increase the count of loaded metadata relations.
-					data->get<3>() = downloadingState; // Set the downloading state
-				}
-			} else {
-				AddLogLineCS(_("Corrupted MBTD.dat file in line: ") + boost::lexical_cast<std::string>(lineCounter));
-				AddDebugLogLineC(logTorrent, wxT("Reading line from MBTD.dat with wrong count of fields in line: ") + boost::lexical_cast<std::string>(lineCounter) +
-					" saying: " + input);
+			else if (parsedLine[0].length() && parsedLine[1].length() && !parsedLine[2].length()){
+				// Metadata for torrent is not known, but SHA1 identifier was already transfered.
+				data = UpdateMetadata(muleId, BTId);
 			}
+			if (data != m_relations.size()){
+				counter++; // Increase the count of loaded metadata relations.
+				m_relations[data].m_state = downloadingState; // Set the downloading state
+			}
+		} else {
+			AddLogLineCS(_("Corrupted MBTD.dat file in line: ") + boost::lexical_cast<std::string>(lineCounter));
+			AddDebugLogLineC(logTorrent, wxT("Reading line from MBTD.dat with wrong count of fields in line: ") + boost::lexical_cast<std::string>(lineCounter) +
+				" saying: " + input);
 		}
-		MBTD.close();
-		AddLogLineNS(_("MBTD.dat - Loaded definitions: ") + (boost::lexical_cast<std::string>(counter)));
 	}
+	MBTD.close();
+	return counter;
 }
 
 void CTorrentMuleMapping::Save(boost::filesystem::path workingDir){
 	// This method fully rewrites the MBTD.dat file
-	int counter=0;
-	boost::filesystem::ofstream MBTD( workingDir / "MBTD.dat", std::ios::trunc);
-	MBTD << "#MuleToBTDictFile" << std::endl;
-	for ( const_iterator it = begin(); it != end(); it++){
-		if ((*it)->get<0>()) MBTD << (*it)->get<0>()->EncodeSTL();
-		MBTD << ":";
-		if ((*it)->get<1>()) MBTD << libtorrent::base32encode((*it)->get<1>()->to_string());
-		MBTD << ":";
-		if ((*it)->get<2>()) MBTD << (*it)->get<2>()->native();
-		MBTD << ":";
-		MBTD << (*it)->get<3>(); //state
-		MBTD << std::endl;
-		counter++;
+	std::vector<MBTDRecord> records(m_relations.size());
+	std::string pool;
+	for (size_t i = 0; i < m_relations.size(); ++i){
+		const MetadataRelation& data = m_relations[i];
+		MBTDRecord& record = records[i];
+		memset(&record, 0, sizeof(record));
+		if (data.HasMuleIH()) memcpy(record.muleId, data.GetMuleIH().GetHash(), sizeof(record.muleId));
+		if (data.HasBTIH()) memcpy(record.BTId, &data.GetBTIH()[0], sizeof(record.BTId));
+		if (data.HasTorrentPath()){
+			const std::string& path = data.GetTorrentPath().native();
+			record.pathOffset = pool.size();
+			record.pathLength = path.size();
+			pool.append(path);
+		}
+		record.known = data.m_known;
+		record.state = data.GetState();
 	}
+	MBTDHeader header;
+	memcpy(header.magic, MBTD_MAGIC, sizeof(header.magic));
+	header.byteOrder = MBTD_BYTE_ORDER;
+	header.version = MBTD_VERSION;
+	header.count = records.size();
+	header.poolLength = pool.size();
+	// Written aside and renamed, so a crash while saving never loses the known relations.
+	boost::filesystem::path filename = workingDir / "MBTD.dat";
+	boost::filesystem::path tempname = workingDir / "MBTD.dat.new";
+	boost::filesystem::ofstream MBTD(tempname, std::ios::trunc | std::ios::binary);
+	MBTD.write((const char*)&header, sizeof(header));
+	if (!records.empty()) MBTD.write((const char*)&records[0], records.size() * sizeof(MBTDRecord));
+	MBTD.write(pool.data(), pool.size());
 	MBTD.close();
-	AddLogLineNS(_("MBTD.dat - Saved definitions: ") + (boost::lexical_cast<std::string>(counter)));
+	try {
+		if (MBTD.fail()){
+			AddLogLineCS(_("Failed writing MBTD.dat, torrent metadata relations were not saved."));
+			boost::filesystem::remove(tempname);
+			return;
+		}
+		boost::filesystem::rename(tempname, filename);
+	} catch (boost::filesystem::filesystem_error &fe){
+		AddLogLineCS(_("Failed saving MBTD.dat: ") + std::string(fe.what()));
+		return;
+	}
+	AddLogLineNS(_("MBTD.dat - Saved definitions: ") + (boost::lexical_cast<std::string>(records.size())));
 }
 
 bool CTorrentMuleMapping::HasTorrentPath(CMD4Hash muleId) const{
 	MuleIdToMetadataRelation::const_iterator it  = m_MuleIHDictionary.find(muleId);
 	if (m_MuleIHDictionary.end() != it) {
-		return (it->second->get<2>() != NULL);
+		return (m_relations[it->second].HasTorrentPath());
 	} else {
 		return false;
 	}
@@ -298,7 +406,7 @@ bool CTorrentMuleMapping::HasTorrentPath(CMD4Hash muleId) const{
 bool CTorrentMuleMapping::HasTorrentPath(libtorrent::sha1_hash btId) const{
 	BTIdToMetadataRelation::const_iterator it  = m_BTIHDictionary.find(btId);
 	if (m_BTIHDictionary.end() != it) {
-		return (it->second->get<2>() != NULL);
+		return (m_relations[it->second].HasTorrentPath());
 	} else {
 		return false;
 	}
@@ -312,7 +420,7 @@ bool CTorrentMuleMapping::HasTorrentPath(boost::filesystem::path torrentPath) co
 bool CTorrentMuleMapping::HasBTIH(CMD4Hash muleId) const{
 	MuleIdToMetadataRelation::const_iterator it  = m_MuleIHDictionary.find(muleId);
 	if (m_MuleIHDictionary.end() != it) {
-		return (it->second->get<1>() != NULL);
+		return (m_relations[it->second].HasBTIH());
 	} else {
 		return false;
 	}
@@ -326,7 +434,7 @@ bool CTorrentMuleMapping::HasBTIH(libtorrent::sha1_hash btId) const{
 bool CTorrentMuleMapping::HasBTIH(boost::filesystem::path torrentPath) const{
 	InfoFileToMetadataRelation::const_iterator it  = m_BTFileDictionary.find(torrentPath);
 	if (m_BTFileDictionary.end() != it) {
-		return (it->second->get<1>() != NULL);
+		return (m_relations[it->second].HasBTIH());
 	} else {
 		return false;
 	}
@@ -340,7 +448,7 @@ bool CTorrentMuleMapping::HasMuleIH(CMD4Hash muleId) const{
 bool CTorrentMuleMapping::HasMuleIH(libtorrent::sha1_hash btId) const{
 	BTIdToMetadataRelation::const_iterator it  = m_BTIHDictionary.find(btId);
 	if (m_BTIHDictionary.end() != it) {
-		return (it->second->get<0>() != NULL);
+		return (m_relations[it->second].HasMuleIH());
 	} else {
 		return false;
 	}
@@ -349,24 +457,12 @@ bool CTorrentMuleMapping::HasMuleIH(libtorrent::sha1_hash btId) const{
 bool CTorrentMuleMapping::HasMuleIH(boost::filesystem::path torrentPath) const{
 	InfoFileToMetadataRelation::const_iterator it  = m_BTFileDictionary.find(torrentPath);
 	if (m_BTFileDictionary.end() != it) {
-		return (it->second->get<0>() != NULL);
+		return (m_relations[it->second].HasMuleIH());
 	} else {
 		return false;
 	}
 }
 
-CTorrentMuleMapping::~CTorrentMuleMapping() {
-	for(std::vector<MetadataRelation*>::iterator it=m_IterableMetadataRelations.begin(); it != m_IterableMetadataRelations.end(); ++it){
-		if (NULL!= (*it)->get<0>()) delete((*it)->get<0>());
-		if (NULL!= (*it)->get<1>()) delete((*it)->get<1>());
-		if (NULL!= (*it)->get<2>()) delete((*it)->get<2>());
-	}
-	m_IterableMetadataRelations.clear();
-	m_MuleIHDictionary.clear();
-	m_BTIHDictionary.clear();
-	m_BTFileDictionary.clear();
-}
+CTorrentMuleMapping::~CTorrentMuleMapping() {}
 
 }
-
-
@@ -7,10 +7,11 @@
 
 #ifndef TORRENTMULEMAPPING_H_
 #define TORRENTMULEMAPPING_H_
-#include <boost/tuple/tuple.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/filesystem.hpp>
 #include <string>
+#include <vector>
+#include <string.h>
 #include <libtorrent/peer_id.hpp>
 #include "MD4Hash.h"
 
@@ -28,49 +29,79 @@ typedef enum{
 } state;
 
 /**
- * Metadata Relation is a 4-tuple with relations between aMule and Torrent metadata.
+ * Metadata Relation relates aMule and Torrent metadata of a content.
  *
  * It contains a MD4 to identify the content in aMule, a SHA1 to identify the content as Torrent, a path
  * to the .torrent info-file containning the full Torrent metadata, and a state of the content.
+ * Any of the identifiers may be unknown yet, check it with the Has* methods before using them.
+ *
+ * Relations are stored by value in a contiguous vector and referenced by a RelationHandle (its index),
+ * so iterating them doesn't chase pointers and the indexes are just small integers.
+ */
+class MetadataRelation {
+public:
+	MetadataRelation() : m_known(0), m_state(downloading) {}
+
+	bool HasMuleIH() const { return (m_known & KnownMuleIH) != 0; }
+	bool HasBTIH() const { return (m_known & KnownBTIH) != 0; }
+	bool HasTorrentPath() const { return (m_known & KnownTorrentPath) != 0; }
+
+	const CMD4Hash& GetMuleIH() const { return m_muleId; }
+	const libtorrent::sha1_hash& GetBTIH() const { return m_BTId; }
+	const boost::filesystem::path& GetTorrentPath() const { return m_torrentPath; }
+	state GetState() const { return m_state; }
+
+private:
+	friend class CTorrentMuleMapping;
+
+	enum {
+		KnownMuleIH = 0x01,
+		KnownBTIH = 0x02,
+		KnownTorrentPath = 0x04
+	};
+
+	CMD4Hash m_muleId; //! MD4 aMule file identifier, valid if KnownMuleIH is set.
+	libtorrent::sha1_hash m_BTId; //! SHA1 torrent content identifier, valid if KnownBTIH is set.
+	boost::filesystem::path m_torrentPath; //! Filename of the info-file, valid if KnownTorrentPath is set.
+	uint8 m_known; //! Which of the identifiers are known.
+	state m_state; //! What the client is doing with the content.
+};
+
+/**
+ * Index of a MetadataRelation in the relation store.
+ *
+ * Handles stay valid until the relation or another one is erased.
  */
-typedef boost::tuple<CMD4Hash*, libtorrent::sha1_hash*, boost::filesystem::path*, state> MetadataRelation;
+typedef uint32 RelationHandle;
 
 /**
  * Hash function for MuleIdToMetadataRelation indexing
+ *
+ * The MD4 is already uniformly distributed, so its first bytes are used as they are.
  */
 struct MD4ToHash
-    : std::unary_function<CMD4Hash, std::size_t>
+	: std::unary_function<CMD4Hash, std::size_t>
 {
-    std::size_t operator()(CMD4Hash const& v) const
-    {
-        std::size_t seed = 0;
-        std::string x = v.EncodeSTL();
-        for(std::string::const_iterator it = x.begin();
-            it != x.end(); ++it)
-        {
-            boost::hash_combine(seed, *it);
-        }
-
-        return seed;
-    }
+	std::size_t operator()(CMD4Hash const& v) const
+	{
+		std::size_t seed;
+		memcpy(&seed, v.GetHash(), sizeof(seed));
+		return seed;
+	}
 };
 
 /**
  * Hash function for BTIdToMetadataRelation indexing
+ *
+ * The SHA1 is already uniformly distributed, so its first bytes are used as they are.
  */
 struct SHA1ToHash
 	: std::unary_function<libtorrent::sha1_hash, std::size_t>
 {
 	std::size_t operator()(libtorrent::sha1_hash const& v) const
 	{
-		std::size_t seed = 0;
-		std::string x = v.to_string();
-		for(std::string::const_iterator it = x.begin();
-			it != x.end(); ++it)
-		{
-			boost::hash_combine(seed, *it);
-		}
-
+		std::size_t seed;
+		memcpy(&seed, &v[0], sizeof(seed));
 		return seed;
 	}
 };
@@ -83,32 +114,25 @@ struct filenameToHash
 {
 	std::size_t operator()(boost::filesystem::path const& v) const
 	{
-		std::size_t seed = 0;
-		std::string x = v.native();
-		for(std::string::const_iterator it = x.begin();
-			it != x.end(); ++it)
-		{
-			boost::hash_combine(seed, *it);
-		}
-
-		return seed;
+		const boost::filesystem::path::string_type& x = v.native();
+		return boost::hash_range(x.begin(), x.end());
 	}
 };
 
 /**
  * MuleIdToMetadataRelation is a Map used to provide indexing of the known MetadataRelations by Mule MD4 Identifiers.
  */
-typedef boost::unordered_map<CMD4Hash, MetadataRelation*, MD4ToHash >  MuleIdToMetadataRelation;
+typedef boost::unordered_map<CMD4Hash, RelationHandle, MD4ToHash >  MuleIdToMetadataRelation;
 
 /**
  * BTIdToMetadataRelation is a Map used to provide indexing of the known MetadataRelations by Torrent SHA1 Identifiers.
  */
-typedef boost::unordered_map<libtorrent::sha1_hash, MetadataRelation*, SHA1ToHash >  BTIdToMetadataRelation;
+typedef boost::unordered_map<libtorrent::sha1_hash, RelationHandle, SHA1ToHash >  BTIdToMetadataRelation;
 
 /**
  * InfoFileToMetadataRelation is a Map used to provide indexing of the known MetadataRelations by Torrent's metadata filename.
  */
-typedef boost::unordered_map<boost::filesystem::path, MetadataRelation* , filenameToHash>  InfoFileToMetadataRelation;
+typedef boost::unordered_map<boost::filesystem::path, RelationHandle, filenameToHash>  InfoFileToMetadataRelation;
 
 /**
  * CTorrentMuleMapping is a container for the MetadataRelations.
@@ -126,9 +150,9 @@ public:
 	 * @param muleId A MD4 identifier of an aMule known file.
 	 * @param torrentId A SHA1 identifier of a torrent known content.
 	 * @param torrentFile A filename of where the info-file metadata is saved to load it again in next session.
-	 * @return Pointer to the created or updated Metadata Relation.
+	 * @return Handle to the created or updated Metadata Relation.
 	 */
-	MetadataRelation* UpdateMetadata(CMD4Hash muleId, libtorrent::sha1_hash torrentId, boost::filesystem::path torrentFile);
+	RelationHandle UpdateMetadata(CMD4Hash muleId, libtorrent::sha1_hash torrentId, boost::filesystem::path torrentFile);
 
 	/**
 	 * Creates a MetadataRelation.
@@ -140,9 +164,9 @@ public:
 	 *
 	 * @param muleId A MD4 identifier of an aMule known file.
 	 * @param torrentId A SHA1 identifier of a torrent known content.
-	 * @return Pointer to the created or updated Metadata Relation.
+	 * @return Handle to the created or updated Metadata Relation.
 	 */
-	MetadataRelation* UpdateMetadata(CMD4Hash muleId, libtorrent::sha1_hash torrentId);
+	RelationHandle UpdateMetadata(CMD4Hash muleId, libtorrent::sha1_hash torrentId);
 
 	/**
 	 * Erases a MetadataRelation.
@@ -161,9 +185,9 @@ public:
 	 *
 	 * @param torrentId A SHA1 identifier of a torrent known content.
 	 * @param torrentFile A filename of where the info-file metadata is saved to load it again in next session.
-	 * @return Pointer to the created or updated Metadata Relation.
+	 * @return Handle to the created or updated Metadata Relation.
 	 */
-	MetadataRelation* UpdateMetadata(libtorrent::sha1_hash torrentId, boost::filesystem::path torrentFile); // downloading from BT, no MD4 generated yet
+	RelationHandle UpdateMetadata(libtorrent::sha1_hash torrentId, boost::filesystem::path torrentFile); // downloading from BT, no MD4 generated yet
 
 	// There is no Unary Updates sin  there nothing to relate until 2 are know.
 	// Also there is no muleId, torrentFile Updates since when torrentFile
@@ -407,8 +431,10 @@ public:
 
 	/**
 	 * Iterator type, only const iteration is allowed.
+	 *
+	 * Updating the metadata of known relations keeps the iterators valid, but adding or erasing relations doesn't.
 	 */
-	typedef std::vector<MetadataRelation*>::const_iterator const_iterator;
+	typedef std::vector<MetadataRelation>::const_iterator const_iterator;
 
 	/**
 	 * Standard iterator begin
@@ -421,14 +447,22 @@ public:
 	const_iterator end() const;
 
 	/**
-	 * It loads a persisted instance of the class from filename
+	 * Number of known MetadataRelations.
+	 */
+	size_t size() const { return m_relations.size(); }
+
+	/**
+	 * It loads a persisted instance of the class from MBTD.dat in the working directory.
+	 *
+	 * The binary format written by Save is memory mapped and read in place, the old
+	 * text format is still accepted and converted on next Save.
 	 */
-	void Load(boost::filesystem::path filename);
+	void Load(boost::filesystem::path workingDir);
 
 	/**
-	 * It persists actual instance into filename.
+	 * It persists actual instance into MBTD.dat in the working directory.
 	 */
-	void Save(boost::filesystem::path filename);
+	void Save(boost::filesystem::path workingDir);
 
 	/**
 	 * Destructor
@@ -442,15 +476,38 @@ private:
 	 * @param muleId Pointer to a MD4 identifier of an aMule known file.
 	 * @param torrentId Pointer to a SHA1 identifier of a torrent known content.
 	 * @param torrentFile Pointer to a filename of where the info-file metadata is saved to load it again in next session.
-	 * @return Pointer to the created or updated Metadata Relation.
+	 * @return Handle to the created or updated Metadata Relation.
 	 */
-	MetadataRelation* UpdateMetadata(CMD4Hash* muleId, libtorrent::sha1_hash* BTId, boost::filesystem::path* torrentPath);
+	RelationHandle UpdateMetadata(const CMD4Hash* muleId, const libtorrent::sha1_hash* BTId, const boost::filesystem::path* torrentPath);
+
+	/**
+	 * Points the dictionaries to the new position of a relation moved in the store.
+	 */
+	void Reindex(RelationHandle handle);
+
+	/**
+	 * Loaders for the binary and the old text formats of MBTD.dat.
+	 *
+	 * @return Count of loaded relations.
+	 */
+	int LoadBinary(const byte* data, size_t length);
+	int LoadText(const boost::filesystem::path& filename);
+
+	//! Lookups, throwing std::out_of_range for unknown identifiers as the maps' at() does.
+	//@{
+	MetadataRelation& At(const CMD4Hash& muleId) { return m_relations[m_MuleIHDictionary.at(muleId)]; }
+	MetadataRelation& At(const libtorrent::sha1_hash& BTId) { return m_relations[m_BTIHDictionary.at(BTId)]; }
+	MetadataRelation& At(const boost::filesystem::path& torrentPath) { return m_relations[m_BTFileDictionary.at(torrentPath)]; }
+	const MetadataRelation& At(const CMD4Hash& muleId) const { return m_relations[m_MuleIHDictionary.at(muleId)]; }
+	const MetadataRelation& At(const libtorrent::sha1_hash& BTId) const { return m_relations[m_BTIHDictionary.at(BTId)]; }
+	const MetadataRelation& At(const boost::filesystem::path& torrentPath) const { return m_relations[m_BTFileDictionary.at(torrentPath)]; }
+	//@}
 
 	MuleIdToMetadataRelation m_MuleIHDictionary; //! All MetadataRelations indexed by MD4 aMule file identifier.
 	BTIdToMetadataRelation m_BTIHDictionary;  //! All MetadataRelations indexed by SHA1 torrent content identifier.
 	InfoFileToMetadataRelation m_BTFileDictionary;  //! All MetadataRelations indexed by torrent info-file filename.
 
-	std::vector<MetadataRelation*> m_IterableMetadataRelations;  //! A vector with all the known MetadataRelations.
+	std::vector<MetadataRelation> m_relations;  //! All the known MetadataRelations, indexed by RelationHandle.
 };
 
 }
@@ -14,6 +14,9 @@
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
 #include <libtorrent/peer_info.hpp>
+#include <libtorrent/time.hpp>
+#include <deque>
+#include <algorithm>
 #include <common/Macros.h>
 #include "amule.h"
 
@@ -23,8 +26,17 @@ namespace torrent {
 CTorrentStrategy::CTorrentStrategy(libtorrent::session* torrentSession, CTorrentMuleMapping* mapping) {
 	m_ts = torrentSession;
 	m_lastTimeProcessWasRun = ::GetTickCount();
-	m_lastTimeAlertsWereProcessed = ::GetTickCount();
+	m_lastTimeValidationQueueProcessed = ::GetTickCount();
 	m_tmm = mapping;
+	m_processedAlerts = 0;
+	m_alertLatencySum = 0;
+	m_maxAlertLatency = 0;
+	m_maxAlertBacklog = 0;
+	m_alertHandlers[libtorrent::torrent_finished_alert::alert_type] = &CTorrentStrategy::HandleFinishedAlert;
+	m_alertHandlers[libtorrent::storage_moved_alert::alert_type] = &CTorrentStrategy::HandleStorageMovedAlert;
+	m_alertHandlers[libtorrent::torrent_resumed_alert::alert_type] = &CTorrentStrategy::HandleResumedAlert;
+	m_alertHandlers[libtorrent::metadata_received_alert::alert_type] = &CTorrentStrategy::HandleMetadataReceivedAlert;
+	m_alertHandlers[libtorrent::save_resume_data_alert::alert_type] = &CTorrentStrategy::HandleSaveResumeDataAlert;
 }
 
 uint64 CTorrentStrategy::GetCompletedSize(CMD4Hash fileId){
@@ -39,7 +51,8 @@ void CTorrentStrategy::OnReceivedMetadata(libtorrent::metadata_received_alert* m
 		m_tmm->SetDownloading(h.info_hash());
 }
 
-CTorrentStrategy::CTorrentStrategy() {} //! for inheritance purposes only.
+CTorrentStrategy::CTorrentStrategy()
+	: m_processedAlerts(0), m_alertLatencySum(0), m_maxAlertLatency(0), m_maxAlertBacklog(0) {} //! for inheritance purposes only.
 CTorrentStrategy::~CTorrentStrategy() {}
 
 CTorrentAlwaysFallToBTStrategy::CTorrentAlwaysFallToBTStrategy(libtorrent::session* torrentSession, CTorrentMuleMapping* mapping):CTorrentStrategy(torrentSession, mapping){}
@@ -60,61 +73,106 @@ void CTorrentStrategy::OnFinishedDownload(libtorrent::torrent_finished_alert* tf
 	h.move_storage(std::string(thePrefs::GetIncomingDir().GetPrintable()));
 }
 
-void CTorrentStrategy::ProcessAlert(std::auto_ptr<libtorrent::alert> a){
-	if (a.get()->category() == libtorrent::alert::error_notification) {
-		AddLogLineCS(_("Torrent error: ") + (a.get()->message()) + wxT(" - ") + std::string(a.get()->what()));
-	}
-	if (libtorrent::torrent_finished_alert* p = libtorrent::alert_cast<libtorrent::torrent_finished_alert>(a.get())){
-		AddDebugLogLineN(logTorrent, wxT("alert type: FINISHED ALERT"));
-		OnFinishedDownload(p);
-	} else if (libtorrent::storage_moved_alert* sma = libtorrent::alert_cast<libtorrent::storage_moved_alert>(a.get())){
-		AddDebugLogLineN(logTorrent, wxT("alert type: STORAGE MOVED ALERT"));
-		libtorrent::torrent_handle h = sma->handle;
-		theApp->sharedfiles->Reload();
-		if(m_tmm->HasMuleIH(h.info_hash())){
-			m_validationQueue.push_back(pair<CMD4Hash, int>( m_tmm->GetMuleIH(h.info_hash()), 0));
+void CTorrentStrategy::ProcessAlerts(){
+	std::deque<libtorrent::alert*> alerts;
+	m_ts->pop_alerts(&alerts);
+	if (!alerts.empty()){
+		if (alerts.size() > m_maxAlertBacklog){
+			m_maxAlertBacklog = alerts.size();
 		}
-		if(h.get_torrent_info().num_files() != 1){
-			AddLogLineNS("Downloaded a multi-file content, it will not be shared in aMule network");
-			//TODO: Something need to map the amulecollections to multi file torrents to avoid this message
+		libtorrent::ptime now = libtorrent::time_now();
+		uint32 batchLatency = 0;
+		for (std::deque<libtorrent::alert*>::iterator it = alerts.begin(); it != alerts.end(); ++it){
+			std::auto_ptr<libtorrent::alert> a(*it);
+			uint32 latency = libtorrent::total_milliseconds(now - a->timestamp());
+			m_alertLatencySum += latency;
+			batchLatency = std::max(batchLatency, latency);
+			try {
+				ProcessAlert(a.get());
+			} catch (libtorrent::libtorrent_exception& e){
+				// A handle going invalid under one alert must not lose the rest of the batch.
+				AddDebugLogLineC(logTorrent, wxT("Exception handling torrent alert: ") + std::string(e.what()));
+			}
 		}
-	} else if (libtorrent::torrent_resumed_alert* tra = libtorrent::alert_cast<libtorrent::torrent_resumed_alert>(a.get())){
-		AddDebugLogLineN(logTorrent, wxT("alert type: TORRENT RESUMED ALERT"));
-		OnTorrentResumed(tra);
-	} else if (libtorrent::metadata_received_alert* mra = libtorrent::alert_cast<libtorrent::metadata_received_alert>(a.get())){
-		AddDebugLogLineN(logTorrent, wxT("alert type: METADATA RECEIVED ALERT"));
-		OnReceivedMetadata(mra);
+		m_processedAlerts += alerts.size();
+		m_maxAlertLatency = std::max(m_maxAlertLatency, batchLatency);
+		AddDebugLogLineN(logTorrent, wxT("Processed ") + boost::lexical_cast<std::string>(alerts.size()) + " torrent alerts, oldest was " + boost::lexical_cast<std::string>(batchLatency) + " ms old");
 	}
-}
-
-void CTorrentAlwaysFallToBTStrategy::Process(){
-	// Process alerts
+	
 	uint32 tick = ::GetTickCount();
-	if(!( tick - m_lastTimeAlertsWereProcessed < SEC2MS(1))) {
-		std::auto_ptr<libtorrent::alert> a = m_ts->pop_alert();
-		if (a.get() != NULL) ProcessAlert(a);
-		m_lastTimeAlertsWereProcessed = tick;
-		if (!m_validationQueue.empty() && (tick - m_lastTimeValidationQueueProcessed < SEC2MS(5))){
-			ValidateDownloads();
-		}
+	if (!m_validationQueue.empty() && (tick - m_lastTimeValidationQueueProcessed >= SEC2MS(5))){
+		ValidateDownloads();
 		m_lastTimeValidationQueueProcessed = tick;
 	}
 }
 
+void CTorrentStrategy::ProcessAlert(libtorrent::alert* a){
+	if (a->category() & libtorrent::alert::error_notification) {
+		AddLogLineCS(_("Torrent error: ") + (a->message()) + wxT(" - ") + std::string(a->what()));
+	}
+	AlertHandlerMap::const_iterator it = m_alertHandlers.find(a->type());
+	if (it != m_alertHandlers.end()){
+		(this->*(it->second))(a);
+	}
+}
+
+void CTorrentStrategy::HandleFinishedAlert(libtorrent::alert* a){
+	AddDebugLogLineN(logTorrent, wxT("alert type: FINISHED ALERT"));
+	OnFinishedDownload(static_cast<libtorrent::torrent_finished_alert*>(a));
+}
+
+void CTorrentStrategy::HandleStorageMovedAlert(libtorrent::alert* a){
+	AddDebugLogLineN(logTorrent, wxT("alert type: STORAGE MOVED ALERT"));
+	OnStorageMoved(static_cast<libtorrent::storage_moved_alert*>(a));
+}
+
+void CTorrentStrategy::HandleResumedAlert(libtorrent::alert* a){
+	AddDebugLogLineN(logTorrent, wxT("alert type: TORRENT RESUMED ALERT"));
+	OnTorrentResumed(static_cast<libtorrent::torrent_resumed_alert*>(a));
+}
+
+void CTorrentStrategy::HandleMetadataReceivedAlert(libtorrent::alert* a){
+	AddDebugLogLineN(logTorrent, wxT("alert type: METADATA RECEIVED ALERT"));
+	OnReceivedMetadata(static_cast<libtorrent::metadata_received_alert*>(a));
+}
+
+void CTorrentStrategy::HandleSaveResumeDataAlert(libtorrent::alert* a){
+	libtorrent::save_resume_data_alert* sra = static_cast<libtorrent::save_resume_data_alert*>(a);
+	if (sra->resume_data){
+		CTorrent::GetInstance().SaveResumeData(sra->handle, *sra->resume_data);
+	}
+}
+
+void CTorrentStrategy::OnStorageMoved(libtorrent::storage_moved_alert* sma){
+	libtorrent::torrent_handle h = sma->handle;
+	theApp->sharedfiles->Reload();
+	if(m_tmm->HasMuleIH(h.info_hash())){
+		m_validationQueue.push_back(pair<CMD4Hash, int>( m_tmm->GetMuleIH(h.info_hash()), 0));
+	}
+	if(h.get_torrent_info().num_files() != 1){
+		AddLogLineNS("Downloaded a multi-file content, it will not be shared in aMule network");
+		//TODO: Something need to map the amulecollections to multi file torrents to avoid this message
+	}
+}
+
+void CTorrentAlwaysFallToBTStrategy::Process(){
+	// Everything this strategy does is driven by the alerts.
+}
+
 void CTorrentStrategy::ValidateDownloads(){
-	CKnownFile *file ;
 	std::vector<pair<CMD4Hash, int> >::iterator it = m_validationQueue.begin();
-	if (theApp->sharedfiles->GetCount() && (NULL != (file =  theApp->sharedfiles->GetFileByID(it->first)))){
-		if (it->second > MAX_ALLOWED_VALIDATION_TRIES){
-			m_validationQueue.erase(it);
+	while (it != m_validationQueue.end()){
+		if (theApp->sharedfiles->GetCount() && (NULL != theApp->sharedfiles->GetFileByID(it->first))){
+			AddDebugLogLineN(logTorrent, wxT("Validated downloaded file against its MD4 in try: ") + boost::lexical_cast<std::string>(it->second));
+			it = m_validationQueue.erase(it);
+		} else if (++it->second > MAX_ALLOWED_VALIDATION_TRIES){
 			AddLogLineCS(_("A file couldn't be validated against MD4 after download"));
 			//TODO: This file was completed success in torrent and the MD4 doesn't match, someone injected a fake SHA1, handle it.
+			it = m_validationQueue.erase(it);
+		} else {
+			++it;
 		}
-		it->second++;
-	} else {
-		AddDebugLogLineN(logTorrent, wxT("Validated downloaded file against its MD4 in try: ") + boost::lexical_cast<std::string>(it->second));
-		m_validationQueue.erase(it);
-	}	
+	}
 }
 
 void CTorrentStrategy::OnTorrentResumed(libtorrent::torrent_resumed_alert* ){ }
@@ -136,14 +194,7 @@ void CTorrentAlwaysFallToBTStrategy::OnTorrentResumed(libtorrent::torrent_resume
 
 CNoTorrentStrategy::CNoTorrentStrategy(libtorrent::session* torrentSession, CTorrentMuleMapping* mapping):CTorrentStrategy(torrentSession, mapping){}
 void CNoTorrentStrategy::Process(){
-	// Alerts need to be processed just in case we receive some metadata and want to save it.
-	uint32 tick = ::GetTickCount();
-	if( tick - m_lastTimeAlertsWereProcessed > SEC2MS(1)) return;
-	std::auto_ptr<libtorrent::alert> a = m_ts->pop_alert();
-	if (a.get() != NULL){
-		ProcessAlert(a);
-	}
-	m_lastTimeAlertsWereProcessed = tick;
+	// Only the alerts are needed, in case we receive some metadata and want to save it.
 }
 
 void CNoTorrentStrategy::OnReceivedMetadata(libtorrent::metadata_received_alert* mra){
@@ -164,15 +215,6 @@ CTorrentSwitchToTheMostUsablePeersStrategy::CTorrentSwitchToTheMostUsablePeersSt
 
 void CTorrentSwitchToTheMostUsablePeersStrategy::Process(){
 	uint32 tick = ::GetTickCount();
-	if(!( tick - m_lastTimeAlertsWereProcessed < SEC2MS(1))) {
-		std::auto_ptr<libtorrent::alert> a = m_ts->pop_alert();
-		if (a.get() != NULL) ProcessAlert(a);
-		m_lastTimeAlertsWereProcessed = tick;
-		if (!m_validationQueue.empty() && (tick - m_lastTimeValidationQueueProcessed < SEC2MS(5))){
-			ValidateDownloads();
-		}
-		m_lastTimeValidationQueueProcessed = tick;
-	}
 	// If 60 seconds passed since last optimistic resume, do it!
 	if ( tick - m_lastTimeOptimisticResume > SEC2MS(60)){
 		AddLogLineNS(wxT("DEBUG: Strategy going Optimistic resume."));
@@ -199,20 +241,20 @@ void CTorrentSwitchToTheMostUsablePeersStrategy::Process(){
 	//TODO: do a lock-safe iteration for the pauses.
 	/*if ( tick - m_lastTimeOptimisticResume > SEC2MS(10) && tick - m_lastTimeAppliedPauses > SEC2MS(60)){
 		AddLogLineNS("DEBUG: Pausing the lower tempting download items in each queue");
-		for (CTorrentMuleMapping::const_iterator tmmit = m_tmm->begin(); tmmit != m_tmm->end(); ++m_tmm){
-			if ( (*tmmit)->get<0>() != NULL  && (*tmmit)->get<1>() != NULL && (*tmmit)->get<3>() == downloading){
-				CPartFile* part = theApp->downloadqueue->GetFileByID(*(*tmmit)->get<0>());
+		for (CTorrentMuleMapping::const_iterator tmmit = m_tmm->begin(); tmmit != m_tmm->end(); ++tmmit){
+			if ( tmmit->HasMuleIH() && tmmit->HasBTIH() && tmmit->GetState() == downloading){
+				CPartFile* part = theApp->downloadqueue->GetFileByID(tmmit->GetMuleIH());
 				if (part != NULL) {
-					libtorrent::torrent_handle th = m_ts->find_torrent(*(*tmmit)->get<1>());
+					libtorrent::torrent_handle th = m_ts->find_torrent(tmmit->GetBTIH());
 					if (th.is_valid()){
 						AddLogLineNS(boost::lexical_cast<std::string>(part->GetKBpsDown()).append("<?").append(boost::lexical_cast<std::string>(th.status().download_rate)));
 						if (part->GetKBpsDown() < th.status().download_rate){
 							part->PauseFile();
-							m_pausedMule.push_back(*(*tmmit)->get<0>());
+							m_pausedMule.push_back(tmmit->GetMuleIH());
 						} else {
 							th.auto_managed(false);
 							th.set_upload_mode(true);
-							m_pausedTorrent.push_back(*(*tmmit)->get<1>());
+							m_pausedTorrent.push_back(tmmit->GetBTIH());
 						}
 					}
 				}
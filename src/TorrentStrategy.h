@@ -8,6 +8,7 @@
 #ifndef TORRENTSTRATEGY_H_
 #define TORRENTSTRATEGY_H_
 #include <vector>
+#include <map>
 #include "MD4Hash.h"
 #include <libtorrent/peer_id.hpp>
 #include <libtorrent/session.hpp>
@@ -47,6 +48,35 @@ public:
 	 */
 	virtual void Process()=0;
 
+	/**
+	 * Drains all the pending alerts from the torrent session and handles them.
+	 *
+	 * It is meant to be called on every core tick, even when Process is not, so alerts are
+	 * handled as soon as possible instead of backing up in the session until libtorrent
+	 * drops them. It also runs the validation of finished downloads.
+	 */
+	void ProcessAlerts();
+
+	/**
+	 * Total number of alerts processed since the strategy was created.
+	 */
+	uint64 GetProcessedAlerts() const { return m_processedAlerts; }
+
+	/**
+	 * Largest number of alerts that were pending in the session at once.
+	 */
+	uint32 GetMaxAlertBacklog() const { return m_maxAlertBacklog; }
+
+	/**
+	 * Average time in milliseconds between an alert being posted by libtorrent and it being handled.
+	 */
+	uint32 GetAverageAlertLatency() const { return m_processedAlerts ? m_alertLatencySum / m_processedAlerts : 0; }
+
+	/**
+	 * Longest time in milliseconds between an alert being posted by libtorrent and it being handled.
+	 */
+	uint32 GetMaxAlertLatency() const { return m_maxAlertLatency; }
+
 	/**
 	 * Given a file get an estimation of how much of it was downloaded.
 	 *
@@ -67,9 +97,20 @@ public:
 	virtual ~CTorrentStrategy();
 protected:
 	/**
-	 * Processes the alerts coming from asynchronous torrent tasks.
+	 * Processes an alert coming from asynchronous torrent tasks.
+	 *
+	 * The alert is dispatched to the handler registered for its type in m_alertHandlers.
+	 */
+	void ProcessAlert(libtorrent::alert*);
+
+	/**
+	 * Handlers for the alert types, they cast the alert and call the matching On* method.
 	 */
-	void ProcessAlert(std::auto_ptr<libtorrent::alert>);
+	void HandleFinishedAlert(libtorrent::alert*);
+	void HandleStorageMovedAlert(libtorrent::alert*);
+	void HandleResumedAlert(libtorrent::alert*);
+	void HandleMetadataReceivedAlert(libtorrent::alert*);
+	void HandleSaveResumeDataAlert(libtorrent::alert*);
 
 	/**
 	 * Process the received metadata alert 
@@ -92,15 +133,28 @@ protected:
 	 */
 	virtual void OnFinishedDownload(libtorrent::torrent_finished_alert * );
 
+	/**
+	 * Process the moved storage alert
+	 *
+	 * Reloads the shared files and queues the download for validation.
+	 */
+	void OnStorageMoved(libtorrent::storage_moved_alert*);
+
 	/**
 	 * Check the torrents that were finished if any of them failed the MD4 check.
 	 */
 	void ValidateDownloads();
 	
+	typedef void (CTorrentStrategy::*AlertHandler)(libtorrent::alert*);
+	typedef std::map<int, AlertHandler> AlertHandlerMap;
 	
 	uint32 m_lastTimeProcessWasRun; //! last time the Process method was called for this strategy.
-	uint32 m_lastTimeAlertsWereProcessed; //! last time the Alerts for torrent asynchronous task were processed.
 	uint32 m_lastTimeValidationQueueProcessed; //! last time the Validation Queue was processed.
+	AlertHandlerMap m_alertHandlers; //! Handlers for the alert types the strategy cares about, keyed by alert type.
+	uint64 m_processedAlerts; //! Number of alerts processed.
+	uint64 m_alertLatencySum; //! Sum of the latencies of all processed alerts, in milliseconds.
+	uint32 m_maxAlertLatency; //! Longest latency of a processed alert, in milliseconds.
+	uint32 m_maxAlertBacklog; //! Largest number of alerts drained at once.
 	libtorrent::session * m_ts; //! pointer to the active torrent session.
 	CTorrentMuleMapping * m_tmm; //! pointer to the Metadata Relation for torrent and amule.
 	std::vector<std::pair<CMD4Hash, int> > m_validationQueue; //! This Vector keeps record of those hashes awaiting validation and how many tries for validation were done.
@@ -132,7 +186,7 @@ public:
 	CTorrentAlwaysFallToBTStrategy(libtorrent::session* torrentSession, CTorrentMuleMapping* mapping);
 
 	/**
-	 * When new BT info has was received moves the download to Torrent Protocol and start ProcessAlerts
+	 * Nothing to do, downloads are moved to Torrent Protocol when the alerts are handled.
 	 *
 	 * @see CTorrentStrategy::Process and CTorrentStrategy::ProcessAlerts
 	 */
@@ -217,7 +271,7 @@ public:
 	CTorrentSwitchToTheMostUsablePeersStrategy(libtorrent::session* torrentSession, CTorrentMuleMapping* mapping);
 
 	/**
-	 * Does nothing.
+	 * Periodically resumes the downloads that were paused in favour of the other protocol.
 	 *
 	 * @see CTorrentStrategy::Process and CTorrentStrategy::ProcessAlerts
 	 */
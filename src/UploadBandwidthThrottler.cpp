@@ -28,6 +28,7 @@
 #include <protocol/ed2k/Constants.h>
 #include <common/Macros.h>
 #include <common/Constants.h>
+#include <common/Atomic.h>
 
 #include <cmath>
 #include <limits> // Do_not_auto_remove (NetBSD)
@@ -36,6 +37,9 @@
 #include "Logger.h"
 #include "Preferences.h"
 #include "Statistics.h"
+#include "GetTickCount.h"		// Needed for GetTickCountUSec
+
+#include <wx/utils.h>			// Needed for wxMicroSleep
 
 #ifndef _MSC_VER
 
@@ -65,6 +69,14 @@ UploadBandwidthThrottler::UploadBandwidthThrottler()
 {
 	m_SentBytesSinceLastCall = 0;
 	m_SentBytesSinceLastCallOverhead = 0;
+	m_PendingControlQueue = NULL;
+	m_removedSlots = 0;
+
+	// Chain all pool entries into the free list
+	for (uint32 i = 0; i < CONTROL_POOL_SIZE; ++i) {
+		m_ControlPool[i].nextFree = (i + 1 < CONTROL_POOL_SIZE) ? i + 2 : 0;
+	}
+	m_FreeControlSockets = 1;
 
 	m_doRun = true;
 
@@ -79,6 +91,7 @@ UploadBandwidthThrottler::UploadBandwidthThrottler()
 UploadBandwidthThrottler::~UploadBandwidthThrottler()
 {
 	EndThread();
+	DeletePendingControlQueue();
 }
 
 
@@ -121,12 +134,11 @@ uint64 UploadBandwidthThrottler::GetNumberOfSentBytesOverheadSinceLastCallAndRes
  * The sockets are called in the order they exist in the list, so the top socket (index 0)
  * will be given a chance first to use bandwidth, and then the next socket (index 1) etc.
  *
- * It is possible to add a socket several times to the list without removing it inbetween,
- * but that should be avoided.
+ * Adding a socket that is already in the list moves it to the new place.
  *
  * @param index insert the socket at this place in the list. An index that is higher than the
  *              current number of sockets in the list will mean that the socket should be inserted
- *              last in the list.
+ *              last in the list. Only adding last is O(1), inserting elsewhere renumbers the list.
  *
  * @param socket the address to the socket that should be added to the list. If the address is NULL,
  *               this method will do nothing.
@@ -137,20 +149,28 @@ void UploadBandwidthThrottler::AddToStandardList(uint32 index, ThrottledFileSock
 		wxMutexLocker lock( m_sendLocker );
 
 		RemoveFromStandardListNoLock(socket);
-		if (index > (uint32)m_StandardOrder_list.size()) {
-			index = m_StandardOrder_list.size();
+
+		if (index >= m_StandardOrder_list.size() - m_removedSlots) {
+			socket->m_uploadSlot = m_StandardOrder_list.size();
+			m_StandardOrder_list.push_back(socket);
+		} else {
+			// The index counts live sockets only, so get rid of the holes first
+			uint32 unused = 0;
+			CompactStandardList(unused);
+
+			m_StandardOrder_list.insert(m_StandardOrder_list.begin() + index, socket);
+			for (uint32 i = index; i < m_StandardOrder_list.size(); ++i) {
+				m_StandardOrder_list[i]->m_uploadSlot = i;
+			}
 		}
-		
-		m_StandardOrder_list.insert(m_StandardOrder_list.begin() + index, socket);
 	}
 }
 
 
 /**
- * Remove a socket from the list of sockets that have upload slots.
- *
- * If the socket has mistakenly been added several times to the list, this method
- * will return all of the entries for the socket.
+ * Remove a socket from the list of sockets that have upload slots. Unlike queueing
+ * control packets this takes m_sendLocker, so it waits for the upload thread to finish
+ * its current loop.
  *
  * @param socket the address of the socket that should be removed from the list. If this socket
  *               does not exist in the list, this method will do nothing.
@@ -169,12 +189,68 @@ bool UploadBandwidthThrottler::RemoveFromStandardList(ThrottledFileSocket* socke
  * the socket. This method should only be called when the current thread already owns
  * the m_sendLocker lock!
  *
+ * The socket's entry is replaced by NULL, and the hole is removed later by
+ * CompactStandardList, so the order of the other sockets is kept without moving them.
+ *
  * @param socket address of the socket that should be removed from the list. If this socket
  *               does not exist in the list, this method will do nothing.
  */
 bool UploadBandwidthThrottler::RemoveFromStandardListNoLock(ThrottledFileSocket* socket)
 {
-	return (EraseFirstValue( m_StandardOrder_list, socket ) > 0);
+	const uint32 slot = socket->m_uploadSlot;
+	if (slot == ThrottledFileSocket::NO_UPLOAD_SLOT) {
+		return false;
+	}
+
+	wxCHECK(slot < m_StandardOrder_list.size() && m_StandardOrder_list[slot] == socket, false);
+
+	m_StandardOrder_list[slot] = NULL;
+	socket->m_uploadSlot = ThrottledFileSocket::NO_UPLOAD_SLOT;
+	++m_removedSlots;
+
+	// Holes at the end can go right away
+	while (!m_StandardOrder_list.empty() && m_StandardOrder_list.back() == NULL) {
+		m_StandardOrder_list.pop_back();
+		--m_removedSlots;
+	}
+
+	return true;
+}
+
+
+/**
+ * Removes the holes left in m_StandardOrder_list by removed sockets. NOT THREADSAFE!
+ * The caller must own the m_sendLocker lock.
+ *
+ * @param rememberedSlotCounter a position in the list, which is adjusted to point to
+ *                              the same socket (or the one following it if it was removed).
+ */
+void UploadBandwidthThrottler::CompactStandardList(uint32& rememberedSlotCounter)
+{
+	if (m_removedSlots == 0) {
+		return;
+	}
+
+	uint32 live = 0;
+	uint32 remembered = 0;
+	for (uint32 i = 0; i < m_StandardOrder_list.size(); ++i) {
+		if (i == rememberedSlotCounter) {
+			remembered = live;
+		}
+
+		ThrottledFileSocket* socket = m_StandardOrder_list[i];
+		if (socket) {
+			socket->m_uploadSlot = live;
+			m_StandardOrder_list[live++] = socket;
+		}
+	}
+
+	if (rememberedSlotCounter < m_StandardOrder_list.size()) {
+		rememberedSlotCounter = remembered;
+	}
+
+	m_StandardOrder_list.resize(live);
+	m_removedSlots = 0;
 }
 
 
@@ -187,24 +263,117 @@ bool UploadBandwidthThrottler::RemoveFromStandardListNoLock(ThrottledFileSocket*
 * already have done its work when the second Send() is called, and will just
 * return with little cpu overhead.
 *
+* This method takes no locks, so it never waits for the send thread.
+*
 * @param socket address to the socket that requests to have controlpacket send
 *               to be called on it
 */
 void UploadBandwidthThrottler::QueueForSendingControlPacket(ThrottledControlSocket* socket, bool hasSent)
 {
-	// Get critical section
-	wxMutexLocker lock( m_tempQueueLocker );
-
 	if ( m_doRun ) {
-		if( hasSent ) {
-			m_TempControlQueueFirst_list.push_back(socket);
+		PendingControlSocket* entry = AllocPendingControlSocket();
+		entry->socket = socket;
+		entry->hasSent = hasSent;
+
+		do {
+			entry->next = AtomicLoad(&m_PendingControlQueue);
+		} while (!AtomicCompareAndSwap(&m_PendingControlQueue, entry->next, entry));
+	}
+}
+
+
+/**
+ * Moves the sockets queued by QueueForSendingControlPacket to the control queues,
+ * in the order they were queued. NOT THREADSAFE! The caller must own the m_sendLocker
+ * lock, which makes it the only consumer of m_PendingControlQueue.
+ */
+void UploadBandwidthThrottler::DrainPendingControlQueue()
+{
+	PendingControlSocket* entry = AtomicExchange(&m_PendingControlQueue, (PendingControlSocket*)NULL);
+
+	// The pending queue is newest first
+	PendingControlSocket* oldest = NULL;
+	while (entry) {
+		PendingControlSocket* next = entry->next;
+		entry->next = oldest;
+		oldest = entry;
+		entry = next;
+	}
+
+	while (oldest) {
+		if (oldest->hasSent) {
+			m_ControlQueueFirst_list.push_back(oldest->socket);
 		} else {
-			m_TempControlQueue_list.push_back(socket);
+			m_ControlQueue_list.push_back(oldest->socket);
 		}
+
+		PendingControlSocket* next = oldest->next;
+		FreePendingControlSocket(oldest);
+		oldest = next;
 	}
 }
 
 
+/**
+ * Throws away the sockets queued by QueueForSendingControlPacket, without touching them.
+ */
+void UploadBandwidthThrottler::DeletePendingControlQueue()
+{
+	PendingControlSocket* entry = AtomicExchange(&m_PendingControlQueue, (PendingControlSocket*)NULL);
+
+	while (entry) {
+		PendingControlSocket* next = entry->next;
+		FreePendingControlSocket(entry);
+		entry = next;
+	}
+}
+
+
+/**
+ * Takes an entry for m_PendingControlQueue from the pool, without locking.
+ * Falls back to the heap when the pool is exhausted.
+ */
+UploadBandwidthThrottler::PendingControlSocket* UploadBandwidthThrottler::AllocPendingControlSocket()
+{
+	uint64 head = AtomicLoad(&m_FreeControlSockets);
+	for (;;) {
+		uint32 index = (uint32)head;
+		if (index == 0) {
+			return new PendingControlSocket;
+		}
+
+		// The entry may be taken by another thread meanwhile, in which case
+		// nextFree is stale, but then the tag has changed and the swap fails.
+		PendingControlSocket* entry = &m_ControlPool[index - 1];
+		uint64 next = (((head >> 32) + 1) << 32) | entry->nextFree;
+		if (AtomicCompareAndSwap(&m_FreeControlSockets, head, next)) {
+			return entry;
+		}
+
+		head = AtomicLoad(&m_FreeControlSockets);
+	}
+}
+
+
+/**
+ * Returns an entry taken with AllocPendingControlSocket, without locking.
+ */
+void UploadBandwidthThrottler::FreePendingControlSocket(PendingControlSocket* entry)
+{
+	if (entry < m_ControlPool || entry >= m_ControlPool + CONTROL_POOL_SIZE) {
+		delete entry;
+		return;
+	}
+
+	uint64 head;
+	uint64 next;
+	do {
+		head = AtomicLoad(&m_FreeControlSockets);
+		entry->nextFree = (uint32)head;
+		next = (((head >> 32) + 1) << 32) | (uint32)(entry - m_ControlPool + 1);
+	} while (!AtomicCompareAndSwap(&m_FreeControlSockets, head, next));
+}
+
 
 /**
  * Remove the socket from all lists and queues. This will make it safe to
@@ -216,13 +385,12 @@ void UploadBandwidthThrottler::QueueForSendingControlPacket(ThrottledControlSock
 void UploadBandwidthThrottler::DoRemoveFromAllQueues(ThrottledControlSocket* socket)
 {
 	if ( m_doRun ) {
+		// Take over the pending requests, so none of them is left behind for this socket
+		DrainPendingControlQueue();
+
 		// Remove this socket from control packet queue
 		EraseValue( m_ControlQueue_list, socket );
 		EraseValue( m_ControlQueueFirst_list, socket );
-		
-		wxMutexLocker lock( m_tempQueueLocker );
-		EraseValue( m_TempControlQueue_list, socket );
-		EraseValue( m_TempControlQueueFirst_list, socket );
 	}
 }
 
@@ -268,6 +436,91 @@ void UploadBandwidthThrottler::EndThread()
 }
 
 
+/**
+ * Calls send on the sockets, control packets first, then the upload slots.
+ * NOT THREADSAFE! The caller must own the m_sendLocker lock.
+ *
+ * @return the number of bytes sent, including overhead.
+ */
+sint32 UploadBandwidthThrottler::SendQueuedData(sint32 bytesToSpend, uint32 thisLoopTick, uint32 minFragSize, uint32 doubleSendSize, uint32& rememberedSlotCounter)
+{
+	sint32 spentBytes = 0;
+	sint32 spentOverhead = 0;
+
+	// Send any queued up control packets first
+	while (spentBytes < bytesToSpend && (!m_ControlQueueFirst_list.empty() || !m_ControlQueue_list.empty())) {
+		ThrottledControlSocket* socket = NULL;
+
+		if (!m_ControlQueueFirst_list.empty()) {
+			socket = m_ControlQueueFirst_list.front();
+			m_ControlQueueFirst_list.pop_front();
+		} else if (!m_ControlQueue_list.empty()) {
+			socket = m_ControlQueue_list.front();
+			m_ControlQueue_list.pop_front();
+		}
+
+		if (socket != NULL) {
+			SocketSentBytes socketSentBytes = socket->SendControlData(bytesToSpend-spentBytes, minFragSize);
+			spentBytes += socketSentBytes.sentBytesControlPackets + socketSentBytes.sentBytesStandardPackets;
+			spentOverhead += socketSentBytes.sentBytesControlPackets;
+		}
+	}
+
+	// Check if any sockets haven't gotten data for a long time. Then trickle them a package.
+	uint32 slots = m_StandardOrder_list.size();
+	for (uint32 slotCounter = 0; slotCounter < slots; slotCounter++) {
+		ThrottledFileSocket* socket = m_StandardOrder_list[ slotCounter ];
+
+		if (socket != NULL) {
+			if (thisLoopTick-socket->GetLastCalledSend() > SEC2MS(1)) {
+				// trickle
+				uint32 neededBytes = socket->GetNeededBytes();
+
+				if (neededBytes > 0) {
+					SocketSentBytes socketSentBytes = socket->SendFileAndControlData(neededBytes, minFragSize);
+					spentBytes += socketSentBytes.sentBytesControlPackets + socketSentBytes.sentBytesStandardPackets;
+					spentOverhead += socketSentBytes.sentBytesControlPackets;
+				}
+			}
+		} else {
+			AddDebugLogLineN(logGeneral, CFormat( wxT("There was a NULL socket in the UploadBandwidthThrottler Standard list (trickle)! Prevented usage. Index: %i Size: %i"))
+				% slotCounter % m_StandardOrder_list.size());
+		}
+	}
+
+	// Give available bandwidth to slots, starting with the one we ended with last time.
+	// There are two passes. First pass gives packets of doubleSendSize, second pass
+	// gives as much as possible.
+	// Second pass starts with the last slot of the first pass actually.
+	for (uint32 slotCounter = 0; (slotCounter < slots * 2) && spentBytes < bytesToSpend; slotCounter++) {
+		if (rememberedSlotCounter >= slots) {	// wrap around pointer
+			rememberedSlotCounter = 0;
+		}
+
+		uint32 data = (slotCounter < slots - 1)	? doubleSendSize				// pass 1
+													: (bytesToSpend - spentBytes);	// pass 2
+
+		ThrottledFileSocket* socket = m_StandardOrder_list[ rememberedSlotCounter ];
+
+		if (socket != NULL) {
+			SocketSentBytes socketSentBytes = socket->SendFileAndControlData(data, doubleSendSize);
+			spentBytes += socketSentBytes.sentBytesControlPackets + socketSentBytes.sentBytesStandardPackets;
+			spentOverhead += socketSentBytes.sentBytesControlPackets;
+		} else {
+			AddDebugLogLineN(logGeneral, CFormat(wxT("There was a NULL socket in the UploadBandwidthThrottler Standard list (equal-for-all)! Prevented usage. Index: %i Size: %i"))
+				% rememberedSlotCounter % m_StandardOrder_list.size());
+		}
+
+		rememberedSlotCounter++;
+	}
+
+	m_SentBytesSinceLastCall += spentBytes;
+	m_SentBytesSinceLastCallOverhead += spentOverhead;
+
+	return spentBytes;
+}
+
+
 /**
  * The thread method that handles calling send for the individual sockets.
  *
@@ -276,21 +529,30 @@ void UploadBandwidthThrottler::EndThread()
  * out of available bandwidth for this loop. Upload slots will not be allowed to go without having sent
  * called for more than a defined amount of time (i.e. two seconds).
  *
+ * In token bucket mode, bandwidth is credited with microsecond precision, and the thread sleeps
+ * exactly until there is enough for one fragment, instead of polling every millisecond. Unused
+ * bandwidth is saved up to a burst of 100ms worth of data.
+ *
  * @return always returns 0.
  */
 void* UploadBandwidthThrottler::Entry()
 {
 	const uint32 TIME_BETWEEN_UPLOAD_LOOPS = 1;
+	// Shortest sleep in token bucket mode, so a slot sending tiny amounts doesn't make us spin
+	const uint64 MIN_TOKEN_BUCKET_SLEEP = 250;
 	
 	uint32 lastLoopTick = GetTickCountFullRes();
+	uint64 lastLoopUSec = GetTickCountUSec();
 	// Bytes to spend in current cycle. If we spend more this becomes negative and causes a wait next time.
 	sint32 bytesToSpend = 0;
+	// Token bucket mode: millionths of a byte carried over to the next loop
+	uint64 creditRemainder = 0;
 	uint32 allowedDataRate = 0;
 	uint32 rememberedSlotCounter = 0;
 	uint32 extraSleepTime = TIME_BETWEEN_UPLOAD_LOOPS;
 	
 	while (m_doRun && !TestDestroy()) {
-		uint32 timeSinceLastLoop = GetTickCountFullRes() - lastLoopTick;
+		const bool tokenBucket = thePrefs::UseUploadTokenBucket();
 
 		// Calculate data rate
 		if (thePrefs::GetMaxUpload() == UNLIMITED) {
@@ -309,18 +571,37 @@ void* UploadBandwidthThrottler::Entry()
 
 
 		uint32 sleepTime;
-		if (bytesToSpend < 1) {
-			// We have sent more than allowed in last cycle so we have to wait now
-			// until we can send at least 1 byte.
-			sleepTime = std::max((-bytesToSpend + 1) * 1000 / allowedDataRate + 2, // add 2 ms to allow for rounding inaccuracies
-									extraSleepTime);
+		uint64 sleepTimeUSec = 0;
+		if (tokenBucket) {
+			// Wait until the bucket holds a fragment, or longer if there was nothing to send
+			if (bytesToSpend < (sint32)minFragSize) {
+				sleepTimeUSec = ((sint64)minFragSize - bytesToSpend) * (uint64)1000000 / allowedDataRate;
+			}
+			if (extraSleepTime > TIME_BETWEEN_UPLOAD_LOOPS) {
+				sleepTimeUSec = std::max<uint64>(sleepTimeUSec, extraSleepTime * (uint64)1000);
+			}
+			sleepTimeUSec = std::max(sleepTimeUSec, MIN_TOKEN_BUCKET_SLEEP);
+			sleepTime = (uint32)(sleepTimeUSec / 1000);
+
+			uint64 timeSinceLastLoopUSec = GetTickCountUSec() - lastLoopUSec;
+			if (timeSinceLastLoopUSec < sleepTimeUSec) {
+				wxMicroSleep(sleepTimeUSec - timeSinceLastLoopUSec);
+			}
 		} else {
-			// We could send at once, but sleep a while to not suck up all cpu
-			sleepTime = extraSleepTime;
-		}
+			if (bytesToSpend < 1) {
+				// We have sent more than allowed in last cycle so we have to wait now
+				// until we can send at least 1 byte.
+				sleepTime = std::max((-bytesToSpend + 1) * 1000 / allowedDataRate + 2, // add 2 ms to allow for rounding inaccuracies
+										extraSleepTime);
+			} else {
+				// We could send at once, but sleep a while to not suck up all cpu
+				sleepTime = extraSleepTime;
+			}
 
-		if (timeSinceLastLoop < sleepTime) {
-			Sleep(sleepTime-timeSinceLastLoop);
+			uint32 timeSinceLastLoop = GetTickCountFullRes() - lastLoopTick;
+			if (timeSinceLastLoop < sleepTime) {
+				Sleep(sleepTime-timeSinceLastLoop);
+			}
 		}
 
 		// Check after sleep in case the thread has been signaled to end
@@ -329,9 +610,13 @@ void* UploadBandwidthThrottler::Entry()
 		}
 
 		const uint32 thisLoopTick = GetTickCountFullRes();
-		timeSinceLastLoop = thisLoopTick - lastLoopTick;
+		uint32 timeSinceLastLoop = thisLoopTick - lastLoopTick;
 		lastLoopTick = thisLoopTick;
 
+		const uint64 thisLoopUSec = GetTickCountUSec();
+		uint64 timeSinceLastLoopUSec = thisLoopUSec - lastLoopUSec;
+		lastLoopUSec = thisLoopUSec;
+
 		if (timeSinceLastLoop > sleepTime + 2000) {
 			AddDebugLogLineN(logGeneral, CFormat(wxT("UploadBandwidthThrottler: Time since last loop too long. time: %ims wanted: %ims Max: %ims")) 
 				% timeSinceLastLoop % sleepTime % (sleepTime + 2000));
@@ -341,112 +626,47 @@ void* UploadBandwidthThrottler::Entry()
 
 		// Calculate how many bytes we can spend
 
-		bytesToSpend += (sint32) (allowedDataRate / 1000.0 * timeSinceLastLoop);
+		if (tokenBucket) {
+			timeSinceLastLoopUSec = std::min(timeSinceLastLoopUSec, sleepTimeUSec + 2000000);
 
-		if (bytesToSpend >= 1) {
-			sint32 spentBytes = 0;
-			sint32 spentOverhead = 0;
+			const uint64 credit = (uint64)allowedDataRate * timeSinceLastLoopUSec + creditRemainder;
+			bytesToSpend += (sint32)(credit / 1000000);
+			creditRemainder = credit % 1000000;
+		} else {
+			bytesToSpend += (sint32) (allowedDataRate / 1000.0 * timeSinceLastLoop);
+		}
 
+		if (bytesToSpend >= 1) {
 			wxMutexLocker sendLock(m_sendLocker);
 
-			{
-				wxMutexLocker queueLock(m_tempQueueLocker);
-
-				// are there any sockets in m_TempControlQueue_list? Move them to normal m_ControlQueue_list;
-				m_ControlQueueFirst_list.insert(	m_ControlQueueFirst_list.end(),
-													m_TempControlQueueFirst_list.begin(),
-													m_TempControlQueueFirst_list.end() );
+			// Pick up the sockets queued since the last loop and close the holes
+			// left by removed upload slots.
+			DrainPendingControlQueue();
+			CompactStandardList(rememberedSlotCounter);
 
-				m_ControlQueue_list.insert( m_ControlQueue_list.end(), 
-											m_TempControlQueue_list.begin(),
-											m_TempControlQueue_list.end() );
-
-				m_TempControlQueue_list.clear();
-				m_TempControlQueueFirst_list.clear();
-			}
-	
-			// Send any queued up control packets first
-			while (spentBytes < bytesToSpend && (!m_ControlQueueFirst_list.empty() || !m_ControlQueue_list.empty())) {
-				ThrottledControlSocket* socket = NULL;
-	
-				if (!m_ControlQueueFirst_list.empty()) {
-					socket = m_ControlQueueFirst_list.front();
-					m_ControlQueueFirst_list.pop_front();
-				} else if (!m_ControlQueue_list.empty()) {
-					socket = m_ControlQueue_list.front();
-					m_ControlQueue_list.pop_front();
-				}
-	
-				if (socket != NULL) {
-					SocketSentBytes socketSentBytes = socket->SendControlData(bytesToSpend-spentBytes, minFragSize);
-					spentBytes += socketSentBytes.sentBytesControlPackets + socketSentBytes.sentBytesStandardPackets;
-					spentOverhead += socketSentBytes.sentBytesControlPackets;
-				}
-			}
-	
-			// Check if any sockets haven't gotten data for a long time. Then trickle them a package.
-			uint32 slots = m_StandardOrder_list.size();
-			for (uint32 slotCounter = 0; slotCounter < slots; slotCounter++) {
-				ThrottledFileSocket* socket = m_StandardOrder_list[ slotCounter ];
-	
-				if (socket != NULL) {
-					if (thisLoopTick-socket->GetLastCalledSend() > SEC2MS(1)) {
-						// trickle
-						uint32 neededBytes = socket->GetNeededBytes();
-	
-						if (neededBytes > 0) {
-							SocketSentBytes socketSentBytes = socket->SendFileAndControlData(neededBytes, minFragSize);
-							spentBytes += socketSentBytes.sentBytesControlPackets + socketSentBytes.sentBytesStandardPackets;
-							spentOverhead += socketSentBytes.sentBytesControlPackets;
-						}
-					}
-				} else {
-					AddDebugLogLineN(logGeneral, CFormat( wxT("There was a NULL socket in the UploadBandwidthThrottler Standard list (trickle)! Prevented usage. Index: %i Size: %i"))
-						% slotCounter % m_StandardOrder_list.size());
-				}
-			}
-	
-			// Give available bandwidth to slots, starting with the one we ended with last time.
-			// There are two passes. First pass gives packets of doubleSendSize, second pass
-			// gives as much as possible.
-			// Second pass starts with the last slot of the first pass actually.
-			for (uint32 slotCounter = 0; (slotCounter < slots * 2) && spentBytes < bytesToSpend; slotCounter++) {
-				if (rememberedSlotCounter >= slots) {	// wrap around pointer
-					rememberedSlotCounter = 0;
-				}
-
-				uint32 data = (slotCounter < slots - 1)	? doubleSendSize				// pass 1
-															: (bytesToSpend - spentBytes);	// pass 2
-
-				ThrottledFileSocket* socket = m_StandardOrder_list[ rememberedSlotCounter ];
-
-				if (socket != NULL) {
-					SocketSentBytes socketSentBytes = socket->SendFileAndControlData(data, doubleSendSize);
-					spentBytes += socketSentBytes.sentBytesControlPackets + socketSentBytes.sentBytesStandardPackets;
-					spentOverhead += socketSentBytes.sentBytesControlPackets;
-				} else {
-					AddDebugLogLineN(logGeneral, CFormat(wxT("There was a NULL socket in the UploadBandwidthThrottler Standard list (equal-for-all)! Prevented usage. Index: %i Size: %i"))
-						% rememberedSlotCounter % m_StandardOrder_list.size());
-				}
-
-				rememberedSlotCounter++;
-			}
+			const uint32 slots = m_StandardOrder_list.size();
+			const sint32 spentBytes = SendQueuedData(bytesToSpend, thisLoopTick, minFragSize, doubleSendSize, rememberedSlotCounter);
 
 			// Do some limiting of what we keep for the next loop.
 			bytesToSpend -= spentBytes;
-			sint32 minBytesToSpend = (slots + 1) * minFragSize;
 
-			if (bytesToSpend < - minBytesToSpend) {
-				bytesToSpend = - minBytesToSpend;
+			if (tokenBucket) {
+				// Bucket depth is 100ms worth of data, but at least a fragment per slot
+				const sint32 bucketDepth = std::max<sint32>(allowedDataRate / 10, (slots + 1) * minFragSize);
+
+				bytesToSpend = std::min(std::max(bytesToSpend, -bucketDepth), bucketDepth);
 			} else {
-				sint32 bandwidthSavedTolerance = slots * 512 + 1;
-				if (bytesToSpend > bandwidthSavedTolerance) {
-					bytesToSpend = bandwidthSavedTolerance;
+				sint32 minBytesToSpend = (slots + 1) * minFragSize;
+
+				if (bytesToSpend < - minBytesToSpend) {
+					bytesToSpend = - minBytesToSpend;
+				} else {
+					sint32 bandwidthSavedTolerance = slots * 512 + 1;
+					if (bytesToSpend > bandwidthSavedTolerance) {
+						bytesToSpend = bandwidthSavedTolerance;
+					}
 				}
 			}
-			
-			m_SentBytesSinceLastCall += spentBytes;
-			m_SentBytesSinceLastCallOverhead += spentOverhead;
 
 			if (spentBytes == 0) {	// spentBytes includes the overhead
 				extraSleepTime = std::min<uint32>(extraSleepTime * 5, 1000); // 1s at most
@@ -456,15 +676,18 @@ void* UploadBandwidthThrottler::Entry()
 		}
 	}
 
-	{
-		wxMutexLocker queueLock(m_tempQueueLocker);
-		m_TempControlQueue_list.clear();
-		m_TempControlQueueFirst_list.clear();
-	}
-
 	wxMutexLocker sendLock(m_sendLocker);
+	DeletePendingControlQueue();
 	m_ControlQueue_list.clear();
+	m_ControlQueueFirst_list.clear();
+
+	for (uint32 i = 0; i < m_StandardOrder_list.size(); ++i) {
+		if (m_StandardOrder_list[i]) {
+			m_StandardOrder_list[i]->m_uploadSlot = ThrottledFileSocket::NO_UPLOAD_SLOT;
+		}
+	}
 	m_StandardOrder_list.clear();
+	m_removedSlots = 0;
 
 	return 0;
 }
@@ -30,6 +30,7 @@
 #include <wx/thread.h>
 
 #include <deque>
+#include <vector>
 
 #include "Types.h"
 
@@ -56,6 +57,11 @@ public:
 private:
     void DoRemoveFromAllQueues(ThrottledControlSocket* socket);
     bool RemoveFromStandardListNoLock(ThrottledFileSocket* socket);
+    void CompactStandardList(uint32& rememberedSlotCounter);
+    void DrainPendingControlQueue();
+    void DeletePendingControlQueue();
+
+    sint32 SendQueuedData(sint32 bytesToSpend, uint32 thisLoopTick, uint32 minFragSize, uint32 doubleSendSize, uint32& rememberedSlotCounter);
 
     void* Entry();
 	
@@ -63,7 +69,6 @@ private:
 
 
     wxMutex m_sendLocker;
-    wxMutex m_tempQueueLocker;
 	
 	typedef std::deque<ThrottledControlSocket*> SocketQueue;
 	
@@ -71,15 +76,43 @@ private:
     SocketQueue m_ControlQueue_list;
 	// a queue for all the sockets that want to have Send() called on them.
     SocketQueue m_ControlQueueFirst_list;
-	// sockets that wants to enter m_ControlQueue_list 
-    SocketQueue m_TempControlQueue_list;
-	// sockets that wants to enter m_ControlQueue_list and has been able to send before 
-    SocketQueue m_TempControlQueueFirst_list; 
-
 
-	typedef std::deque<ThrottledFileSocket*> FileSocketQueue;
-	// sockets that have upload slots. Ordered so the most prioritized socket is first
-    FileSocketQueue m_StandardOrder_list; 
+	// A socket that wants to enter m_ControlQueue_list or m_ControlQueueFirst_list
+	struct PendingControlSocket {
+		ThrottledControlSocket* socket;
+		// has been able to send before, goes to m_ControlQueueFirst_list
+		bool hasSent;
+		PendingControlSocket* next;
+		// index + 1 of the next entry in the free list, 0 at its end
+		uint32 nextFree;
+	};
+
+	// Sockets queued by any thread, newest first. Pushing is lock-free, so the
+	// network code never waits for the upload thread. It is emptied into the
+	// control queues only by whoever holds m_sendLocker.
+	PendingControlSocket* volatile m_PendingControlQueue;
+
+	// Entries for m_PendingControlQueue, so queueing a socket does not allocate.
+	// Only when all of them are queued at once are further entries allocated.
+	enum { CONTROL_POOL_SIZE = 1024 };
+	PendingControlSocket m_ControlPool[CONTROL_POOL_SIZE];
+	// The unused entries of m_ControlPool. The low 32 bits are the index + 1 of
+	// the first entry, the high 32 bits are bumped on every change, so a pop
+	// racing with a pop and push of the same entry fails instead of corrupting
+	// the list.
+	volatile uint64 m_FreeControlSockets;
+
+	PendingControlSocket* AllocPendingControlSocket();
+	void FreePendingControlSocket(PendingControlSocket* entry);
+
+
+	typedef std::vector<ThrottledFileSocket*> FileSocketList;
+	// sockets that have upload slots. Ordered so the most prioritized socket is first.
+	// Removed sockets leave a NULL behind, which the upload thread compacts away, so
+	// adding a socket at the end and removing any socket is O(1).
+    FileSocketList m_StandardOrder_list; 
+	// number of NULL entries in m_StandardOrder_list
+	uint32 m_removedSlots;
 
     uint64 m_SentBytesSinceLastCall;
     uint64 m_SentBytesSinceLastCallOverhead;
@@ -318,11 +318,9 @@ void CUpDownClient::CreateStandardPackets(const byte* buffer, uint32 togo, Reque
 			data.WriteUInt32(startpos);
 			data.WriteUInt32(endpos);
 		}
-		char *tempbuf = new char[nPacketSize];
-		memfile.Read(tempbuf, nPacketSize);
-		data.Write(tempbuf, nPacketSize);
-		delete [] tempbuf;
-		CPacket* packet = new CPacket(data, (bLargeBlocks ? OP_EMULEPROT : OP_EDONKEYPROT), (bLargeBlocks ? (uint8)OP_SENDINGPART_I64 : (uint8)OP_SENDINGPART));	
+		data.Write(memfile.GetRawBuffer() + memfile.GetPosition(), nPacketSize);
+		memfile.Seek(nPacketSize, wxFromCurrent);
+		CPacket* packet = new CPacket(data, (bLargeBlocks ? OP_EMULEPROT : OP_EDONKEYPROT), (bLargeBlocks ? (uint8)OP_SENDINGPART_I64 : (uint8)OP_SENDINGPART), true);	
 		theStats::AddUpOverheadFileRequest(16 + 2 * (bLargeBlocks ? 8 :4));
 		theStats::AddUploadToSoft(GetClientSoft(), nPacketSize);
 		AddDebugLogLineN(logLocalClient, 
@@ -371,11 +369,9 @@ void CUpDownClient::CreatePackedPackets(const byte* buffer, uint32 togo, Request
 			data.WriteUInt32(currentblock->StartOffset);
 		}
 		data.WriteUInt32(newsize);			
-		char *tempbuf = new char[nPacketSize];
-		memfile.Read(tempbuf, nPacketSize);
-		data.Write(tempbuf,nPacketSize);
-		delete [] tempbuf;
-		CPacket* packet = new CPacket(data, OP_EMULEPROT, (isLargeBlock ? OP_COMPRESSEDPART_I64 : OP_COMPRESSEDPART));
+		data.Write(memfile.GetRawBuffer() + memfile.GetPosition(), nPacketSize);
+		memfile.Seek(nPacketSize, wxFromCurrent);
+		CPacket* packet = new CPacket(data, OP_EMULEPROT, (isLargeBlock ? OP_COMPRESSEDPART_I64 : OP_COMPRESSEDPART), true);
 	
 		// approximate payload size
 		uint32 payloadSize = nPacketSize*oldSize/newsize;
@@ -468,7 +464,10 @@ void CUpDownClient::SetUploadFileID(CKnownFile* newreqfile)
 {
 	if (m_uploadingfile == newreqfile) {
 		return;
-	} else if (m_uploadingfile) {
+	}
+
+	SetECDirty();
+	if (m_uploadingfile) {
 		m_uploadingfile->RemoveUploadingClient(this);
 		m_uploadingfile->UpdateUpPartsFrequency(this, false); // Decrement
 	}
@@ -631,6 +630,7 @@ uint32 CUpDownClient::SendBlockData()
         // not enough values to calculate trustworthy speed. Use -1 to tell this
         m_nUpDatarate = 0; //-1;
     }
+	SetECDirty();
 
     // Check if it's time to update the display.
 	m_cSendblock++;
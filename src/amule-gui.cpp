@@ -78,10 +78,16 @@ BEGIN_EVENT_TABLE(CamuleGuiApp, wxApp)
 	// Hash ended notifier
 	EVT_MULE_HASHING(CamuleGuiApp::OnFinishedHashing)
 	EVT_MULE_AICH_HASHING(CamuleGuiApp::OnFinishedAICHHashing)
+	EVT_MULE_PART_HASHING(CamuleGuiApp::OnFinishedPartHashing)
 
 	// File completion ended notifier
 	EVT_MULE_FILE_COMPLETED(CamuleGuiApp::OnFinishedCompletion)
 
+#ifdef ENABLE_TORRENT
+	// Torrent metadata creation ended notifier
+	EVT_MULE_TORRENT_CREATED(CamuleGuiApp::OnFinishedTorrentCreation)
+#endif
+
 	// HTTPDownload finished
 	EVT_MULE_INTERNAL(wxEVT_CORE_FINISHED_HTTP_DOWNLOAD, -1, CamuleGuiApp::OnFinishedHTTPDownload)
 
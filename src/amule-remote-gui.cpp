@@ -259,7 +259,9 @@ bool CamuleRemoteGuiApp::OnInit()
 	glob_prefs = new CPreferencesRem(m_connect);
 	long enableZLIB;
 	wxConfig::Get()->Read(wxT("/EC/ZLIB"), &enableZLIB, 1);
-	m_connect->SetCapabilities(enableZLIB != 0, true, false);	// ZLIB, UTF8 numbers, notification
+	long levelZLIB;
+	wxConfig::Get()->Read(wxT("/EC/ZLIBLevel"), &levelZLIB, Z_DEFAULT_COMPRESSION);
+	m_connect->SetCapabilities(enableZLIB != 0, true, false, levelZLIB);	// ZLIB, UTF8 numbers, notification, ZLIB level
 	
 	InitCustomLanguages();
 	InitLocale(m_locale, StrLang2wx(thePrefs::GetLanguageID()));
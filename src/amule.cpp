@@ -559,7 +559,7 @@ bool CamuleApp::OnInit()
 	// Log is confusing, because log entries from background will only be printed
 	// once foreground becomes idle, and that will only be after loading 
 	// of the partfiles has finished.
-	CThreadScheduler::Start();
+	CThreadScheduler::Start(thePrefs::GetMaxTaskThreads());
 	
 	// These must be initialized after the gui is loaded.
 	if (thePrefs::GetNetworkED2K()) {
@@ -1334,12 +1334,32 @@ void CamuleApp::OnFinishedAICHHashing(CHashingEvent& evt)
 }
 
 
+void CamuleApp::OnFinishedPartHashing(CPartHashingEvent& evt)
+{
+	CPartFile* owner = const_cast<CPartFile*>(evt.GetOwner());
+	wxCHECK_RET(owner, wxT("Part hashing event sent for unspecified file"));
+
+	// Check if the partfile still exists, as it might have
+	// been deleted in the mean time.
+	if (downloadqueue->IsPartFile(owner)) {
+		owner->PartHashFinished(evt.GetPart(), evt.GetHash(), evt.ErrorOccured());
+	}
+}
+
+
 void CamuleApp::OnFinishedCompletion(CCompletionEvent& evt)
 {
 	CPartFile* completed = const_cast<CPartFile*>(evt.GetOwner());
 	wxCHECK_RET(completed, wxT("Completion event sent for unspecified file"));
 	wxASSERT_MSG(downloadqueue->IsPartFile(completed), wxT("CCompletionEvent for unknown partfile."));
 	
+#ifdef ENABLE_TORRENT
+	// Create a torrent if this was not created earlier.
+	if (!evt.ErrorOccured() && !torrent::CTorrent::GetInstance().HasBTMetadata(completed->GetFileHash())) {
+		torrent::CTorrent::GetInstance().GiveUp(completed->GetFileHash());
+		torrent::CTorrent::GetInstance().CreateMetadataForFile(completed->GetFileHash(), evt.GetFullPath().GetFullName(), evt.GetFullPath().GetPath());
+	}
+#endif
 	completed->CompleteFileEnded(evt.ErrorOccured(), evt.GetFullPath());
 	if (evt.ErrorOccured()) {
 		CUserEvents::ProcessEvent(CUserEvents::ErrorOnCompletion, completed);
@@ -1349,6 +1369,18 @@ void CamuleApp::OnFinishedCompletion(CCompletionEvent& evt)
 	CUserEvents::ProcessEvent(CUserEvents::DownloadCompleted, completed);
 }
 
+#ifdef ENABLE_TORRENT
+void CamuleApp::OnFinishedTorrentCreation(CTorrentCreatedEvent& evt)
+{
+	if (!evt.GetTorrentFile().IsOk()) {
+		AddLogLineC(CFormat(_("Failed to save the BitTorrent metadata of file %s")) % evt.GetFileId().Encode());
+		return;
+	}
+
+	torrent::CTorrent::GetInstance().RegisterMetadataFile(evt.GetFileId(), CPathToBoost(evt.GetTorrentFile()));
+}
+#endif
+
 void CamuleApp::OnFinishedAllocation(CAllocFinishedEvent& evt)
 {
 	CPartFile *file = evt.GetFile();
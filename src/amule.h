@@ -76,8 +76,10 @@ class CTimer;
 class CTimerEvent;
 class wxSingleInstanceChecker;
 class CHashingEvent;
+class CPartHashingEvent;
 class CMuleInternalEvent;
 class CCompletionEvent;
+class CTorrentCreatedEvent;
 class CAllocFinishedEvent;
 class wxExecuteData;
 class CLoggingEvent;
@@ -320,7 +322,11 @@ protected:
 
 	void OnFinishedHashing(CHashingEvent& evt);
 	void OnFinishedAICHHashing(CHashingEvent& evt);
+	void OnFinishedPartHashing(CPartHashingEvent& evt);
 	void OnFinishedCompletion(CCompletionEvent& evt);
+#ifdef ENABLE_TORRENT
+	void OnFinishedTorrentCreation(CTorrentCreatedEvent& evt);
+#endif
 	void OnFinishedAllocation(CAllocFinishedEvent& evt);
 	void OnFinishedHTTPDownload(CMuleInternalEvent& evt);
 	void OnHashingShutdown(CMuleInternalEvent&);
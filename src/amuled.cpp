@@ -104,10 +104,16 @@ BEGIN_EVENT_TABLE(CamuleDaemonApp, wxAppConsole)
 	// Hash ended notifier
 	EVT_MULE_HASHING(CamuleDaemonApp::OnFinishedHashing)
 	EVT_MULE_AICH_HASHING(CamuleDaemonApp::OnFinishedAICHHashing)
+	EVT_MULE_PART_HASHING(CamuleDaemonApp::OnFinishedPartHashing)
 	
 	// File completion ended notifier
 	EVT_MULE_FILE_COMPLETED(CamuleDaemonApp::OnFinishedCompletion)
 
+#ifdef ENABLE_TORRENT
+	// Torrent metadata creation ended notifier
+	EVT_MULE_TORRENT_CREATED(CamuleDaemonApp::OnFinishedTorrentCreation)
+#endif
+
 	// HTTPDownload finished
 	EVT_MULE_INTERNAL(wxEVT_CORE_FINISHED_HTTP_DOWNLOAD, -1, CamuleDaemonApp::OnFinishedHTTPDownload)
 
@@ -0,0 +1,137 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#ifndef COMMONATOMIC_H
+#define COMMONATOMIC_H
+
+//
+// Minimal atomic operations on pointers and counters, for the few places
+// where a mutex shared between the network threads and the main thread is
+// too contended. All operations are full memory barriers.
+//
+
+#include "../../Types.h"		// Needed for uint64
+
+#ifdef _MSC_VER
+#	include <windows.h>
+
+template<typename T>
+inline bool AtomicCompareAndSwap(T* volatile* dest, T* expected, T* value)
+{
+	return InterlockedCompareExchangePointer((PVOID volatile*)dest, value, expected) == expected;
+}
+
+template<typename T>
+inline T* AtomicExchange(T* volatile* dest, T* value)
+{
+	return (T*)InterlockedExchangePointer((PVOID volatile*)dest, value);
+}
+
+template<typename T>
+inline T* AtomicLoad(T* volatile* src)
+{
+	return (T*)InterlockedCompareExchangePointer((PVOID volatile*)src, NULL, NULL);
+}
+
+inline long AtomicLoad(volatile long* src)
+{
+	return InterlockedCompareExchange(src, 0, 0);
+}
+
+inline long AtomicIncrement(volatile long* value)
+{
+	return InterlockedIncrement(value);
+}
+
+inline long AtomicDecrement(volatile long* value)
+{
+	return InterlockedDecrement(value);
+}
+
+inline bool AtomicCompareAndSwap(volatile uint64* dest, uint64 expected, uint64 value)
+{
+	return (uint64)InterlockedCompareExchange64((volatile LONGLONG*)dest, value, expected) == expected;
+}
+
+inline uint64 AtomicLoad(volatile uint64* src)
+{
+	return InterlockedCompareExchange64((volatile LONGLONG*)src, 0, 0);
+}
+
+#else
+
+template<typename T>
+inline bool AtomicCompareAndSwap(T* volatile* dest, T* expected, T* value)
+{
+	return __sync_bool_compare_and_swap(dest, expected, value);
+}
+
+template<typename T>
+inline T* AtomicExchange(T* volatile* dest, T* value)
+{
+	// __sync_lock_test_and_set is only an acquire barrier
+	__sync_synchronize();
+	return __sync_lock_test_and_set(dest, value);
+}
+
+template<typename T>
+inline T* AtomicLoad(T* volatile* src)
+{
+	T* value = *src;
+	__sync_synchronize();
+	return value;
+}
+
+inline long AtomicLoad(volatile long* src)
+{
+	long value = *src;
+	__sync_synchronize();
+	return value;
+}
+
+inline long AtomicIncrement(volatile long* value)
+{
+	return __sync_add_and_fetch(value, 1);
+}
+
+inline long AtomicDecrement(volatile long* value)
+{
+	return __sync_sub_and_fetch(value, 1);
+}
+
+inline bool AtomicCompareAndSwap(volatile uint64* dest, uint64 expected, uint64 value)
+{
+	return __sync_bool_compare_and_swap(dest, expected, value);
+}
+
+inline uint64 AtomicLoad(volatile uint64* src)
+{
+	// A plain load may tear on 32 bit targets
+	return __sync_val_compare_and_swap(src, 0, 0);
+}
+
+#endif
+
+#endif // COMMONATOMIC_H
+// File_checked_for_headers
@@ -168,6 +168,7 @@ CKeyEntry::CKeyEntry()
 	m_publishingIPs = NULL;
 	m_trustValue = 0;
 	m_lastTrustValueCalc = 0;
+	m_indexSlot = 0;
 }
 
 CKeyEntry::~CKeyEntry()
@@ -105,6 +105,8 @@ protected:
 
 class CKeyEntry : public CEntry
 {
+	friend class CKeywordIndex;
+
       protected:
 	struct sPublishingIP {
 		uint32_t m_ip;
@@ -137,6 +139,7 @@ class CKeyEntry : public CEntry
 
 	uint32_t m_lastTrustValueCalc;
 	double	 m_trustValue;
+	uint32_t m_indexSlot;		// slot in the CKeywordIndex of the keyword
 	PublishingIPList *		m_publishingIPs;
 	static GlobalPublishIPMap	s_globalPublishIPs;	// tracks count of publishings for each 255.255.255.0/24 subnet
 };
@@ -407,6 +407,7 @@ void CIndexed::Clean()
 				if (!currName->m_bSource && currName->m_tLifeTime < tNow) {
 					k_Removed++;
 					itEntry = currSource->entryList.erase(itEntry);
+					currKeyHash->m_index.Remove(currName);
 					delete currName;
 					continue;
 				} else if (currName->m_bSource) {
@@ -499,6 +500,7 @@ bool CIndexed::AddKeyword(const CUInt128& keyID, const CUInt128& sourceID, Kadem
 		currKeyHash = new KeyHash;
 		currKeyHash->keyID.SetValue(keyID);
 		currKeyHash->m_Source_map[currSource->sourceID] = currSource;
+		currKeyHash->m_index.Add(entry);
 		m_Keyword_map[currKeyHash->keyID] = currKeyHash;
 		load = 1;
 		m_totalIndexKeyword++;
@@ -537,6 +539,8 @@ bool CIndexed::AddKeyword(const CUInt128& keyID, const CUInt128& sourceID, Kadem
 				if (oldEntry == NULL) {
 					m_totalIndexKeyword++;
 					AddDebugLogLineN(logKadIndex, wxT("Multiple sizes published for file ") + entry->m_uSourceID.ToHexString());
+				} else {
+					currKeyHash->m_index.Remove(oldEntry);
 				}
 				delete oldEntry;
 				oldEntry = NULL;
@@ -546,6 +550,7 @@ bool CIndexed::AddKeyword(const CUInt128& keyID, const CUInt128& sourceID, Kadem
 			}
 			load = (uint8_t)((indexTotal * 100) / KADEMLIAMAXINDEX);
 			currSource->entryList.push_front(entry);
+			currKeyHash->m_index.Add(entry);
 			return true;
 		} else {
 			currSource = new Source;
@@ -553,6 +558,7 @@ bool CIndexed::AddKeyword(const CUInt128& keyID, const CUInt128& sourceID, Kadem
 			entry->MergeIPsAndFilenames(NULL); // IpTracking init
 			currSource->entryList.push_front(entry);
 			currKeyHash->m_Source_map[currSource->sourceID] = currSource;
+			currKeyHash->m_index.Add(entry);
 			m_totalIndexKeyword++;
 			load = (indexTotal * 100) / KADEMLIAMAXINDEX;
 			return true;
@@ -753,40 +759,47 @@ void CIndexed::SendValidKeywordResult(const CUInt128& keyID, const SSearchTerm*
 		DEBUG_ONLY( uint32_t dbgResultsTrusted = 0; )
 		DEBUG_ONLY( uint32_t dbgResultsUntrusted = 0; )
 
+		// Evaluate the search terms once over the keyword's index, then only
+		// visit the matching entries.
+		const CKeywordIndex& index = currKeyHash->m_index;
+		CKeywordIndex::SlotSet matches;
+		if (pSearchTerms) {
+			index.Match(pSearchTerms, matches);
+		}
+
 		do {
-			for (CSourceKeyMap::iterator itSource = currKeyHash->m_Source_map.begin(); itSource != currKeyHash->m_Source_map.end(); ++itSource) {
-				Source* currSource =  itSource->second;
+			for (uint32_t slot = 0; slot < index.GetSlotCount(); ++slot) {
+				if (pSearchTerms ? !CKeywordIndex::IsSet(matches, slot) : !index.GetEntry(slot)) {
+					continue;
+				}
 
-				for (CKadEntryPtrList::iterator itEntry = currSource->entryList.begin(); itEntry != currSource->entryList.end(); ++itEntry) {
-					Kademlia::CKeyEntry* currName = static_cast<Kademlia::CKeyEntry*>(*itEntry);
-					wxASSERT(currName->IsKeyEntry());
-					if ((onlyTrusted ^ (currName->GetTrustValue() < 1.0)) && (!pSearchTerms || currName->SearchTermsMatch(pSearchTerms))) {
-						if (count < 0) {
+				Kademlia::CKeyEntry* currName = index.GetEntry(slot);
+				wxASSERT(currName->IsKeyEntry());
+				wxASSERT(!pSearchTerms || currName->SearchTermsMatch(pSearchTerms));
+				if (onlyTrusted ^ (currName->GetTrustValue() < 1.0)) {
+					if (count < 0) {
+						count++;
+					} else if ((uint16_t)count < maxResults) {
+						if (!oldClient || currName->m_uSize <= OLD_MAX_FILE_SIZE) {
 							count++;
-						} else if ((uint16_t)count < maxResults) {
-							if (!oldClient || currName->m_uSize <= OLD_MAX_FILE_SIZE) {
-								count++;
 #ifdef __DEBUG__
-								if (onlyTrusted) {
-									dbgResultsTrusted++;
-								} else {
-									dbgResultsUntrusted++;
-								}
+							if (onlyTrusted) {
+								dbgResultsTrusted++;
+							} else {
+								dbgResultsUntrusted++;
+							}
 #endif
-								packetdata.WriteUInt128(currName->m_uSourceID);
-								currName->WriteTagListWithPublishInfo(&packetdata);
-								if (count % 50 == 0) {
-									DebugSend(Kad2SearchRes, ip, port);
-									CKademlia::GetUDPListener()->SendPacket(packetdata, KADEMLIA2_SEARCH_RES, ip, port, senderKey, NULL);
-									// Reset the packet, keeping the header (Kad id, key id, number of entries)
-									packetdata.SetLength(16 + 16 + 2);
-								}
+							packetdata.WriteUInt128(currName->m_uSourceID);
+							currName->WriteTagListWithPublishInfo(&packetdata);
+							if (count % 50 == 0) {
+								DebugSend(Kad2SearchRes, ip, port);
+								CKademlia::GetUDPListener()->SendPacket(packetdata, KADEMLIA2_SEARCH_RES, ip, port, senderKey, NULL);
+								// Reset the packet, keeping the header (Kad id, key id, number of entries)
+								packetdata.SetLength(16 + 16 + 2);
 							}
-						} else {
-							itSource = currKeyHash->m_Source_map.end();
-							--itSource;
-							break;
 						}
+					} else {
+						break;
 					}
 				}
 			}
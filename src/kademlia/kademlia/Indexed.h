@@ -42,6 +42,7 @@ there client on the eMule forum..
 
 #include "SearchManager.h"
 #include "Entry.h"
+#include "KeywordIndex.h"
 
 class wxArrayString;
 
@@ -61,6 +62,7 @@ struct KeyHash
 {
 	Kademlia::CUInt128 keyID;
 	CSourceKeyMap m_Source_map;
+	Kademlia::CKeywordIndex m_index;
 };
 
 
@@ -0,0 +1,292 @@
+//
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+// Copyright (c) 2002-2011 Merkur ( devs@emule-project.net / http://www.emule-project.net )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#include "KeywordIndex.h"
+
+#include <wx/tokenzr.h>
+
+#include <common/StringFunctions.h>
+#include <tags/FileTags.h>
+
+#include "Indexed.h"
+#include "SearchManager.h"
+
+#include <algorithm>
+
+////////////////////////////////////////
+using namespace Kademlia;
+////////////////////////////////////////
+
+
+namespace {
+	inline void SetSlot(CKeywordIndex::SlotSet& set, uint32_t slot)
+	{
+		set[slot / 32] |= 1u << (slot % 32);
+	}
+
+	std::string ToUTF8(const wxString& str)
+	{
+		Unicode2CharBuf buf(unicode2UTF8(str));
+		const char* data = buf;
+		return data ? std::string(data) : std::string();
+	}
+
+	template<typename T>
+	bool CompareValues(SSearchTerm::ESearchTermType op, T value, T operand)
+	{
+		switch (op) {
+			case SSearchTerm::OpGreaterEqual:	return value >= operand;
+			case SSearchTerm::OpLessEqual:		return value <= operand;
+			case SSearchTerm::OpGreater:		return value > operand;
+			case SSearchTerm::OpLess:		return value < operand;
+			case SSearchTerm::OpEqual:		return value == operand;
+			case SSearchTerm::OpNotEqual:		return value != operand;
+			default:				return false;
+		}
+	}
+}
+
+
+void CKeywordIndex::Add(CKeyEntry* entry)
+{
+	uint32_t slotIndex;
+	if (m_freeSlots.empty()) {
+		slotIndex = m_slots.size();
+		m_slots.push_back(SSlot());
+	} else {
+		slotIndex = m_freeSlots.back();
+		m_freeSlots.pop_back();
+	}
+
+	SSlot& slot = m_slots[slotIndex];
+	slot.entry = entry;
+	entry->m_indexSlot = slotIndex;
+
+	const wxString name(entry->GetCommonFileNameLowerCase());
+	wxStringTokenizer tkz(name, CSearchManager::GetInvalidKeywordChars());
+	while (tkz.HasMoreTokens()) {
+		wxString token(tkz.GetNextToken());
+		if (token.IsEmpty()) {
+			continue;
+		}
+
+		TokenMap::iterator it = m_tokens.insert(TokenMap::value_type(ToUTF8(token), SlotList())).first;
+		SlotList& slots = it->second;
+		SlotList::iterator pos = std::lower_bound(slots.begin(), slots.end(), slotIndex);
+		if (pos == slots.end() || *pos != slotIndex) {
+			slots.insert(pos, slotIndex);
+			slot.tokens.push_back(it);
+		}
+	}
+
+	int ext = name.Find(wxT('.'), true);
+	slot.hasExtension = (ext != wxNOT_FOUND);
+	slot.extension = slot.hasExtension ? ToUTF8(name.Mid(ext + 1)) : std::string();
+
+	slot.hasType = false;
+	for (TagPtrList::const_iterator it = entry->m_taglist.begin(); it != entry->m_taglist.end(); ++it) {
+		if ((*it)->IsStr() && (*it)->GetName() == TAG_FILETYPE) {
+			slot.type = ToUTF8((*it)->GetStr().Lower());
+			slot.hasType = true;
+			break;
+		}
+	}
+
+	slot.hasSize = entry->GetIntTagValue(TAG_FILESIZE, slot.size, true);
+}
+
+
+void CKeywordIndex::Remove(CKeyEntry* entry)
+{
+	uint32_t slotIndex = entry->m_indexSlot;
+	wxCHECK_RET(slotIndex < m_slots.size() && m_slots[slotIndex].entry == entry, wxT("Entry is not indexed"));
+
+	SSlot& slot = m_slots[slotIndex];
+	for (std::vector<TokenMap::iterator>::iterator it = slot.tokens.begin(); it != slot.tokens.end(); ++it) {
+		SlotList& slots = (*it)->second;
+		slots.erase(std::lower_bound(slots.begin(), slots.end(), slotIndex));
+		if (slots.empty()) {
+			m_tokens.erase(*it);
+		}
+	}
+
+	slot = SSlot();
+	m_freeSlots.push_back(slotIndex);
+}
+
+
+void CKeywordIndex::Match(const SSearchTerm* searchTerms, SlotSet& result) const
+{
+	Evaluate(searchTerms, result);
+}
+
+
+void CKeywordIndex::Evaluate(const SSearchTerm* searchTerm, SlotSet& result) const
+{
+	result.assign((m_slots.size() + 31) / 32, 0);
+
+	switch (searchTerm->type) {
+		case SSearchTerm::AND:
+		case SSearchTerm::OR:
+		case SSearchTerm::NOT: {
+			Evaluate(searchTerm->left, result);
+			SlotSet right;
+			Evaluate(searchTerm->right, right);
+			for (size_t i = 0; i < result.size(); ++i) {
+				if (searchTerm->type == SSearchTerm::AND) {
+					result[i] &= right[i];
+				} else if (searchTerm->type == SSearchTerm::OR) {
+					result[i] |= right[i];
+				} else {
+					result[i] &= ~right[i];
+				}
+			}
+			break;
+		}
+		case SSearchTerm::String:
+			EvaluateString(searchTerm, result);
+			break;
+		case SSearchTerm::MetaTag:
+			EvaluateMetaTag(searchTerm, result);
+			break;
+		default:
+			EvaluateNumeric(searchTerm, result);
+			break;
+	}
+}
+
+
+void CKeywordIndex::EvaluateString(const SSearchTerm* searchTerm, SlotSet& result) const
+{
+	// All strings of the term have to be found (AND)
+	size_t count = searchTerm->astr->GetCount();
+	for (size_t i = 0; i < count; ++i) {
+		std::string str(ToUTF8((*(searchTerm->astr))[i]));
+
+		SlotSet found(result.size(), 0);
+		if (str.empty()) {
+			// Contained in any name
+			for (uint32_t slot = 0; slot < m_slots.size(); ++slot) {
+				if (m_slots[slot].entry) {
+					SetSlot(found, slot);
+				}
+			}
+		} else {
+			for (TokenMap::const_iterator it = m_tokens.begin(); it != m_tokens.end(); ++it) {
+				if (it->first.find(str) != std::string::npos) {
+					for (SlotList::const_iterator slot = it->second.begin(); slot != it->second.end(); ++slot) {
+						SetSlot(found, *slot);
+					}
+				}
+			}
+		}
+
+		if (i == 0) {
+			result.swap(found);
+		} else {
+			for (size_t j = 0; j < result.size(); ++j) {
+				result[j] &= found[j];
+			}
+		}
+	}
+}
+
+
+void CKeywordIndex::EvaluateMetaTag(const SSearchTerm* searchTerm, SlotSet& result) const
+{
+	const CTag* tag = searchTerm->tag;
+	if (tag->GetType() != 2) {	// meta tags with string values
+		return;
+	}
+
+	const wxString& name = tag->GetName();
+	if (name == TAG_FILEFORMAT || name == TAG_FILETYPE) {
+		// Format is matched against the extension of the file name, and
+		// neither of them is compared case sensitive.
+		const bool format = (name == TAG_FILEFORMAT);
+		const std::string value(ToUTF8(tag->GetStr().Lower()));
+		for (uint32_t slotIndex = 0; slotIndex < m_slots.size(); ++slotIndex) {
+			const SSlot& slot = m_slots[slotIndex];
+			if (slot.entry) {
+				if (format ? (slot.hasExtension && slot.extension == value) : (slot.hasType && slot.type == value)) {
+					SetSlot(result, slotIndex);
+				}
+			}
+		}
+	} else {
+		for (uint32_t slotIndex = 0; slotIndex < m_slots.size(); ++slotIndex) {
+			const CKeyEntry* entry = m_slots[slotIndex].entry;
+			if (entry) {
+				for (TagPtrList::const_iterator it = entry->m_taglist.begin(); it != entry->m_taglist.end(); ++it) {
+					if ((*it)->IsStr() && name == (*it)->GetName()) {
+						if ((*it)->GetStr().CmpNoCase(tag->GetStr()) == 0) {
+							SetSlot(result, slotIndex);
+						}
+						break;
+					}
+				}
+			}
+		}
+	}
+}
+
+
+void CKeywordIndex::EvaluateNumeric(const SSearchTerm* searchTerm, SlotSet& result) const
+{
+	const CTag* tag = searchTerm->tag;
+	const wxString& name = tag->GetName();
+
+	if (tag->IsInt()) {	// meta tags with integer values
+		const uint64_t operand = tag->GetInt();
+		const bool size = (name == TAG_FILESIZE);
+		for (uint32_t slotIndex = 0; slotIndex < m_slots.size(); ++slotIndex) {
+			const SSlot& slot = m_slots[slotIndex];
+			if (slot.entry) {
+				uint64_t value = slot.size;
+				if (size ? slot.hasSize : slot.entry->GetIntTagValue(name, value, true)) {
+					if (CompareValues(searchTerm->type, value, operand)) {
+						SetSlot(result, slotIndex);
+					}
+				}
+			}
+		}
+	} else if (tag->IsFloat()) {	// meta tags with float values
+		const float operand = tag->GetFloat();
+		for (uint32_t slotIndex = 0; slotIndex < m_slots.size(); ++slotIndex) {
+			const CKeyEntry* entry = m_slots[slotIndex].entry;
+			if (entry) {
+				for (TagPtrList::const_iterator it = entry->m_taglist.begin(); it != entry->m_taglist.end(); ++it) {
+					if ((*it)->IsFloat() && name == (*it)->GetName()) {
+						if (CompareValues(searchTerm->type, (*it)->GetFloat(), operand)) {
+							SetSlot(result, slotIndex);
+						}
+						break;
+					}
+				}
+			}
+		}
+	}
+}
+// File_checked_for_headers
@@ -0,0 +1,134 @@
+//								-*- C++ -*-
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+// Copyright (c) 2002-2011 Merkur ( devs@emule-project.net / http://www.emule-project.net )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#ifndef __KAD_KEYWORD_INDEX_H__
+#define __KAD_KEYWORD_INDEX_H__
+
+#include "../../Types.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+struct SSearchTerm;
+
+////////////////////////////////////////
+namespace Kademlia {
+////////////////////////////////////////
+
+class CKeyEntry;
+
+/**
+ * Secondary index over the entries stored for one keyword, used to answer
+ * keyword searches without evaluating the search terms on every entry.
+ *
+ * Every entry occupies a slot, which stays the same for the lifetime of the
+ * entry. For each slot the index keeps the lower-cased UTF-8 tokens of the
+ * file name, its extension, its size and its file type. The tokens are
+ * additionally kept in an inverted map from token to slots.
+ *
+ * Search strings are tokenized with the same separators as the file names,
+ * so a search string is contained in a file name exactly when it is
+ * contained in one of the name's tokens. Search terms can thus be answered
+ * by testing each distinct token once, instead of each file name.
+ */
+class CKeywordIndex
+{
+public:
+	//! Bitset of slots, one bit per slot.
+	typedef std::vector<uint32_t> SlotSet;
+
+	/**
+	 * Adds an entry, which must not be modified as long as it is indexed.
+	 */
+	void	Add(CKeyEntry* entry);
+
+	/**
+	 * Removes an entry, must be called before the entry is deleted.
+	 */
+	void	Remove(CKeyEntry* entry);
+
+	/**
+	 * Returns the number of slots, including unused ones.
+	 */
+	uint32_t GetSlotCount() const			{ return m_slots.size(); }
+
+	/**
+	 * Returns the entry of a slot, or NULL if the slot is unused.
+	 */
+	CKeyEntry* GetEntry(uint32_t slot) const	{ return m_slots[slot].entry; }
+
+	/**
+	 * Evaluates search terms against all indexed entries.
+	 *
+	 * @param searchTerms The search expression, as received from the network.
+	 * @param result Receives the set of slots whose entries match.
+	 *
+	 * The result is the same as that of CKeyEntry::SearchTermsMatch for
+	 * every entry.
+	 */
+	void	Match(const SSearchTerm* searchTerms, SlotSet& result) const;
+
+	/**
+	 * Tests if a slot is contained in a set.
+	 */
+	static bool IsSet(const SlotSet& set, uint32_t slot)	{ return (set[slot / 32] >> (slot % 32)) & 1; }
+
+private:
+	typedef std::vector<uint32_t> SlotList;
+	typedef std::map<std::string, SlotList> TokenMap;
+
+	struct SSlot {
+		CKeyEntry*	entry;
+		//! The tokens of the file name, in m_tokens.
+		std::vector<TokenMap::iterator> tokens;
+		//! Lower-cased extension of the file name.
+		std::string	extension;
+		bool		hasExtension;
+		//! Lower-cased value of the file type tag.
+		std::string	type;
+		bool		hasType;
+		//! Value of the file size (virtual) tag.
+		uint64_t	size;
+		bool		hasSize;
+	};
+
+	void	Evaluate(const SSearchTerm* searchTerm, SlotSet& result) const;
+	void	EvaluateString(const SSearchTerm* searchTerm, SlotSet& result) const;
+	void	EvaluateMetaTag(const SSearchTerm* searchTerm, SlotSet& result) const;
+	void	EvaluateNumeric(const SSearchTerm* searchTerm, SlotSet& result) const;
+
+	//! The slots, unused ones have a NULL entry.
+	std::vector<SSlot> m_slots;
+	//! Unused slots, reused before new ones are added.
+	SlotList m_freeSlots;
+	//! Maps each distinct token to the sorted list of slots containing it.
+	TokenMap m_tokens;
+};
+
+} // End namespace
+
+#endif // __KAD_KEYWORD_INDEX_H__
+// File_checked_for_headers
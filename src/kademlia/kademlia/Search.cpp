@@ -944,11 +944,10 @@ void CSearch::ProcessResultNotes(const CUInt128& answer, TagPtrList *info)
 		} else if (!tag->GetName().Cmp(TAG_DESCRIPTION)) {
 			wxString strComment(tag->GetStr());
 			bFilterComment = thePrefs::IsMessageFiltered(strComment);
-			entry->AddTag(tag);
-			*it = NULL;	// Prevent actual data being freed
+			// The tags of search results may be in an arena, see CKademliaUDPListener::ProcessSearchResponse
+			entry->AddTag(tag->CloneTag());
 		} else if (!tag->GetName().Cmp(TAG_FILERATING)) {
-			entry->AddTag(tag);
-			*it = NULL;	// Prevent actual data being freed
+			entry->AddTag(tag->CloneTag());
 		}
 	}
 
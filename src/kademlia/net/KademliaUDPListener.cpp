@@ -955,6 +955,9 @@ void CKademliaUDPListener::ProcessSearchResponse(CMemFile& bio)
 
 	// How many results..
 	uint16_t count = bio.ReadUInt16();
+	// The tags of a result are not needed once it was processed
+	CTagArena arena;
+	TagPtrList tags;
 	while (count > 0) {
 		// What is the answer
 		CUInt128 answer = bio.ReadUInt128();
@@ -965,9 +968,10 @@ void CKademliaUDPListener::ProcessSearchResponse(CMemFile& bio)
 		// supposed to be 'viewed' by user only and not feed into the Kad engine again!
 		// If that tag list is once used for something else than for viewing, special care has to be taken for any
 		// string conversion!
- 		CScopedContainer<TagPtrList> tags;
-		bio.ReadTagPtrList(tags.get(), true/*bOptACP*/);
-		CSearchManager::ProcessResult(target, answer, tags.get());
+		bio.ReadTagPtrList(&tags, true/*bOptACP*/, &arena);
+		CSearchManager::ProcessResult(target, answer, &tags);
+		tags.clear();
+		arena.Clear();
 		count--;
 	}
 }
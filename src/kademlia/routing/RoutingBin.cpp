@@ -45,22 +45,52 @@ there client on the eMule forum..
 using namespace Kademlia;
 ////////////////////////////////////////
 
-CRoutingBin::GlobalTrackingMap	CRoutingBin::s_globalContactIPs;
-CRoutingBin::GlobalTrackingMap	CRoutingBin::s_globalContactSubnets;
+CIPCountMap	CRoutingBin::s_globalContactIPs;
+CIPCountMap	CRoutingBin::s_globalContactSubnets;
 
 #define MAX_CONTACTS_SUBNET	10
 #define MAX_CONTACTS_IP		1
 
 CRoutingBin::~CRoutingBin()
 {
-	for (ContactList::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
-		AdjustGlobalTracking((*it)->GetIPAddress(), false);
+	for (uint32_t i = 0; i < m_size; i++) {
+		AdjustGlobalTracking(m_entries[i].ip, false);
 		if (!m_dontDeleteContacts) {
-			delete *it;
+			delete m_entries[i].contact;
 		}
 	}
 
-	m_entries.clear();
+	m_size = 0;
+}
+
+uint32_t CRoutingBin::FindEntry(const CContact *contact) const throw()
+{
+	uint32_t i = 0;
+	while (i < m_size && m_entries[i].contact != contact) {
+		i++;
+	}
+	return i;
+}
+
+void CRoutingBin::UpdateEntry(Entry& entry) throw()
+{
+	const CContact *contact = entry.contact;
+	entry.id = contact->GetClientID();
+	entry.ip = contact->GetIPAddress();
+	entry.udpPort = contact->GetUDPPort();
+	entry.tcpPort = contact->GetTCPPort();
+	entry.type = contact->GetType();
+	entry.version = contact->GetVersion();
+	entry.ipVerified = contact->IsIPVerified();
+}
+
+void CRoutingBin::ContactChanged(CContact *contact)
+{
+	uint32_t i = FindEntry(contact);
+	wxASSERT(i < m_size);
+	if (i < m_size) {
+		UpdateEntry(m_entries[i]);
+	}
 }
 
 bool CRoutingBin::AddContact(CContact *contact)
@@ -69,11 +99,11 @@ bool CRoutingBin::AddContact(CContact *contact)
 
 	uint32_t sameSubnets = 0;
 	// Check if we already have a contact with this ID in the list.
-	for (ContactList::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
-		if (contact->GetClientID() == (*it)->GetClientID()) {
+	for (uint32_t i = 0; i < m_size; i++) {
+		if (contact->GetClientID() == m_entries[i].id) {
 			return false;
 		}
-		if ((contact->GetIPAddress() & 0xFFFFFF00) == ((*it)->GetIPAddress() & 0xFFFFFF00)) {
+		if ((contact->GetIPAddress() & 0xFFFFFF00) == (m_entries[i].ip & 0xFFFFFF00)) {
 			sameSubnets++;
 		}
 	}
@@ -92,8 +122,10 @@ bool CRoutingBin::AddContact(CContact *contact)
 	}
 
 	// If not full, add to the end of list
-	if (m_entries.size() < K) {
-		m_entries.push_back(contact);
+	if (m_size < K) {
+		Entry& entry = m_entries[m_size++];
+		entry.contact = contact;
+		UpdateEntry(entry);
 		AdjustGlobalTracking(contact->GetIPAddress(), true);
 		return true;
 	}
@@ -109,20 +141,36 @@ void CRoutingBin::SetAlive(CContact *contact)
 	if (test) {
 		// Mark contact as being alive.
 		test->UpdateType();
+		ContactChanged(test);
 		// Move to the end of the list
 		PushToBottom(test);
 	}
 }
 
+void CRoutingBin::RemoveContact(CContact *contact, bool noTrackingAdjust)
+{
+	uint32_t i = FindEntry(contact);
+	if (i == m_size) {
+		return;
+	}
+	if (!noTrackingAdjust) {
+		AdjustGlobalTracking(m_entries[i].ip, false);
+	}
+	for (m_size--; i < m_size; i++) {
+		m_entries[i] = m_entries[i + 1];
+	}
+}
+
 void CRoutingBin::SetTCPPort(uint32_t ip, uint16_t port, uint16_t tcpPort)
 {
 	// Find contact with IP/Port
-	for (ContactList::iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
-		CContact *c = *it;
-		if ((ip == c->GetIPAddress()) && (port == c->GetUDPPort())) {
+	for (uint32_t i = 0; i < m_size; i++) {
+		if ((ip == m_entries[i].ip) && (port == m_entries[i].udpPort)) {
 			// Set TCPPort and mark as alive.
+			CContact *c = m_entries[i].contact;
 			c->SetTCPPort(tcpPort);
 			c->UpdateType();
+			UpdateEntry(m_entries[i]);
 			// Move to the end of the list
 			PushToBottom(c);
 			break;
@@ -132,9 +180,9 @@ void CRoutingBin::SetTCPPort(uint32_t ip, uint16_t port, uint16_t tcpPort)
 
 CContact *CRoutingBin::GetContact(const CUInt128 &id) const throw()
 {
-	for (ContactList::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
-		if ((*it)->GetClientID() == id) {
-			return *it;
+	for (uint32_t i = 0; i < m_size; i++) {
+		if (m_entries[i].id == id) {
+			return m_entries[i].contact;
 		}
 	}
 	return NULL;
@@ -142,11 +190,13 @@ CContact *CRoutingBin::GetContact(const CUInt128 &id) const throw()
 
 CContact *CRoutingBin::GetContact(uint32_t ip, uint16_t port, bool tcpPort) const throw()
 {
-	for (ContactList::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
-		CContact *contact = *it;
-		if ((contact->GetIPAddress() == ip)
-		    && ((!tcpPort && port == contact->GetUDPPort()) || (tcpPort && port == contact->GetTCPPort()) || port == 0)) {
-			return contact;
+	for (uint32_t i = 0; i < m_size; i++) {
+		const Entry& entry = m_entries[i];
+		if (entry.ip != ip) {
+			continue;
+		}
+		if ((!tcpPort && port == entry.udpPort) || (tcpPort && port == entry.tcpPort) || port == 0) {
+			return entry.contact;
 		}
 	}
 	return NULL;
@@ -155,8 +205,8 @@ CContact *CRoutingBin::GetContact(uint32_t ip, uint16_t port, bool tcpPort) cons
 void CRoutingBin::GetNumContacts(uint32_t& nInOutContacts, uint32_t& nInOutFilteredContacts, uint8_t minVersion) const throw()
 {
 	// count all nodes which meet the search criteria and also report those who don't
-	for (ContactList::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
-		if ((*it)->GetVersion() >= minVersion) {
+	for (uint32_t i = 0; i < m_size; i++) {
+		if (m_entries[i].version >= minVersion) {
 			nInOutContacts++;
 		} else {
 			nInOutFilteredContacts++;
@@ -172,8 +222,8 @@ void CRoutingBin::GetEntries(ContactList *result, bool emptyFirst) const
 	}
 
 	// Append all entries to the results.
-	if (m_entries.size() > 0) {
-		result->insert(result->end(), m_entries.begin(), m_entries.end());
+	for (uint32_t i = 0; i < m_size; i++) {
+		result->push_back(m_entries[i].contact);
 	}
 }
 
@@ -185,19 +235,20 @@ void CRoutingBin::GetClosestTo(uint32_t maxType, const CUInt128 &target, uint32_
 	}
 
 	// No entries, no closest.
-	if (m_entries.size() == 0) {
+	if (m_size == 0) {
 		return;
 	}
 
 	// First put results in sort order for target so we can insert them correctly.
 	// We don't care about max results at this time.
-	for (ContactList::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
-		if ((*it)->GetType() <= maxType && (*it)->IsIPVerified()) {
-			CUInt128 targetDistance((*it)->GetClientID() ^ target);
-			(*result)[targetDistance] = *it;
+	for (uint32_t i = 0; i < m_size; i++) {
+		const Entry& entry = m_entries[i];
+		if (entry.type <= maxType && entry.ipVerified) {
+			CUInt128 targetDistance(entry.id ^ target);
+			(*result)[targetDistance] = entry.contact;
 			// This list will be used for an unknown time, Inc in use so it's not deleted.
 			if (inUse) {
-				(*it)->IncUse();
+				entry.contact->IncUse();
 			}
 		}
 	}
@@ -216,11 +267,7 @@ void CRoutingBin::GetClosestTo(uint32_t maxType, const CUInt128 &target, uint32_
 void CRoutingBin::AdjustGlobalTracking(uint32_t ip, bool increase)
 {
 	// IP
-	uint32_t sameIPCount = 0;
-	GlobalTrackingMap::const_iterator itIP = s_globalContactIPs.find(ip);
-	if (itIP != s_globalContactIPs.end()) {
-		sameIPCount = itIP->second;
-	}
+	uint32_t sameIPCount = s_globalContactIPs.Get(ip);
 	if (increase) {
 		if (sameIPCount >= MAX_CONTACTS_IP) {
 			AddDebugLogLineN(logKadRouting, wxT("Global IP Tracking inconsistency on increase (") + KadIPToString(ip) + wxT(")"));
@@ -234,18 +281,10 @@ void CRoutingBin::AdjustGlobalTracking(uint32_t ip, bool increase)
 		}
 		sameIPCount--;
 	}
-	if (sameIPCount != 0) {
-		s_globalContactIPs[ip] = sameIPCount;
-	} else {
-		s_globalContactIPs.erase(ip);
-	}
+	s_globalContactIPs.Set(ip, sameIPCount);
 
 	// Subnet
-	uint32_t sameSubnetCount = 0;
-	GlobalTrackingMap::const_iterator itSubnet = s_globalContactSubnets.find(ip & 0xFFFFFF00);
-	if (itSubnet != s_globalContactSubnets.end()) {
-		sameSubnetCount = itSubnet->second;
-	}
+	uint32_t sameSubnetCount = s_globalContactSubnets.Get(ip & 0xFFFFFF00);
 	if (increase) {
 		if (sameSubnetCount >= MAX_CONTACTS_SUBNET && !::IsLanIP(wxUINT32_SWAP_ALWAYS(ip))) {
 			AddDebugLogLineN(logKadRouting, wxT("Global Subnet Tracking inconsistency on increase (") + KadIPToString(ip) + wxT("/24)"));
@@ -259,11 +298,7 @@ void CRoutingBin::AdjustGlobalTracking(uint32_t ip, bool increase)
 		}
 		sameSubnetCount--;
 	}
-	if (sameSubnetCount != 0) {
-		s_globalContactSubnets[ip & 0xFFFFFF00] = sameSubnetCount;
-	} else {
-		s_globalContactSubnets.erase(ip & 0xFFFFFF00);
-	}
+	s_globalContactSubnets.Set(ip & 0xFFFFFF00, sameSubnetCount);
 }
 
 bool CRoutingBin::ChangeContactIPAddress(CContact *contact, uint32_t newIP)
@@ -276,14 +311,11 @@ bool CRoutingBin::ChangeContactIPAddress(CContact *contact, uint32_t newIP)
 		return true;
 	}
 
-	wxASSERT(GetContact(contact->GetClientID()) == contact);
+	uint32_t index = FindEntry(contact);
+	wxASSERT(index < m_size);
 
 	// no more than 1 KadID per IP
-	uint32_t sameIPCount = 0;
-	GlobalTrackingMap::const_iterator itIP = s_globalContactIPs.find(newIP);
-	if (itIP != s_globalContactIPs.end()) {
-		sameIPCount = itIP->second;
-	}
+	uint32_t sameIPCount = s_globalContactIPs.Get(newIP);
 	if (sameIPCount >= MAX_CONTACTS_IP) {
 		AddDebugLogLineN(logKadRouting, wxT("Rejected kad contact IP change on update (old IP=") + KadIPToString(contact->GetIPAddress()) + wxT(", requested IP=") + KadIPToString(newIP) + wxT(") - too many contacts with the same IP (global)"));
 		return false;
@@ -291,11 +323,7 @@ bool CRoutingBin::ChangeContactIPAddress(CContact *contact, uint32_t newIP)
 
 	if ((contact->GetIPAddress() & 0xFFFFFF00) != (newIP & 0xFFFFFF00)) {
 		// no more than 10 IPs from the same /24 netmask global, except if it's a LAN IP (if we don't accept LAN IPs they already have been filtered before)
-		uint32_t sameSubnetGlobalCount = 0;
-		GlobalTrackingMap::const_iterator itGlobalSubnet = s_globalContactSubnets.find(newIP & 0xFFFFFF00);
-		if (itGlobalSubnet != s_globalContactSubnets.end()) {
-			sameSubnetGlobalCount = itGlobalSubnet->second;
-		}
+		uint32_t sameSubnetGlobalCount = s_globalContactSubnets.Get(newIP & 0xFFFFFF00);
 		if (sameSubnetGlobalCount >= MAX_CONTACTS_SUBNET && !::IsLanIP(wxUINT32_SWAP_ALWAYS(newIP))) {
 			AddDebugLogLineN(logKadRouting, wxT("Rejected kad contact IP change on update (old IP=") + KadIPToString(contact->GetIPAddress()) + wxT(", requested IP=") + KadIPToString(newIP) + wxT(") - too many contacts with the same Subnet (global)"));
 			return false;
@@ -304,8 +332,8 @@ bool CRoutingBin::ChangeContactIPAddress(CContact *contact, uint32_t newIP)
 		// no more than 2 IPs from the same /24 netmask in one bin, except if it's a LAN IP (if we don't accept LAN IPs they already have been filtered before)
 		uint32_t sameSubnets = 0;
 		// Check if we already have a contact with this ID in the list.
-		for (ContactList::const_iterator itContact = m_entries.begin(); itContact != m_entries.end(); ++itContact) {
-			if ((newIP & 0xFFFFFF00) == ((*itContact)->GetIPAddress() & 0xFFFFFF00)) {
+		for (uint32_t i = 0; i < m_size; i++) {
+			if ((newIP & 0xFFFFFF00) == (m_entries[i].ip & 0xFFFFFF00)) {
 				sameSubnets++;
 			}
 		}
@@ -318,39 +346,49 @@ bool CRoutingBin::ChangeContactIPAddress(CContact *contact, uint32_t newIP)
 	// everything fine
 	AddDebugLogLineN(logKadRouting, wxT("Index contact IP change allowed ") + KadIPToString(contact->GetIPAddress()) + wxT(" -> ") + KadIPToString(newIP));
 	AdjustGlobalTracking(contact->GetIPAddress(), false);
+	// also clears the verified flag
 	contact->SetIPAddress(newIP);
+	if (index < m_size) {
+		UpdateEntry(m_entries[index]);
+	}
 	AdjustGlobalTracking(contact->GetIPAddress(), true);
 	return true;
 }
 
 void CRoutingBin::PushToBottom(CContact *contact)
 {
-	wxASSERT(GetContact(contact->GetClientID()) == contact);
+	uint32_t i = FindEntry(contact);
+	wxASSERT(i < m_size);
+	if (i == m_size) {
+		return;
+	}
 
-	RemoveContact(contact, true);
-	m_entries.push_back(contact);
+	Entry entry = m_entries[i];
+	for (; i + 1 < m_size; i++) {
+		m_entries[i] = m_entries[i + 1];
+	}
+	m_entries[i] = entry;
 }
 
 CContact *CRoutingBin::GetRandomContact(uint32_t maxType, uint32_t minKadVersion) const
 {
-	if (m_entries.empty()) {
+	if (m_size == 0) {
 		return NULL;
 	}
 
 	// Find contact
 	CContact *lastFit = NULL;
-	uint32_t randomStartPos = GetRandomUint16() % m_entries.size();
-	uint32_t index = 0;
+	uint32_t randomStartPos = GetRandomUint16() % m_size;
 
-	for (ContactList::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
-		if ((*it)->GetType() <= maxType && (*it)->GetVersion() >= minKadVersion) {
+	for (uint32_t index = 0; index < m_size; index++) {
+		const Entry& entry = m_entries[index];
+		if (entry.type <= maxType && entry.version >= minKadVersion) {
 			if (index >= randomStartPos) {
-				return *it;
+				return entry.contact;
 			} else {
-				lastFit = *it;
+				lastFit = entry.contact;
 			}
 		}
-		index++;
 	}
 
 	return lastFit;
@@ -358,29 +396,22 @@ CContact *CRoutingBin::GetRandomContact(uint32_t maxType, uint32_t minKadVersion
 
 void CRoutingBin::SetAllContactsVerified()
 {
-	for (ContactList::iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
-		(*it)->SetIPVerified(true);
+	for (uint32_t i = 0; i < m_size; i++) {
+		m_entries[i].contact->SetIPVerified(true);
+		m_entries[i].ipVerified = true;
 	}
 }
 
 bool CRoutingBin::CheckGlobalIPLimits(uint32_t ip, uint16_t DEBUG_ONLY(port))
 {
 	// no more than 1 KadID per IP
-	uint32_t sameIPCount = 0;
-	GlobalTrackingMap::const_iterator itIP = s_globalContactIPs.find(ip);
-	if (itIP != s_globalContactIPs.end()) {
-		sameIPCount = itIP->second;
-	}
+	uint32_t sameIPCount = s_globalContactIPs.Get(ip);
 	if (sameIPCount >= MAX_CONTACTS_IP) {
 		AddDebugLogLineN(logKadRouting, wxT("Ignored kad contact (IP=") + KadIPPortToString(ip, port) + wxT(") - too many contacts with the same IP (global)"));
 		return false;
 	}
 	//  no more than 10 IPs from the same /24 netmask global, except if its a LANIP (if we don't accept LANIPs they already have been filtered before)
-	uint32_t sameSubnetGlobalCount = 0;
-	GlobalTrackingMap::const_iterator itSubnet = s_globalContactSubnets.find(ip & 0xFFFFFF00);
-	if (itSubnet != s_globalContactSubnets.end()) {
-		sameSubnetGlobalCount = itSubnet->second;
-	}
+	uint32_t sameSubnetGlobalCount = s_globalContactSubnets.Get(ip & 0xFFFFFF00);
 	if (sameSubnetGlobalCount >= MAX_CONTACTS_SUBNET && !::IsLanIP(wxUINT32_SWAP_ALWAYS(ip))) {
 		AddDebugLogLineN(logKadRouting, wxT("Ignored kad contact (IP=") + KadIPPortToString(ip, port) + wxT(") - too many contacts with the same subnet (global)"));
 		return false;
@@ -390,10 +421,95 @@ bool CRoutingBin::CheckGlobalIPLimits(uint32_t ip, uint16_t DEBUG_ONLY(port))
 
 bool CRoutingBin::HasOnlyLANNodes() const throw()
 {
-	for (ContactList::const_iterator it = m_entries.begin(); it != m_entries.end(); ++it) {
-		if (!::IsLanIP(wxUINT32_SWAP_ALWAYS((*it)->GetIPAddress()))) {
+	for (uint32_t i = 0; i < m_size; i++) {
+		if (!::IsLanIP(wxUINT32_SWAP_ALWAYS(m_entries[i].ip))) {
 			return false;
 		}
 	}
 	return true;
 }
+
+uint32_t CIPCountMap::Home(uint32_t key) const throw()
+{
+	// Keys are IPs and /24 subnets, mix the bits before masking
+	uint32_t hash = key * 0x9E3779B1u;
+	return (hash ^ (hash >> 16)) & (m_slots.size() - 1);
+}
+
+uint32_t CIPCountMap::Find(uint32_t key) const throw()
+{
+	// Linear probing, the table is never more than half full
+	uint32_t index = Home(key);
+	while (m_slots[index].count != 0 && m_slots[index].key != key) {
+		index = (index + 1) & (m_slots.size() - 1);
+	}
+	return index;
+}
+
+uint32_t CIPCountMap::Get(uint32_t key) const throw()
+{
+	return m_slots.empty() ? 0 : m_slots[Find(key)].count;
+}
+
+void CIPCountMap::Set(uint32_t key, uint32_t count)
+{
+	if (m_slots.empty()) {
+		if (count == 0) {
+			return;
+		}
+		Grow();
+	}
+
+	uint32_t index = Find(key);
+	if (m_slots[index].count != 0) {
+		if (count != 0) {
+			m_slots[index].count = count;
+		} else {
+			Erase(index);
+			m_used--;
+		}
+	} else if (count != 0) {
+		if ((m_used + 1) * 2 > m_slots.size()) {
+			Grow();
+			index = Find(key);
+		}
+		m_slots[index].key = key;
+		m_slots[index].count = count;
+		m_used++;
+	}
+}
+
+void CIPCountMap::Erase(uint32_t index) throw()
+{
+	// Move back the entries that probed past the freed slot, so lookups
+	// don't need tombstones
+	const uint32_t mask = m_slots.size() - 1;
+	uint32_t next = index;
+	for (;;) {
+		m_slots[index].count = 0;
+		uint32_t home;
+		do {
+			next = (next + 1) & mask;
+			if (m_slots[next].count == 0) {
+				return;
+			}
+			home = Home(m_slots[next].key);
+		} while (index <= next ? (index < home && home <= next) : (index < home || home <= next));
+		m_slots[index] = m_slots[next];
+		index = next;
+	}
+}
+
+void CIPCountMap::Grow()
+{
+	std::vector<Slot> old;
+	old.swap(m_slots);
+
+	Slot empty = { 0, 0 };
+	m_slots.resize(old.empty() ? m_initialSize : old.size() * 2, empty);
+	for (std::vector<Slot>::const_iterator it = old.begin(); it != old.end(); ++it) {
+		if (it->count != 0) {
+			m_slots[Find(it->key)] = *it;
+		}
+	}
+}
@@ -44,37 +44,77 @@ there client on the eMule forum..
 #include "../kademlia/Defines.h"
 #include "Contact.h"
 
+#include <vector>
+
 ////////////////////////////////////////
 namespace Kademlia {
 ////////////////////////////////////////
 
 class CUInt128;
 
+// Count per IP or subnet, in an open addressing hash table
+class CIPCountMap
+{
+public:
+	// initialSize is the number of slots allocated first, a power of two
+	CIPCountMap(uint32_t initialSize = 1024)
+		: m_used(0),
+		  m_initialSize(initialSize)
+	{}
+
+	uint32_t Get(uint32_t key) const throw();
+	// A count of 0 removes key
+	void	 Set(uint32_t key, uint32_t count);
+	// Number of keys with a count
+	uint32_t GetCount() const throw()	{ return m_used; }
+
+private:
+	struct Slot {
+		uint32_t key;
+		// 0 for an empty slot
+		uint32_t count;
+	};
+
+	uint32_t Home(uint32_t key) const throw();
+	// Slot holding key, or the empty slot it would go to
+	uint32_t Find(uint32_t key) const throw();
+	void	 Erase(uint32_t index) throw();
+	void	 Grow();
+
+	std::vector<Slot> m_slots;
+	uint32_t	m_used;
+	uint32_t	m_initialSize;
+};
+
 class CRoutingBin
 {
 public:
 	CRoutingBin()
-		: m_dontDeleteContacts(false)
+		: m_dontDeleteContacts(false),
+		  m_size(0)
 	{}
 	~CRoutingBin();
 
 	bool	  AddContact(CContact *contact);
 	void	  SetAlive(CContact *contact);
 	void	  SetTCPPort(uint32_t ip, uint16_t port, uint16_t tcpPort);
-	void	  RemoveContact(CContact *contact, bool noTrackingAdjust = false)	{ if (!noTrackingAdjust) AdjustGlobalTracking(contact->GetIPAddress(), false); m_entries.remove(contact); }
+	void	  RemoveContact(CContact *contact, bool noTrackingAdjust = false);
 	CContact *GetContact(const CUInt128 &id) const throw();
 	CContact *GetContact(uint32_t ip, uint16_t port, bool tcpPort) const throw();
-	CContact *GetOldest() const throw()		{ return m_entries.size() ? m_entries.front() : NULL; }
+	CContact *GetOldest() const throw()		{ return m_size ? m_entries[0].contact : NULL; }
 
-	uint32_t  GetSize() const throw()		{ return m_entries.size(); }
+	uint32_t  GetSize() const throw()		{ return m_size; }
 	void	  GetNumContacts(uint32_t& nInOutContacts, uint32_t& nInOutFilteredContacts, uint8_t minVersion) const throw();
-	uint32_t  GetRemaining() const throw()		{ return K - m_entries.size(); }
+	uint32_t  GetRemaining() const throw()		{ return K - m_size; }
 	void	  GetEntries(ContactList *result, bool emptyFirst = true) const;
 	void	  GetClosestTo(uint32_t maxType, const CUInt128 &target, uint32_t maxRequired, ContactMap *result, bool emptyFirst = true, bool setInUse = false) const;
 	bool	  ChangeContactIPAddress(CContact *contact, uint32_t newIP);
 	void	  PushToBottom(CContact *contact); // puts an existing contact from X to the end of the list
 	CContact *GetRandomContact(uint32_t maxType, uint32_t minKadVersion) const;
 	void	  SetAllContactsVerified();
+	// Must be called after changing the ports, type, version or verified
+	// flag of a contact in the bin through the contact itself
+	void	  ContactChanged(CContact *contact);
 	bool	  HasOnlyLANNodes() const throw();
 
 	static bool	CheckGlobalIPLimits(uint32_t ip, uint16_t port);
@@ -85,12 +125,32 @@ protected:
 	static void AdjustGlobalTracking(uint32_t ip, bool increase);
 
 private:
-	ContactList m_entries;
-
-	typedef std::map<uint32_t, uint32_t>	GlobalTrackingMap;
-
-	static GlobalTrackingMap	s_globalContactIPs;
-	static GlobalTrackingMap	s_globalContactSubnets;
+	// Contacts are scanned a lot, so the bin keeps the fields searched
+	// by next to the pointers. A contact's ID never changes, and its IP
+	// only through ChangeContactIPAddress(). Other changes made through
+	// the contact are copied by ContactChanged().
+	struct Entry {
+		CUInt128	id;
+		uint32_t	ip;
+		uint16_t	udpPort;
+		uint16_t	tcpPort;
+		CContact	*contact;
+		uint8_t		type;
+		uint8_t		version;
+		bool		ipVerified;
+	};
+
+	// Index of contact in m_entries, or m_size if it isn't there
+	uint32_t FindEntry(const CContact *contact) const throw();
+	// Copies the searched fields from entry.contact
+	static void UpdateEntry(Entry& entry) throw();
+
+	// Oldest first
+	Entry		m_entries[K];
+	uint32_t	m_size;
+
+	static CIPCountMap	s_globalContactIPs;
+	static CIPCountMap	s_globalContactSubnets;
 };
 
 } // End namespace
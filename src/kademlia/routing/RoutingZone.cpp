@@ -792,6 +792,7 @@ void CRoutingZone::OnSmallTimer()
 
 	if (c != NULL) {
 		c->CheckingType();
+		m_bin->ContactChanged(c);
 		if (c->GetVersion() >= 6) {
 			DebugSend(Kad2HelloReq, c->GetIPAddress(), c->GetUDPPort());
 			CUInt128 clientID = c->GetClientID();
@@ -869,7 +870,13 @@ uint32_t CRoutingZone::GetBootstrapContacts(ContactList *results, uint32_t maxRe
 
 bool CRoutingZone::VerifyContact(const CUInt128& id, uint32_t ip)
 {
-	CContact* contact = GetContact(id);
+	if (!IsLeaf()) {
+		CUInt128 distance = CKademlia::GetPrefs()->GetKadID();
+		distance ^= id;
+		return m_subZones[distance.GetBitNumber(m_level)]->VerifyContact(id, ip);
+	}
+
+	CContact* contact = m_bin->GetContact(id);
 	if (contact == NULL) {
 		return false;
 	} else if (ip != contact->GetIPAddress()) {
@@ -879,6 +886,7 @@ bool CRoutingZone::VerifyContact(const CUInt128& id, uint32_t ip)
 			AddDebugLogLineN(logKadRouting, wxT("Sender already verified (sender: ") + KadIPToString(ip) + wxT(")"));
 		} else {
 			contact->SetIPVerified(true);
+			m_bin->ContactChanged(contact);
 		}
 		return true;
 	}
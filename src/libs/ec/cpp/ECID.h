@@ -30,17 +30,31 @@
 /*
  * Class to create unique IDs for Objects transmitted through EC
  * (Partfiles, Knownfiles, clients...)
+ *
+ * It also keeps track of when the object was last changed, so EC
+ * updates can skip objects that didn't change since the previous one.
  */
 class CECID {
 	// the id
 	uint32 m_ID;
 	// counter to calculate unique ids (defined in ECTag.cpp)
 	static uint32 s_IDCounter;
+	// value of s_ECGeneration when the object was last changed
+	uint64 m_ECGeneration;
+	// global change counter (defined in ECTag.cpp)
+	static uint64 s_ECGeneration;
 public:
-	CECID()				{ m_ID = ++s_IDCounter; }
-	CECID(uint32 id)	{ m_ID = id; }
+	CECID()				{ m_ID = ++s_IDCounter; m_ECGeneration = ++s_ECGeneration; }
+	CECID(uint32 id)	{ m_ID = id; m_ECGeneration = ++s_ECGeneration; }
 	uint32 ECID() const	{ return m_ID; }
-	void RenewECID()	{ m_ID = ++s_IDCounter; }
+	void RenewECID()	{ m_ID = ++s_IDCounter; m_ECGeneration = ++s_ECGeneration; }
+
+	// Mark the object as changed, to be sent in the next EC update
+	void SetECDirty()	{ m_ECGeneration = ++s_ECGeneration; }
+	// True if the object changed after the given generation
+	bool IsECDirty(uint64 since) const	{ return m_ECGeneration > since; }
+	// Generation of the latest change of any object
+	static uint64 GetECGeneration()		{ return s_ECGeneration; }
 };
 
 #endif
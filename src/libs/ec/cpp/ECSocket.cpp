@@ -269,6 +269,7 @@ m_tx_flags(0),
 m_bytes_needed(EC_HEADER_SIZE),
 m_in_header(true),
 m_my_flags(0x20),
+m_compression_level(EC_COMPRESSION_LEVEL),
 m_haveNotificationSupport(false)
 {
 	
@@ -296,6 +297,61 @@ void CECSocket::SendPacket(const CECPacket *packet)
 	OnOutput();
 }
 
+
+namespace {
+	/*
+	 * Unconnected socket, used by EncodePacket() to run the
+	 * regular WritePacket() into its own output queue.
+	 */
+	class CECPacketEncoder : public CECSocket {
+	public:
+		CECPacketEncoder(uint32_t flags, int level) : CECSocket(false)
+		{
+			m_my_flags = flags;
+			m_compression_level = level;
+		}
+
+	private:
+		virtual void WriteDoneAndQueueEmpty()	{}
+		virtual bool InternalConnect(uint32_t, uint16_t, bool)	{ return false; }
+		virtual size_t InternalLastCount()	{ return 0; }
+		virtual bool InternalWaitOnConnect(long, long)	{ return false; }
+		virtual bool InternalWaitForWrite(long, long)	{ return false; }
+		virtual bool InternalWaitForRead(long, long)	{ return false; }
+		virtual int InternalGetLastError()	{ return EC_ERROR_NOERROR; }
+		virtual void InternalClose()	{}
+		virtual bool InternalError()	{ return false; }
+		virtual void InternalRead(void*, size_t)	{}
+		virtual void InternalWrite(const void*, size_t)	{}
+		virtual bool InternalIsConnected()	{ return false; }
+		virtual void InternalDestroy()	{}
+	};
+}
+
+
+uint32 CECSocket::EncodePacket(const CECPacket *packet, uint32_t flags, int level, std::list<CQueuedData *> &data)
+{
+	CECPacketEncoder encoder(flags, level);
+	uint32 len = encoder.WritePacket(packet);
+	data.splice(data.end(), encoder.m_output_queue);
+	return len;
+}
+
+
+void CECSocket::SendEncodedPacket(std::list<CQueuedData *> &data)
+{
+	if (SocketRealError()) {
+		while (!data.empty()) {
+			delete data.front();
+			data.pop_front();
+		}
+		OnError();
+		return;
+	}
+	m_output_queue.splice(m_output_queue.end(), data);
+	OnOutput();
+}
+
 const CECPacket *CECSocket::SendRecvPacket(const CECPacket *packet)
 {
 	SendPacket(packet);
@@ -757,7 +813,7 @@ uint32 CECSocket::WritePacket(const CECPacket *packet)
 		m_z.opaque = Z_NULL;
 		m_z.avail_in = 0;
 		m_z.next_in = &m_in_ptr[0];
-		int zerror = deflateInit(&m_z, EC_COMPRESSION_LEVEL);
+		int zerror = deflateInit(&m_z, m_compression_level);
 		if (zerror != Z_OK) {
 			// don't use zlib if init failed
 			flags &= ~EC_FLAG_ZLIB;
@@ -28,6 +28,7 @@
 
 
 #include <deque>	// Needed for std::deque
+#include <list>		// Needed for std::list
 #include <memory>	// Needed for std::auto_ptr	// Do_not_auto_remove (mingw-gcc-3.4.5)
 #include <string>
 #include <vector>
@@ -92,6 +93,8 @@ private:
 
 protected:
 	uint32_t m_my_flags;
+	// deflate level used when EC_FLAG_ZLIB is set
+	int m_compression_level;
 	bool m_haveNotificationSupport;
 public:
 	CECSocket(bool use_events);
@@ -102,6 +105,8 @@ public:
 	void CloseSocket() { InternalClose(); }
 
 	bool HaveNotificationSupport() const { return m_haveNotificationSupport; }
+
+	int GetCompressionLevel() const { return m_compression_level; }
 		
 	/**
 	 * Sends an EC packet and returns immediately.
@@ -116,6 +121,29 @@ public:
 	 */
 	void SendPacket(const CECPacket *packet);
 
+	/**
+	 * Serializes an EC packet the way SendPacket() would, without sending it.
+	 *
+	 * @param packet The CECPacket packet to be serialized.
+	 * @param flags The flags of the socket the packet will be sent on.
+	 * @param level The compression level of that socket.
+	 * @param data Receives the serialized packet.
+	 * @return The length of the (compressed) packet, excluding the header.
+	 *
+	 * This doesn't touch any socket, so it may be called on a worker
+	 * thread to keep compression of large packets off the event loop.
+	 * The result is sent with SendEncodedPacket(), on the socket's thread.
+	 */
+	static uint32 EncodePacket(const CECPacket *packet, uint32_t flags, int level, std::list<CQueuedData *> &data);
+
+	/**
+	 * Sends a packet serialized by EncodePacket().
+	 *
+	 * @param data The serialized packet. The buffers are taken over
+	 * by the socket, so the list is empty on return.
+	 */
+	void SendEncodedPacket(std::list<CQueuedData *> &data);
+
 	/**
 	 * Sends an EC packet and waits for a reply.
 	 *
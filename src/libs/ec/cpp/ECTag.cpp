@@ -69,7 +69,7 @@ CECTag::CECTag(ec_tagname_t name, unsigned int length, const void *data) : m_tag
 	if (data) {
 		m_dataLen = length;
 		NewData();
-		memcpy(m_tagData, data, m_dataLen);
+		memcpy(Data(), data, m_dataLen);
 	} else {
 		wxASSERT(length == 0);
 		m_dataLen = 0;
@@ -85,13 +85,15 @@ CECTag::CECTag(ec_tagname_t name, unsigned int length, const void *data) : m_tag
  * @param length 	length of data buffer that will be alloc'ed
  * @param dataptr	pointer to a void pointer which will be assigned the internal TAG data buffer
  *
- * \note TAG data buffer has to be filled with valid data after the ctor
+ * \note TAG data buffer has to be filled with valid data after the ctor.
+ * Short buffers are stored inside the tag itself, so the pointer is only
+ * valid until the tag is added to another one or copied.
  */
 CECTag::CECTag(ec_tagname_t name, unsigned int length, void **dataptr)  : m_tagName(name)
 {
 	m_dataLen = length;
 	NewData();
-	*dataptr = m_tagData;
+	*dataptr = Data();
 	m_dataType = EC_TAGTYPE_CUSTOM;
 }
 
@@ -110,8 +112,8 @@ CECTag::CECTag(ec_tagname_t name, const EC_IPv4_t& data) : m_tagName(name)
 
 	m_dataLen = sizeof(EC_IPv4_t);
 	NewData();
-	RawPokeUInt32( ((EC_IPv4_t *)m_tagData)->m_ip, RawPeekUInt32( data.m_ip ) );
-	((EC_IPv4_t *)m_tagData)->m_port = ENDIAN_HTONS(data.m_port);
+	RawPokeUInt32( ((EC_IPv4_t *)Data())->m_ip, RawPeekUInt32( data.m_ip ) );
+	((EC_IPv4_t *)Data())->m_port = ENDIAN_HTONS(data.m_port);
 	m_dataType = EC_TAGTYPE_IPV4;
 }
 
@@ -129,8 +131,8 @@ CECTag::CECTag(ec_tagname_t name, const CMD4Hash& data) : m_tagName(name)
 {
 	m_dataLen = 16;
 	NewData();
-	RawPokeUInt64( m_tagData,		RawPeekUInt64( data.GetHash() ) );
-	RawPokeUInt64( m_tagData + 8,	RawPeekUInt64( data.GetHash() + 8 ) );
+	RawPokeUInt64( Data(),		RawPeekUInt64( data.GetHash() ) );
+	RawPokeUInt64( Data() + 8,	RawPeekUInt64( data.GetHash() + 8 ) );
 	m_dataType = EC_TAGTYPE_HASH16;
 }
 
@@ -169,6 +171,7 @@ CECTag::CECTag(ec_tagname_t name, const wxChar* data)
  */
 CECTag::CECTag(const CECTag& tag)
 {
+	m_dataLen = 0;
 	m_tagData = NULL;
 	*this = tag;
 }
@@ -224,16 +227,16 @@ void CECTag::InitInt(uint64 data)
 	
 	switch (m_dataType) {
 		case EC_TAGTYPE_UINT8:
-			PokeUInt8( m_tagData, (uint8) data );
+			PokeUInt8( Data(), (uint8) data );
 			break;
 		case EC_TAGTYPE_UINT16:
-			PokeUInt16( m_tagData, wxUINT16_SWAP_ALWAYS((uint16) data ));
+			PokeUInt16( Data(), wxUINT16_SWAP_ALWAYS((uint16) data ));
 			break;
 		case EC_TAGTYPE_UINT32:
-			PokeUInt32( m_tagData, wxUINT32_SWAP_ALWAYS((uint32) data ));
+			PokeUInt32( Data(), wxUINT32_SWAP_ALWAYS((uint32) data ));
 			break;
 		case EC_TAGTYPE_UINT64:
-			PokeUInt64( m_tagData, wxUINT64_SWAP_ALWAYS(data) );
+			PokeUInt64( Data(), wxUINT64_SWAP_ALWAYS(data) );
 			break;
 	}
 }
@@ -257,7 +260,7 @@ CECTag::CECTag(ec_tagname_t name, double data) : m_tagName(name)
 	const char * double_chr = double_string.c_str();
 	m_dataLen = (ec_taglen_t)strlen(double_chr) + 1;
 	NewData();
-	memcpy(m_tagData, double_chr, m_dataLen);
+	memcpy(Data(), double_chr, m_dataLen);
 	m_dataType = EC_TAGTYPE_DOUBLE;
 }
 
@@ -266,7 +269,7 @@ CECTag::CECTag(ec_tagname_t name, double data) : m_tagName(name)
  */
 CECTag::~CECTag(void)
 {
-	delete [] m_tagData;
+	FreeData();
 }
 
 /**
@@ -279,13 +282,13 @@ CECTag::~CECTag(void)
 CECTag& CECTag::operator=(const CECTag& tag)
 {
 	if (&tag != this) {
+		FreeData();
 		m_tagName = tag.m_tagName;
 		m_dataLen = tag.m_dataLen;
 		m_dataType = tag.m_dataType;
-		delete [] m_tagData;
 		if (m_dataLen != 0) {
 			NewData();
-			memcpy(m_tagData, tag.m_tagData, m_dataLen);
+			memcpy(Data(), tag.Data(), m_dataLen);
 		} else {
 			m_tagData = NULL;
 		}
@@ -307,7 +310,7 @@ bool CECTag::operator==(const CECTag& tag) const
 			&& m_tagName == tag.m_tagName
 			&& m_dataLen == tag.m_dataLen
 			&&	(m_dataLen == 0
-				|| !memcmp(m_tagData, tag.m_tagData, m_dataLen))
+				|| !memcmp(Data(), tag.Data(), m_dataLen))
 			&& m_tagList == tag.m_tagList;
 }
 
@@ -405,7 +408,11 @@ void CECTag::swap(CECTag& t2)
 	std::swap(m_tagName, t2.m_tagName);
 	std::swap(m_dataType, t2.m_dataType);
 	std::swap(m_dataLen, t2.m_dataLen);
-	std::swap(m_tagData, t2.m_tagData);
+	// swapping the inline buffer swaps the heap pointer as well
+	char tmp[EC_TAG_INLINE_DATA];
+	memcpy(tmp, m_inlineData, EC_TAG_INLINE_DATA);
+	memcpy(m_inlineData, t2.m_inlineData, EC_TAG_INLINE_DATA);
+	memcpy(t2.m_inlineData, tmp, EC_TAG_INLINE_DATA);
 	std::swap(m_tagList, t2.m_tagList);
 }
 
@@ -435,7 +442,7 @@ bool CECTag::ReadFromSocket(CECSocket& socket)
 	m_dataLen = tmp_len - GetTagLen();
 	if (m_dataLen > 0) {
 		NewData();
-		if (!socket.ReadBuffer(m_tagData, m_dataLen)) {
+		if (!socket.ReadBuffer(Data(), m_dataLen)) {
 			return false;
 		}
 	} else {
@@ -462,9 +469,7 @@ bool CECTag::WriteTag(CECSocket& socket) const
 	}
 	
 	if (m_dataLen > 0) {
-		if (m_tagData != NULL) {	// This is here only to make sure everything, it should not be NULL at this point
-			if (!socket.WriteBuffer(m_tagData, m_dataLen)) return false;
-		}
+		if (!socket.WriteBuffer(Data(), m_dataLen)) return false;
 	}
 	
 	return true;
@@ -561,7 +566,7 @@ uint32 CECTag::GetTagLen(void) const
 
 uint64_t CECTag::GetInt() const
 {
-	if (m_tagData == NULL) {
+	if (m_dataLen == 0) {
 		// Empty tag - This is NOT an error.
 		EC_ASSERT(m_dataType == EC_TAGTYPE_UNKNOWN);
 		return 0;
@@ -569,13 +574,13 @@ uint64_t CECTag::GetInt() const
 
 	switch (m_dataType) {
 		case EC_TAGTYPE_UINT8:
-			return PeekUInt8(m_tagData);
+			return PeekUInt8(Data());
 		case EC_TAGTYPE_UINT16:
-			return ENDIAN_NTOHS( RawPeekUInt16( m_tagData ) );
+			return ENDIAN_NTOHS( RawPeekUInt16( Data() ) );
 		case EC_TAGTYPE_UINT32:
-			return ENDIAN_NTOHL( RawPeekUInt32( m_tagData ) );
+			return ENDIAN_NTOHL( RawPeekUInt32( Data() ) );
 		case EC_TAGTYPE_UINT64:
-			return ENDIAN_NTOHLL( RawPeekUInt64( m_tagData ) );
+			return ENDIAN_NTOHLL( RawPeekUInt64( Data() ) );
 		case EC_TAGTYPE_UNKNOWN:
 			// Empty tag - This is NOT an error.
 			return 0;
@@ -591,12 +596,12 @@ std::string CECTag::GetStringDataSTL() const
 	if (m_dataType != EC_TAGTYPE_STRING) {
 		EC_ASSERT(m_dataType == EC_TAGTYPE_UNKNOWN);
 		return std::string();
-	} else if (m_tagData == NULL) {
+	} else if (m_dataLen == 0) {
 		EC_ASSERT(false);
 		return std::string();
 	}
 
-	return std::string(m_tagData);
+	return std::string(Data());
 }
 
 
@@ -615,11 +620,10 @@ CMD4Hash CECTag::GetMD4Data() const
 		return CMD4Hash();
 	}
 
-	EC_ASSERT(m_tagData != NULL);
+	EC_ASSERT(m_dataLen != 0);
 
-	// Doesn't matter if m_tagData is NULL in CMD4Hash(), 
-	// that'll just result in an empty hash.
-	return CMD4Hash((const unsigned char *)m_tagData); 
+	// Missing data just results in an empty hash.
+	return m_dataLen ? CMD4Hash((const unsigned char *)Data()) : CMD4Hash();
 }
 
 
@@ -638,11 +642,11 @@ EC_IPv4_t CECTag::GetIPv4Data() const
 	
 	if (m_dataType != EC_TAGTYPE_IPV4) {
 		EC_ASSERT(m_dataType == EC_TAGTYPE_UNKNOWN);
-	} else if (m_tagData == NULL) {
+	} else if (m_dataLen == 0) {
 		EC_ASSERT(false);
 	} else {
-		RawPokeUInt32( p.m_ip, RawPeekUInt32( ((EC_IPv4_t *)m_tagData)->m_ip ) );
-		p.m_port = ENDIAN_NTOHS(((EC_IPv4_t *)m_tagData)->m_port);
+		RawPokeUInt32( p.m_ip, RawPeekUInt32( ((EC_IPv4_t *)Data())->m_ip ) );
+		p.m_port = ENDIAN_NTOHS(((EC_IPv4_t *)Data())->m_port);
 	}
 
 	return p;
@@ -663,12 +667,12 @@ double CECTag::GetDoubleData(void) const
 	if (m_dataType != EC_TAGTYPE_DOUBLE) {
 		EC_ASSERT(m_dataType == EC_TAGTYPE_UNKNOWN);
 		return 0;
-	} else if (m_tagData == NULL) {
+	} else if (m_dataLen == 0) {
 		EC_ASSERT(false);
 		return 0;
 	}
 	
-	std::istringstream double_str(m_tagData);
+	std::istringstream double_str(Data());
 	
 	double data;
 	double_str >> data;
@@ -681,14 +685,14 @@ void CECTag::ConstructStringTag(ec_tagname_t name, const std::string& data)
 	m_tagName = name;
 	m_dataLen = (ec_taglen_t)strlen(data.c_str()) + 1;
 	NewData();
-	memcpy(m_tagData, data.c_str(), m_dataLen);
+	memcpy(Data(), data.c_str(), m_dataLen);
 	m_dataType = EC_TAGTYPE_STRING;
 }
 
 void CECTag::SetStringData(const wxString& s)
 {
 	if (IsString()) {
-		delete [] m_tagData;
+		FreeData();
 		ConstructStringTag(m_tagName, (const char*)unicode2UTF8(s));
 	}
 }
@@ -1013,7 +1017,7 @@ void CECTag::DebugPrint(int level, bool print_empty) const
 									s2 += wxT("...");
 									break;
 								}
-								s2 += CFormat(wxT("%02X ")) % (unsigned char) m_tagData[i];
+								s2 += CFormat(wxT("%02X ")) % (unsigned char) Data()[i];
 							}
 						}
 						break;
@@ -1159,5 +1163,6 @@ void CECTag::DebugPrint(int level, bool print_empty) const
  */
 
 uint32 CECID::s_IDCounter = 0;
+uint64 CECID::s_ECGeneration = 0;
 
 // File_checked_for_headers
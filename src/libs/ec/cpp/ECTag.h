@@ -137,7 +137,7 @@ class CECTag {
 		bool			HasChildTags() const { return !m_tagList.empty(); }
 		const void *	GetTagData() const { 
 			EC_ASSERT(m_dataType == EC_TAGTYPE_CUSTOM);
-			return m_tagData; 
+			return Data(); 
 		}
 		uint16_t		GetTagDataLen() const { return m_dataLen; }
 		uint32_t		GetTagLen() const;
@@ -207,11 +207,23 @@ class CECTag {
 		// To init. the automatic int data
 		void InitInt(uint64_t data);
 
+		// Data up to this size is stored in the tag itself. This saves an
+		// allocation for every number, hash and address, and most strings.
+		static const unsigned int EC_TAG_INLINE_DATA = 16;
+
 		ec_tagname_t	m_tagName;
 		ec_tagtype_t	m_dataType;
 		ec_taglen_t		m_dataLen;
-		char *			m_tagData;
-		void NewData()	{ m_tagData = new char[m_dataLen]; }
+		union {
+			char *		m_tagData;
+			char		m_inlineData[EC_TAG_INLINE_DATA];
+		};
+		bool IsInlineData() const	{ return m_dataLen <= EC_TAG_INLINE_DATA; }
+		char * Data()				{ return IsInlineData() ? m_inlineData : m_tagData; }
+		const char * Data() const	{ return IsInlineData() ? m_inlineData : m_tagData; }
+		// Both must be called with m_dataLen set to the length of the data
+		void NewData()	{ if (!IsInlineData()) { m_tagData = new char[m_dataLen]; } }
+		void FreeData()	{ if (!IsInlineData()) { delete [] m_tagData; } }
 
 		typedef std::list<CECTag> TagList;
 		TagList m_tagList;
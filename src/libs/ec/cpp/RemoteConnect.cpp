@@ -35,7 +35,8 @@ using std::auto_ptr;
 DEFINE_LOCAL_EVENT_TYPE(wxEVT_EC_CONNECTION)
 
 CECLoginPacket::CECLoginPacket(const wxString& client, const wxString& version,
-							   bool canZLIB, bool canUTF8numbers, bool canNotify)
+							   bool canZLIB, bool canUTF8numbers, bool canNotify,
+							   int zlibLevel)
 :
 CECPacket(EC_OP_AUTH_REQ)
 {
@@ -52,6 +53,10 @@ CECPacket(EC_OP_AUTH_REQ)
 	// Send capabilities:
 	// support ZLIB compression
 	if (canZLIB)		AddTag(CECEmptyTag(EC_TAG_CAN_ZLIB));
+	// preferred deflate level, if not the default one
+	if (canZLIB && zlibLevel != Z_DEFAULT_COMPRESSION) {
+		AddTag(CECTag(EC_TAG_ZLIB_LEVEL, (uint8)zlibLevel));
+	}
 	// support encoding of integers as UTF-8
 	if (canUTF8numbers) AddTag(CECEmptyTag(EC_TAG_CAN_UTF8_NUMBERS));
 	// client accepts push messages
@@ -91,11 +96,15 @@ m_canNotify(false)
 {
 }
 
-void CRemoteConnect::SetCapabilities(bool canZLIB, bool canUTF8numbers, bool canNotify)
+void CRemoteConnect::SetCapabilities(bool canZLIB, bool canUTF8numbers, bool canNotify, int zlibLevel)
 { 
-	m_canZLIB = canZLIB;
-	if (canZLIB) {
+	// Level 0 would only wrap the data into deflate blocks
+	m_canZLIB = canZLIB && zlibLevel != Z_NO_COMPRESSION;
+	if (m_canZLIB) {
 		m_my_flags |= EC_FLAG_ZLIB;
+		if (zlibLevel >= Z_BEST_SPEED && zlibLevel <= Z_BEST_COMPRESSION) {
+			m_compression_level = zlibLevel;
+		}
 	}
 	m_canUTF8numbers = canUTF8numbers;
 	if (canUTF8numbers) {
@@ -134,7 +143,7 @@ bool CRemoteConnect::ConnectToCore(const wxString &host, int port,
 	addr.Service(port);
 
 	if (ConnectSocket(addr)) {
-		CECLoginPacket login_req(m_client, m_version, m_canZLIB, m_canUTF8numbers, m_canNotify);
+		CECLoginPacket login_req(m_client, m_version, m_canZLIB, m_canUTF8numbers, m_canNotify, m_compression_level);
 
 		std::auto_ptr<const CECPacket> getSalt(SendRecvPacket(&login_req));
 		m_ec_state = EC_REQ_SENT;
@@ -169,7 +178,7 @@ void CRemoteConnect::WriteDoneAndQueueEmpty()
 void CRemoteConnect::OnConnect() {
 	if (m_notifier) {
 		wxASSERT(m_ec_state == EC_CONNECT_SENT);
-		CECLoginPacket login_req(m_client, m_version, m_canZLIB, m_canUTF8numbers, m_canNotify);
+		CECLoginPacket login_req(m_client, m_version, m_canZLIB, m_canUTF8numbers, m_canNotify, m_compression_level);
 		CECSocket::SendPacket(&login_req);
 		
 		m_ec_state = EC_REQ_SENT;
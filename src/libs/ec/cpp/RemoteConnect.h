@@ -39,7 +39,8 @@ class CECPacketHandlerBase {
 class CECLoginPacket : public CECPacket {
 	public:
 		CECLoginPacket(const wxString& client, const wxString& version,
-						bool canZLIB = true, bool canUTF8numbers = true, bool canNotify = false);
+						bool canZLIB = true, bool canUTF8numbers = true, bool canNotify = false,
+						int zlibLevel = Z_DEFAULT_COMPRESSION);
 };
 
 class CECAuthPacket : public CECPacket {
@@ -83,7 +84,9 @@ public:
 	// The event handler is used for notifying connect/close 
 	CRemoteConnect(wxEvtHandler* evt_handler);
 
-	void SetCapabilities(bool canZLIB, bool canUTF8numbers, bool canNotify);
+	// zlibLevel is the deflate level the core is asked to use for its replies
+	// (0 disables compression); the same level is used for our requests.
+	void SetCapabilities(bool canZLIB, bool canUTF8numbers, bool canNotify, int zlibLevel = Z_DEFAULT_COMPRESSION);
 
 	bool ConnectToCore(
 		const wxString &host, int port,
@@ -30,6 +30,7 @@
 #include <string>	// Do_not_auto_remove (g++-4.0.1)
 
 #include <wx/datetime.h>
+#include <sys/stat.h>		// Needed for stat()
 
 //-------------------------------------------------------------------
 
@@ -1701,6 +1702,10 @@ CScriptWebServer::CScriptWebServer(CamulewebApp *webApp, const wxString& templat
 
 CScriptWebServer::~CScriptWebServer()
 {
+	for(std::map<std::string, CPhpTemplate *>::iterator i = m_php_templates.begin();
+		i != m_php_templates.end(); i++) {
+		delete i->second;
+	}
 }
 
 char *CScriptWebServer::GetErrorPage(const char *message, long &size)
@@ -1745,22 +1750,44 @@ char *CScriptWebServer::ProcessHtmlRequest(const char *filename, long &size)
 	return buf;
 }
 
+CPhpTemplate *CScriptWebServer::GetPhpTemplate(const char *filename)
+{
+	struct stat st;
+	if ( stat(filename, &st) != 0 ) {
+		return 0;
+	}
+
+	CPhpTemplate *&php_template = m_php_templates[filename];
+	if ( php_template && (php_template->GetModificationTime() != st.st_mtime) ) {
+		delete php_template;
+		php_template = 0;
+	}
+	if ( !php_template ) {
+		php_template = new CPhpTemplate(this, filename, st.st_mtime);
+	}
+	if ( !php_template->IsOk() ) {
+		delete php_template;
+		m_php_templates.erase(filename);
+		return 0;
+	}
+
+	return php_template;
+}
+
 char *CScriptWebServer::ProcessPhpRequest(const char *filename, CSession *sess, long &size)
 {
-	FILE *f = fopen(filename, "r");
-	if ( !f ) {
+	CPhpTemplate *php_template = GetPhpTemplate(filename);
+	if ( !php_template ) {
 		return Get_404_Page(size);
 	}
 
 	CWriteStrBuffer buffer;
-	CPhpFilter(this, sess, filename, &buffer);
+	php_template->Execute(sess, &buffer);
 	
 	size = buffer.Length();
 	char *buf = new char [size+1];
 	buffer.CopyAll(buf);
 	
-	fclose(f);
-	
 	return buf;
 }
 
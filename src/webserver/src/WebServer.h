@@ -769,6 +769,8 @@ class CSession {
 		void LoadVars(CParsedUrl &url);
 };
 
+class CPhpTemplate;
+
 /*
  * Script based webserver
  */
@@ -779,6 +781,10 @@ class CScriptWebServer : public CWebServerBase {
 		char *ProcessHtmlRequest(const char *filename, long &size);
 		char *ProcessPhpRequest(const char *filename, CSession *sess, long &size);
 
+		// parsed pages, reparsed only when file is modified
+		std::map<std::string, CPhpTemplate *> m_php_templates;
+		CPhpTemplate *GetPhpTemplate(const char *filename);
+
 		char *GetErrorPage(const char *message, long &size);
 		char *Get_404_Page(long &size);
 
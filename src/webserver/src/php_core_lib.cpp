@@ -533,8 +533,14 @@ CPhPLibContext::CPhPLibContext(CWebServerBase *server, const char *file)
 	g_curr_context = this;
 
 	m_server = server;
+	m_curr_str_buffer = 0;
 
 	php_engine_init();
+
+	m_global_scope = g_global_scope;
+	m_scope_stack = g_scope_stack;
+	m_syn_tree_top = 0;
+
 	phpin = fopen(file, "r");
 	if ( !phpin ) {
 		return;
@@ -543,7 +549,8 @@ CPhPLibContext::CPhPLibContext(CWebServerBase *server, const char *file)
 	phpparse();
 	
 	m_syn_tree_top = g_syn_tree_top;
-	m_global_scope = g_global_scope;
+
+	TakeSnapshot();
 }
 
 CPhPLibContext::CPhPLibContext(CWebServerBase *server, char *php_buf, int len)
@@ -551,35 +558,125 @@ CPhPLibContext::CPhPLibContext(CWebServerBase *server, char *php_buf, int len)
 	g_curr_context = this;
 
 	m_server = server;
+	m_curr_str_buffer = 0;
 
 	php_engine_init();
 
 	m_global_scope = g_global_scope;
+	m_scope_stack = g_scope_stack;
 
 	php_set_input_buffer(php_buf, len);
 	phpparse();
 	
 	m_syn_tree_top = g_syn_tree_top;
+
+	TakeSnapshot();
 }
 
 CPhPLibContext::~CPhPLibContext()
 {
 	SetContext();
+	for(std::map<PHP_SCOPE_ITEM *, VAR_SNAPSHOT>::iterator i = m_var_snapshot.begin();
+		i != m_var_snapshot.end(); i++) {
+		var_node_free(i->second.var);
+		value_value_free(&i->second.value);
+	}
 	php_engine_free();
+	if ( g_curr_context == this ) {
+		g_curr_context = 0;
+	}
 }
 
 void CPhPLibContext::SetContext()
 {
 	g_syn_tree_top = m_syn_tree_top;
 	g_global_scope = m_global_scope;
+	// scope stack is empty between runs, but engine is still
+	// expecting to have current scope to be global one
+	g_current_scope = m_global_scope;
+	g_scope_stack = m_scope_stack;
 }
 
 void CPhPLibContext::Execute(CWriteStrBuffer *buf)
 {
+	g_curr_context = this;
 	m_curr_str_buffer = buf;
 	
 	PHP_VALUE_NODE val;
 	php_execute(g_syn_tree_top, &val);
+
+	m_curr_str_buffer = 0;
+}
+
+/*
+ * Parser leaves initial values in scope tables: constants of "static"
+ * declarations and "global" links between function scope and global
+ * one. Execution is changing both values and var pointers (by "&"
+ * assignment), so all of it must be remembered in order to run same tree
+ * again. Function local vars are recreated by engine on each call, so
+ * only static ones need to be saved.
+ */
+void CPhPLibContext::TakeSnapshot()
+{
+	TakeScopeSnapshot(m_global_scope, false);
+
+	PHP_SCOPE_TABLE_TYPE *scope_map = (PHP_SCOPE_TABLE_TYPE *)m_global_scope;
+	for(PHP_SCOPE_TABLE_TYPE::iterator i = scope_map->begin(); i != scope_map->end(); i++) {
+		if ( i->second->type != PHP_SCOPE_FUNC ) {
+			continue;
+		}
+		PHP_SYN_FUNC_DECL_NODE *func_decl = i->second->func->func_decl;
+		if ( !func_decl->is_native && func_decl->scope ) {
+			TakeScopeSnapshot(func_decl->scope, true);
+		}
+	}
+}
+
+void CPhPLibContext::TakeScopeSnapshot(PHP_SCOPE_TABLE scope, bool statics_only)
+{
+	PHP_SCOPE_TABLE_TYPE *scope_map = (PHP_SCOPE_TABLE_TYPE *)scope;
+	for(PHP_SCOPE_TABLE_TYPE::iterator i = scope_map->begin(); i != scope_map->end(); i++) {
+		PHP_SCOPE_ITEM *si = i->second;
+		if ( si->type != PHP_SCOPE_VAR ) {
+			continue;
+		}
+		if ( statics_only && !(si->var->flags & PHP_VARFLAG_STATIC) ) {
+			continue;
+		}
+		VAR_SNAPSHOT &snapshot = m_var_snapshot[si];
+		// keep original node alive, even if script replaces it by reference
+		snapshot.var = si->var;
+		snapshot.var->ref_count++;
+		snapshot.flags = si->var->flags;
+		snapshot.value.type = PHP_VAL_NONE;
+		value_value_assign(&snapshot.value, &si->var->value);
+	}
+}
+
+void CPhPLibContext::Reset()
+{
+	for(std::map<PHP_SCOPE_ITEM *, VAR_SNAPSHOT>::iterator i = m_var_snapshot.begin();
+		i != m_var_snapshot.end(); i++) {
+		PHP_SCOPE_ITEM *si = i->first;
+		VAR_SNAPSHOT &snapshot = i->second;
+		if ( si->var != snapshot.var ) {
+			var_node_free(si->var);
+			si->var = snapshot.var;
+			si->var->ref_count++;
+		}
+		value_value_assign(&si->var->value, &snapshot.value);
+		si->var->flags = snapshot.flags;
+	}
+
+	// vars created during execution, like session vars, are not in
+	// snapshot, but must not survive until next run either
+	PHP_SCOPE_TABLE_TYPE *scope_map = (PHP_SCOPE_TABLE_TYPE *)m_global_scope;
+	for(PHP_SCOPE_TABLE_TYPE::iterator i = scope_map->begin(); i != scope_map->end(); i++) {
+		if ( (i->second->type == PHP_SCOPE_VAR) && !m_var_snapshot.count(i->second) ) {
+			value_value_free(&i->second->var->value);
+			i->second->var->value.type = PHP_VAL_NONE;
+		}
+	}
 }
 
 CPhPLibContext *CPhPLibContext::g_curr_context = 0;
@@ -616,9 +713,11 @@ void CPhPLibContext::Print(const char *str)
 }
 
 
-CPhpFilter::CPhpFilter(CWebServerBase *server, CSession *sess,
-			const char *file, CWriteStrBuffer *buff)
+CPhpTemplate::CPhpTemplate(CWebServerBase *server, const char *file, time_t mtime)
 {
+	m_mtime = mtime;
+	m_ok = false;
+
 	FILE *f = fopen(file, "r");
 	if ( !f ) {
 		printf("ERROR: php can not open source file [%s]\n", file);
@@ -626,6 +725,7 @@ CPhpFilter::CPhpFilter(CWebServerBase *server, CSession *sess,
 	}
 	if ( fseek(f, 0, SEEK_END) != 0 ) {
 		printf("ERROR: fseek failed on php source file [%s]\n", file); 
+		fclose(f);
 		return;
 	}
 	int size = ftell(f);
@@ -640,21 +740,49 @@ CPhpFilter::CPhpFilter(CWebServerBase *server, CSession *sess,
 	while ( strlen(scan_ptr) ) {
 		scan_ptr = strstr(scan_ptr, "<?php");
 		if ( !scan_ptr ) {
-			buff->Write(curr_code_end);
+			PHP_TEMPLATE_PART part = { curr_code_end, 0 };
+			m_parts.push_back(part);
 			break;
 		}
-		if ( scan_ptr != curr_code_end ) {
-			buff->Write(curr_code_end, scan_ptr - curr_code_end);
-		}
+		PHP_TEMPLATE_PART part = { std::string(curr_code_end, scan_ptr - curr_code_end), 0 };
 		curr_code_end = strstr(scan_ptr, "?>");
 		if ( !curr_code_end ) {
+			m_parts.push_back(part);
 			break;
 		}
 		curr_code_end += 2; // include "?>" in buffer
 
 		int len = curr_code_end - scan_ptr;
 
-		CPhPLibContext *context = new CPhPLibContext(server, scan_ptr, len);
+		part.m_context = new CPhPLibContext(server, scan_ptr, len);
+		m_parts.push_back(part);
+		
+		scan_ptr = curr_code_end;
+	}
+
+	delete [] buf;
+
+	m_ok = true;
+}
+
+CPhpTemplate::~CPhpTemplate()
+{
+	for(std::list<PHP_TEMPLATE_PART>::iterator i = m_parts.begin(); i != m_parts.end(); i++) {
+		delete i->m_context;
+	}
+}
+
+void CPhpTemplate::Execute(CSession *sess, CWriteStrBuffer *buff)
+{
+	for(std::list<PHP_TEMPLATE_PART>::iterator i = m_parts.begin(); i != m_parts.end(); i++) {
+		if ( !i->m_text.empty() ) {
+			buff->Write(i->m_text.c_str(), i->m_text.length());
+		}
+		CPhPLibContext *context = i->m_context;
+		if ( !context ) {
+			continue;
+		}
+		context->SetContext();
 
 #ifndef PHP_STANDALONE_EN
 		load_session_vars("HTTP_GET_VARS", sess->m_get_vars);
@@ -667,16 +795,21 @@ CPhpFilter::CPhpFilter(CWebServerBase *server, CSession *sess,
 		save_session_vars(sess->m_vars);
 #endif
 
-		delete context;
-		
-		scan_ptr = curr_code_end;
+		context->Reset();
 	}
 
 #ifndef PHP_STANDALONE_EN
 	sess->m_get_vars.clear();
 #endif
+}
 
-	delete [] buf;
+CPhpFilter::CPhpFilter(CWebServerBase *server, CSession *sess,
+			const char *file, CWriteStrBuffer *buff)
+{
+	CPhpTemplate php_template(server, file);
+	if ( php_template.IsOk() ) {
+		php_template.Execute(sess, buff);
+	}
 }
 
 
@@ -55,10 +55,22 @@ class CSession;
 class CPhPLibContext {
 		PHP_SYN_NODE *m_syn_tree_top;
 		PHP_SCOPE_TABLE m_global_scope;
+		PHP_SCOPE_STACK m_scope_stack;
 		
 		CWriteStrBuffer *m_curr_str_buffer;
 
 		CWebServerBase *m_server;
+
+		// state of variables right after parsing, restored by Reset()
+		struct VAR_SNAPSHOT {
+			PHP_VAR_NODE *var;
+			int flags;
+			PHP_VALUE_NODE value;
+		};
+		std::map<PHP_SCOPE_ITEM *, VAR_SNAPSHOT> m_var_snapshot;
+
+		void TakeSnapshot();
+		void TakeScopeSnapshot(PHP_SCOPE_TABLE scope, bool statics_only);
 	public:
 		// parse file and take a "snapshot" of global vars
 		CPhPLibContext(CWebServerBase *server, const char *file);
@@ -68,6 +80,9 @@ class CPhPLibContext {
 		// init global vars, so parser/execution can start
 		void SetContext();
 		void Execute(CWriteStrBuffer *);
+		// bring variables back to their parsed state, so same syntax
+		// tree can be executed again
+		void Reset();
 		
 #ifdef __GNUC__
 		static void Printf(const char *str, ...)  __attribute__ ((__format__ (__printf__, 1, 2)));
@@ -83,6 +98,33 @@ class CPhPLibContext {
 #endif
 };
 
+/*
+ * Page with all it's php blocks parsed: text between blocks is kept
+ * as is, and each block is executed in it's own context, like before.
+ * Parsing is costly, so webserver keeps these around until source file
+ * is modified.
+ */
+class CPhpTemplate {
+		struct PHP_TEMPLATE_PART {
+			// text before php block
+			std::string m_text;
+			// 0 for text after last block
+			CPhPLibContext *m_context;
+		};
+		std::list<PHP_TEMPLATE_PART> m_parts;
+
+		time_t m_mtime;
+		bool m_ok;
+	public:
+		CPhpTemplate(CWebServerBase *server, const char *file, time_t mtime = 0);
+		~CPhpTemplate();
+
+		bool IsOk() const { return m_ok; }
+		time_t GetModificationTime() const { return m_mtime; }
+
+		void Execute(CSession *sess, CWriteStrBuffer *buff);
+};
+
 class CPhpFilter {
 	public:
 		CPhpFilter(CWebServerBase *server, CSession *sess,
@@ -0,0 +1,111 @@
+//								-*- C++ -*-
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+
+#include <muleunit/test.h>
+#include <MemFile.h>
+#include <Tag.h>
+#include <tags/FileTags.h>
+#include <ScopedPtr.h>
+
+#include <wx/stopwatch.h>
+
+using namespace muleunit;
+
+
+DECLARE_SIMPLE(CTag)
+
+TEST_M(CTag, KadKeywordResults, wxT("Kad: Parse a stream of keyword search results"))
+{
+	// Builds the payload of KADEMLIA2_SEARCH_RES packets answering a keyword
+	// search, with the tags a current eMule publishes for audio files, and
+	// parses it the way CKademliaUDPListener::ProcessSearchResponse does:
+	// once with heap allocated tags and once with a per-packet arena.
+	const unsigned results = 300;
+	const unsigned packets = 200;
+
+	byte answer[16] = { 0 };
+
+	CMemFile packet;
+	// Search target
+	packet.WriteHash(CMD4Hash(answer));
+	packet.WriteUInt16(results);
+	for (unsigned i = 0; i < results; ++i) {
+		for (unsigned j = 0; j < sizeof(answer); ++j) {
+			answer[j] = (byte)(i * 31 + j);
+		}
+		packet.WriteHash(CMD4Hash(answer));
+
+		wxString artist = wxString::Format(wxT("Artist %u"), i % 40);
+		wxString title = wxString::Format(wxT("Some rather long song title number %u"), i);
+		TagPtrList tags;
+		tags.push_back(new CTagString(TAG_FILENAME, artist + wxT(" - ") + title + wxT(" (Live) [320kbps].mp3")));
+		tags.push_back(new CTagVarInt(TAG_FILESIZE, 3000000 + i * 7919));
+		tags.push_back(new CTagVarInt(TAG_SOURCES, 1 + i % 300));
+		tags.push_back(new CTagString(TAG_FILETYPE, ED2KFTSTR_AUDIO));
+		tags.push_back(new CTagString(TAG_FILEFORMAT, wxT("mp3")));
+		tags.push_back(new CTagString(TAG_MEDIA_ARTIST, artist));
+		tags.push_back(new CTagString(TAG_MEDIA_TITLE, title));
+		tags.push_back(new CTagVarInt(TAG_MEDIA_LENGTH, 120 + i % 300));
+		tags.push_back(new CTagVarInt(TAG_MEDIA_BITRATE, 320));
+		tags.push_back(new CTagString(TAG_MEDIA_CODEC, wxT("mp3")));
+		tags.push_back(new CTagVarInt(TAG_PUBLISHINFO, 0x01010000 + i));
+		packet.WriteTagPtrList(tags);
+		deleteTagPtrListEntries(&tags);
+	}
+
+	uint64 heapSizes = 0;
+	wxStopWatch timer;
+	for (unsigned p = 0; p < packets; ++p) {
+		packet.Seek(16, wxFromStart);
+		for (unsigned count = packet.ReadUInt16(); count > 0; --count) {
+			packet.ReadHash();
+			CScopedContainer<TagPtrList> tags;
+			packet.ReadTagPtrList(tags.get(), true);
+			heapSizes += tags.get()->size();
+		}
+	}
+	long elapsed = timer.Time();
+	Print(wxString::Format(wxT("\t\tHeap:  %.0f ns/tag"), elapsed * 1e6 / (heapSizes ? heapSizes : 1)));
+
+	uint64 arenaSizes = 0;
+	timer.Start();
+	for (unsigned p = 0; p < packets; ++p) {
+		CTagArena arena;
+		TagPtrList tags;
+		packet.Seek(16, wxFromStart);
+		for (unsigned count = packet.ReadUInt16(); count > 0; --count) {
+			packet.ReadHash();
+			packet.ReadTagPtrList(&tags, true, &arena);
+			arenaSizes += tags.size();
+			tags.clear();
+			arena.Clear();
+		}
+	}
+	elapsed = timer.Time();
+	Print(wxString::Format(wxT("\t\tArena: %.0f ns/tag"), elapsed * 1e6 / (arenaSizes ? arenaSizes : 1)));
+
+	ASSERT_EQUALS(11u * results * packets, heapSizes);
+	ASSERT_EQUALS(heapSizes, arenaSizes);
+}
@@ -8,6 +8,7 @@
 #include "MD4Hash.h"
 #include "amule.h"
 #include "Packet.h"
+#include "ScopedPtr.h"
 #include <vector>
 
 using namespace muleunit;
@@ -712,3 +713,86 @@ TEST_M(CTag, Ed2kBlob2, wxT("Ed2k: Read/Write BLOB - string tagname"))
 		CheckTagValue( valid_tag_value( blob ), &tag);
 	}
 }
+
+TEST_M(CTag, Ed2kReadIntOrSkip, wxT("Ed2k: Read integers and skip other tags without creating them"))
+{
+	byte packet[] = {
+		/*Tag1*/ 0x82, FT_FILENAME, 0x03, 0x00, 'a', 'b', 'c',
+		/*Tag2*/ 0x07, 0x02, 0x00, 'A', 'A', 0x04, 0x00, 0x00, 0x00,
+		0x01, 0x02, 0x03, 0x04,
+		/*Tag3*/ 0x83, FT_FILESIZE, 0x78, 0x56, 0x34, 0x12,
+		/*Tag4*/ 0x94, FT_FLAGS, 'x', 'y', 'z', 'w',
+		/*Tag5*/ 0x89, FT_ULPRIORITY, 0x05,
+	};
+
+	CMemFile buf(packet, sizeof (packet));
+	uint8 name = 0;
+	uint64 value = 0;
+
+	ASSERT_FALSE(CTag::ReadIntOrSkip(buf, name, value));
+	ASSERT_EQUALS(FT_FILENAME, name);
+	ASSERT_FALSE(CTag::ReadIntOrSkip(buf, name, value));
+	ASSERT_EQUALS(0, name);
+	ASSERT_TRUE(CTag::ReadIntOrSkip(buf, name, value));
+	ASSERT_EQUALS(FT_FILESIZE, name);
+	ASSERT_EQUALS(0x12345678u, value);
+	ASSERT_FALSE(CTag::ReadIntOrSkip(buf, name, value));
+	ASSERT_EQUALS(FT_FLAGS, name);
+	ASSERT_TRUE(CTag::ReadIntOrSkip(buf, name, value));
+	ASSERT_EQUALS(FT_ULPRIORITY, name);
+	ASSERT_EQUALS(5u, value);
+	ASSERT_EQUALS(sizeof (packet), buf.GetPosition());
+}
+
+TEST_M(CTag, Ed2kReadIntOrSkipMalformed, wxT("Ed2k: Skipping a BLOB longer than the data fails"))
+{
+	byte packet[] = {
+		/*Tag1*/ 0x87, 0xFF, 0x05, 0x00, 0x00, 0x00,
+		0x01, 0x02, 0x03, 0x04,
+	};
+
+	CMemFile buf(packet, sizeof (packet));
+	uint8 name = 0;
+	uint64 value = 0;
+
+	ASSERT_RAISES(CInvalidPacket, CTag::ReadIntOrSkip(buf, name, value));
+}
+
+TEST_M(CTag, KadArena, wxT("Kad: Tags read into an arena equal the heap allocated ones"))
+{
+	const byte hash[16] = { 0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF, 0x01, 0x23, 0x45, 0x67, 0x89, 0xAB, 0xCD, 0xEF };
+
+	CMemFile buf;
+	TagPtrList written;
+	written.push_back(new CTagString(TAG_FILENAME, wxT("Some Artist - Some Title.mp3")));
+	written.push_back(new CTagVarInt(TAG_FILESIZE, 4573214));
+	written.push_back(new CTagString(wxT("bitrate"), wxT("192")));
+	written.push_back(new CTagHash(wxT("hash"), CMD4Hash(hash)));
+	written.push_back(new CTagFloat(TAG_FILERATING, 3.5f));
+	buf.WriteTagPtrList(written);
+	deleteTagPtrListEntries(&written);
+
+	CScopedContainer<TagPtrList> heap;
+	buf.Seek(0, wxFromStart);
+	buf.ReadTagPtrList(heap.get());
+
+	CTagArena arena;
+	for (int pass = 0; pass < 2; ++pass) {
+		CONTEXT(wxString::Format(wxT("Pass %d"), pass));
+		TagPtrList tags;
+		buf.Seek(0, wxFromStart);
+		buf.ReadTagPtrList(&tags, false, &arena);
+		ASSERT_EQUALS(heap.get()->size(), tags.size());
+
+		TagPtrList::const_iterator it = heap.get()->begin();
+		for (TagPtrList::const_iterator it2 = tags.begin(); it2 != tags.end(); ++it, ++it2) {
+			ASSERT_EQUALS((*it)->GetFullInfo(), (*it2)->GetFullInfo());
+			// Names are interned
+			ASSERT_TRUE(&(*it)->GetName() == &(*it2)->GetName());
+
+			CScopedPtr<CTag> clone((*it2)->CloneTag());
+			ASSERT_EQUALS((*it)->GetFullInfo(), clone->GetFullInfo());
+		}
+		arena.Clear();
+	}
+}
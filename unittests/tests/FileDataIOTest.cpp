@@ -728,6 +728,68 @@ TEST(CMemFile, SetLength)
 }
 
 
+TEST(CMemFile, Reserve)
+{
+	CMemFile file;
+
+	file.Reserve(100);
+	ASSERT_EQUALS(0u, file.GetLength());
+
+	byte* buffer = file.GetRawBuffer();
+	for (size_t i = 0; i < 100; ++i) {
+		file.WriteUInt8(i);
+	}
+
+	// No reallocation within the reserved size
+	ASSERT_TRUE(buffer == file.GetRawBuffer());
+	ASSERT_EQUALS(100u, file.GetLength());
+	
+	file.Seek(0, wxFromStart);
+	for (size_t i = 0; i < 100; ++i) {
+		ASSERT_EQUALS(i, file.ReadUInt8());
+	}
+}
+
+
+TEST(CMemFile, DetachBuffer)
+{
+	{
+		CMemFile file;
+		for (size_t i = 0; i < 4096; ++i) {
+			file.WriteUInt8(i & 0xFF);
+		}
+
+		byte* buffer = file.DetachBuffer();
+		ASSERT_TRUE(buffer != NULL);
+		ASSERT_EQUALS(0u, file.GetLength());
+		for (size_t i = 0; i < 4096; ++i) {
+			ASSERT_EQUALS(i & 0xFF, buffer[CMemFile::HeaderRoom + i]);
+		}
+		delete [] buffer;
+
+		// The file is still usable afterwards
+		file.WriteUInt32(0x12345678);
+		ASSERT_EQUALS(4u, file.GetLength());
+	}
+
+	{
+		// Empty files still yield room for a header
+		CMemFile file;
+		byte* buffer = file.DetachBuffer();
+		ASSERT_TRUE(buffer != NULL);
+		delete [] buffer;
+	}
+
+	{
+		// Attached buffers are not owned and cannot be detached
+		byte arr[10];
+		CMemFile file(arr, sizeof(arr));
+		ASSERT_TRUE(file.DetachBuffer() == NULL);
+		ASSERT_EQUALS(sizeof(arr), file.GetLength());
+	}
+}
+
+
 /////////////////////////////////////////////////////////////////////
 // CFile specific tests
 
@@ -0,0 +1,93 @@
+//								-*- C++ -*-
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+
+#include <muleunit/test.h>
+#include <IPFilterTable.h>
+
+#include <wx/stopwatch.h>
+
+#include <algorithm>
+#include <stdlib.h>
+#include <vector>
+
+using namespace muleunit;
+
+
+DECLARE_SIMPLE(IPFilterTable)
+
+
+TEST(IPFilterTable, Lookup)
+{
+	// Looks up random IPs in a blocklist of the size of the common public
+	// lists, once with the table and once with a binary search over the
+	// sorted range starts, which is what CIPFilter did before the table.
+	// Both searches must return the same range index for every address.
+	std::vector<uint32> starts;
+	std::vector<uint32> ends;
+	uint32 next = 0;
+	srand(4321);
+	while (starts.size() < 300000) {
+		uint32 gap = rand() % 0x3000;
+		uint32 length = rand() % 0x800;
+		if (0xffffffffu - next < gap + length) {
+			break;
+		}
+		starts.push_back(next + gap);
+		ends.push_back(next + gap + length);
+		next += gap + length + 1;
+	}
+
+	CIPFilterTable table;
+	for (size_t i = 0; i < starts.size(); ++i) {
+		table.AddRange(starts[i], ends[i]);
+	}
+	table.Finish();
+
+	const unsigned count = 4000000;
+	std::vector<uint32> ips(count);
+	for (unsigned i = 0; i < count; ++i) {
+		ips[i] = ((uint32)rand() << 16) ^ (uint32)rand();
+	}
+
+	std::vector<int> expected(count);
+	wxStopWatch timer;
+	for (unsigned i = 0; i < count; ++i) {
+		std::vector<uint32>::const_iterator it = std::upper_bound(starts.begin(), starts.end(), ips[i]);
+		int index = (int)(it - starts.begin()) - 1;
+		expected[i] = (index >= 0 && ips[i] <= ends[index]) ? index : -1;
+	}
+	long elapsed = timer.Time();
+	Print(wxString::Format(wxT("\t\tBinary search: %.0f ns/lookup"), elapsed * 1e6 / count));
+
+	std::vector<int> found(count);
+	timer.Start();
+	for (unsigned i = 0; i < count; ++i) {
+		found[i] = table.Find(ips[i]);
+	}
+	elapsed = timer.Time();
+	Print(wxString::Format(wxT("\t\tIPFilterTable: %.0f ns/lookup"), elapsed * 1e6 / count));
+
+	ASSERT_TRUE(expected == found);
+}
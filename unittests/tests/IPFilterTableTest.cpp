@@ -0,0 +1,144 @@
+//								-*- C++ -*-
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+
+#include <muleunit/test.h>
+#include <IPFilterTable.h>
+
+#include <stdlib.h>
+
+using namespace muleunit;
+
+
+DECLARE_SIMPLE(IPFilterTable)
+
+
+TEST(IPFilterTable, Empty)
+{
+	CIPFilterTable table;
+	table.Finish();
+
+	ASSERT_EQUALS(0u, table.GetRangeCount());
+	ASSERT_EQUALS(-1, table.Find(0));
+	ASSERT_EQUALS(-1, table.Find(0x7f000001));
+	ASSERT_EQUALS(-1, table.Find(0xffffffff));
+}
+
+
+TEST(IPFilterTable, Boundaries)
+{
+	CIPFilterTable table;
+	table.AddRange(0x00000000, 0x00000000);
+	// Spans several /16 networks without starting in them.
+	table.AddRange(0x0a00fff0, 0x0a05000f);
+	table.AddRange(0x0a050010, 0x0a050010);
+	table.AddRange(0xc0a80000, 0xc0a8ffff);
+	table.AddRange(0xfffffff0, 0xffffffff);
+	table.Finish();
+
+	ASSERT_EQUALS(5u, table.GetRangeCount());
+
+	ASSERT_EQUALS(0, table.Find(0x00000000));
+	ASSERT_EQUALS(-1, table.Find(0x00000001));
+
+	ASSERT_EQUALS(-1, table.Find(0x0a00ffef));
+	ASSERT_EQUALS(1, table.Find(0x0a00fff0));
+	ASSERT_EQUALS(1, table.Find(0x0a010000));
+	ASSERT_EQUALS(1, table.Find(0x0a03abcd));
+	ASSERT_EQUALS(1, table.Find(0x0a05000f));
+	ASSERT_EQUALS(2, table.Find(0x0a050010));
+	ASSERT_EQUALS(-1, table.Find(0x0a050011));
+
+	ASSERT_EQUALS(-1, table.Find(0xc0a7ffff));
+	ASSERT_EQUALS(3, table.Find(0xc0a80000));
+	ASSERT_EQUALS(3, table.Find(0xc0a8ffff));
+	ASSERT_EQUALS(-1, table.Find(0xc0a90000));
+
+	ASSERT_EQUALS(-1, table.Find(0xffffffef));
+	ASSERT_EQUALS(4, table.Find(0xfffffff0));
+	ASSERT_EQUALS(4, table.Find(0xffffffff));
+}
+
+
+TEST(IPFilterTable, Names)
+{
+	CIPFilterTable table;
+	std::string name("Test range");
+	table.AddRange(0x01000000, 0x01ffffff);
+	table.AddRange(0x02000000, 0x02ffffff, &name);
+	table.Finish();
+
+	ASSERT_TRUE(name.empty());
+	ASSERT_TRUE(table.GetName(0).empty());
+	ASSERT_TRUE(table.GetName(1) == "Test range");
+	ASSERT_TRUE(table.GetName(-1).empty());
+}
+
+
+TEST(IPFilterTable, RandomRanges)
+{
+	// Compare against a linear search over many small and some huge ranges.
+	std::vector<std::pair<uint32, uint32> > ranges;
+	uint32 next = 0;
+	srand(1234);
+	while (ranges.size() < 5000) {
+		uint32 gap = rand() % 0x40000;
+		uint32 length = (rand() % 10) ? rand() % 0x1000 : rand() % 0x1000000;
+		if (0xffffffffu - next < gap + length) {
+			break;
+		}
+		ranges.push_back(std::make_pair(next + gap, next + gap + length));
+		next += gap + length + 1;
+	}
+
+	CIPFilterTable table;
+	for (size_t i = 0; i < ranges.size(); ++i) {
+		table.AddRange(ranges[i].first, ranges[i].second);
+	}
+	table.Finish();
+
+	ASSERT_EQUALS((uint32)ranges.size(), table.GetRangeCount());
+
+	for (int i = 0; i < 100000; ++i) {
+		uint32 ip;
+		if (i % 2) {
+			// Close to a range boundary
+			const std::pair<uint32, uint32>& range = ranges[rand() % ranges.size()];
+			ip = ((i % 4) == 1 ? range.first : range.second) + (rand() % 3) - 1;
+		} else {
+			ip = ((uint32)rand() << 16) ^ (uint32)rand();
+		}
+
+		int expected = -1;
+		for (size_t j = 0; j < ranges.size(); ++j) {
+			if (ranges[j].first <= ip && ip <= ranges[j].second) {
+				expected = (int)j;
+				break;
+			}
+		}
+
+		ASSERT_EQUALS(expected, table.Find(ip));
+	}
+}
+
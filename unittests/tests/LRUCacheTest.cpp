@@ -0,0 +1,132 @@
+//								-*- C++ -*-
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+
+#include <muleunit/test.h>
+#include <LRUCache.h>
+
+#include <map>
+#include <stdlib.h>
+
+using namespace muleunit;
+
+
+DECLARE_SIMPLE(LRUCache)
+
+
+TEST(LRUCache, FindAndInsert)
+{
+	CLRUCache<int, int> cache(3);
+	ASSERT_EQUALS(0u, cache.GetCount());
+	ASSERT_TRUE(cache.Find(1) == NULL);
+
+	ASSERT_EQUALS(10, cache.Insert(1, 10));
+	ASSERT_EQUALS(1u, cache.GetCount());
+	ASSERT_TRUE(cache.Find(1) != NULL);
+	ASSERT_EQUALS(10, *cache.Find(1));
+
+	// Replacing keeps a single entry
+	cache.Insert(1, 11);
+	ASSERT_EQUALS(1u, cache.GetCount());
+	ASSERT_EQUALS(11, *cache.Find(1));
+
+	// Values can be changed through the returned pointer
+	*cache.Find(1) = 12;
+	ASSERT_EQUALS(12, *cache.Find(1));
+
+	cache.Clear();
+	ASSERT_EQUALS(0u, cache.GetCount());
+	ASSERT_TRUE(cache.Find(1) == NULL);
+}
+
+
+TEST(LRUCache, Eviction)
+{
+	CLRUCache<int, int> cache(3);
+	cache.Insert(1, 10);
+	cache.Insert(2, 20);
+	cache.Insert(3, 30);
+
+	// Full, 1 is the least recently used
+	cache.Insert(4, 40);
+	ASSERT_EQUALS(3u, cache.GetCount());
+	ASSERT_TRUE(cache.Find(1) == NULL);
+
+	// Finding 2 makes 3 the least recently used
+	ASSERT_TRUE(cache.Find(2) != NULL);
+	cache.Insert(5, 50);
+	ASSERT_TRUE(cache.Find(3) == NULL);
+	ASSERT_EQUALS(20, *cache.Find(2));
+
+	// Replacing 4 makes 5 the least recently used
+	cache.Insert(4, 41);
+	cache.Insert(6, 60);
+	ASSERT_EQUALS(3u, cache.GetCount());
+	ASSERT_TRUE(cache.Find(5) == NULL);
+	ASSERT_EQUALS(41, *cache.Find(4));
+	ASSERT_EQUALS(20, *cache.Find(2));
+	ASSERT_EQUALS(60, *cache.Find(6));
+}
+
+
+TEST(LRUCache, Random)
+{
+	// Compares against a map with use counters as timestamps
+	const size_t maxEntries = 50;
+	CLRUCache<int, int> cache(maxEntries);
+	std::map<int, std::pair<int, int> > model;	// key -> (value, last use)
+
+	srand(4096);
+	for (int use = 0; use < 100000; ++use) {
+		int key = rand() % 150;
+		CONTEXT(wxString::Format(wxT("Use %d, key %d"), use, key));
+
+		std::map<int, std::pair<int, int> >::iterator it = model.find(key);
+		if (rand() % 2) {
+			int* value = cache.Find(key);
+			if (it == model.end()) {
+				ASSERT_TRUE(value == NULL);
+			} else {
+				ASSERT_TRUE(value != NULL);
+				ASSERT_EQUALS(it->second.first, *value);
+				it->second.second = use;
+			}
+		} else {
+			int value = rand();
+			if (it == model.end() && model.size() == maxEntries) {
+				std::map<int, std::pair<int, int> >::iterator oldest = model.begin();
+				for (it = model.begin(); it != model.end(); ++it) {
+					if (it->second.second < oldest->second.second) {
+						oldest = it;
+					}
+				}
+				model.erase(oldest);
+			}
+			model[key] = std::make_pair(value, use);
+			ASSERT_EQUALS(value, cache.Insert(key, value));
+		}
+
+		ASSERT_EQUALS(model.size(), cache.GetCount());
+	}
+}
@@ -0,0 +1,188 @@
+//								-*- C++ -*-
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+
+#include <muleunit/test.h>
+#include <RLE.h>
+
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace muleunit;
+
+
+DECLARE_SIMPLE(RLE)
+
+
+namespace {
+
+uint64 RandomValue(uint64 maxValue)
+{
+	uint64 value = (uint64)rand() << 62 ^ (uint64)rand() << 31 ^ rand();
+	return maxValue == ~(uint64)0 ? value : value % (maxValue + 1);
+}
+
+// Random data with long runs, like part availability or gap lists
+template <typename T>
+void Randomize(std::vector<T>& data, size_t size, T maxValue)
+{
+	data.resize(size);
+	size_t i = 0;
+	while (i < size) {
+		T value = (T)RandomValue(maxValue);
+		// Mostly short runs, sometimes longer than an RLE sequence
+		size_t run = (rand() % 4) ? rand() % 4 + 1 : rand() % 600 + 1;
+		for (; run > 0 && i < size; --run) {
+			data[i++] = value;
+		}
+	}
+}
+
+// Changes some values, so the differential encoding has something to do
+template <typename T>
+void Mutate(std::vector<T>& data, T maxValue)
+{
+	for (int n = rand() % 5; n > 0 && !data.empty(); --n) {
+		size_t start = rand() % data.size();
+		size_t end = std::min(data.size(), start + rand() % 40 + 1);
+		T value = (T)RandomValue(maxValue);
+		for (size_t i = start; i < end; ++i) {
+			data[i] = value;
+		}
+	}
+}
+
+size_t RandomSize()
+{
+	switch (rand() % 4) {
+		case 0:		return rand() % 10;
+		case 1:		return rand() % 100;
+		default:	return rand() % 2000;
+	}
+}
+
+}
+
+
+TEST(RLE, RoundTripParts)
+{
+	// Part availability, as sent for every download. The values are clipped
+	// to 0xff by the encoder.
+	srand(20201);
+	for (int stream = 0; stream < 50; ++stream) {
+		RLE_Data encoder;
+		RLE_Data decoder;
+		ArrayOfUInts16 data;
+		Randomize<uint16>(data, RandomSize(), 300);
+
+		for (int update = 0; update < 40; ++update) {
+			CONTEXT(wxString::Format(wxT("Stream %d, update %d, size %u"), stream, update, (unsigned)data.size()));
+
+			int outlen = -1;
+			bool changed = false;
+			const uint8 *encoded = encoder.Encode(data, outlen, changed);
+			if (changed) {
+				decoder.Decode(encoded, outlen);
+			} else {
+				ASSERT_TRUE(encoded == NULL);
+			}
+			delete[] encoded;
+
+			ASSERT_EQUALS((int)data.size(), decoder.Size());
+			for (size_t i = 0; i < data.size(); ++i) {
+				ASSERT_EQUALS(std::min<uint16>(data[i], 0xff), decoder.Buffer()[i]);
+			}
+
+			switch (rand() % 6) {
+				case 0:		break;
+				case 1:		Randomize<uint16>(data, RandomSize(), 300); break;
+				default:	Mutate<uint16>(data, 300);
+			}
+		}
+	}
+}
+
+
+TEST(RLE, RoundTripGaps)
+{
+	// Gap lists, encoded byte plane by byte plane
+	srand(20202);
+	for (int stream = 0; stream < 50; ++stream) {
+		RLE_Data encoder;
+		RLE_Data decoder;
+		ArrayOfUInts64 data;
+		Randomize<uint64>(data, RandomSize() & ~1, (stream % 2) ? 0xffffffffffffffffULL : 0x3ffffffffULL);
+
+		for (int update = 0; update < 40; ++update) {
+			CONTEXT(wxString::Format(wxT("Stream %d, update %d, size %u"), stream, update, (unsigned)data.size()));
+
+			int outlen = -1;
+			bool changed = false;
+			const uint8 *encoded = encoder.Encode(data, outlen, changed);
+			ArrayOfUInts64 decoded;
+			if (changed) {
+				decoder.Decode(encoded, outlen, decoded);
+				ASSERT_TRUE(data == decoded);
+			} else {
+				ASSERT_TRUE(encoded == NULL);
+			}
+			delete[] encoded;
+
+			if (rand() % 6 == 1) {
+				Randomize<uint64>(data, RandomSize() & ~1, 0x3ffffffffULL);
+			} else {
+				Mutate<uint64>(data, 0x3ffffffffULL);
+			}
+		}
+	}
+}
+
+
+TEST(RLE, RoundTripNoDiff)
+{
+	// Without the differential mode every state is encoded on its own
+	srand(20203);
+	for (int i = 0; i < 500; ++i) {
+		CONTEXT(wxString::Format(wxT("Round %d"), i));
+
+		std::vector<uint8> data;
+		Randomize<uint8>(data, RandomSize(), 0xff);
+		ArrayOfUInts16 parts(data.begin(), data.end());
+
+		RLE_Data encoder(0, false);
+		RLE_Data decoder(0, false);
+		int outlen = -1;
+		bool changed = false;
+		const uint8 *encoded = encoder.Encode(parts, outlen, changed);
+		ASSERT_EQUALS(!data.empty(), changed);
+		// Worst case is a 50% growth
+		ASSERT_TRUE(outlen <= (int)(data.size() * 3 / 2 + 1));
+		decoder.Decode(encoded, outlen);
+		delete[] encoded;
+
+		ASSERT_EQUALS((int)data.size(), decoder.Size());
+		ASSERT_TRUE(data.empty() || memcmp(&data[0], decoder.Buffer(), data.size()) == 0);
+	}
+}
@@ -0,0 +1,146 @@
+//								-*- C++ -*-
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+
+#include <muleunit/test.h>
+#include <kademlia/routing/RoutingBin.h>
+#include <Statistics.h>
+
+#include <wx/stopwatch.h>
+
+#include <algorithm>
+#include <stdlib.h>
+#include <vector>
+
+using namespace muleunit;
+using namespace Kademlia;
+
+// Contact.cpp counts the nodes in the statistics, which aren't linked
+uint16_t CStatistics::s_kadNodesCur;
+
+
+DECLARE_SIMPLE(RoutingBin)
+
+
+namespace {
+
+CUInt128 RandomID()
+{
+	CUInt128 id;
+	for (unsigned i = 0; i < 4; ++i) {
+		id.Set32BitChunk(i, ((uint32_t)rand() << 16) ^ (uint32_t)rand());
+	}
+	return id;
+}
+
+// The closest contacts from a plain list, the way CRoutingBin found them
+// before it kept the contact fields in its entries.
+void GetClosestFromList(const ContactList& list, const CUInt128& target, uint32_t maxRequired, ContactMap* result)
+{
+	for (ContactList::const_iterator it = list.begin(); it != list.end(); ++it) {
+		if ((*it)->GetType() <= 3 && (*it)->IsIPVerified()) {
+			(*result)[(*it)->GetClientID() ^ target] = *it;
+		}
+	}
+	while (result->size() > maxRequired) {
+		result->erase(--result->end());
+	}
+}
+
+}
+
+
+TEST(RoutingBin, Closest)
+{
+	// Asks full bins for the contacts closest to random targets, once
+	// through the bins and once by scanning lists of the same contacts.
+	// The contacts are allocated in random order, as they are added over
+	// time in the client, so that the lists don't get an unfair cache
+	// advantage. Only the number of contacts found is kept while timing;
+	// the results are compared query by query afterwards.
+	const uint32_t binCount = 2000;
+	std::vector<uint32_t> order(binCount * K);
+	for (uint32_t i = 0; i < order.size(); ++i) {
+		order[i] = i;
+	}
+	srand(1618);
+	for (uint32_t i = order.size() - 1; i > 0; --i) {
+		std::swap(order[i], order[rand() % (i + 1)]);
+	}
+
+	std::vector<CRoutingBin*> bins(binCount);
+	std::vector<ContactList> lists(binCount);
+	for (uint32_t i = 0; i < binCount; ++i) {
+		bins[i] = new CRoutingBin;
+	}
+	for (uint32_t i = 0; i < order.size(); ++i) {
+		const uint32_t n = order[i];
+		// A public IP in a /24 of its own
+		CContact* contact = new CContact(RandomID(), 0x50000001 + (n << 8), 4000 + n, 5000 + n, 8, CKadUDPKey(0), n % 4 != 0, CUInt128((uint32_t)0));
+		uint32_t bin = n % binCount;
+		ASSERT_TRUE(bins[bin]->AddContact(contact));
+		lists[bin].push_back(contact);
+	}
+
+	const unsigned count = 400000;
+	const uint32_t maxRequired = 4;
+	std::vector<CUInt128> targets(count);
+	for (unsigned i = 0; i < count; ++i) {
+		targets[i] = RandomID();
+	}
+
+	uint64_t listFound = 0;
+	wxStopWatch timer;
+	for (unsigned i = 0; i < count; ++i) {
+		ContactMap result;
+		GetClosestFromList(lists[i % binCount], targets[i], maxRequired, &result);
+		listFound += result.size();
+	}
+	long elapsed = timer.Time();
+	Print(wxString::Format(wxT("\t\tContact lists: %.0f ns/query"), elapsed * 1e6 / count));
+
+	uint64_t binFound = 0;
+	timer.Start();
+	for (unsigned i = 0; i < count; ++i) {
+		ContactMap result;
+		bins[i % binCount]->GetClosestTo(3, targets[i], maxRequired, &result);
+		binFound += result.size();
+	}
+	elapsed = timer.Time();
+	Print(wxString::Format(wxT("\t\tRoutingBin: %.0f ns/query"), elapsed * 1e6 / count));
+
+	ASSERT_EQUALS(listFound, binFound);
+	for (unsigned i = 0; i < count; ++i) {
+		ContactMap expected;
+		ContactMap found;
+		GetClosestFromList(lists[i % binCount], targets[i], maxRequired, &expected);
+		bins[i % binCount]->GetClosestTo(3, targets[i], maxRequired, &found);
+		CONTEXT(wxString::Format(wxT("Query %u"), i));
+		ASSERT_TRUE(expected == found);
+	}
+
+	for (uint32_t i = 0; i < binCount; ++i) {
+		delete bins[i];
+	}
+}
@@ -0,0 +1,170 @@
+//								-*- C++ -*-
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+
+#include <muleunit/test.h>
+#include <kademlia/routing/RoutingBin.h>
+#include <Statistics.h>
+
+#include <map>
+#include <stdlib.h>
+
+using namespace muleunit;
+using namespace Kademlia;
+
+// Contact.cpp counts the nodes in the statistics, which aren't linked
+uint16_t CStatistics::s_kadNodesCur;
+
+
+DECLARE_SIMPLE(RoutingBin)
+
+
+namespace {
+
+CUInt128 RandomID()
+{
+	CUInt128 id;
+	for (unsigned i = 0; i < 4; ++i) {
+		id.Set32BitChunk(i, ((uint32_t)rand() << 16) ^ (uint32_t)rand());
+	}
+	return id;
+}
+
+// A public IP in a /24 of its own
+uint32_t TestIP(uint32_t n)
+{
+	return 0x50000001 + (n << 8);
+}
+
+CContact* NewContact(uint32_t n, bool ipVerified)
+{
+	return new CContact(RandomID(), TestIP(n), 4000 + n, 5000 + n, 8, CKadUDPKey(0), ipVerified, CUInt128((uint32_t)0));
+}
+
+}
+
+
+TEST(RoutingBin, CountMap)
+{
+	// Compares against std::map. Few keys are used at a time, so the
+	// table stays small and runs of probed slots often wrap around its
+	// end. Erasing from those has to move entries back across the wrap.
+	CIPCountMap map(8);
+	std::map<uint32_t, uint32_t> expected;
+	const unsigned keyCount = 12;
+	uint32_t keys[keyCount];
+
+	srand(2718);
+	for (int round = 0; round < 2000; ++round) {
+		for (unsigned i = 0; i < keyCount; ++i) {
+			// IPs and subnets, as used by CRoutingBin
+			keys[i] = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+			if (rand() % 2) {
+				keys[i] &= 0xFFFFFF00;
+			}
+		}
+
+		for (int step = 0; step < 200; ++step) {
+			uint32_t key = keys[rand() % keyCount];
+			// Removals as often as inserts, to keep the table well filled
+			uint32_t count = (rand() % 2) ? 0 : rand() % 3 + 1;
+			// The last steps empty the table for the next round
+			if (step >= 200 - (int)keyCount) {
+				key = keys[200 - step - 1];
+				count = 0;
+			}
+			CONTEXT(wxString::Format(wxT("Round %d, step %d, key %x, count %u"), round, step, key, count));
+
+			map.Set(key, count);
+			if (count) {
+				expected[key] = count;
+			} else {
+				expected.erase(key);
+			}
+
+			ASSERT_EQUALS(expected.size(), map.GetCount());
+			for (unsigned i = 0; i < keyCount; ++i) {
+				std::map<uint32_t, uint32_t>::const_iterator it = expected.find(keys[i]);
+				ASSERT_EQUALS(it == expected.end() ? 0 : it->second, map.Get(keys[i]));
+			}
+		}
+		ASSERT_EQUALS(0u, map.GetCount());
+	}
+}
+
+
+TEST(RoutingBin, ContactChanges)
+{
+	// The bin keeps copies of the contact fields it searches by, which
+	// must follow the changes made to the contacts.
+	CRoutingBin bin;
+	CContact* first = NewContact(1, false);
+	CContact* second = NewContact(2, true);
+	ASSERT_TRUE(bin.AddContact(first));
+	ASSERT_TRUE(bin.AddContact(second));
+
+	const CUInt128 target((uint32_t)0);
+	ContactMap result;
+	bin.GetClosestTo(3, target, K, &result);
+	ASSERT_EQUALS(1u, result.size());
+	ASSERT_TRUE(result.begin()->second == second);
+
+	bin.SetAllContactsVerified();
+	bin.GetClosestTo(3, target, K, &result);
+	ASSERT_EQUALS(2u, result.size());
+
+	// Also marks the contact as alive, changing its type from 3 to 2
+	ASSERT_TRUE(bin.GetContact(TestIP(1), 5001, true) == first);
+	bin.SetTCPPort(TestIP(1), 4001, 6001);
+	ASSERT_TRUE(bin.GetContact(TestIP(1), 5001, true) == NULL);
+	ASSERT_TRUE(bin.GetContact(TestIP(1), 6001, true) == first);
+	bin.GetClosestTo(2, target, K, &result);
+	ASSERT_EQUALS(1u, result.size());
+	ASSERT_TRUE(result.begin()->second == first);
+
+	second->SetUDPPort(7002);
+	second->SetVersion(9);
+	second->UpdateType();
+	bin.ContactChanged(second);
+	ASSERT_TRUE(bin.GetContact(TestIP(2), 4002, false) == NULL);
+	ASSERT_TRUE(bin.GetContact(TestIP(2), 7002, false) == second);
+	ASSERT_TRUE(bin.GetRandomContact(2, 9) == second);
+	bin.GetClosestTo(2, target, K, &result);
+	ASSERT_EQUALS(2u, result.size());
+
+	uint32_t contacts = 0;
+	uint32_t filtered = 0;
+	bin.GetNumContacts(contacts, filtered, 9);
+	ASSERT_EQUALS(1u, contacts);
+	ASSERT_EQUALS(1u, filtered);
+
+	// A new IP has to be verified again
+	ASSERT_TRUE(bin.ChangeContactIPAddress(first, TestIP(3)));
+	ASSERT_TRUE(bin.GetContact(TestIP(1), 0, false) == NULL);
+	ASSERT_TRUE(bin.GetContact(TestIP(3), 0, false) == first);
+	bin.GetClosestTo(3, target, K, &result);
+	ASSERT_EQUALS(1u, result.size());
+	ASSERT_TRUE(result.begin()->second == second);
+}
+
@@ -0,0 +1,87 @@
+//								-*- C++ -*-
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#include <muleunit/test.h>
+#include <SHAKernels.h>
+#include <CryptoPP_Inc.h>
+
+#include <wx/stopwatch.h>
+
+#include <vector>
+
+using namespace muleunit;
+using namespace SHAKernels;
+
+
+DECLARE_SIMPLE(SHAKernels)
+
+
+TEST(SHAKernels, Throughput)
+{
+	// Hashes the AICH blocks of a few parts with every supported kernel and
+	// with CryptoPP, which is what the part hashing used before the kernels.
+	// CryptoPP gives the reference digests every kernel is checked against.
+	const uint32 length = 184320;
+	const unsigned count = 256;
+
+	std::vector<byte> data(length * count);
+	for (size_t i = 0; i < data.size(); ++i) {
+		data[i] = (byte)(i * 131 + i / 977);
+	}
+
+	std::vector<const byte*> buffers(count);
+	for (unsigned i = 0; i < count; ++i) {
+		buffers[i] = &data[i * length];
+	}
+
+	const double megabytes = (double)data.size() / (1024 * 1024);
+
+	std::vector<byte> expected(20 * count);
+	CryptoPP::SHA1 sha;
+	wxStopWatch timer;
+	for (unsigned i = 0; i < count; ++i) {
+		sha.CalculateDigest(&expected[20 * i], buffers[i], length);
+	}
+	long elapsed = timer.Time();
+	Print(wxString::Format(wxT("\t\tCryptoPP SHA1: %.0f MB/s"), megabytes * 1000 / (elapsed ? elapsed : 1)));
+
+	EKernel old = GetKernel();
+	for (int i = 0; i < KernelCount; ++i) {
+		EKernel kernel = (EKernel)i;
+		if (!SetKernel(kernel)) {
+			continue;
+		}
+
+		std::vector<byte> digests(20 * count);
+		timer.Start();
+		HashBuffers(&buffers[0], length, &digests[0], count);
+		elapsed = timer.Time();
+		Print(wxString::Format(wxT("\t\t%s: %.0f MB/s"), GetName(kernel).c_str(), megabytes * 1000 / (elapsed ? elapsed : 1)));
+
+		CONTEXT(GetName(kernel));
+		ASSERT_TRUE(expected == digests);
+	}
+
+	SetKernel(old);
+}
@@ -0,0 +1,160 @@
+//								-*- C++ -*-
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+#include <muleunit/test.h>
+#include <SHAKernels.h>
+
+#include <vector>
+#include <string.h>
+
+using namespace muleunit;
+using namespace SHAKernels;
+
+
+/**
+ * Hashes 'count' copies of the given buffer with the given kernel and
+ * returns the digests as hex strings, separated by spaces.
+ */
+static wxString HashCopies(EKernel kernel, const std::vector<byte>& data, unsigned count)
+{
+	// Every lane gets its own copy, so that mixing up lanes is noticed.
+	// The extra byte keeps the copies non-empty without being hashed.
+	std::vector<std::vector<byte> > copies(count, data);
+	std::vector<const byte*> buffers(count);
+	for (unsigned i = 0; i < count; ++i) {
+		copies[i].push_back(0);
+		buffers[i] = &copies[i][0];
+	}
+
+	std::vector<byte> digests(20 * count);
+	EKernel old = GetKernel();
+	SetKernel(kernel);
+	HashBuffers(&buffers[0], data.size(), &digests[0], count);
+	SetKernel(old);
+
+	wxString result;
+	for (unsigned i = 0; i < count; ++i) {
+		if (i) {
+			result += wxT(" ");
+		}
+		for (unsigned j = 0; j < 20; ++j) {
+			result += wxString::Format(wxT("%02x"), digests[20 * i + j]);
+		}
+	}
+
+	return result;
+}
+
+
+static wxString Repeat(const wxString& str, unsigned count)
+{
+	wxString result;
+	for (unsigned i = 0; i < count; ++i) {
+		result += (i ? wxT(" ") : wxT("")) + str;
+	}
+
+	return result;
+}
+
+
+static std::vector<byte> FromString(const char* str, unsigned repeat = 1)
+{
+	std::vector<byte> result;
+	for (unsigned i = 0; i < repeat; ++i) {
+		result.insert(result.end(), str, str + strlen(str));
+	}
+
+	return result;
+}
+
+
+DECLARE_SIMPLE(SHAKernels)
+
+
+TEST(SHAKernels, Support)
+{
+	ASSERT_TRUE(IsSupported(KernelGeneric));
+	ASSERT_EQUALS(1u, GetLanes(KernelGeneric));
+	ASSERT_TRUE(IsSupported(GetBestKernel()));
+	ASSERT_FALSE(IsSupported(KernelCount));
+}
+
+
+TEST(SHAKernels, KnownVectors)
+{
+	// Test vectors from FIPS 180-2, covering the one and two padding block cases.
+	for (int i = 0; i < KernelCount; ++i) {
+		EKernel kernel = (EKernel)i;
+		if (!IsSupported(kernel)) {
+			continue;
+		}
+
+		// Not a multiple of any lane count, so the remainders are tested as well.
+		const unsigned count = 13;
+
+		ASSERT_EQUALS(Repeat(wxT("da39a3ee5e6b4b0d3255bfef95601890afd80709"), count),
+			HashCopies(kernel, FromString(""), count));
+		ASSERT_EQUALS(Repeat(wxT("a9993e364706816aba3e25717850c26c9cd0d89d"), count),
+			HashCopies(kernel, FromString("abc"), count));
+		ASSERT_EQUALS(Repeat(wxT("84983e441c3bd26ebaae4aa1f95129e5e54670f1"), count),
+			HashCopies(kernel, FromString("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"), count));
+		ASSERT_EQUALS(Repeat(wxT("34aa973cd4c4daa4f61eeb2bdbad27316534016f"), 9),
+			HashCopies(kernel, FromString("aaaaaaaaaa", 100000), 9));
+	}
+}
+
+
+TEST(SHAKernels, DistinctBuffers)
+{
+	// Lanes must not leak into each other, so hash buffers of different
+	// content and compare every kernel against the generic one.
+	const uint32 length = 184320 + 3;
+	const unsigned count = 13;
+
+	std::vector<byte> data(length * count);
+	for (size_t i = 0; i < data.size(); ++i) {
+		data[i] = (byte)(i * 131 + i / 977);
+	}
+
+	std::vector<const byte*> buffers(count);
+	for (unsigned i = 0; i < count; ++i) {
+		buffers[i] = &data[i * length];
+	}
+
+	std::vector<byte> expected(20 * count);
+	EKernel old = GetKernel();
+	SetKernel(KernelGeneric);
+	HashBuffers(&buffers[0], length, &expected[0], count);
+
+	for (int i = 0; i < KernelCount; ++i) {
+		if (SetKernel((EKernel)i)) {
+			std::vector<byte> digests(20 * count);
+			HashBuffers(&buffers[0], length, &digests[0], count);
+			ASSERT_TRUE(expected == digests);
+		}
+	}
+
+	SetKernel(old);
+}
+
@@ -0,0 +1,198 @@
+//								-*- C++ -*-
+// This file is part of the aMule Project.
+//
+// Copyright (c) 2003-2011 aMule Team ( admin@amule.org / http://www.amule.org )
+//
+// Any parts of this program derived from the xMule, lMule or eMule project,
+// or contributed by third-party developers are copyrighted by their
+// respective authors.
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software
+// Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301, USA
+//
+
+
+#include <muleunit/test.h>
+#include <UploadBandwidthThrottler.h>
+#include <ThrottledSocket.h>
+#include <Preferences.h>
+#include <Statistics.h>
+#include <GetTickCount.h>
+#include <common/Atomic.h>
+
+#include <wx/stopwatch.h>
+
+#include <stdlib.h>
+#include <vector>
+
+using namespace muleunit;
+
+// The throttler reads these, but the preferences and statistics aren't
+// linked. A fixed limit keeps it away from the (missing) upload rate.
+uint16 CPreferences::s_maxupload = 50000;
+bool CPreferences::s_uploadTokenBucket = false;
+CStatTreeItemRateCounter* CStatistics::s_uploadrate = NULL;
+
+
+DECLARE_SIMPLE(UploadBandwidthThrottler)
+
+
+namespace {
+
+// Calls of SendControlData, made by the upload thread
+volatile long s_controlCalls = 0;
+
+class CStubControlSocket : public ThrottledControlSocket
+{
+public:
+	virtual SocketSentBytes SendControlData(uint32, uint32)
+	{
+		AtomicIncrement(&s_controlCalls);
+		SocketSentBytes sent = { true, 0, 0 };
+		return sent;
+	}
+};
+
+// An upload slot with nothing to send
+class CStubFileSocket : public ThrottledFileSocket
+{
+public:
+	virtual SocketSentBytes SendControlData(uint32, uint32)
+	{
+		SocketSentBytes sent = { true, 0, 0 };
+		return sent;
+	}
+
+	virtual SocketSentBytes SendFileAndControlData(uint32, uint32)
+	{
+		SocketSentBytes sent = { true, 0, 0 };
+		return sent;
+	}
+
+	// Never due for a trickle packet
+	virtual uint32 GetLastCalledSend()	{ return GetTickCountFullRes(); }
+	virtual uint32 GetNeededBytes()		{ return 0; }
+};
+
+// Queues control sockets like the network threads do
+class CQueueingThread : public wxThread
+{
+public:
+	CQueueingThread(UploadBandwidthThrottler& throttler, std::vector<CStubControlSocket>& sockets, unsigned count, unsigned seed)
+		: wxThread(wxTHREAD_JOINABLE),
+		  m_throttler(throttler),
+		  m_sockets(sockets),
+		  m_count(count),
+		  m_seed(seed)
+	{}
+
+protected:
+	virtual ExitCode Entry()
+	{
+		for (unsigned i = 0; i < m_count; ++i) {
+			m_seed = m_seed * 1103515245 + 12345;
+			m_throttler.QueueForSendingControlPacket(&m_sockets[(m_seed >> 8) % m_sockets.size()], (m_seed >> 4) & 1);
+		}
+		return 0;
+	}
+
+private:
+	UploadBandwidthThrottler& m_throttler;
+	std::vector<CStubControlSocket>& m_sockets;
+	unsigned m_count;
+	unsigned m_seed;
+};
+
+}
+
+
+TEST(UploadBandwidthThrottler, SlotChurn)
+{
+	// 10000 upload slots, while the upload thread keeps looping over them.
+	// Mostly slots ending and new ones being appended, sometimes a slot
+	// inserted in front, which renumbers the list.
+	const unsigned socketCount = 10000;
+	const unsigned count = 200000;
+	std::vector<CStubFileSocket> sockets(socketCount);
+	std::vector<bool> hasSlot(socketCount, true);
+
+	UploadBandwidthThrottler throttler;
+	for (unsigned i = 0; i < socketCount; ++i) {
+		throttler.AddToStandardList(i, &sockets[i]);
+	}
+
+	srand(10000);
+	wxStopWatch timer;
+	for (unsigned i = 0; i < count; ++i) {
+		unsigned n = rand() % socketCount;
+		if (hasSlot[n]) {
+			ASSERT_TRUE(throttler.RemoveFromStandardList(&sockets[n]));
+		} else if (rand() % 100) {
+			throttler.AddToStandardList(0xFFFFFFFF, &sockets[n]);
+		} else {
+			throttler.AddToStandardList(rand() % 100, &sockets[n]);
+		}
+		hasSlot[n] = !hasSlot[n];
+	}
+	long elapsed = timer.Time();
+	Print(wxString::Format(wxT("\t\tAdd/remove: %.0f ns/call"), elapsed * 1e6 / count));
+
+	for (unsigned i = 0; i < socketCount; ++i) {
+		ASSERT_EQUALS(hasSlot[i], throttler.RemoveFromStandardList(&sockets[i]));
+	}
+	throttler.EndThread();
+}
+
+
+TEST(UploadBandwidthThrottler, ControlQueue)
+{
+	// Four threads queue control sockets at once, more than fit into the
+	// entry pool, while the upload thread drains them. Every request has
+	// to end up as one SendControlData call.
+	const unsigned threadCount = 4;
+	const unsigned count = 500000;
+	std::vector<CStubControlSocket> sockets(10000);
+	std::vector<CStubFileSocket> slots(100);
+
+	UploadBandwidthThrottler throttler;
+	for (unsigned i = 0; i < slots.size(); ++i) {
+		throttler.AddToStandardList(i, &slots[i]);
+	}
+
+	std::vector<CQueueingThread*> threads;
+	for (unsigned i = 0; i < threadCount; ++i) {
+		threads.push_back(new CQueueingThread(throttler, sockets, count, i + 1));
+	}
+
+	s_controlCalls = 0;
+	wxStopWatch timer;
+	for (unsigned i = 0; i < threadCount; ++i) {
+		threads[i]->Create();
+		threads[i]->Run();
+	}
+	for (unsigned i = 0; i < threadCount; ++i) {
+		threads[i]->Wait();
+		delete threads[i];
+	}
+	long elapsed = timer.Time();
+	Print(wxString::Format(wxT("\t\tQueueForSendingControlPacket, %u threads: %.0f ns/call"), threadCount, elapsed * 1e6 / (threadCount * count)));
+
+	// The upload thread sleeps between loops, give it time to catch up
+	for (int wait = 0; wait < 1000 && AtomicLoad(&s_controlCalls) < (long)(threadCount * count); ++wait) {
+		wxThread::Sleep(10);
+	}
+	throttler.EndThread();
+
+	ASSERT_EQUALS((long)(threadCount * count), AtomicLoad(&s_controlCalls));
+}